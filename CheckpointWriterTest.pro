@@ -0,0 +1,36 @@
+QT -= core gui
+
+TARGET = CheckpointWriterTest
+CONFIG += console
+CONFIG -= app_bundle
+CONFIG += c++11
+
+unix:LIBS += -pthread
+
+TEMPLATE = app
+
+SOURCES += checkpointwritertest.cpp \
+    io.cpp \
+    bufferwriter.cpp \
+    text.cpp \
+    lstm.cpp \
+    lstmstate.cpp \
+    lstmsession.cpp \
+    lstmstats.cpp \
+    lstmallocations.cpp \
+    lstmsparsity.cpp \
+    lstmcheckpointinfo.cpp \
+    lstmcheckpointwriter.cpp
+
+HEADERS += \
+    io.h \
+    bufferwriter.h \
+    text.h \
+    lstm.h \
+    lstmstate.h \
+    lstmsession.h \
+    lstmstats.h \
+    lstmallocations.h \
+    lstmsparsity.h \
+    lstmcheckpointinfo.h \
+    lstmcheckpointwriter.h
@@ -0,0 +1,40 @@
+QT -= core gui
+
+TARGET = LSTMBenchmark
+CONFIG += console
+CONFIG -= app_bundle
+CONFIG += c++11
+
+unix:LIBS += -pthread
+
+TEMPLATE = app
+
+SOURCES += benchmark.cpp \
+    io.cpp \
+    bufferwriter.cpp \
+    text.cpp \
+    lstm.cpp \
+    lstmstate.cpp \
+    lstmsession.cpp \
+    lstmstats.cpp \
+    lstmallocations.cpp \
+    lstmsparsity.cpp \
+    lstmcheckpointinfo.cpp \
+    perfcounters.cpp \
+    lstmworkmodel.cpp \
+    lstmreplicaset.cpp
+
+HEADERS += \
+    io.h \
+    bufferwriter.h \
+    text.h \
+    lstm.h \
+    lstmstate.h \
+    lstmsession.h \
+    lstmstats.h \
+    lstmallocations.h \
+    lstmsparsity.h \
+    lstmcheckpointinfo.h \
+    perfcounters.h \
+    lstmworkmodel.h \
+    lstmreplicaset.h
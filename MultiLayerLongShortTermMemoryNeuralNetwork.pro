@@ -3,18 +3,47 @@ QT -= core gui
 TARGET = LongShortTermMemoryNeuralNetwork
 CONFIG += console
 CONFIG -= app_bundle
+CONFIG += c++11
+
+unix:LIBS += -pthread
 
 TEMPLATE = app
 
 SOURCES += main.cpp \
     io.cpp \
+    bufferwriter.cpp \
     text.cpp \
     lstm.cpp \
-    lstmstate.cpp
+    lstmstate.cpp \
+    lstmsession.cpp \
+    lstmstats.cpp \
+    lstmallocations.cpp \
+    lstmsparsity.cpp \
+    lstmquantized.cpp \
+    lstmreplicaset.cpp \
+    stackedlstm.cpp \
+    lstmcheckpointinfo.cpp \
+    lstmcheckpointwriter.cpp \
+    sequencedataset.cpp \
+    trainingeventlog.cpp \
+    lstmworkmodel.cpp
 
 HEADERS += \
     io.h \
+    bufferwriter.h \
     text.h \
     lstm.h \
-    lstmstate.h
+    lstmstate.h \
+    lstmsession.h \
+    lstmstats.h \
+    lstmallocations.h \
+    lstmsparsity.h \
+    lstmquantized.h \
+    lstmreplicaset.h \
+    stackedlstm.h \
+    lstmcheckpointinfo.h \
+    lstmcheckpointwriter.h \
+    sequencedataset.h \
+    trainingeventlog.h \
+    lstmworkmodel.h
 
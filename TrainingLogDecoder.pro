@@ -0,0 +1,20 @@
+QT -= core gui
+
+TARGET = TrainingLogDecoder
+CONFIG += console
+CONFIG -= app_bundle
+CONFIG += c++11
+
+unix:LIBS += -pthread
+
+TEMPLATE = app
+
+SOURCES += traininglogdecoder.cpp \
+    io.cpp \
+    text.cpp \
+    trainingeventlog.cpp
+
+HEADERS += \
+    io.h \
+    text.h \
+    trainingeventlog.h
@@ -0,0 +1,754 @@
+// Times LSTM::process() and learn() over a matrix of topologies and prints ns/step, steps/s and weights/s, with statistics over repetitions
+// after warm-up, as text or as JSON (to track regressions between releases).
+// Usage: LSTMBenchmark [--quick] [--repetitions <n>] [--only <configuration name>] [--json <file, or - for stdout>] [--counters]
+//        [--roofline] [--replicas]
+// With --counters, hardware counters (cycles, instructions, cache and branch misses) are read with Linux perf_event around process(),
+// LSTMState::calculateGatePreValues() and learn(); if they cannot be opened (e.g. in containers), they are left out with a note.
+// With --roofline, the analytic FLOPs and bytes of LSTMWorkModel are divided by the median times and compared to the peak FLOP/s and
+// bandwidth measured on this machine first, which shows whether process() and learn() are compute or memory bound.
+// With --replicas, the trained LSTM is also copied into an LSTMReplicaSet and one session worker per CPU steps sessions against the replica of
+// its NUMA node for a fixed time; the steps/s of each node are reported (a single copy on machines with one node).
+// If the engine is compiled with LSTM_PHASE_TIMERS, the time spent in each phase (see LSTMPhase) is reported as well, and with
+// LSTM_ALLOCATION_TRACKING, the heap allocations per process() step and learn() call and the peak live bytes (see LSTMAllocationCategory).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#include "text.h"
+#include "lstm.h"
+#include "perfcounters.h"
+#include "lstmworkmodel.h"
+#include "lstmreplicaset.h"
+
+#define BENCHMARK_JSON_VERSION 1
+#define BENCHMARK_PEAK_ACCUMULATOR_COUNT 32 // Independent multiply-add chains of the peak FLOP/s kernel
+#define BENCHMARK_BANDWIDTH_ARRAY_SIZE (8*1024*1024) // Doubles per array of the bandwidth kernel (64 MiB, beyond the caches)
+#define BENCHMARK_REPLICA_WARM_UP_SHARE 0.2 // Of the replica measurement time, run before the step counts are reset
+
+struct BenchmarkConfiguration
+{
+    const char *name;
+    uint32_t inputCount;
+    uint32_t outputCount;
+    uint32_t hiddenLayerCounts[4]; // Per gate (forget, input, output, candidate)
+    uint32_t hiddenLayerWidths[4]; // Neurons in each hidden layer of a gate network
+    uint32_t backpropagationSteps;
+};
+
+static const BenchmarkConfiguration configurations[]=
+{
+    {"hello",3,3,{1,2,3,1},{6,6,6,6},3}, // Topology of main.cpp
+    {"small",8,8,{1,1,1,1},{16,16,16,16},3},
+    {"medium",16,16,{1,1,1,1},{32,32,32,32},4},
+    {"noHidden",32,32,{0,0,0,0},{0,0,0,0},4},
+    {"deep",16,16,{3,3,3,3},{32,32,32,32},4},
+    {"wide",16,16,{1,1,1,1},{128,128,128,128},4},
+    {"perGate",16,16,{0,1,2,3},{16,32,32,64},4},
+    {"manyInputs",64,8,{1,1,1,1},{32,32,32,32},4},
+    {"longBptt",8,8,{1,1,1,1},{16,16,16,16},32}
+};
+
+// Calls around which the hardware counters are read
+enum BenchmarkCountedCall
+{
+    BenchmarkCountedCall_process=0,
+    BenchmarkCountedCall_gatePreValues=1,
+    BenchmarkCountedCall_learn=2
+};
+#define BENCHMARK_COUNTED_CALL_COUNT 3
+
+static const char *countedCallNames[BENCHMARK_COUNTED_CALL_COUNT]={"process","gatePreValues","learn"};
+
+struct BenchmarkStatistics
+{
+    double min;
+    double median;
+    double mean;
+    double standardDeviation;
+};
+
+struct BenchmarkResult
+{
+    uint64_t weightCount; // Weights (including bias weights) of the gate networks evaluated per step
+    BenchmarkStatistics processTime; // ns per process() call
+    BenchmarkStatistics learnTime; // ns per learn() call
+    LSTMStats phaseStats; // Of all repetitions after the warm-up
+    // Per LSTMAllocationCategory, of all repetitions after the warm-up:
+    double processAllocationCounts[LSTM_ALLOCATION_CATEGORY_COUNT]; // Per step
+    double processAllocatedBytes[LSTM_ALLOCATION_CATEGORY_COUNT];
+    double learnAllocationCounts[LSTM_ALLOCATION_CATEGORY_COUNT]; // Per call
+    double learnAllocatedBytes[LSTM_ALLOCATION_CATEGORY_COUNT];
+    LSTMAllocationStats allocationStats; // For the peaks
+    PerfCounterSums counterSums[BENCHMARK_COUNTED_CALL_COUNT]; // Per BenchmarkCountedCall, of all repetitions after the warm-up
+    // From LSTMWorkModel; per process() step and per learn() call (with a full window)
+    double processFlops;
+    double processBytes;
+    double learnFlops;
+    double learnBytes;
+    // With --replicas; dimensions of the arrays: NUMA nodes. The caller frees the arrays.
+    uint32_t replicaNodeCount; // 0 if not measured
+    uint32_t *replicaNodeWorkerCounts;
+    double *replicaNodeStepsPerSecond;
+};
+
+// Peaks measured on this machine for the roofline
+struct BenchmarkMachinePeak
+{
+    double flopsPerSecond; // Multiply-add kernel on doubles, built with the same compiler flags as the engine
+    double bytesPerSecond; // Triad (a=b+s*c) over arrays much larger than the caches
+};
+
+static void clearAllocations(BenchmarkResult *result)
+{
+    for(uint8_t category=0;category<LSTM_ALLOCATION_CATEGORY_COUNT;category++)
+    {
+        result->processAllocationCounts[category]=0.0;
+        result->processAllocatedBytes[category]=0.0;
+        result->learnAllocationCounts[category]=0.0;
+        result->learnAllocatedBytes[category]=0.0;
+    }
+}
+
+static void addAllocations(double *counts, double *bytes, LSTMAllocationStats &before, LSTMAllocationStats &after)
+{
+    for(uint8_t category=0;category<LSTM_ALLOCATION_CATEGORY_COUNT;category++)
+    {
+        counts[category]+=(double)(after.allocationCounts[category]-before.allocationCounts[category]);
+        bytes[category]+=(double)(after.allocatedBytes[category]-before.allocatedBytes[category]);
+    }
+}
+
+static BenchmarkStatistics getStatistics(double *values, uint32_t count)
+{
+    BenchmarkStatistics statistics;
+    std::sort(values,values+count);
+    statistics.min=values[0];
+    statistics.median=count%2==1?values[count/2]:(values[count/2-1]+values[count/2])/2.0;
+    double sum=0.0;
+    for(uint32_t i=0;i<count;i++)
+        sum+=values[i];
+    statistics.mean=sum/count;
+    double squaredDeviationSum=0.0;
+    for(uint32_t i=0;i<count;i++)
+        squaredDeviationSum+=(values[i]-statistics.mean)*(values[i]-statistics.mean);
+    statistics.standardDeviation=count>1?sqrt(squaredDeviationSum/(count-1)):0.0;
+    return statistics;
+}
+
+static double getSeconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+}
+
+// Best of a few runs of each kernel
+static BenchmarkMachinePeak measureMachinePeak()
+{
+    BenchmarkMachinePeak peak;
+    peak.flopsPerSecond=0.0;
+    peak.bytesPerSecond=0.0;
+
+    double accumulators[BENCHMARK_PEAK_ACCUMULATOR_COUNT];
+    for(uint32_t accumulator=0;accumulator<BENCHMARK_PEAK_ACCUMULATOR_COUNT;accumulator++)
+        accumulators[accumulator]=1.0+accumulator*1e-9;
+    volatile double multiplier=0.9999999; // volatile so the compiler cannot fold the loop
+    volatile double addend=1e-7;
+    double m=multiplier;
+    double a=addend;
+    uint64_t iterationCount=1<<22;
+    for(uint32_t run=0;run<5;run++)
+    {
+        std::chrono::steady_clock::time_point start=std::chrono::steady_clock::now();
+        for(uint64_t iteration=0;iteration<iterationCount;iteration++)
+        {
+            for(uint32_t accumulator=0;accumulator<BENCHMARK_PEAK_ACCUMULATOR_COUNT;accumulator++)
+                accumulators[accumulator]=accumulators[accumulator]*m+a;
+        }
+        double seconds=getSeconds(start);
+        peak.flopsPerSecond=std::max(peak.flopsPerSecond,2.0*BENCHMARK_PEAK_ACCUMULATOR_COUNT*iterationCount/seconds);
+    }
+    double sum=0.0;
+    for(uint32_t accumulator=0;accumulator<BENCHMARK_PEAK_ACCUMULATOR_COUNT;accumulator++)
+        sum+=accumulators[accumulator];
+    addend=sum; // Keeps the results alive
+
+    double *arrays=(double*)malloc(3*(size_t)BENCHMARK_BANDWIDTH_ARRAY_SIZE*sizeof(double));
+    double *target=arrays;
+    double *source1=arrays+BENCHMARK_BANDWIDTH_ARRAY_SIZE;
+    double *source2=arrays+2*BENCHMARK_BANDWIDTH_ARRAY_SIZE;
+    for(uint32_t i=0;i<BENCHMARK_BANDWIDTH_ARRAY_SIZE;i++)
+    {
+        target[i]=0.0;
+        source1[i]=1.0;
+        source2[i]=2.0;
+    }
+    for(uint32_t run=0;run<5;run++)
+    {
+        std::chrono::steady_clock::time_point start=std::chrono::steady_clock::now();
+        for(uint32_t i=0;i<BENCHMARK_BANDWIDTH_ARRAY_SIZE;i++)
+            target[i]=source1[i]+m*source2[i];
+        double seconds=getSeconds(start);
+        peak.bytesPerSecond=std::max(peak.bytesPerSecond,3.0*BENCHMARK_BANDWIDTH_ARRAY_SIZE*sizeof(double)/seconds);
+    }
+    addend=target[BENCHMARK_BANDWIDTH_ARRAY_SIZE-1];
+    free(arrays);
+    return peak;
+}
+
+static uint64_t getEvaluatedWeightCount(LSTM *lstm)
+{
+    LSTMState *state=lstm->getWeightState();
+    uint32_t gateTotalLayerCounts[4]={state->forgetGateTotalLayerCount,state->inputGateTotalLayerCount,state->outputGateTotalLayerCount,state->candidateGateTotalLayerCount};
+    uint32_t *gateHiddenLayerNeuronCounts[4]={state->forgetGateHiddenLayerNeuronCounts,state->inputGateHiddenLayerNeuronCounts,state->outputGateHiddenLayerNeuronCounts,state->candidateGateHiddenLayerNeuronCounts};
+    uint64_t weightCount=0;
+    for(uint8_t gate=0;gate<4;gate++)
+    {
+        if(gate==0&&!state->hasForgetGateNetwork())
+            continue;
+        uint64_t networkWeightCount=0;
+        uint32_t neuronsInLastLayer=state->inputAndOutputCount;
+        for(uint32_t thisLayer=0;thisLayer<gateTotalLayerCounts[gate];thisLayer++)
+        {
+            uint32_t neuronsInThisLayer=thisLayer==gateTotalLayerCounts[gate]-1?state->gateNetworkOutputCount:gateHiddenLayerNeuronCounts[gate][thisLayer];
+            networkWeightCount+=(uint64_t)neuronsInThisLayer*(neuronsInLastLayer+1);
+            neuronsInLastLayer=neuronsInThisLayer;
+        }
+        weightCount+=networkWeightCount*state->gateNetworkCount+state->outputCount; // And the value sum bias weights
+    }
+    if(state->projectionOutputCount>0)
+        weightCount+=(uint64_t)state->projectionOutputCount*(state->outputCount+1);
+    return weightCount;
+}
+
+// One worker per CPU, pinned to the node of that CPU, steps its own session through the input sequence with the local replica until "stop" is
+// set. The node step counts are reset after a warm-up and read when the measurement time is over.
+static void measureReplicas(LSTM *lstm, double **inputs, uint32_t stepsPerSequence, double seconds, BenchmarkResult *result)
+{
+    LSTMReplicaSet *replicaSet=new LSTMReplicaSet(lstm);
+    uint32_t workerCount=replicaSet->cpuCount;
+    uint32_t scratchSize=lstm->getSessionScratchSize();
+    std::atomic<bool> stop(false);
+    std::thread *workers=new std::thread[workerCount];
+    for(uint32_t worker=0;worker<workerCount;worker++)
+    {
+        workers[worker]=std::thread([lstm,replicaSet,inputs,stepsPerSequence,scratchSize,worker,&stop]()
+        {
+            replicaSet->pinCurrentThreadToNode(replicaSet->cpuNodes[worker]);
+            LSTMSession *session=lstm->createSession();
+            double *output=(double*)malloc(lstm->outputCount*sizeof(double));
+            double *scratch=(double*)malloc(scratchSize*sizeof(double));
+            for(uint32_t step=0;!stop.load(std::memory_order_relaxed);step=(step+1)%stepsPerSequence)
+            {
+                if(step==0)
+                    session->reset();
+                replicaSet->processSession(session,inputs[step],output,scratch);
+            }
+            free(output);
+            free(scratch);
+            lstm->destroySession(session);
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds*BENCHMARK_REPLICA_WARM_UP_SHARE));
+    replicaSet->resetNodeStepCounts();
+    std::chrono::steady_clock::time_point start=std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    double measuredSeconds=getSeconds(start);
+    result->replicaNodeCount=replicaSet->nodeCount;
+    result->replicaNodeWorkerCounts=(uint32_t*)malloc(replicaSet->nodeCount*sizeof(uint32_t));
+    result->replicaNodeStepsPerSecond=(double*)malloc(replicaSet->nodeCount*sizeof(double));
+    for(uint32_t node=0;node<replicaSet->nodeCount;node++)
+    {
+        result->replicaNodeStepsPerSecond[node]=replicaSet->getNodeStepCount(node)/measuredSeconds;
+        result->replicaNodeWorkerCounts[node]=0;
+    }
+    for(uint32_t worker=0;worker<workerCount;worker++)
+        result->replicaNodeWorkerCounts[replicaSet->cpuNodes[worker]]++;
+    stop.store(true,std::memory_order_relaxed);
+    for(uint32_t worker=0;worker<workerCount;worker++)
+        workers[worker].join();
+    delete[] workers;
+    delete replicaSet;
+}
+
+static void clearCounterSums(BenchmarkResult *result)
+{
+    for(uint8_t call=0;call<BENCHMARK_COUNTED_CALL_COUNT;call++)
+        PerfCounters::clearSums(&result->counterSums[call]);
+}
+
+// Each sequence consists of backpropagationSteps+1 process() calls followed by one learn() call, as in main.cpp.
+// "counters" is 0 unless the hardware counters are read; the replicas are measured afterwards for "replicaSeconds" if it is not 0.
+static BenchmarkResult run(const BenchmarkConfiguration *configuration, uint32_t warmUpSequenceCount, uint32_t sequenceCount, uint32_t repetitionCount, PerfCounters *counters, double replicaSeconds)
+{
+    uint32_t *hiddenLayerNeuronCounts[4];
+    for(uint8_t gate=0;gate<4;gate++)
+    {
+        hiddenLayerNeuronCounts[gate]=(uint32_t*)malloc((configuration->hiddenLayerCounts[gate]+1)*sizeof(uint32_t));
+        for(uint32_t hiddenLayer=0;hiddenLayer<configuration->hiddenLayerCounts[gate];hiddenLayer++)
+            hiddenLayerNeuronCounts[gate][hiddenLayer]=configuration->hiddenLayerWidths[gate];
+    }
+    LSTM *lstm=new LSTM(configuration->inputCount,configuration->outputCount,configuration->backpropagationSteps,0.01,0.5,0.0001,0.01,0.5,0.0001,configuration->hiddenLayerCounts[0],hiddenLayerNeuronCounts[0],configuration->hiddenLayerCounts[1],hiddenLayerNeuronCounts[1],configuration->hiddenLayerCounts[2],hiddenLayerNeuronCounts[2],configuration->hiddenLayerCounts[3],hiddenLayerNeuronCounts[3]);
+
+    uint32_t stepsPerSequence=configuration->backpropagationSteps+1;
+    // Dimensions: Steps of a sequence - inputs or outputs
+    double **inputs=(double**)malloc(stepsPerSequence*sizeof(double*));
+    double **desiredOutputs=(double**)malloc(stepsPerSequence*sizeof(double*));
+    for(uint32_t step=0;step<stepsPerSequence;step++)
+    {
+        inputs[step]=(double*)malloc(configuration->inputCount*sizeof(double));
+        desiredOutputs[step]=(double*)malloc(configuration->outputCount*sizeof(double));
+        for(uint32_t inputN=0;inputN<configuration->inputCount;inputN++)
+            inputs[step][inputN]=inputN==step%configuration->inputCount?1.0:0.0;
+        for(uint32_t outputN=0;outputN<configuration->outputCount;outputN++)
+            desiredOutputs[step][outputN]=outputN==(step+1)%configuration->outputCount?1.0:0.0;
+    }
+
+    BenchmarkResult result;
+    clearAllocations(&result);
+    clearCounterSums(&result);
+    result.replicaNodeCount=0;
+    result.replicaNodeWorkerCounts=0;
+    result.replicaNodeStepsPerSecond=0;
+    uint8_t gateNetworkActivations[4]={lstm->forgetGateNetworkActivation,lstm->inputGateNetworkActivation,lstm->outputGateNetworkActivation,lstm->candidateGateNetworkActivation};
+    double *processTimes=(double*)malloc(repetitionCount*sizeof(double));
+    double *learnTimes=(double*)malloc(repetitionCount*sizeof(double));
+    bool trackAllocations=LSTMAllocations::isEnabled(); // The stats are read outside of the timed calls
+    LSTMAllocationStats allocationsBefore;
+    for(uint32_t repetition=0;repetition<=repetitionCount;repetition++)
+    {
+        // Repetition 0 is the warm-up
+        uint32_t thisSequenceCount=repetition==0?warmUpSequenceCount:sequenceCount;
+        uint64_t processTime=0;
+        uint64_t learnTime=0;
+        for(uint32_t sequence=0;sequence<thisSequenceCount;sequence++)
+        {
+            for(uint32_t step=0;step<stepsPerSequence;step++)
+            {
+                if(trackAllocations)
+                    allocationsBefore=LSTMAllocations::getStats();
+                if(counters!=0)
+                    counters->start();
+                std::chrono::steady_clock::time_point start=std::chrono::steady_clock::now();
+                double *output=lstm->process(inputs[step]);
+                processTime+=(uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-start).count();
+                if(counters!=0)
+                    counters->stop(&result.counterSums[BenchmarkCountedCall_process]);
+                if(trackAllocations)
+                {
+                    LSTMAllocationStats allocationsAfter=LSTMAllocations::getStats();
+                    addAllocations(result.processAllocationCounts,result.processAllocatedBytes,allocationsBefore,allocationsAfter);
+                }
+                free(output);
+                if(counters!=0)
+                {
+                    // The gate networks cannot be bracketed inside process(), so they are evaluated once more (untimed) on the state it has
+                    // just pushed, which writes the same values again.
+                    LSTMState *state=lstm->getCurrentState();
+                    double *previousOutputs=lstm->hasState(1)?lstm->getState(1)->output:0;
+                    counters->start();
+                    state->calculateGatePreValues(previousOutputs,gateNetworkActivations);
+                    counters->stop(&result.counterSums[BenchmarkCountedCall_gatePreValues]);
+                }
+            }
+            if(trackAllocations)
+                allocationsBefore=LSTMAllocations::getStats();
+            if(counters!=0)
+                counters->start();
+            std::chrono::steady_clock::time_point start=std::chrono::steady_clock::now();
+            lstm->learn(desiredOutputs);
+            learnTime+=(uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-start).count();
+            if(counters!=0)
+                counters->stop(&result.counterSums[BenchmarkCountedCall_learn]);
+            if(trackAllocations)
+            {
+                LSTMAllocationStats allocationsAfter=LSTMAllocations::getStats();
+                addAllocations(result.learnAllocationCounts,result.learnAllocatedBytes,allocationsBefore,allocationsAfter);
+            }
+        }
+        if(repetition==0)
+        {
+            lstm->resetStats();
+            LSTMAllocations::resetStats();
+            clearAllocations(&result); // Drops the allocations and counts of the warm-up
+            clearCounterSums(&result);
+        }
+        else
+        {
+            processTimes[repetition-1]=(double)processTime/((double)sequenceCount*stepsPerSequence);
+            learnTimes[repetition-1]=(double)learnTime/sequenceCount;
+        }
+    }
+
+    double measuredStepCount=(double)repetitionCount*sequenceCount*stepsPerSequence;
+    double measuredLearnCallCount=(double)repetitionCount*sequenceCount;
+    for(uint8_t category=0;category<LSTM_ALLOCATION_CATEGORY_COUNT;category++)
+    {
+        result.processAllocationCounts[category]/=measuredStepCount;
+        result.processAllocatedBytes[category]/=measuredStepCount;
+        result.learnAllocationCounts[category]/=measuredLearnCallCount;
+        result.learnAllocatedBytes[category]/=measuredLearnCallCount;
+    }
+    result.allocationStats=LSTMAllocations::getStats();
+    result.weightCount=getEvaluatedWeightCount(lstm);
+    LSTMWorkModel workModel(lstm);
+    result.processFlops=workModel.processFlops;
+    result.processBytes=workModel.getProcessBytes();
+    result.learnFlops=workModel.learnFlops;
+    result.learnBytes=workModel.learnParameterBytes;
+    result.processTime=getStatistics(processTimes,repetitionCount);
+    result.learnTime=getStatistics(learnTimes,repetitionCount);
+    result.phaseStats=lstm->stats();
+    if(replicaSeconds>0.0)
+        measureReplicas(lstm,inputs,stepsPerSequence,replicaSeconds,&result);
+    free(processTimes);
+    free(learnTimes);
+    for(uint32_t step=0;step<stepsPerSequence;step++)
+    {
+        free(inputs[step]);
+        free(desiredOutputs[step]);
+    }
+    free(inputs);
+    free(desiredOutputs);
+    delete lstm;
+    for(uint8_t gate=0;gate<4;gate++)
+        free(hiddenLayerNeuronCounts[gate]);
+    return result;
+}
+
+static void writeJsonNumber(FILE *f, double value)
+{
+    char str[TEXT_DOUBLE_BUFFER_SIZE];
+    text::formatDouble(value,str);
+    fputs(str,f);
+}
+
+static void writeJsonStatistics(FILE *f, const char *name, BenchmarkStatistics *statistics)
+{
+    fprintf(f,"\"%s\": {\"min\": ",name);
+    writeJsonNumber(f,statistics->min);
+    fputs(", \"median\": ",f);
+    writeJsonNumber(f,statistics->median);
+    fputs(", \"mean\": ",f);
+    writeJsonNumber(f,statistics->mean);
+    fputs(", \"stddev\": ",f);
+    writeJsonNumber(f,statistics->standardDeviation);
+    fputs("}",f);
+}
+
+// IPC, or null (JSON) or n/a (text) if cycles or instructions are not available
+static void writeInstructionsPerCycle(FILE *f, PerfCounters *counters, PerfCounterSums *sums, bool json)
+{
+    bool available=counters->isAvailable(PerfCounter_cycles)&&counters->isAvailable(PerfCounter_instructions)&&sums->values[PerfCounter_cycles]>0.0;
+    double instructionsPerCycle=available?sums->values[PerfCounter_instructions]/sums->values[PerfCounter_cycles]:0.0;
+    if(json)
+    {
+        if(available)
+            writeJsonNumber(f,instructionsPerCycle);
+        else
+            fputs("null",f);
+    }
+    else if(available)
+        fprintf(f," %12.2f",instructionsPerCycle);
+    else
+        fprintf(f," %12s","n/a");
+}
+
+// Achieved GFLOP/s and GB/s of one call from its work and median time, against the roofline bound at its arithmetic intensity
+static void writeRoofline(FILE *f, const char *name, double flops, double bytes, double nanoseconds, BenchmarkMachinePeak *peak, bool json)
+{
+    double flopsPerByte=bytes>0.0?flops/bytes:0.0;
+    double memoryBound=flopsPerByte*peak->bytesPerSecond;
+    bool isMemoryBound=memoryBound<peak->flopsPerSecond;
+    double boundFlopsPerSecond=isMemoryBound?memoryBound:peak->flopsPerSecond;
+    double flopsPerSecond=flops/(nanoseconds*1e-9);
+    double bytesPerSecond=bytes/(nanoseconds*1e-9);
+    if(json)
+    {
+        fprintf(f,"\"%s\": {\"flops\": ",name);
+        writeJsonNumber(f,flops);
+        fputs(", \"bytes\": ",f);
+        writeJsonNumber(f,bytes);
+        fputs(", \"gflopsPerSecond\": ",f);
+        writeJsonNumber(f,flopsPerSecond*1e-9);
+        fputs(", \"gbPerSecond\": ",f);
+        writeJsonNumber(f,bytesPerSecond*1e-9);
+        fputs(", \"flopsPerByte\": ",f);
+        writeJsonNumber(f,flopsPerByte);
+        fputs(", \"boundGflopsPerSecond\": ",f);
+        writeJsonNumber(f,boundFlopsPerSecond*1e-9);
+        fprintf(f,", \"bound\": \"%s\"}",isMemoryBound?"memory":"compute");
+    }
+    else
+        fprintf(f,"  %-20s %12.3f %12.3f %12.3f %14.3f %11.1f%% %s\n",name,flopsPerSecond*1e-9,bytesPerSecond*1e-9,flopsPerByte,boundFlopsPerSecond*1e-9,100.0*flopsPerSecond/boundFlopsPerSecond,isMemoryBound?"memory":"compute");
+}
+
+static void writeJsonUInt32Array(FILE *f, const char *name, const uint32_t *values, uint32_t count)
+{
+    fprintf(f,"\"%s\": [",name);
+    for(uint32_t i=0;i<count;i++)
+        fprintf(f,i>0?", %u":"%u",values[i]);
+    fputs("]",f);
+}
+
+int main(int argc, char *argv[])
+{
+    bool quick=false;
+    uint32_t repetitionCount=0; // Default depends on --quick
+    const char *only=0;
+    const char *jsonPath=0;
+    bool readCounters=false;
+    bool roofline=false;
+    bool replicas=false;
+    for(int arg=1;arg<argc;arg++)
+    {
+        if(strcmp(argv[arg],"--quick")==0)
+            quick=true;
+        else if(strcmp(argv[arg],"--repetitions")==0&&arg+1<argc)
+            repetitionCount=(uint32_t)atoi(argv[++arg]);
+        else if(strcmp(argv[arg],"--only")==0&&arg+1<argc)
+            only=argv[++arg];
+        else if(strcmp(argv[arg],"--json")==0&&arg+1<argc)
+            jsonPath=argv[++arg];
+        else if(strcmp(argv[arg],"--counters")==0)
+            readCounters=true;
+        else if(strcmp(argv[arg],"--roofline")==0)
+            roofline=true;
+        else if(strcmp(argv[arg],"--replicas")==0)
+            replicas=true;
+        else
+        {
+            fprintf(stderr,"Usage: %s [--quick] [--repetitions <n>] [--only <configuration name>] [--json <file, or - for stdout>] [--counters] [--roofline] [--replicas]\n",argv[0]);
+            return 2;
+        }
+    }
+    if(repetitionCount==0)
+        repetitionCount=quick?3:10;
+    uint32_t warmUpSequenceCount=quick?5:20;
+    uint32_t sequenceCount=quick?10:50;
+    double replicaSeconds=replicas?(quick?0.2:1.0):0.0;
+
+    PerfCounters *counters=0;
+    if(readCounters)
+    {
+        counters=PerfCounters::create();
+        if(counters==0)
+            fprintf(stderr,"Hardware counters are not available (perf_event_open: %s); continuing without them\n",strerror(errno));
+        else
+        {
+            for(uint8_t counter=0;counter<PERF_COUNTER_COUNT;counter++)
+            {
+                if(!counters->isAvailable(counter))
+                    fprintf(stderr,"Hardware counter %s is not available\n",PerfCounters::getCounterName(counter));
+            }
+        }
+    }
+
+    BenchmarkMachinePeak machinePeak;
+    if(roofline)
+        machinePeak=measureMachinePeak();
+
+    FILE *json=0;
+    if(jsonPath!=0)
+    {
+        json=strcmp(jsonPath,"-")==0?stdout:fopen(jsonPath,"w");
+        if(json==0)
+        {
+            fprintf(stderr,"Cannot create %s\n",jsonPath);
+            delete counters;
+            return 1;
+        }
+        fprintf(json,"{\"version\": %u, \"repetitions\": %u, \"warmUpSequences\": %u, \"sequencesPerRepetition\": %u, ",BENCHMARK_JSON_VERSION,repetitionCount,warmUpSequenceCount,sequenceCount);
+        if(roofline)
+        {
+            fputs("\"machinePeak\": {\"gflopsPerSecond\": ",json);
+            writeJsonNumber(json,machinePeak.flopsPerSecond*1e-9);
+            fputs(", \"gbPerSecond\": ",json);
+            writeJsonNumber(json,machinePeak.bytesPerSecond*1e-9);
+            fputs("}, ",json);
+        }
+        fputs("\"configurations\": [",json);
+    }
+    FILE *textOutput=json==stdout?stderr:stdout; // Keeps the JSON on stdout parseable
+    if(roofline)
+        fprintf(textOutput,"Machine peak: %.3f GFLOP/s (multiply-add), %.3f GB/s (triad)\n",machinePeak.flopsPerSecond*1e-9,machinePeak.bytesPerSecond*1e-9);
+    fprintf(textOutput,"%-12s %12s %12s %14s %14s %12s %14s %14s\n","","weights","process ns","+-","steps/s","learn ns","+-","weights/s");
+
+    uint32_t configurationCount=sizeof(configurations)/sizeof(BenchmarkConfiguration);
+    bool firstResult=true;
+    for(uint32_t configurationN=0;configurationN<configurationCount;configurationN++)
+    {
+        const BenchmarkConfiguration *configuration=&configurations[configurationN];
+        if(only!=0&&strcmp(only,configuration->name)!=0)
+            continue;
+        BenchmarkResult result=run(configuration,warmUpSequenceCount,sequenceCount,repetitionCount,counters,replicaSeconds);
+        double stepsPerSecond=1e9/result.processTime.median;
+        double processWeightsPerSecond=stepsPerSecond*result.weightCount; // Each weight is read once per step
+        double learnCallsPerSecond=1e9/result.learnTime.median;
+        double learnWeightsPerSecond=learnCallsPerSecond*result.weightCount; // Each weight is updated once per call
+        fprintf(textOutput,"%-12s %12llu %12.0f %14.0f %14.0f %12.0f %14.0f %14.3g\n",configuration->name,(unsigned long long)result.weightCount,result.processTime.median,result.processTime.standardDeviation,stepsPerSecond,result.learnTime.median,result.learnTime.standardDeviation,processWeightsPerSecond);
+        for(uint8_t phase=0;phase<LSTM_PHASE_COUNT&&LSTMStats::isEnabled();phase++)
+        {
+            uint64_t phaseCount=result.phaseStats.phaseCounts[phase];
+            // Share of all of process() or learn():
+            uint64_t parentNanoseconds=result.phaseStats.phaseNanoseconds[phase<LSTMPhase_learn?LSTMPhase_process:LSTMPhase_learn];
+            fprintf(textOutput,"  %-20s %12.0f ns %6.1f%%\n",LSTMStats::getPhaseName(phase),phaseCount>0?(double)result.phaseStats.phaseNanoseconds[phase]/phaseCount:0.0,parentNanoseconds>0?100.0*result.phaseStats.phaseNanoseconds[phase]/parentNanoseconds:0.0);
+        }
+        if(LSTMAllocations::isEnabled())
+        {
+            fprintf(textOutput,"  %-20s %12s %12s %12s %12s %12s\n","allocations","per step","bytes","per learn","bytes","peak bytes");
+            for(uint8_t category=0;category<LSTM_ALLOCATION_CATEGORY_COUNT;category++)
+                fprintf(textOutput,"  %-20s %12.2f %12.0f %12.2f %12.0f %12llu\n",LSTMAllocations::getCategoryName(category),result.processAllocationCounts[category],result.processAllocatedBytes[category],result.learnAllocationCounts[category],result.learnAllocatedBytes[category],(unsigned long long)result.allocationStats.peakLiveBytes[category]);
+            fprintf(textOutput,"  %-20s %64llu\n","peak total",(unsigned long long)result.allocationStats.peakTotalLiveBytes);
+        }
+        if(roofline)
+        {
+            fprintf(textOutput,"  %-20s %12s %12s %12s %14s %12s\n","roofline","GFLOP/s","GB/s","FLOP/byte","bound GFLOP/s","of bound");
+            writeRoofline(textOutput,"process",result.processFlops,result.processBytes,result.processTime.median,&machinePeak,false);
+            writeRoofline(textOutput,"learn",result.learnFlops,result.learnBytes,result.learnTime.median,&machinePeak,false);
+        }
+        if(result.replicaNodeCount>0)
+        {
+            fprintf(textOutput,"  %-20s %12s %12s\n","replicas","workers","steps/s");
+            double totalStepsPerSecond=0.0;
+            for(uint32_t node=0;node<result.replicaNodeCount;node++)
+            {
+                char nodeName[32];
+                sprintf(nodeName,"node %u",node);
+                fprintf(textOutput,"  %-20s %12u %12.0f\n",nodeName,result.replicaNodeWorkerCounts[node],result.replicaNodeStepsPerSecond[node]);
+                totalStepsPerSecond+=result.replicaNodeStepsPerSecond[node];
+            }
+            fprintf(textOutput,"  %-20s %12s %12.0f\n","total","",totalStepsPerSecond);
+        }
+        if(counters!=0)
+        {
+            fprintf(textOutput,"  %-20s %12s %12s %12s %12s %12s\n","counters per call","cycles","instructions","IPC","cacheMisses","branchMisses");
+            for(uint8_t call=0;call<BENCHMARK_COUNTED_CALL_COUNT;call++)
+            {
+                PerfCounterSums *sums=&result.counterSums[call];
+                fprintf(textOutput,"  %-20s",countedCallNames[call]);
+                for(uint8_t counter=0;counter<PERF_COUNTER_COUNT;counter++)
+                {
+                    if(counter==PerfCounter_cacheMisses) // IPC goes before the misses
+                        writeInstructionsPerCycle(textOutput,counters,sums,false);
+                    if(counters->isAvailable(counter)&&sums->intervalCount>0)
+                        fprintf(textOutput," %12.0f",sums->values[counter]/sums->intervalCount);
+                    else
+                        fprintf(textOutput," %12s","n/a");
+                }
+                fputs("\n",textOutput);
+            }
+        }
+        fflush(textOutput);
+
+        if(json!=0)
+        {
+            fprintf(json,"%s\n  {\"name\": \"%s\", \"inputCount\": %u, \"outputCount\": %u, ",firstResult?"":",",configuration->name,configuration->inputCount,configuration->outputCount);
+            writeJsonUInt32Array(json,"hiddenLayerCounts",configuration->hiddenLayerCounts,4);
+            fputs(", ",json);
+            writeJsonUInt32Array(json,"hiddenLayerWidths",configuration->hiddenLayerWidths,4);
+            fprintf(json,", \"backpropagationSteps\": %u, \"weightCount\": %llu,\n   \"process\": {",configuration->backpropagationSteps,(unsigned long long)result.weightCount);
+            writeJsonStatistics(json,"nsPerStep",&result.processTime);
+            fputs(", \"stepsPerSecond\": ",json);
+            writeJsonNumber(json,stepsPerSecond);
+            fputs(", \"weightsPerSecond\": ",json);
+            writeJsonNumber(json,processWeightsPerSecond);
+            fputs("},\n   \"learn\": {",json);
+            writeJsonStatistics(json,"nsPerCall",&result.learnTime);
+            fputs(", \"callsPerSecond\": ",json);
+            writeJsonNumber(json,learnCallsPerSecond);
+            fputs(", \"weightsPerSecond\": ",json);
+            writeJsonNumber(json,learnWeightsPerSecond);
+            fputs("}",json);
+            if(LSTMStats::isEnabled())
+            {
+                fputs(",\n   \"phases\": {",json);
+                for(uint8_t phase=0;phase<LSTM_PHASE_COUNT;phase++)
+                    fprintf(json,"%s\"%s\": {\"count\": %llu, \"ns\": %llu}",phase>0?", ":"",LSTMStats::getPhaseName(phase),(unsigned long long)result.phaseStats.phaseCounts[phase],(unsigned long long)result.phaseStats.phaseNanoseconds[phase]);
+                fputs("}",json);
+            }
+            if(LSTMAllocations::isEnabled())
+            {
+                fputs(",\n   \"allocations\": {",json);
+                for(uint8_t category=0;category<LSTM_ALLOCATION_CATEGORY_COUNT;category++)
+                {
+                    fprintf(json,"%s\"%s\": {\"processCountPerStep\": ",category>0?", ":"",LSTMAllocations::getCategoryName(category));
+                    writeJsonNumber(json,result.processAllocationCounts[category]);
+                    fputs(", \"processBytesPerStep\": ",json);
+                    writeJsonNumber(json,result.processAllocatedBytes[category]);
+                    fputs(", \"learnCountPerCall\": ",json);
+                    writeJsonNumber(json,result.learnAllocationCounts[category]);
+                    fputs(", \"learnBytesPerCall\": ",json);
+                    writeJsonNumber(json,result.learnAllocatedBytes[category]);
+                    fprintf(json,", \"peakLiveBytes\": %llu}",(unsigned long long)result.allocationStats.peakLiveBytes[category]);
+                }
+                fprintf(json,", \"peakTotalLiveBytes\": %llu}",(unsigned long long)result.allocationStats.peakTotalLiveBytes);
+            }
+            if(roofline)
+            {
+                fputs(",\n   \"roofline\": {",json);
+                writeRoofline(json,"process",result.processFlops,result.processBytes,result.processTime.median,&machinePeak,true);
+                fputs(", ",json);
+                writeRoofline(json,"learn",result.learnFlops,result.learnBytes,result.learnTime.median,&machinePeak,true);
+                fputs("}",json);
+            }
+            if(result.replicaNodeCount>0)
+            {
+                fprintf(json,",\n   \"replicas\": {\"nodeCount\": %u, \"nodes\": [",result.replicaNodeCount);
+                double totalStepsPerSecond=0.0;
+                for(uint32_t node=0;node<result.replicaNodeCount;node++)
+                {
+                    fprintf(json,"%s{\"workers\": %u, \"stepsPerSecond\": ",node>0?", ":"",result.replicaNodeWorkerCounts[node]);
+                    writeJsonNumber(json,result.replicaNodeStepsPerSecond[node]);
+                    fputs("}",json);
+                    totalStepsPerSecond+=result.replicaNodeStepsPerSecond[node];
+                }
+                fputs("], \"stepsPerSecond\": ",json);
+                writeJsonNumber(json,totalStepsPerSecond);
+                fputs("}",json);
+            }
+            if(counters!=0)
+            {
+                // Per call; null if a counter is not available
+                fputs(",\n   \"counters\": {",json);
+                for(uint8_t call=0;call<BENCHMARK_COUNTED_CALL_COUNT;call++)
+                {
+                    PerfCounterSums *sums=&result.counterSums[call];
+                    fprintf(json,"%s\"%s\": {",call>0?", ":"",countedCallNames[call]);
+                    for(uint8_t counter=0;counter<PERF_COUNTER_COUNT;counter++)
+                    {
+                        fprintf(json,"\"%s\": ",PerfCounters::getCounterName(counter));
+                        if(counters->isAvailable(counter)&&sums->intervalCount>0)
+                            writeJsonNumber(json,sums->values[counter]/sums->intervalCount);
+                        else
+                            fputs("null",json);
+                        fputs(", ",json);
+                    }
+                    fputs("\"instructionsPerCycle\": ",json);
+                    writeInstructionsPerCycle(json,counters,sums,true);
+                    fputs("}",json);
+                }
+                fputs("}",json);
+            }
+            fputs("}",json);
+            firstResult=false;
+        }
+        free(result.replicaNodeWorkerCounts);
+        free(result.replicaNodeStepsPerSecond);
+    }
+
+    delete counters;
+    if(json!=0)
+    {
+        fputs("\n]}\n",json);
+        if(json!=stdout)
+            fclose(json);
+    }
+    return 0;
+}
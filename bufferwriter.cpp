@@ -0,0 +1,227 @@
+#include "bufferwriter.h"
+
+BufferWriter::BufferWriter(fs_t initialSize)
+{
+    bufferSize=initialSize<8?8:initialSize; // Room for the largest single value
+    buffer=(char*)malloc(bufferSize);
+    pos=0;
+    previousChunksSize=0;
+    chunksSize=8;
+    chunks=(char**)malloc(chunksSize*sizeof(char*));
+    chunkSizes=(fs_t*)malloc(chunksSize*sizeof(fs_t));
+    chunkCount=0;
+    file=0;
+    failed=false;
+    systemIsLittleEndian=io::getSystemIsLittleEndian();
+}
+
+BufferWriter::BufferWriter(FILE *_file, fs_t _bufferSize)
+{
+    bufferSize=_bufferSize<8?8:_bufferSize;
+    buffer=(char*)malloc(bufferSize);
+    pos=0;
+    previousChunksSize=0;
+    chunksSize=0;
+    chunks=0;
+    chunkSizes=0;
+    chunkCount=0;
+    file=_file;
+    failed=false;
+    systemIsLittleEndian=io::getSystemIsLittleEndian();
+}
+
+void BufferWriter::startChunk(fs_t minimumSize)
+{
+    if(file!=0)
+    {
+        flush();
+        if(bufferSize<minimumSize)
+        {
+            free(buffer);
+            bufferSize=minimumSize;
+            buffer=(char*)malloc(bufferSize);
+        }
+        return;
+    }
+    if(pos==0&&chunkCount==0)
+    {
+        // Nothing written yet: the first chunk can simply be replaced.
+        free(buffer);
+        bufferSize=minimumSize;
+        buffer=(char*)malloc(bufferSize);
+        return;
+    }
+    if(chunkCount==chunksSize)
+    {
+        chunksSize*=2;
+        chunks=(char**)realloc(chunks,chunksSize*sizeof(char*));
+        chunkSizes=(fs_t*)realloc(chunkSizes,chunksSize*sizeof(fs_t));
+    }
+    chunks[chunkCount]=buffer;
+    chunkSizes[chunkCount++]=pos;
+    previousChunksSize+=pos;
+    bufferSize=2*bufferSize>minimumSize?2*bufferSize:minimumSize;
+    buffer=(char*)malloc(bufferSize);
+    pos=0;
+}
+
+void BufferWriter::ensureSpace(fs_t size)
+{
+    if(bufferSize-pos<size)
+        startChunk(size);
+}
+
+void BufferWriter::reserve(fs_t size)
+{
+    ensureSpace(size);
+}
+
+fs_t BufferWriter::getSize()
+{
+    return previousChunksSize+pos;
+}
+
+void BufferWriter::writeUInt8(uint8_t i)
+{
+    ensureSpace(sizeof(uint8_t));
+    io::writeUInt8(buffer,i,pos);
+}
+
+void BufferWriter::writeUInt16(uint16_t i)
+{
+    ensureSpace(sizeof(uint16_t));
+    io::writeUInt16(buffer,i,pos);
+}
+
+void BufferWriter::writeUInt32(uint32_t i)
+{
+    ensureSpace(sizeof(uint32_t));
+    io::writeUInt32(buffer,i,pos);
+}
+
+void BufferWriter::writeUInt64(uint64_t i)
+{
+    ensureSpace(sizeof(uint64_t));
+    io::writeUInt64(buffer,i,pos);
+}
+
+void BufferWriter::writeFloat(float i)
+{
+    writeFloats(&i,1);
+}
+
+void BufferWriter::writeDouble(double i)
+{
+    writeDoubles(&i,1);
+}
+
+void BufferWriter::writeRawData(const char *in, fs_t length)
+{
+    // Large blocks are split over chunks (or buffer flushes) instead of requiring a chunk of their size.
+    while(length>0)
+    {
+        if(pos==bufferSize)
+            startChunk(1);
+        fs_t partLength=bufferSize-pos<length?bufferSize-pos:length;
+        io::writeRawData(buffer,in,partLength,pos);
+        in+=partLength;
+        length-=partLength;
+    }
+}
+
+void BufferWriter::writeDoubles(const double *in, fs_t count)
+{
+    while(count>0)
+    {
+        ensureSpace(sizeof(double));
+        fs_t partCount=(bufferSize-pos)/sizeof(double);
+        if(partCount>count)
+            partCount=count;
+        io::writeDoubles(buffer,in,partCount,pos,systemIsLittleEndian);
+        in+=partCount;
+        count-=partCount;
+    }
+}
+
+void BufferWriter::writeFloats(const float *in, fs_t count)
+{
+    while(count>0)
+    {
+        ensureSpace(sizeof(float));
+        fs_t partCount=(bufferSize-pos)/sizeof(float);
+        if(partCount>count)
+            partCount=count;
+        io::writeFloats(buffer,in,partCount,pos,systemIsLittleEndian);
+        in+=partCount;
+        count-=partCount;
+    }
+}
+
+void BufferWriter::writeUInt32s(const uint32_t *in, fs_t count)
+{
+    while(count>0)
+    {
+        ensureSpace(sizeof(uint32_t));
+        fs_t partCount=(bufferSize-pos)/sizeof(uint32_t);
+        if(partCount>count)
+            partCount=count;
+        io::writeUInt32s(buffer,in,partCount,pos);
+        in+=partCount;
+        count-=partCount;
+    }
+}
+
+void BufferWriter::pad(fs_t alignment)
+{
+    while(getSize()%alignment!=0)
+        writeUInt8(0);
+}
+
+bool BufferWriter::flush()
+{
+    if(file!=0&&pos>0)
+    {
+        if(fwrite(buffer,1,pos,file)!=pos)
+            failed=true;
+        previousChunksSize+=pos;
+        pos=0;
+    }
+    return !failed;
+}
+
+char *BufferWriter::detach(fs_t &size)
+{
+    size=getSize();
+    char *data;
+    if(chunkCount==0)
+        data=buffer;
+    else
+    {
+        data=(char*)malloc(size>0?size:1);
+        fs_t dataPos=0;
+        for(uint32_t chunk=0;chunk<chunkCount;chunk++)
+        {
+            memcpy(data+dataPos,chunks[chunk],chunkSizes[chunk]);
+            dataPos+=chunkSizes[chunk];
+            free(chunks[chunk]);
+        }
+        memcpy(data+dataPos,buffer,pos);
+        free(buffer);
+        chunkCount=0;
+    }
+    bufferSize=8;
+    buffer=(char*)malloc(bufferSize);
+    pos=0;
+    previousChunksSize=0;
+    return data;
+}
+
+BufferWriter::~BufferWriter()
+{
+    flush();
+    for(uint32_t chunk=0;chunk<chunkCount;chunk++)
+        free(chunks[chunk]);
+    free(chunks);
+    free(chunkSizes);
+    free(buffer);
+}
@@ -0,0 +1,58 @@
+#ifndef BUFFERWRITER_H
+#define BUFFERWRITER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "io.h"
+
+#define BUFFER_WRITER_DEFAULT_FILE_BUFFER_SIZE (1<<20)
+
+// Sequential writer for the io formats (little-endian, see io.h) with two modes:
+// In memory, the data is written to chunks: when a chunk is full, a new one (twice as large) is started instead of reallocating and copying
+// what has been written. detach() returns the data in one block, which is only copied if more than one chunk was used, so reserve() the
+// expected size first to avoid any copy.
+// Streaming to a file, one buffer is reused: whenever it is full, it is written to the file with a single fwrite(), so the memory used does not
+// depend on the size of the output.
+
+class BufferWriter
+{
+public:
+    char *buffer; // Current chunk
+    fs_t bufferSize;
+    fs_t pos; // In the current chunk
+    fs_t previousChunksSize; // Bytes in the previous chunks (in memory) or written to the file
+    char **chunks; // Dimensions: Previous chunks (in memory)
+    fs_t *chunkSizes;
+    uint32_t chunkCount;
+    uint32_t chunksSize;
+    FILE *file; // 0 in memory
+    bool failed; // A write to the file has failed
+    bool systemIsLittleEndian;
+
+    BufferWriter(fs_t initialSize=4096); // In memory
+    BufferWriter(FILE *_file,fs_t _bufferSize=BUFFER_WRITER_DEFAULT_FILE_BUFFER_SIZE); // Streaming to "_file"
+    void reserve(fs_t size); // Makes room for "size" more bytes in the current chunk
+    fs_t getSize(); // Bytes written so far
+    void writeUInt8(uint8_t i);
+    void writeUInt16(uint16_t i);
+    void writeUInt32(uint32_t i);
+    void writeUInt64(uint64_t i);
+    void writeFloat(float i);
+    void writeDouble(double i);
+    void writeRawData(const char *in,fs_t length);
+    void writeDoubles(const double *in,fs_t count);
+    void writeFloats(const float *in,fs_t count);
+    void writeUInt32s(const uint32_t *in,fs_t count);
+    void pad(fs_t alignment); // Writes zeros until the size is a multiple of "alignment"
+    bool flush(); // Writes the buffer to the file. Returns false if any write has failed.
+    char *detach(fs_t &size); // In memory: returns all data (the caller frees it) and empties the writer
+    ~BufferWriter(); // Flushes to the file, but does not close it
+
+private:
+    void startChunk(fs_t minimumSize);
+    void ensureSpace(fs_t size);
+};
+
+#endif // BUFFERWRITER_H
@@ -0,0 +1,127 @@
+// Checks that LSTMCheckpointWriter never breaks the chain of incremental checkpoints it writes: after checkpoints to the same path in a row
+// and to alternating paths, the last checkpoint and every file of its chain must still load and hold the parameters written to them.
+// (Files of an earlier chain may break when their base is overwritten by a new full checkpoint.)
+// Usage: CheckpointWriterTest [<directory for the checkpoint files>]
+// Exits with 0 if all checks pass.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "io.h"
+#include "lstm.h"
+#include "lstmcheckpointwriter.h"
+
+#define CHECKPOINT_WRITER_TEST_INPUT_COUNT 3
+#define CHECKPOINT_WRITER_TEST_OUTPUT_COUNT 3
+#define CHECKPOINT_WRITER_TEST_BACKPROPAGATION_STEPS 3
+
+// One process() sequence and learn() call, so each checkpoint differs from the previous one
+static void train(LSTM *lstm, uint32_t sequence)
+{
+    uint32_t stepCount=CHECKPOINT_WRITER_TEST_BACKPROPAGATION_STEPS+1;
+    double *desiredOutputs[CHECKPOINT_WRITER_TEST_BACKPROPAGATION_STEPS+1];
+    for(uint32_t step=0;step<stepCount;step++)
+    {
+        double input[CHECKPOINT_WRITER_TEST_INPUT_COUNT];
+        for(uint32_t inputN=0;inputN<CHECKPOINT_WRITER_TEST_INPUT_COUNT;inputN++)
+            input[inputN]=inputN==(sequence+step)%CHECKPOINT_WRITER_TEST_INPUT_COUNT?1.0:0.0;
+        free(lstm->process(input));
+        desiredOutputs[step]=(double*)malloc(CHECKPOINT_WRITER_TEST_OUTPUT_COUNT*sizeof(double));
+        for(uint32_t outputN=0;outputN<CHECKPOINT_WRITER_TEST_OUTPUT_COUNT;outputN++)
+            desiredOutputs[step][outputN]=outputN==(sequence+step+1)%CHECKPOINT_WRITER_TEST_OUTPUT_COUNT?1.0:0.0;
+    }
+    lstm->learn(desiredOutputs);
+    for(uint32_t step=0;step<stepCount;step++)
+        free(desiredOutputs[step]);
+}
+
+// Whether the checkpoint at "filePath" loads and holds the same parameters as "expected" (a serialized LSTM)
+static bool checkCheckpoint(const char *filePath, char *expected, fs_t expectedSize)
+{
+    LSTM *loaded=LSTM::load(filePath);
+    if(loaded==0)
+    {
+        fprintf(stderr,"%s cannot be loaded\n",filePath);
+        return false;
+    }
+    fs_t size;
+    char *data=loaded->serialize(size);
+    bool matches=size==expectedSize&&memcmp(data,expected,size)==0;
+    if(!matches)
+        fprintf(stderr,"%s does not hold the parameters of its last checkpoint\n",filePath);
+    free(data);
+    delete loaded;
+    return matches;
+}
+
+// Checkpoints to paths[sequence%pathCount] after each training sequence and checks the files of the current chain after each checkpoint
+static bool runCheckpoints(const char *name, char **paths, uint32_t pathCount, uint32_t checkpointCount, uint32_t fullCheckpointInterval)
+{
+    uint32_t hiddenLayerNeuronCounts[1]={4};
+    LSTM *lstm=new LSTM(CHECKPOINT_WRITER_TEST_INPUT_COUNT,CHECKPOINT_WRITER_TEST_OUTPUT_COUNT,CHECKPOINT_WRITER_TEST_BACKPROPAGATION_STEPS,0.1,0.5,0.0001,0.01,0.5,0.0001,1,hiddenLayerNeuronCounts,1,hiddenLayerNeuronCounts,1,hiddenLayerNeuronCounts,1,hiddenLayerNeuronCounts);
+    LSTMCheckpointWriter *writer=new LSTMCheckpointWriter(lstm,fullCheckpointInterval);
+    char **expected=(char**)malloc(pathCount*sizeof(char*));
+    fs_t *expectedSizes=(fs_t*)malloc(pathCount*sizeof(fs_t));
+    for(uint32_t path=0;path<pathCount;path++)
+        expected[path]=0;
+    bool passed=true;
+    for(uint32_t sequence=0;sequence<checkpointCount&&passed;sequence++)
+    {
+        train(lstm,sequence);
+        uint32_t path=sequence%pathCount;
+        writer->checkpoint(paths[path],false,true);
+        writer->waitUntilWritten();
+        if(!writer->lastCheckpointSucceeded)
+        {
+            fprintf(stderr,"%s: checkpoint %u to %s failed\n",name,sequence,paths[path]);
+            passed=false;
+            break;
+        }
+        free(expected[path]);
+        expected[path]=lstm->serialize(expectedSizes[path]);
+        passed=checkCheckpoint(paths[path],expected[path],expectedSizes[path]);
+        for(uint32_t chainFile=0;chainFile<writer->chainFilePathCount&&passed;chainFile++)
+        {
+            for(uint32_t checkedPath=0;checkedPath<pathCount;checkedPath++)
+            {
+                if(strcmp(writer->chainFilePaths[chainFile],paths[checkedPath])==0)
+                    passed=checkCheckpoint(paths[checkedPath],expected[checkedPath],expectedSizes[checkedPath]);
+            }
+        }
+    }
+    printf("%-40s %s\n",name,passed?"passed":"FAILED");
+    for(uint32_t path=0;path<pathCount;path++)
+    {
+        free(expected[path]);
+        remove(paths[path]);
+    }
+    free(expected);
+    free(expectedSizes);
+    delete writer;
+    delete lstm;
+    return passed;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *directory=argc>1?argv[1]:".";
+    char *paths[3];
+    const char *fileNames[3]={"checkpointWriterTestA.lstm","checkpointWriterTestB.lstm","checkpointWriterTestC.lstm"};
+    for(uint32_t path=0;path<3;path++)
+    {
+        paths[path]=(char*)malloc(strlen(directory)+1+strlen(fileNames[path])+1);
+        sprintf(paths[path],"%s/%s",directory,fileNames[path]);
+    }
+
+    bool passed=true;
+    passed&=runCheckpoints("full checkpoints only",paths,1,4,0);
+    passed&=runCheckpoints("same path",paths,1,8,4);
+    passed&=runCheckpoints("alternating paths",paths,2,12,4);
+    passed&=runCheckpoints("three alternating paths",paths,3,12,8);
+
+    for(uint32_t path=0;path<3;path++)
+        free(paths[path]);
+    return passed?0:1;
+}
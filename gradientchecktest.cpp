@@ -0,0 +1,142 @@
+// Checks the derivatives learn() calculates against finite differences of the loss: with momentum and weight decay set to 0, one learn()
+// call changes each weight by -learning rate times the derivative of the summed squared error of the backpropagation window w.r.t. that
+// weight. Covers per-cell and shared gate networks with hidden layers of different sizes, for each cell variant.
+// Usage: GradientCheckTest
+// Exits with 0 if all checks pass.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "lstm.h"
+
+#define GRADIENT_CHECK_TEST_INPUT_COUNT 3
+#define GRADIENT_CHECK_TEST_OUTPUT_COUNT 3
+#define GRADIENT_CHECK_TEST_CELL_COUNT 4
+#define GRADIENT_CHECK_TEST_BACKPROPAGATION_STEPS 3
+#define GRADIENT_CHECK_TEST_STEP_COUNT (GRADIENT_CHECK_TEST_BACKPROPAGATION_STEPS+1)
+#define GRADIENT_CHECK_TEST_LEARNING_RATE 0.1
+#define GRADIENT_CHECK_TEST_EPSILON 1e-6
+#define GRADIENT_CHECK_TEST_TOLERANCE 1e-6
+
+static double inputs[GRADIENT_CHECK_TEST_STEP_COUNT][GRADIENT_CHECK_TEST_INPUT_COUNT]={{1.0,0.0,0.5},{0.0,1.0,-0.5},{0.3,0.2,1.0},{-1.0,0.5,0.0}};
+static double desiredOutputs[GRADIENT_CHECK_TEST_STEP_COUNT][GRADIENT_CHECK_TEST_OUTPUT_COUNT]={{1.0,-0.5,0.3},{0.0,0.2,-0.4},{0.5,0.5,-0.1},{-0.3,0.1,0.6}};
+
+// The hidden layers of each gate network (forget, input, output, candidate gate); sizes differ from each other and from the topmost layer.
+static uint32_t hiddenLayerCounts[4]={1,2,1,1};
+static uint32_t hiddenLayerNeuronCounts[4][2]={{5,0},{5,6},{6,0},{5,0}};
+
+// Summed squared error of one window of process() calls
+static double getWindowLoss(LSTM *lstm)
+{
+    double loss=0.0;
+    for(uint32_t step=0;step<GRADIENT_CHECK_TEST_STEP_COUNT;step++)
+    {
+        double *output=lstm->process(inputs[step]);
+        for(uint32_t outputN=0;outputN<GRADIENT_CHECK_TEST_OUTPUT_COUNT;outputN++)
+            loss+=pow(output[outputN]-desiredOutputs[step][outputN],2.0);
+        free(output);
+    }
+    return loss;
+}
+
+// Weight "weight" of neuron "neuron" in layer "layer" of a gate network; weight==neuronsInPreviousLayer selects the neuron's bias weight.
+static double *getGateNetworkWeight(LSTM *lstm, uint8_t gate, uint32_t network, uint32_t layer, uint32_t neuron, uint32_t weight, uint32_t neuronsInPreviousLayer)
+{
+    LSTMState *state=lstm->getWeightState();
+    double ****gateLayerWeights[4]={state->forgetGateLayerWeights,state->inputGateLayerWeights,state->outputGateLayerWeights,state->candidateGateLayerWeights};
+    double ***gateLayerBiasWeights[4]={state->forgetGateLayerBiasWeights,state->inputGateLayerBiasWeights,state->outputGateLayerBiasWeights,state->candidateGateLayerBiasWeights};
+    if(weight==neuronsInPreviousLayer)
+        return &gateLayerBiasWeights[gate][network][layer][neuron];
+    return &gateLayerWeights[gate][network][layer][neuron][weight];
+}
+
+// Compares the change learn() made to one gate network weight of "learned" with the finite difference of the loss of the serialized
+// untrained LSTM in "data"
+static bool checkGateNetworkWeight(const char *name, char *data, fs_t size, LSTM *untrained, LSTM *learned, uint8_t gate, uint32_t network, uint32_t layer, uint32_t neuron, uint32_t weight, uint32_t neuronsInPreviousLayer)
+{
+    double before=*getGateNetworkWeight(untrained,gate,network,layer,neuron,weight,neuronsInPreviousLayer);
+    double after=*getGateNetworkWeight(learned,gate,network,layer,neuron,weight,neuronsInPreviousLayer);
+    double analyticDerivative=-(after-before)/GRADIENT_CHECK_TEST_LEARNING_RATE;
+    double losses[2];
+    for(uint8_t direction=0;direction<2;direction++)
+    {
+        LSTM *perturbed=LSTM::deserialize(data,size);
+        *getGateNetworkWeight(perturbed,gate,network,layer,neuron,weight,neuronsInPreviousLayer)+=direction==0?GRADIENT_CHECK_TEST_EPSILON:-GRADIENT_CHECK_TEST_EPSILON;
+        losses[direction]=getWindowLoss(perturbed);
+        delete perturbed;
+    }
+    double numericDerivative=(losses[0]-losses[1])/(2.0*GRADIENT_CHECK_TEST_EPSILON);
+    if(fabs(analyticDerivative-numericDerivative)<=GRADIENT_CHECK_TEST_TOLERANCE)
+        return true;
+    fprintf(stderr,"%s: gate %u, network %u, layer %u, neuron %u, weight %u: learn() %.9g, finite difference %.9g\n",name,gate,network,layer,neuron,weight,analyticDerivative,numericDerivative);
+    return false;
+}
+
+// Trains a copy of a new LSTM on one window and checks every topmost layer neuron and a sample of the other weights of each gate network
+static bool runGradientCheck(const char *name, bool sharedGateNetworks, uint8_t cellVariant)
+{
+    LSTM *untrained=new LSTM(GRADIENT_CHECK_TEST_INPUT_COUNT,GRADIENT_CHECK_TEST_OUTPUT_COUNT,GRADIENT_CHECK_TEST_BACKPROPAGATION_STEPS,GRADIENT_CHECK_TEST_LEARNING_RATE,0.0,0.0,GRADIENT_CHECK_TEST_LEARNING_RATE,0.0,0.0,hiddenLayerCounts[0],hiddenLayerNeuronCounts[0],hiddenLayerCounts[1],hiddenLayerNeuronCounts[1],hiddenLayerCounts[2],hiddenLayerNeuronCounts[2],hiddenLayerCounts[3],hiddenLayerNeuronCounts[3],GRADIENT_CHECK_TEST_CELL_COUNT,sharedGateNetworks,cellVariant);
+    fs_t size;
+    char *data=untrained->serialize(size);
+    LSTM *learned=LSTM::deserialize(data,size);
+    double *windowDesiredOutputs[GRADIENT_CHECK_TEST_STEP_COUNT];
+    for(uint32_t step=0;step<GRADIENT_CHECK_TEST_STEP_COUNT;step++)
+    {
+        free(learned->process(inputs[step]));
+        windowDesiredOutputs[step]=desiredOutputs[step];
+    }
+    learned->learn(windowDesiredOutputs);
+
+    bool passed=true;
+    uint32_t checkedWeightCount=0;
+    uint32_t gateNetworkCount=untrained->getGateNetworkCount();
+    uint32_t gateNetworkOutputCount=untrained->getGateNetworkOutputCount();
+    for(uint8_t gate=0;gate<4&&passed;gate++)
+    {
+        if(gate==0&&!untrained->getWeightState()->hasForgetGateNetwork())
+            continue;
+        uint32_t totalLayerCount=hiddenLayerCounts[gate]+1;
+        for(uint32_t network=0;network<gateNetworkCount&&passed;network++)
+        {
+            for(uint32_t layer=0;layer<totalLayerCount&&passed;layer++)
+            {
+                uint32_t neuronsInThisLayer=layer==totalLayerCount-1?gateNetworkOutputCount:hiddenLayerNeuronCounts[gate][layer];
+                uint32_t neuronsInPreviousLayer=layer==0?GRADIENT_CHECK_TEST_INPUT_COUNT+GRADIENT_CHECK_TEST_CELL_COUNT:hiddenLayerNeuronCounts[gate][layer-1];
+                // The topmost layer neurons of per-cell networks each belong to an input or a previous output, so all of them are checked.
+                uint32_t neuronStride=layer==totalLayerCount-1?1:2;
+                for(uint32_t neuron=0;neuron<neuronsInThisLayer&&passed;neuron+=neuronStride)
+                {
+                    for(uint32_t weight=neuron%3;weight<neuronsInPreviousLayer&&passed;weight+=3)
+                    {
+                        passed=checkGateNetworkWeight(name,data,size,untrained,learned,gate,network,layer,neuron,weight,neuronsInPreviousLayer);
+                        checkedWeightCount++;
+                    }
+                    if(passed)
+                    {
+                        passed=checkGateNetworkWeight(name,data,size,untrained,learned,gate,network,layer,neuron,neuronsInPreviousLayer,neuronsInPreviousLayer);
+                        checkedWeightCount++;
+                    }
+                }
+            }
+        }
+    }
+    printf("%-40s %s (%u weights)\n",name,passed?"passed":"FAILED",checkedWeightCount);
+    free(data);
+    delete learned;
+    delete untrained;
+    return passed;
+}
+
+int main()
+{
+    bool passed=true;
+    passed&=runGradientCheck("per-cell gate networks",false,LSTMCellVariant_standard);
+    passed&=runGradientCheck("shared gate networks",true,LSTMCellVariant_standard);
+    passed&=runGradientCheck("coupled input/forget, per-cell networks",false,LSTMCellVariant_coupledInputForget);
+    passed&=runGradientCheck("coupled input/forget, shared networks",true,LSTMCellVariant_coupledInputForget);
+    passed&=runGradientCheck("GRU, per-cell networks",false,LSTMCellVariant_gru);
+    passed&=runGradientCheck("GRU, shared networks",true,LSTMCellVariant_gru);
+    return passed?0:1;
+}
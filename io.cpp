@@ -1,5 +1,50 @@
 #include "io.h"
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <stdio.h>
+
+// Bulk arrays are stored as consecutive little-endian values. On little-endian systems they are copied as they are; otherwise each value is
+// byte-swapped (in a loop compilers turn into vector shuffles).
+static void copyLittleEndian32(char *out, const char *in, fs_t count, bool systemIsLittleEndian)
+{
+    if(systemIsLittleEndian)
+    {
+        memcpy(out,in,count*sizeof(uint32_t));
+        return;
+    }
+    for(fs_t i=0;i<count;i++)
+    {
+        uint32_t value;
+        memcpy(&value,in+i*sizeof(uint32_t),sizeof(uint32_t));
+        value=io::reverseUInt32ByteOrder(value);
+        memcpy(out+i*sizeof(uint32_t),&value,sizeof(uint32_t));
+    }
+}
+
+static void copyLittleEndian64(char *out, const char *in, fs_t count, bool systemIsLittleEndian)
+{
+    if(systemIsLittleEndian)
+    {
+        memcpy(out,in,count*sizeof(uint64_t));
+        return;
+    }
+    for(fs_t i=0;i<count;i++)
+    {
+        uint64_t value;
+        memcpy(&value,in+i*sizeof(uint64_t),sizeof(uint64_t));
+        value=io::reverseUInt64ByteOrder(value);
+        memcpy(out+i*sizeof(uint64_t),&value,sizeof(uint64_t));
+    }
+}
+
 uint8_t io::readUInt8(char *&data)
 {
     return (uint8_t)*(data++);
@@ -83,6 +128,24 @@ char *io::readZeroTerminatedData(char *&data)
     return out;
 }
 
+void io::readDoubles(char *&data, double *out, fs_t count, bool systemIsLittleEndian)
+{
+    copyLittleEndian64((char*)out,data,count,systemIsLittleEndian);
+    data+=count*sizeof(double);
+}
+
+void io::readFloats(char *&data, float *out, fs_t count, bool systemIsLittleEndian)
+{
+    copyLittleEndian32((char*)out,data,count,systemIsLittleEndian);
+    data+=count*sizeof(float);
+}
+
+void io::readUInt32s(char *&data, uint32_t *out, fs_t count)
+{
+    copyLittleEndian32((char*)out,data,count,getSystemIsLittleEndian());
+    data+=count*sizeof(uint32_t);
+}
+
 uint8_t io::peekUInt8(char *data, fs_t pos)
 {
     return (uint8_t)data[pos++];
@@ -180,7 +243,7 @@ uint16_t io::posBasedReadUInt16(char *data, fs_t &pos)
 
 uint32_t io::posBasedReadUInt32(char *data, fs_t &pos)
 {
-    uint32_t out=data[pos++];
+    uint32_t out=(uint8_t)data[pos++];
     out|=((uint32_t)((uint8_t)data[pos++]))<<8;
     out|=((uint32_t)((uint8_t)data[pos++]))<<16;
     out|=((uint32_t)((uint8_t)data[pos++]))<<24;
@@ -249,6 +312,24 @@ char *io::posBasedReadZeroTerminatedData(char *data, fs_t &pos)
     return out;
 }
 
+void io::posBasedReadDoubles(char *data, fs_t &pos, double *out, fs_t count, bool systemIsLittleEndian)
+{
+    copyLittleEndian64((char*)out,data+pos,count,systemIsLittleEndian);
+    pos+=count*sizeof(double);
+}
+
+void io::posBasedReadFloats(char *data, fs_t &pos, float *out, fs_t count, bool systemIsLittleEndian)
+{
+    copyLittleEndian32((char*)out,data+pos,count,systemIsLittleEndian);
+    pos+=count*sizeof(float);
+}
+
+void io::posBasedReadUInt32s(char *data, fs_t &pos, uint32_t *out, fs_t count)
+{
+    copyLittleEndian32((char*)out,data+pos,count,getSystemIsLittleEndian());
+    pos+=count*sizeof(uint32_t);
+}
+
 void io::writeUInt8(char *data, uint8_t i, fs_t &pos)
 {
     data[pos++]=i;
@@ -333,6 +414,24 @@ void io::writeRawData(char *data, const char *in, fs_t length, fs_t &pos)
         data[pos++]=(uint8_t)in[i];
 }
 
+void io::writeDoubles(char *data, const double *in, fs_t count, fs_t &pos, bool systemIsLittleEndian)
+{
+    copyLittleEndian64(data+pos,(const char*)in,count,systemIsLittleEndian);
+    pos+=count*sizeof(double);
+}
+
+void io::writeFloats(char *data, const float *in, fs_t count, fs_t &pos, bool systemIsLittleEndian)
+{
+    copyLittleEndian32(data+pos,(const char*)in,count,systemIsLittleEndian);
+    pos+=count*sizeof(float);
+}
+
+void io::writeUInt32s(char *data, const uint32_t *in, fs_t count, fs_t &pos)
+{
+    copyLittleEndian32(data+pos,(const char*)in,count,getSystemIsLittleEndian());
+    pos+=count*sizeof(uint32_t);
+}
+
 
 void io::putUInt8(char *data, uint8_t i, fs_t pos)
 {
@@ -501,6 +600,27 @@ void io::writeRawDataToBuffer(char *&data, const char *in, fs_t length, fs_t &po
     writeRawData(data,in,length,pos);
 }
 
+void io::writeDoublesToBuffer(char *&data, const double *in, fs_t count, fs_t &pos, fs_t &bufferSize, bool systemIsLittleEndian)
+{
+    fs_t newPos=pos+count*sizeof(double);
+    bufferCheck(data,newPos,bufferSize); // Once for the whole array
+    writeDoubles(data,in,count,pos,systemIsLittleEndian);
+}
+
+void io::writeFloatsToBuffer(char *&data, const float *in, fs_t count, fs_t &pos, fs_t &bufferSize, bool systemIsLittleEndian)
+{
+    fs_t newPos=pos+count*sizeof(float);
+    bufferCheck(data,newPos,bufferSize);
+    writeFloats(data,in,count,pos,systemIsLittleEndian);
+}
+
+void io::writeUInt32sToBuffer(char *&data, const uint32_t *in, fs_t count, fs_t &pos, fs_t &bufferSize)
+{
+    fs_t newPos=pos+count*sizeof(uint32_t);
+    bufferCheck(data,newPos,bufferSize);
+    writeUInt32s(data,in,count,pos);
+}
+
 void io::writeRawDataToLongBuffer(char *&data, const char *in, uint64_t length, uint64_t &pos, uint64_t &bufferSize)
 {
     uint64_t newPos=pos+length;
@@ -563,6 +683,178 @@ bool io::longBufferCheck(char *&buffer, uint64_t pos, uint64_t &bufferSize)
     return ret;
 }
 
+char *io::readFile(const char *filePath, fs_t &size)
+{
+    size=0;
+    FILE *f=fopen(filePath,"rb");
+    if(f==0)
+        return 0;
+    char *data=0;
+    if(fseek(f,0,SEEK_END)==0)
+    {
+        long fileSize=ftell(f);
+        if(fileSize>0&&fseek(f,0,SEEK_SET)==0)
+        {
+            data=(char*)malloc((size_t)fileSize);
+            if(fread(data,1,(size_t)fileSize,f)==(size_t)fileSize)
+                size=(fs_t)fileSize;
+            else
+            {
+                free(data);
+                data=0;
+            }
+        }
+    }
+    fclose(f);
+    return data;
+}
+
+char *io::mapFile(const char *filePath, fs_t &size)
+{
+    size=0;
+#ifdef _WIN32
+    HANDLE file=CreateFileA(filePath,GENERIC_READ,FILE_SHARE_READ,0,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,0);
+    if(file==INVALID_HANDLE_VALUE)
+        return 0;
+    LARGE_INTEGER fileSize;
+    char *data=0;
+    if(GetFileSizeEx(file,&fileSize)&&fileSize.QuadPart>0)
+    {
+        HANDLE mapping=CreateFileMappingA(file,0,PAGE_READONLY,0,0,0);
+        if(mapping!=0)
+        {
+            data=(char*)MapViewOfFile(mapping,FILE_MAP_READ,0,0,0);
+            CloseHandle(mapping); // The view keeps the mapping alive.
+        }
+        if(data!=0)
+            size=(fs_t)fileSize.QuadPart;
+    }
+    CloseHandle(file);
+    return data;
+#else
+    int file=open(filePath,O_RDONLY);
+    if(file<0)
+        return 0;
+    struct stat fileStat;
+    char *data=0;
+    if(fstat(file,&fileStat)==0&&fileStat.st_size>0)
+    {
+        void *mapping=mmap(0,(size_t)fileStat.st_size,PROT_READ,MAP_SHARED,file,0);
+        if(mapping!=MAP_FAILED)
+        {
+            data=(char*)mapping;
+            size=(fs_t)fileStat.st_size;
+        }
+    }
+    close(file); // The mapping stays valid.
+    return data;
+#endif
+}
+
+void io::unmapFile(char *data, fs_t size)
+{
+#ifdef _WIN32
+    (void)size;
+    UnmapViewOfFile(data);
+#else
+    munmap(data,size);
+#endif
+}
+
+bool io::writeFileAtomically(const char *filePath, const char *data, fs_t size)
+{
+    fs_t pathLength=strlen(filePath);
+    char *temporaryPath=(char*)malloc(pathLength+5);
+    memcpy(temporaryPath,filePath,pathLength);
+    memcpy(temporaryPath+pathLength,".tmp",5);
+    bool success=false;
+#ifdef _WIN32
+    HANDLE file=CreateFileA(temporaryPath,GENERIC_WRITE,0,0,CREATE_ALWAYS,FILE_ATTRIBUTE_NORMAL,0);
+    if(file!=INVALID_HANDLE_VALUE)
+    {
+        success=true;
+        for(fs_t written=0;success&&written<size;)
+        {
+            DWORD chunkSize=(DWORD)(size-written>0x40000000?0x40000000:size-written);
+            DWORD chunkWritten;
+            success=WriteFile(file,data+written,chunkSize,&chunkWritten,0)&&chunkWritten==chunkSize;
+            written+=chunkWritten;
+        }
+        success=FlushFileBuffers(file)&&success;
+        success=CloseHandle(file)&&success;
+        success=success&&MoveFileExA(temporaryPath,filePath,MOVEFILE_REPLACE_EXISTING|MOVEFILE_WRITE_THROUGH);
+        if(!success)
+            DeleteFileA(temporaryPath); // A failed write, flush or move leaves the temporary file behind otherwise
+    }
+#else
+    int file=open(temporaryPath,O_WRONLY|O_CREAT|O_TRUNC,0644);
+    if(file>=0)
+    {
+        success=true;
+        for(fs_t written=0;success&&written<size;)
+        {
+            ssize_t chunkWritten=write(file,data+written,size-written);
+            if(chunkWritten<0&&errno==EINTR)
+                continue; // Interrupted by a signal before anything was written
+            success=chunkWritten>0;
+            if(success)
+                written+=(fs_t)chunkWritten;
+        }
+        success=fsync(file)==0&&success;
+        success=close(file)==0&&success;
+        success=success&&rename(temporaryPath,filePath)==0;
+        if(!success)
+            unlink(temporaryPath); // A failed write, fsync or rename leaves the temporary file behind otherwise
+        else
+        {
+            // The rename is only durable once the directory has been synced as well.
+            const char *lastSlash=strrchr(filePath,'/');
+            char *directoryPath=lastSlash==0?0:(char*)fixedLengthDataToString((char*)filePath,lastSlash==filePath?1:(fs_t)(lastSlash-filePath));
+            int directory=open(directoryPath==0?".":directoryPath,O_RDONLY);
+            if(directory>=0)
+            {
+                fsync(directory);
+                close(directory);
+            }
+            free(directoryPath);
+        }
+    }
+#endif
+    free(temporaryPath);
+    return success;
+}
+
+uint64_t io::hash64(const char *data, fs_t size, uint64_t hash)
+{
+    // FNV-1a over 64 bit words (and the remaining bytes), which is much faster than per byte and good enough to detect damaged or mismatched files
+    // The words are read little-endian, so the hash does not depend on the system.
+    bool systemIsLittleEndian=getSystemIsLittleEndian();
+    fs_t wordCount=size/sizeof(uint64_t);
+    for(fs_t word=0;word<wordCount;word++)
+    {
+        uint64_t value;
+        memcpy(&value,data+word*sizeof(uint64_t),sizeof(uint64_t));
+        if(!systemIsLittleEndian)
+            value=reverseUInt64ByteOrder(value);
+        hash=(hash^value)*0x100000001b3ULL;
+    }
+    for(fs_t pos=wordCount*sizeof(uint64_t);pos<size;pos++)
+        hash=(hash^(uint8_t)data[pos])*0x100000001b3ULL;
+    return hash;
+}
+
+uint64_t io::hash64Doubles(const double *values, fs_t count, uint64_t hash)
+{
+    // The little-endian words written for the values are their bit patterns, so nothing has to be converted.
+    for(fs_t value=0;value<count;value++)
+    {
+        uint64_t bits;
+        memcpy(&bits,values+value,sizeof(uint64_t));
+        hash=(hash^bits)*0x100000001b3ULL;
+    }
+    return hash;
+}
+
 bool io::getSystemIsLittleEndian()
 {
     union
@@ -12,6 +12,8 @@
 
 typedef size_t fs_t;
 
+#define IO_HASH64_INITIAL_VALUE 0xcbf29ce484222325ULL
+
 class io
 {
 public:
@@ -25,6 +27,10 @@ public:
     static double readDouble2(char *&data);
     static char *readFixedLengthData(char *&data, fs_t &length);
     static char *readZeroTerminatedData(char *&data);
+    // Arrays of "count" values; see the note in io.cpp
+    static void readDoubles(char *&data, double *out, fs_t count, bool systemIsLittleEndian);
+    static void readFloats(char *&data, float *out, fs_t count, bool systemIsLittleEndian);
+    static void readUInt32s(char *&data, uint32_t *out, fs_t count);
 
     static uint8_t peekUInt8(char *data, fs_t pos);
     static uint16_t peekUInt16(char *data, fs_t pos);
@@ -46,6 +52,9 @@ public:
     static double posBasedReadDouble2(char *data, fs_t &pos);
     static char *posBasedReadFixedLengthData(char *data, fs_t &pos, fs_t &length);
     static char *posBasedReadZeroTerminatedData(char *data, fs_t &pos);
+    static void posBasedReadDoubles(char *data, fs_t &pos, double *out, fs_t count, bool systemIsLittleEndian);
+    static void posBasedReadFloats(char *data, fs_t &pos, float *out, fs_t count, bool systemIsLittleEndian);
+    static void posBasedReadUInt32s(char *data, fs_t &pos, uint32_t *out, fs_t count);
 
     static void writeUInt8(char *data, uint8_t i, fs_t &pos);
     static void writeUInt16(char *data, uint16_t i, fs_t &pos);
@@ -58,6 +67,9 @@ public:
     static void writeFixedLengthData(char *data, fs_t length, const char *in, fs_t &pos);
     static void writeZeroTerminatedData(char *data, const char *in, fs_t &pos);
     static void writeRawData(char *data, const char *in, fs_t length, fs_t &pos);
+    static void writeDoubles(char *data, const double *in, fs_t count, fs_t &pos, bool systemIsLittleEndian);
+    static void writeFloats(char *data, const float *in, fs_t count, fs_t &pos, bool systemIsLittleEndian);
+    static void writeUInt32s(char *data, const uint32_t *in, fs_t count, fs_t &pos);
 
     static void putUInt8(char *data, uint8_t i, fs_t pos);
     static void putUInt16(char *data, uint16_t i, fs_t pos);
@@ -82,6 +94,9 @@ public:
     static void writeFixedLengthDataToBuffer(char *&data, fs_t length, const char *in, fs_t &pos, fs_t &bufferSize);
     static void writeZeroTerminatedDataToBuffer(char *&data, const char *in, fs_t &pos, fs_t &bufferSize);
     static void writeRawDataToBuffer(char *&data, const char *in, fs_t length, fs_t &pos, fs_t &bufferSize);
+    static void writeDoublesToBuffer(char *&data, const double *in, fs_t count, fs_t &pos, fs_t &bufferSize, bool systemIsLittleEndian);
+    static void writeFloatsToBuffer(char *&data, const float *in, fs_t count, fs_t &pos, fs_t &bufferSize, bool systemIsLittleEndian);
+    static void writeUInt32sToBuffer(char *&data, const uint32_t *in, fs_t count, fs_t &pos, fs_t &bufferSize);
     static void writeRawDataToLongBuffer(char *&data, const char *in, uint64_t length, uint64_t &pos, uint64_t &bufferSize);
     static void writeRawCharToBuffer(char *&data, unsigned char in, fs_t &pos, fs_t &bufferSize);
     static void writeRawCharToLongBuffer(char *&data, unsigned char in, uint64_t &pos, uint64_t &bufferSize);
@@ -91,6 +106,16 @@ public:
     static bool bufferCheck(char *&buffer, fs_t pos, fs_t &bufferSize);
     static bool longBufferCheck(char *&buffer, uint64_t pos, uint64_t &bufferSize);
 
+    static char *readFile(const char *filePath, fs_t &size); // Returns 0 if the file cannot be read or is empty. The caller frees the data.
+    // Maps a file read-only into memory (page-aligned). Returns 0 if the file cannot be opened or is empty. Free with unmapFile().
+    static char *mapFile(const char *filePath, fs_t &size);
+    static void unmapFile(char *data, fs_t size);
+    // Writes "data" to filePath+".tmp", flushes it to the disk and renames it to "filePath", so that "filePath" is never left partially written.
+    static bool writeFileAtomically(const char *filePath, const char *data, fs_t size);
+
+    // Fast non-cryptographic checksum. Data split at multiples of 8 bytes can be hashed in parts by passing the hash of the previous parts.
+    static uint64_t hash64(const char *data, fs_t size, uint64_t hash=IO_HASH64_INITIAL_VALUE);
+    static uint64_t hash64Doubles(const double *values, fs_t count, uint64_t hash=IO_HASH64_INITIAL_VALUE); // Same as hash64() of writeDoubles()
     static bool getSystemIsLittleEndian(); // Endianness depends on the machine the application runs on, not on the compiler!
     static uint16_t reverseUInt16ByteOrder(uint16_t i);
     static uint32_t reverseUInt32ByteOrder(uint32_t i);
@@ -1,5 +1,7 @@
 #include "lstm.h"
 
+#include <algorithm>
+
 double LSTM::sig(double input)
 {
     // Derivative: sig(input)*(1.0-sig(input))
@@ -96,6 +98,8 @@ void LSTM::fillDoubleArrayWithRandomValues(double *array, uint32_t size, double
 
 LSTMState *LSTM::pushState()
 {
+    LSTM_TIME_PHASE(pushStateTimer,&phaseStats,LSTMPhase_pushState);
+
     // This works as follows: the buffer is larger (usually 2 times larger) than the required size, allowing us to avoid having to move memory
     // every time a new state is pushed. Once the buffer is filled, the needed elements in the front are moved back, overriding the old states
     // that aren't needed anymore, and creating room for new states to be pushed.
@@ -115,7 +119,13 @@ LSTMState *LSTM::pushState()
         stateArrayPos++;
     }
     // Copy values from previous state, if such a state exists:
-    LSTMState *newState=stateArrayPos>0/*Has previous state?*/?new LSTMState(getState(1)):new LSTMState(0,inputCount,outputCount,forgetGateHiddenLayerCount,forgetGateHiddenLayerNeuronCounts,inputGateHiddenLayerCount,inputGateHiddenLayerNeuronCounts,outputGateHiddenLayerCount,outputGateHiddenLayerNeuronCounts,candidateGateHiddenLayerCount,candidateGateHiddenLayerNeuronCounts);
+    LSTMState *newState;
+    if(stateArrayPos>0/*Has previous state?*/)
+        newState=new LSTMState(getState(1));
+    else if(templateState!=0)
+        newState=new LSTMState(templateState); // Keep the weights sessions may already have been processed with
+    else
+        newState=createState();
     states[stateArrayPos]=newState;
     if(stateArrayPos>backpropagationSteps)
     {
@@ -146,11 +156,46 @@ LSTMState *LSTM::getState(uint32_t stepsBack)
     return states[stateArrayPos-stepsBack];
 }
 
-LSTM::LSTM(uint32_t _inputCount, uint32_t _outputCount, uint32_t _backpropagationSteps, double _learningRate, double _momentum, double _weightDecay, double _networkLearningRate, double _networkMomentum, double _networkWeightDecay, uint32_t _forgetGateHiddenLayerCount, uint32_t *_forgetGateHiddenLayerNeuronCounts, uint32_t _inputGateHiddenLayerCount, uint32_t *_inputGateHiddenLayerNeuronCounts, uint32_t _outputGateHiddenLayerCount, uint32_t *_outputGateHiddenLayerNeuronCounts, uint32_t _candidateGateHiddenLayerCount, uint32_t *_candidateGateHiddenLayerNeuronCounts)
+LSTMState *LSTM::getWeightState()
+{
+    if(stateArrayPos!=0xffffffff)
+        return getCurrentState(); // learn() adjusts the weights of the current state
+    if(templateState==0)
+        templateState=createState();
+    return templateState;
+}
+
+LSTMState *LSTM::createState(bool allocateWeights)
+{
+    LSTMState *state=new LSTMState(0,inputCount,cellCount,forgetGateHiddenLayerCount,forgetGateHiddenLayerNeuronCounts,inputGateHiddenLayerCount,inputGateHiddenLayerNeuronCounts,outputGateHiddenLayerCount,outputGateHiddenLayerNeuronCounts,candidateGateHiddenLayerCount,candidateGateHiddenLayerNeuronCounts,allocateWeights,hasOutputProjection()?outputCount:0,sharedGateNetworks,cellVariant);
+    state->sparsity=sparsity;
+    return state;
+}
+
+bool LSTM::hasOutputProjection()
+{
+    return cellCount!=outputCount;
+}
+
+uint32_t LSTM::getGateNetworkCount()
+{
+    return sharedGateNetworks?1:cellCount;
+}
+
+uint32_t LSTM::getGateNetworkOutputCount()
+{
+    return sharedGateNetworks?cellCount:inputCount+cellCount;
+}
+
+LSTM::LSTM(uint32_t _inputCount, uint32_t _outputCount, uint32_t _backpropagationSteps, double _learningRate, double _momentum, double _weightDecay, double _networkLearningRate, double _networkMomentum, double _networkWeightDecay, uint32_t _forgetGateHiddenLayerCount, uint32_t *_forgetGateHiddenLayerNeuronCounts, uint32_t _inputGateHiddenLayerCount, uint32_t *_inputGateHiddenLayerNeuronCounts, uint32_t _outputGateHiddenLayerCount, uint32_t *_outputGateHiddenLayerNeuronCounts, uint32_t _candidateGateHiddenLayerCount, uint32_t *_candidateGateHiddenLayerNeuronCounts, uint32_t _cellCount, bool _sharedGateNetworks, uint8_t _cellVariant)
 {
     inputCount=_inputCount;
     outputCount=_outputCount;
-    uint32_t inputAndOutputCount=inputCount+outputCount;
+    cellCount=_cellCount==0?_outputCount:_cellCount;
+    sharedGateNetworks=_sharedGateNetworks;
+    cellVariant=_cellVariant;
+    uint32_t inputAndOutputCount=inputCount+cellCount;
+    uint32_t gateNetworkOutputCount=getGateNetworkOutputCount();
     backpropagationSteps=_backpropagationSteps;
     learningRate=_learningRate;
     momentum=_momentum;
@@ -178,20 +223,29 @@ LSTM::LSTM(uint32_t _inputCount, uint32_t _outputCount, uint32_t _backpropagatio
 
     stateArraySize=2*backpropagationSteps+1 /*One for the current state.*/;
     stateArrayPos=0xffffffff;
-    states=(LSTMState**)malloc(stateArraySize*sizeof(LSTMState*));
+    states=(LSTMState**)LSTMAllocations::allocate(stateArraySize*sizeof(LSTMState*),LSTMAllocationCategory_state);
+    templateState=0;
+    sparsity=0;
+    mappedCheckpoint=0;
+    mappedCheckpointSize=0;
+    historyPrecision=LSTMHistoryPrecision_double;
+    forgetGateNetworkActivation=LSTMGateActivation_tanh;
+    inputGateNetworkActivation=LSTMGateActivation_tanh;
+    outputGateNetworkActivation=LSTMGateActivation_tanh;
+    candidateGateNetworkActivation=LSTMGateActivation_tanh;
 
     forgetGateHiddenLayerCount=_forgetGateHiddenLayerCount;
     inputGateHiddenLayerCount=_inputGateHiddenLayerCount;
     outputGateHiddenLayerCount=_outputGateHiddenLayerCount;
     candidateGateHiddenLayerCount=_candidateGateHiddenLayerCount;
 
-    size_t outputCountBasedDoubleArraySize=outputCount*sizeof(double);
-    previousForgetGateValueSumBiasWeightDeltas=(double*)malloc(outputCountBasedDoubleArraySize);
-    previousInputGateValueSumBiasWeightDeltas=(double*)malloc(outputCountBasedDoubleArraySize);
-    previousOutputGateValueSumBiasWeightDeltas=(double*)malloc(outputCountBasedDoubleArraySize);
-    previousCandidateGateValueSumBiasWeightDeltas=(double*)malloc(outputCountBasedDoubleArraySize);
+    size_t cellCountBasedDoubleArraySize=cellCount*sizeof(double);
+    previousForgetGateValueSumBiasWeightDeltas=(double*)LSTMAllocations::allocate(cellCountBasedDoubleArraySize,LSTMAllocationCategory_gradient);
+    previousInputGateValueSumBiasWeightDeltas=(double*)LSTMAllocations::allocate(cellCountBasedDoubleArraySize,LSTMAllocationCategory_gradient);
+    previousOutputGateValueSumBiasWeightDeltas=(double*)LSTMAllocations::allocate(cellCountBasedDoubleArraySize,LSTMAllocationCategory_gradient);
+    previousCandidateGateValueSumBiasWeightDeltas=(double*)LSTMAllocations::allocate(cellCountBasedDoubleArraySize,LSTMAllocationCategory_gradient);
 
-    for(uint32_t cell=0;cell<outputCount;cell++)
+    for(uint32_t cell=0;cell<cellCount;cell++)
     {
         previousForgetGateValueSumBiasWeightDeltas[cell]=0.0;
         previousInputGateValueSumBiasWeightDeltas[cell]=0.0;
@@ -199,11 +253,25 @@ LSTM::LSTM(uint32_t _inputCount, uint32_t _outputCount, uint32_t _backpropagatio
         previousCandidateGateValueSumBiasWeightDeltas[cell]=0.0;
     }
 
+    previousOutputProjectionWeightDeltas=0;
+    previousOutputProjectionBiasWeightDeltas=0;
+    if(hasOutputProjection())
+    {
+        previousOutputProjectionWeightDeltas=(double**)LSTMAllocations::allocate(outputCount*sizeof(double*),LSTMAllocationCategory_gradient);
+        previousOutputProjectionBiasWeightDeltas=(double*)LSTMAllocations::allocate(outputCount*sizeof(double),LSTMAllocationCategory_gradient);
+        for(uint32_t projectionOutput=0;projectionOutput<outputCount;projectionOutput++)
+        {
+            previousOutputProjectionWeightDeltas[projectionOutput]=(double*)LSTMAllocations::allocate(cellCountBasedDoubleArraySize,LSTMAllocationCategory_gradient);
+            fillDoubleArray(previousOutputProjectionWeightDeltas[projectionOutput],cellCount,0.0);
+        }
+        fillDoubleArray(previousOutputProjectionBiasWeightDeltas,outputCount,0.0);
+    }
+
     // Copy hidden layer neuron counts (to avoid errors)
 
     // Forget gate
     uint32_t forgetGateHiddenLayerNeuronCountArraySize=forgetGateHiddenLayerCount*sizeof(uint32_t);
-    forgetGateHiddenLayerNeuronCounts=(uint32_t*)malloc(forgetGateHiddenLayerNeuronCountArraySize);
+    forgetGateHiddenLayerNeuronCounts=(uint32_t*)LSTMAllocations::allocate(forgetGateHiddenLayerNeuronCountArraySize,LSTMAllocationCategory_state);
     if(_forgetGateHiddenLayerNeuronCounts==0)
     {
         for(uint32_t hiddenLayer=0;hiddenLayer<forgetGateHiddenLayerCount;hiddenLayer++)
@@ -214,7 +282,7 @@ LSTM::LSTM(uint32_t _inputCount, uint32_t _outputCount, uint32_t _backpropagatio
 
     // Input gate
     uint32_t inputGateHiddenLayerNeuronCountArraySize=inputGateHiddenLayerCount*sizeof(uint32_t);
-    inputGateHiddenLayerNeuronCounts=(uint32_t*)malloc(inputGateHiddenLayerNeuronCountArraySize);
+    inputGateHiddenLayerNeuronCounts=(uint32_t*)LSTMAllocations::allocate(inputGateHiddenLayerNeuronCountArraySize,LSTMAllocationCategory_state);
     if(_inputGateHiddenLayerNeuronCounts==0)
     {
         for(uint32_t hiddenLayer=0;hiddenLayer<inputGateHiddenLayerCount;hiddenLayer++)
@@ -225,7 +293,7 @@ LSTM::LSTM(uint32_t _inputCount, uint32_t _outputCount, uint32_t _backpropagatio
 
     // Output gate
     uint32_t outputGateHiddenLayerNeuronCountArraySize=outputGateHiddenLayerCount*sizeof(uint32_t);
-    outputGateHiddenLayerNeuronCounts=(uint32_t*)malloc(outputGateHiddenLayerNeuronCountArraySize);
+    outputGateHiddenLayerNeuronCounts=(uint32_t*)LSTMAllocations::allocate(outputGateHiddenLayerNeuronCountArraySize,LSTMAllocationCategory_state);
     if(_outputGateHiddenLayerNeuronCounts==0)
     {
         for(uint32_t hiddenLayer=0;hiddenLayer<outputGateHiddenLayerCount;hiddenLayer++)
@@ -236,7 +304,7 @@ LSTM::LSTM(uint32_t _inputCount, uint32_t _outputCount, uint32_t _backpropagatio
 
     // Candidate gate
     uint32_t candidateGateHiddenLayerNeuronCountArraySize=candidateGateHiddenLayerCount*sizeof(uint32_t);
-    candidateGateHiddenLayerNeuronCounts=(uint32_t*)malloc(candidateGateHiddenLayerNeuronCountArraySize);
+    candidateGateHiddenLayerNeuronCounts=(uint32_t*)LSTMAllocations::allocate(candidateGateHiddenLayerNeuronCountArraySize,LSTMAllocationCategory_state);
     if(_candidateGateHiddenLayerNeuronCounts==0)
     {
         for(uint32_t hiddenLayer=0;hiddenLayer<candidateGateHiddenLayerCount;hiddenLayer++)
@@ -255,30 +323,30 @@ LSTM::LSTM(uint32_t _inputCount, uint32_t _outputCount, uint32_t _backpropagatio
     size_t outputGateTotalLayerCountBasedDoublePointerArraySize=outputGateTotalLayerCount*sizeof(double*);
     size_t candidateGateTotalLayerCountBasedDoublePointerArraySize=candidateGateTotalLayerCount*sizeof(double*);
 
-    previousForgetGateBiasWeightDeltas=(double**)malloc(forgetGateTotalLayerCountBasedDoublePointerArraySize);
-    previousInputGateBiasWeightDeltas=(double**)malloc(inputGateTotalLayerCountBasedDoublePointerArraySize);
-    previousOutputGateBiasWeightDeltas=(double**)malloc(outputGateTotalLayerCountBasedDoublePointerArraySize);
-    previousCandidateGateBiasWeightDeltas=(double**)malloc(candidateGateTotalLayerCountBasedDoublePointerArraySize);
-    previousForgetGateWeightDeltas=(double***)malloc(forgetGateTotalLayerCountBasedDoublePointerArraySize);
-    previousInputGateWeightDeltas=(double***)malloc(inputGateTotalLayerCountBasedDoublePointerArraySize);
-    previousOutputGateWeightDeltas=(double***)malloc(outputGateTotalLayerCountBasedDoublePointerArraySize);
-    previousCandidateGateWeightDeltas=(double***)malloc(candidateGateTotalLayerCountBasedDoublePointerArraySize);
+    previousForgetGateBiasWeightDeltas=(double**)LSTMAllocations::allocate(forgetGateTotalLayerCountBasedDoublePointerArraySize,LSTMAllocationCategory_gradient);
+    previousInputGateBiasWeightDeltas=(double**)LSTMAllocations::allocate(inputGateTotalLayerCountBasedDoublePointerArraySize,LSTMAllocationCategory_gradient);
+    previousOutputGateBiasWeightDeltas=(double**)LSTMAllocations::allocate(outputGateTotalLayerCountBasedDoublePointerArraySize,LSTMAllocationCategory_gradient);
+    previousCandidateGateBiasWeightDeltas=(double**)LSTMAllocations::allocate(candidateGateTotalLayerCountBasedDoublePointerArraySize,LSTMAllocationCategory_gradient);
+    previousForgetGateWeightDeltas=(double***)LSTMAllocations::allocate(forgetGateTotalLayerCountBasedDoublePointerArraySize,LSTMAllocationCategory_gradient);
+    previousInputGateWeightDeltas=(double***)LSTMAllocations::allocate(inputGateTotalLayerCountBasedDoublePointerArraySize,LSTMAllocationCategory_gradient);
+    previousOutputGateWeightDeltas=(double***)LSTMAllocations::allocate(outputGateTotalLayerCountBasedDoublePointerArraySize,LSTMAllocationCategory_gradient);
+    previousCandidateGateWeightDeltas=(double***)LSTMAllocations::allocate(candidateGateTotalLayerCountBasedDoublePointerArraySize,LSTMAllocationCategory_gradient);
 
     // Forget gate
     for(uint32_t currentLayer=0;currentLayer<forgetGateTotalLayerCount;currentLayer++)
     {
-        uint32_t neuronsInThisLayer=currentLayer==forgetGateTotalLayerCount-1?inputAndOutputCount:forgetGateHiddenLayerNeuronCounts[currentLayer];
+        uint32_t neuronsInThisLayer=currentLayer==forgetGateTotalLayerCount-1?gateNetworkOutputCount:forgetGateHiddenLayerNeuronCounts[currentLayer];
         uint32_t neuronsInPreviousLayer=currentLayer==0?inputAndOutputCount:forgetGateHiddenLayerNeuronCounts[currentLayer-1];
         size_t thisLayerNeuronCountBasedDoubleArraySize=neuronsInThisLayer*sizeof(double);
         size_t thisLayerNeuronCountBasedDoublePointerArraySize=neuronsInThisLayer*sizeof(double*);
         size_t previousLayerNeuronCountBasedDoubleArraySize=neuronsInPreviousLayer*sizeof(double);
-        previousForgetGateBiasWeightDeltas[currentLayer]=(double*)malloc(thisLayerNeuronCountBasedDoubleArraySize);
-        previousForgetGateWeightDeltas[currentLayer]=(double**)malloc(thisLayerNeuronCountBasedDoublePointerArraySize);
+        previousForgetGateBiasWeightDeltas[currentLayer]=(double*)LSTMAllocations::allocate(thisLayerNeuronCountBasedDoubleArraySize,LSTMAllocationCategory_gradient);
+        previousForgetGateWeightDeltas[currentLayer]=(double**)LSTMAllocations::allocate(thisLayerNeuronCountBasedDoublePointerArraySize,LSTMAllocationCategory_gradient);
 
         for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
         {
             previousForgetGateBiasWeightDeltas[currentLayer][neuronInThisLayer]=0.0;
-            previousForgetGateWeightDeltas[currentLayer][neuronInThisLayer]=(double*)malloc(previousLayerNeuronCountBasedDoubleArraySize);
+            previousForgetGateWeightDeltas[currentLayer][neuronInThisLayer]=(double*)LSTMAllocations::allocate(previousLayerNeuronCountBasedDoubleArraySize,LSTMAllocationCategory_gradient);
             for(uint32_t neuronInPreviousLayer=0;neuronInPreviousLayer<neuronsInPreviousLayer;neuronInPreviousLayer++)
                 previousForgetGateWeightDeltas[currentLayer][neuronInThisLayer][neuronInPreviousLayer]=0.0;
         }
@@ -287,18 +355,18 @@ LSTM::LSTM(uint32_t _inputCount, uint32_t _outputCount, uint32_t _backpropagatio
     // Input gate
     for(uint32_t currentLayer=0;currentLayer<inputGateTotalLayerCount;currentLayer++)
     {
-        uint32_t neuronsInThisLayer=currentLayer==inputGateTotalLayerCount-1?inputAndOutputCount:inputGateHiddenLayerNeuronCounts[currentLayer];
+        uint32_t neuronsInThisLayer=currentLayer==inputGateTotalLayerCount-1?gateNetworkOutputCount:inputGateHiddenLayerNeuronCounts[currentLayer];
         uint32_t neuronsInPreviousLayer=currentLayer==0?inputAndOutputCount:inputGateHiddenLayerNeuronCounts[currentLayer-1];
         size_t thisLayerNeuronCountBasedDoubleArraySize=neuronsInThisLayer*sizeof(double);
         size_t thisLayerNeuronCountBasedDoublePointerArraySize=neuronsInThisLayer*sizeof(double*);
         size_t previousLayerNeuronCountBasedDoubleArraySize=neuronsInPreviousLayer*sizeof(double);
-        previousInputGateBiasWeightDeltas[currentLayer]=(double*)malloc(thisLayerNeuronCountBasedDoubleArraySize);
-        previousInputGateWeightDeltas[currentLayer]=(double**)malloc(thisLayerNeuronCountBasedDoublePointerArraySize);
+        previousInputGateBiasWeightDeltas[currentLayer]=(double*)LSTMAllocations::allocate(thisLayerNeuronCountBasedDoubleArraySize,LSTMAllocationCategory_gradient);
+        previousInputGateWeightDeltas[currentLayer]=(double**)LSTMAllocations::allocate(thisLayerNeuronCountBasedDoublePointerArraySize,LSTMAllocationCategory_gradient);
 
         for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
         {
             previousInputGateBiasWeightDeltas[currentLayer][neuronInThisLayer]=0.0;
-            previousInputGateWeightDeltas[currentLayer][neuronInThisLayer]=(double*)malloc(previousLayerNeuronCountBasedDoubleArraySize);
+            previousInputGateWeightDeltas[currentLayer][neuronInThisLayer]=(double*)LSTMAllocations::allocate(previousLayerNeuronCountBasedDoubleArraySize,LSTMAllocationCategory_gradient);
             for(uint32_t neuronInPreviousLayer=0;neuronInPreviousLayer<neuronsInPreviousLayer;neuronInPreviousLayer++)
                 previousInputGateWeightDeltas[currentLayer][neuronInThisLayer][neuronInPreviousLayer]=0.0;
         }
@@ -307,18 +375,18 @@ LSTM::LSTM(uint32_t _inputCount, uint32_t _outputCount, uint32_t _backpropagatio
     // Output gate
     for(uint32_t currentLayer=0;currentLayer<outputGateTotalLayerCount;currentLayer++)
     {
-        uint32_t neuronsInThisLayer=currentLayer==outputGateTotalLayerCount-1?inputAndOutputCount:outputGateHiddenLayerNeuronCounts[currentLayer];
+        uint32_t neuronsInThisLayer=currentLayer==outputGateTotalLayerCount-1?gateNetworkOutputCount:outputGateHiddenLayerNeuronCounts[currentLayer];
         uint32_t neuronsInPreviousLayer=currentLayer==0?inputAndOutputCount:outputGateHiddenLayerNeuronCounts[currentLayer-1];
         size_t thisLayerNeuronCountBasedDoubleArraySize=neuronsInThisLayer*sizeof(double);
         size_t thisLayerNeuronCountBasedDoublePointerArraySize=neuronsInThisLayer*sizeof(double*);
         size_t previousLayerNeuronCountBasedDoubleArraySize=neuronsInPreviousLayer*sizeof(double);
-        previousOutputGateBiasWeightDeltas[currentLayer]=(double*)malloc(thisLayerNeuronCountBasedDoubleArraySize);
-        previousOutputGateWeightDeltas[currentLayer]=(double**)malloc(thisLayerNeuronCountBasedDoublePointerArraySize);
+        previousOutputGateBiasWeightDeltas[currentLayer]=(double*)LSTMAllocations::allocate(thisLayerNeuronCountBasedDoubleArraySize,LSTMAllocationCategory_gradient);
+        previousOutputGateWeightDeltas[currentLayer]=(double**)LSTMAllocations::allocate(thisLayerNeuronCountBasedDoublePointerArraySize,LSTMAllocationCategory_gradient);
 
         for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
         {
             previousOutputGateBiasWeightDeltas[currentLayer][neuronInThisLayer]=0.0;
-            previousOutputGateWeightDeltas[currentLayer][neuronInThisLayer]=(double*)malloc(previousLayerNeuronCountBasedDoubleArraySize);
+            previousOutputGateWeightDeltas[currentLayer][neuronInThisLayer]=(double*)LSTMAllocations::allocate(previousLayerNeuronCountBasedDoubleArraySize,LSTMAllocationCategory_gradient);
             for(uint32_t neuronInPreviousLayer=0;neuronInPreviousLayer<neuronsInPreviousLayer;neuronInPreviousLayer++)
                 previousOutputGateWeightDeltas[currentLayer][neuronInThisLayer][neuronInPreviousLayer]=0.0;
         }
@@ -327,18 +395,18 @@ LSTM::LSTM(uint32_t _inputCount, uint32_t _outputCount, uint32_t _backpropagatio
     // Candidate gate
     for(uint32_t currentLayer=0;currentLayer<candidateGateTotalLayerCount;currentLayer++)
     {
-        uint32_t neuronsInThisLayer=currentLayer==candidateGateTotalLayerCount-1?inputAndOutputCount:candidateGateHiddenLayerNeuronCounts[currentLayer];
+        uint32_t neuronsInThisLayer=currentLayer==candidateGateTotalLayerCount-1?gateNetworkOutputCount:candidateGateHiddenLayerNeuronCounts[currentLayer];
         uint32_t neuronsInPreviousLayer=currentLayer==0?inputAndOutputCount:candidateGateHiddenLayerNeuronCounts[currentLayer-1];
         size_t thisLayerNeuronCountBasedDoubleArraySize=neuronsInThisLayer*sizeof(double);
         size_t thisLayerNeuronCountBasedDoublePointerArraySize=neuronsInThisLayer*sizeof(double*);
         size_t previousLayerNeuronCountBasedDoubleArraySize=neuronsInPreviousLayer*sizeof(double);
-        previousCandidateGateBiasWeightDeltas[currentLayer]=(double*)malloc(thisLayerNeuronCountBasedDoubleArraySize);
-        previousCandidateGateWeightDeltas[currentLayer]=(double**)malloc(thisLayerNeuronCountBasedDoublePointerArraySize);
+        previousCandidateGateBiasWeightDeltas[currentLayer]=(double*)LSTMAllocations::allocate(thisLayerNeuronCountBasedDoubleArraySize,LSTMAllocationCategory_gradient);
+        previousCandidateGateWeightDeltas[currentLayer]=(double**)LSTMAllocations::allocate(thisLayerNeuronCountBasedDoublePointerArraySize,LSTMAllocationCategory_gradient);
 
         for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
         {
             previousCandidateGateBiasWeightDeltas[currentLayer][neuronInThisLayer]=0.0;
-            previousCandidateGateWeightDeltas[currentLayer][neuronInThisLayer]=(double*)malloc(previousLayerNeuronCountBasedDoubleArraySize);
+            previousCandidateGateWeightDeltas[currentLayer][neuronInThisLayer]=(double*)LSTMAllocations::allocate(previousLayerNeuronCountBasedDoubleArraySize,LSTMAllocationCategory_gradient);
             for(uint32_t neuronInPreviousLayer=0;neuronInPreviousLayer<neuronsInPreviousLayer;neuronInPreviousLayer++)
                 previousCandidateGateWeightDeltas[currentLayer][neuronInThisLayer][neuronInPreviousLayer]=0.0;
         }
@@ -347,127 +415,118 @@ LSTM::LSTM(uint32_t _inputCount, uint32_t _outputCount, uint32_t _backpropagatio
 
 LSTM::~LSTM()
 {
-    for(uint32_t layer=stateArrayPos-backpropagationSteps;layer<=stateArrayPos;layer++)
-        delete states[layer];
-    free(states);
-
-    uint32_t inputAndOutputCount=inputCount+outputCount;
+    if(stateArrayPos!=0xffffffff) // Only delete the states that have not been deleted by pushState() yet
+    {
+        for(uint32_t layer=stateArrayPos>backpropagationSteps?stateArrayPos-backpropagationSteps:0;layer<=stateArrayPos;layer++)
+            delete states[layer];
+    }
+    LSTMAllocations::release(states);
+    if(templateState!=0)
+        delete templateState;
+    if(mappedCheckpoint!=0) // After the template state, which may point into it
+        io::unmapFile(mappedCheckpoint,mappedCheckpointSize);
+    if(sparsity!=0)
+        delete sparsity;
+
+    uint32_t gateNetworkOutputCount=getGateNetworkOutputCount();
     // Forget gate
     for(uint32_t currentLayer=0;currentLayer<forgetGateTotalLayerCount;currentLayer++)
     {
-        uint32_t neuronsInThisLayer=currentLayer==forgetGateTotalLayerCount-1?inputAndOutputCount:forgetGateHiddenLayerNeuronCounts[currentLayer];
+        uint32_t neuronsInThisLayer=currentLayer==forgetGateTotalLayerCount-1?gateNetworkOutputCount:forgetGateHiddenLayerNeuronCounts[currentLayer];
         for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
-            free(previousForgetGateWeightDeltas[currentLayer][neuronInThisLayer]);
-        free(previousForgetGateWeightDeltas[currentLayer]);
+            LSTMAllocations::release(previousForgetGateWeightDeltas[currentLayer][neuronInThisLayer]);
+        LSTMAllocations::release(previousForgetGateWeightDeltas[currentLayer]);
+        LSTMAllocations::release(previousForgetGateBiasWeightDeltas[currentLayer]);
     }
 
     // Input gate
     for(uint32_t currentLayer=0;currentLayer<inputGateTotalLayerCount;currentLayer++)
     {
-        uint32_t neuronsInThisLayer=currentLayer==inputGateTotalLayerCount-1?inputAndOutputCount:inputGateHiddenLayerNeuronCounts[currentLayer];
+        uint32_t neuronsInThisLayer=currentLayer==inputGateTotalLayerCount-1?gateNetworkOutputCount:inputGateHiddenLayerNeuronCounts[currentLayer];
         for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
-            free(previousInputGateWeightDeltas[currentLayer][neuronInThisLayer]);
-        free(previousInputGateWeightDeltas[currentLayer]);
+            LSTMAllocations::release(previousInputGateWeightDeltas[currentLayer][neuronInThisLayer]);
+        LSTMAllocations::release(previousInputGateWeightDeltas[currentLayer]);
+        LSTMAllocations::release(previousInputGateBiasWeightDeltas[currentLayer]);
     }
 
     // Output gate
     for(uint32_t currentLayer=0;currentLayer<outputGateTotalLayerCount;currentLayer++)
     {
-        uint32_t neuronsInThisLayer=currentLayer==outputGateTotalLayerCount-1?inputAndOutputCount:outputGateHiddenLayerNeuronCounts[currentLayer];
+        uint32_t neuronsInThisLayer=currentLayer==outputGateTotalLayerCount-1?gateNetworkOutputCount:outputGateHiddenLayerNeuronCounts[currentLayer];
         for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
-            free(previousOutputGateWeightDeltas[currentLayer][neuronInThisLayer]);
-        free(previousOutputGateWeightDeltas[currentLayer]);
+            LSTMAllocations::release(previousOutputGateWeightDeltas[currentLayer][neuronInThisLayer]);
+        LSTMAllocations::release(previousOutputGateWeightDeltas[currentLayer]);
+        LSTMAllocations::release(previousOutputGateBiasWeightDeltas[currentLayer]);
     }
 
     // Candidate gate
     for(uint32_t currentLayer=0;currentLayer<candidateGateTotalLayerCount;currentLayer++)
     {
-        uint32_t neuronsInThisLayer=currentLayer==candidateGateTotalLayerCount-1?inputAndOutputCount:candidateGateHiddenLayerNeuronCounts[currentLayer];
+        uint32_t neuronsInThisLayer=currentLayer==candidateGateTotalLayerCount-1?gateNetworkOutputCount:candidateGateHiddenLayerNeuronCounts[currentLayer];
         for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
-            free(previousCandidateGateWeightDeltas[currentLayer][neuronInThisLayer]);
-        free(previousCandidateGateWeightDeltas[currentLayer]);
-        free(previousCandidateGateBiasWeightDeltas[currentLayer]);
+            LSTMAllocations::release(previousCandidateGateWeightDeltas[currentLayer][neuronInThisLayer]);
+        LSTMAllocations::release(previousCandidateGateWeightDeltas[currentLayer]);
+        LSTMAllocations::release(previousCandidateGateBiasWeightDeltas[currentLayer]);
     }
 
-    free(previousInputGateBiasWeightDeltas);
-    free(previousForgetGateBiasWeightDeltas);
-    free(previousOutputGateBiasWeightDeltas);
-    free(previousCandidateGateBiasWeightDeltas);
-    free(previousInputGateWeightDeltas);
-    free(previousForgetGateWeightDeltas);
-    free(previousOutputGateWeightDeltas);
-    free(previousCandidateGateWeightDeltas);
-
-    free(previousInputGateValueSumBiasWeightDeltas);
-    free(previousForgetGateValueSumBiasWeightDeltas);
-    free(previousOutputGateValueSumBiasWeightDeltas);
-    free(previousCandidateGateValueSumBiasWeightDeltas);
-
-    free(forgetGateHiddenLayerNeuronCounts);
-    free(inputGateHiddenLayerNeuronCounts);
-    free(outputGateHiddenLayerNeuronCounts);
-    free(candidateGateHiddenLayerNeuronCounts);
+    LSTMAllocations::release(previousInputGateBiasWeightDeltas);
+    LSTMAllocations::release(previousForgetGateBiasWeightDeltas);
+    LSTMAllocations::release(previousOutputGateBiasWeightDeltas);
+    LSTMAllocations::release(previousCandidateGateBiasWeightDeltas);
+    LSTMAllocations::release(previousInputGateWeightDeltas);
+    LSTMAllocations::release(previousForgetGateWeightDeltas);
+    LSTMAllocations::release(previousOutputGateWeightDeltas);
+    LSTMAllocations::release(previousCandidateGateWeightDeltas);
+
+    LSTMAllocations::release(previousInputGateValueSumBiasWeightDeltas);
+    LSTMAllocations::release(previousForgetGateValueSumBiasWeightDeltas);
+    LSTMAllocations::release(previousOutputGateValueSumBiasWeightDeltas);
+    LSTMAllocations::release(previousCandidateGateValueSumBiasWeightDeltas);
+
+    if(hasOutputProjection())
+    {
+        for(uint32_t projectionOutput=0;projectionOutput<outputCount;projectionOutput++)
+            LSTMAllocations::release(previousOutputProjectionWeightDeltas[projectionOutput]);
+        LSTMAllocations::release(previousOutputProjectionWeightDeltas);
+        LSTMAllocations::release(previousOutputProjectionBiasWeightDeltas);
+    }
+
+    LSTMAllocations::release(forgetGateHiddenLayerNeuronCounts);
+    LSTMAllocations::release(inputGateHiddenLayerNeuronCounts);
+    LSTMAllocations::release(outputGateHiddenLayerNeuronCounts);
+    LSTMAllocations::release(candidateGateHiddenLayerNeuronCounts);
 }
 
 double *LSTM::process(double *input)
 {
+    LSTM_TIME_PHASE(processTimer,&phaseStats,LSTMPhase_process);
     LSTMState *l=pushState();
     memcpy(l->input,input,inputCount*sizeof(double)); // Store for backpropagation
     bool hasPreviousState=hasState(1);
     LSTMState *previousState=hasPreviousState?getState(1):0;
-    double *output=(double*)malloc(outputCount*sizeof(double));
-    for(uint32_t cell=0;cell<outputCount;cell++)
+    double *output=(double*)LSTMAllocations::allocateOutput(outputCount*sizeof(double));
+    // Calculate gate pre-values (of all cells at once, as they only depend on the inputs and the previous outputs)
+    uint8_t gateNetworkActivations[4]={forgetGateNetworkActivation,inputGateNetworkActivation,outputGateNetworkActivation,candidateGateNetworkActivation};
     {
-        // Calculate gate pre-values
-        l->calculateGatePreValues(hasPreviousState?previousState->output:0);
-
-        // Calculate forget gate value
-
-        double forgetGateValueSum=0.0;
-        for(uint32_t i=0;i<inputCount;i++)
-            forgetGateValueSum+=l->forgetGatePreValues[cell][i]; // Single-layer version: forgetGateValueSum+=l->forgetGateWeights[cell][i]*input[i];
-        if(hasPreviousState) // Else each product simply yields 0, eliminating the need to add it to the sum.
-        {
-            for(uint32_t i=0;i<outputCount;i++)
-                forgetGateValueSum+=l->forgetGatePreValues[cell][inputCount+i]; // Single-layer version: forgetGateValueSum+=l->forgetGateWeights[cell][inputCount+i]*previousState->output[i]
-        }
-        l->forgetGateValues[cell]=sig(forgetGateValueSum+l->forgetGateValueSumBiasWeights[cell]);
-
-        // Calculate input gate value
-
-        double inputGateValueSum=0.0;
-        for(uint32_t i=0;i<inputCount;i++)
-            inputGateValueSum+=l->inputGatePreValues[cell][i]; // Single-layer version: inputGateValueSum+=l->inputGateWeights[cell][i]*input[i]
-        if(hasPreviousState) // Else each product simply yields 0, eliminating the need to add it to the sum.
-        {
-            for(uint32_t i=0;i<outputCount;i++)
-                inputGateValueSum+=l->inputGatePreValues[cell][inputCount+i]; // Single-layer version: inputGateValueSum+=l->inputGateWeights[cell][inputCount+i]*previousState->output[i]
-        }
-        l->inputGateValues[cell]=sig(inputGateValueSum+l->inputGateValueSumBiasWeights[cell]);
-
-        // Calculate output gate value
-
-        double outputGateValueSum=0.0;
-        for(uint32_t i=0;i<inputCount;i++)
-            outputGateValueSum+=l->outputGatePreValues[cell][i]; // Single-layer version: l->outputGateWeights[cell][i]*input[i]
-        if(hasPreviousState) // Else each product simply yields 0, eliminating the need to add it to the sum.
-        {
-            for(uint32_t i=0;i<outputCount;i++)
-                outputGateValueSum+=l->outputGatePreValues[cell][inputCount+i]; // Single-layer version: outputGateValueSum+=l->outputGateWeights[cell][inputCount+i]*previousState->output[i]
-        }
-        l->outputGateValues[cell]=sig(outputGateValueSum+l->outputGateValueSumBiasWeights[cell]);
+        LSTM_TIME_PHASE(gatePreValuesTimer,&phaseStats,LSTMPhase_gatePreValues);
+        l->calculateGatePreValues(hasPreviousState?previousState->output:0,gateNetworkActivations);
+    }
+    LSTM_TIME_PHASE(gateCombinationTimer,&phaseStats,LSTMPhase_gateCombination);
+    for(uint32_t cell=0;cell<cellCount;cell++)
+    {
+        uint32_t network=sharedGateNetworks?0:cell;
 
-        // Calculate candidate assessment gate value
+        // Calculate the gate values (single-layer version of the gate value sums, e.g. of the forget gate:
+        // sum of l->forgetGateWeights[cell][i]*input[i] and l->forgetGateWeights[cell][inputCount+i]*previousState->output[i])
 
-        double candidateGateValueSum=0.0;
-        for(uint32_t i=0;i<inputCount;i++)
-            candidateGateValueSum+=l->candidateGatePreValues[cell][i]; // Single-layer version: l->candidateGateWeights[cell][i]*input[i]
-        if(hasPreviousState) // Else each product simply yields 0, eliminating the need to add it to the sum.
-        {
-            for(uint32_t i=0;i<outputCount;i++)
-                candidateGateValueSum+=l->candidateGatePreValues[cell][inputCount+i]; // Single-layer version: l->candidateGateWeights[cell][inputCount+i]*previousState->output[i]
-        }
-        l->candidateGateValues[cell]=tanh(candidateGateValueSum+l->candidateGateValueSumBiasWeights[cell]);
+        l->inputGateValues[cell]=sig(l->getGateValueSum(l->inputGatePreValues[network],cell,hasPreviousState)+l->inputGateValueSumBiasWeights[cell]);
+        if(cellVariant==LSTMCellVariant_standard)
+            l->forgetGateValues[cell]=sig(l->getGateValueSum(l->forgetGatePreValues[network],cell,hasPreviousState)+l->forgetGateValueSumBiasWeights[cell]);
+        else
+            l->forgetGateValues[cell]=1.0-l->inputGateValues[cell]; // Coupled input and forget gates (GRU: the update gate)
+        if(cellVariant!=LSTMCellVariant_gru) // The reset gate values have already been calculated by calculateGatePreValues()
+            l->outputGateValues[cell]=sig(l->getGateValueSum(l->outputGatePreValues[network],cell,hasPreviousState)+l->outputGateValueSumBiasWeights[cell]);
+        l->candidateGateValues[cell]=tanh(l->getGateValueSum(l->candidateGatePreValues[network],cell,hasPreviousState)+l->candidateGateValueSumBiasWeights[cell]);
 
         // Calculate new cell state
 
@@ -477,49 +536,88 @@ double *LSTM::process(double *input)
 
         // colah's version has a tanh function around the cell state: output[cell]=l->outputGateValues[cell]*tanh(l->cellStates[cell]);
         // Maybe add the tanh?
-        output[cell]=l->outputGateValues[cell]*l->cellStates[cell];
-        l->output[cell]=output[cell]; // Store for backpropagation
+        if(cellVariant==LSTMCellVariant_gru)
+            l->output[cell]=l->cellStates[cell]; // The reset gate does not gate the output
+        else
+            l->output[cell]=l->outputGateValues[cell]*l->cellStates[cell]; // Store for backpropagation
+    }
+    if(hasOutputProjection())
+        l->projectOutputs(l->output,output);
+    else
+        memcpy(output,l->output,cellCount*sizeof(double));
+    LSTM_STOP_PHASE(gateCombinationTimer);
+    // The previous state is not needed for forward steps anymore, only by learn():
+    if(hasPreviousState)
+    {
+        LSTM_TIME_PHASE(historyCompressionTimer,&phaseStats,LSTMPhase_historyCompression);
+        previousState->compressActivations(historyPrecision);
     }
     return output;
 }
 
 void LSTM::learn(double **desiredOutputs)
 {
+    LSTM_TIME_PHASE(learnTimer,&phaseStats,LSTMPhase_learn);
     uint32_t availableStepsBack=getAvailableStepsBack();
+    uint32_t gateNetworkCount=getGateNetworkCount();
+    uint32_t gateNetworkOutputCount=getGateNetworkOutputCount();
     // Note that we sum this over all steps, so we do not need the extra time dimension (double**).
 
     // Differentials of topmost output layer's weights:
 
-    // Dimensions: cells -> layers -> neurons in topmost output layer -> weights of neurons in layer before topmost output layer to neurons in topmost output layer
+    // Dimensions: cells (gate networks) -> layers -> neurons in topmost output layer -> weights of neurons in layer before topmost output layer to neurons in topmost output layer
 
-    double ****wi_diff=(double****)malloc(outputCount*sizeof(double***));
-    double ****wf_diff=(double****)malloc(outputCount*sizeof(double***));
-    double ****wo_diff=(double****)malloc(outputCount*sizeof(double***));
-    double ****wg_diff=(double****)malloc(outputCount*sizeof(double***));
+    double ****wi_diff=(double****)LSTMAllocations::allocate(gateNetworkCount*sizeof(double***),LSTMAllocationCategory_gradient);
+    double ****wf_diff=(double****)LSTMAllocations::allocate(gateNetworkCount*sizeof(double***),LSTMAllocationCategory_gradient);
+    double ****wo_diff=(double****)LSTMAllocations::allocate(gateNetworkCount*sizeof(double***),LSTMAllocationCategory_gradient);
+    double ****wg_diff=(double****)LSTMAllocations::allocate(gateNetworkCount*sizeof(double***),LSTMAllocationCategory_gradient);
 
     // Dimensions: cells -> layers -> neurons in layer
 
-    double ***ibi_diff=(double***)malloc(outputCount*sizeof(double**));
-    double ***ibf_diff=(double***)malloc(outputCount*sizeof(double**));
-    double ***ibo_diff=(double***)malloc(outputCount*sizeof(double**));
-    double ***ibg_diff=(double***)malloc(outputCount*sizeof(double**));
+    double ***ibi_diff=(double***)LSTMAllocations::allocate(gateNetworkCount*sizeof(double**),LSTMAllocationCategory_gradient);
+    double ***ibf_diff=(double***)LSTMAllocations::allocate(gateNetworkCount*sizeof(double**),LSTMAllocationCategory_gradient);
+    double ***ibo_diff=(double***)LSTMAllocations::allocate(gateNetworkCount*sizeof(double**),LSTMAllocationCategory_gradient);
+    double ***ibg_diff=(double***)LSTMAllocations::allocate(gateNetworkCount*sizeof(double**),LSTMAllocationCategory_gradient);
 
 
     // Error terms
 
     // Dimensions: cells -> layers -> neurons
 
-    double ***i_errorTerms=(double***)malloc(outputCount*sizeof(double**));
-    double ***f_errorTerms=(double***)malloc(outputCount*sizeof(double**));
-    double ***o_errorTerms=(double***)malloc(outputCount*sizeof(double**));
-    double ***g_errorTerms=(double***)malloc(outputCount*sizeof(double**));
+    double ***i_errorTerms=(double***)LSTMAllocations::allocate(gateNetworkCount*sizeof(double**),LSTMAllocationCategory_gradient);
+    double ***f_errorTerms=(double***)LSTMAllocations::allocate(gateNetworkCount*sizeof(double**),LSTMAllocationCategory_gradient);
+    double ***o_errorTerms=(double***)LSTMAllocations::allocate(gateNetworkCount*sizeof(double**),LSTMAllocationCategory_gradient);
+    double ***g_errorTerms=(double***)LSTMAllocations::allocate(gateNetworkCount*sizeof(double**),LSTMAllocationCategory_gradient);
 
-    double *bi_diff=(double*)malloc(outputCount*sizeof(double));
-    double *bf_diff=(double*)malloc(outputCount*sizeof(double));
-    double *bo_diff=(double*)malloc(outputCount*sizeof(double));
-    double *bg_diff=(double*)malloc(outputCount*sizeof(double));
+    double *bi_diff=(double*)LSTMAllocations::allocate(cellCount*sizeof(double),LSTMAllocationCategory_gradient);
+    double *bf_diff=(double*)LSTMAllocations::allocate(cellCount*sizeof(double),LSTMAllocationCategory_gradient);
+    double *bo_diff=(double*)LSTMAllocations::allocate(cellCount*sizeof(double),LSTMAllocationCategory_gradient);
+    double *bg_diff=(double*)LSTMAllocations::allocate(cellCount*sizeof(double),LSTMAllocationCategory_gradient);
     bool weightsAllocated=false;
-    uint32_t inputAndOutputCount=inputCount+outputCount;
+    uint32_t inputAndOutputCount=inputCount+cellCount;
+
+    // Differentials of the output projection's weights (dimensions: outputs -> cells) and bias weights (dimensions: outputs)
+    bool outputProjection=hasOutputProjection();
+    double **wy_diff=0;
+    double *by_diff=0;
+    if(outputProjection)
+    {
+        wy_diff=(double**)LSTMAllocations::allocate(outputCount*sizeof(double*),LSTMAllocationCategory_gradient);
+        by_diff=(double*)LSTMAllocations::allocate(outputCount*sizeof(double),LSTMAllocationCategory_gradient);
+        for(uint32_t projectionOutput=0;projectionOutput<outputCount;projectionOutput++)
+        {
+            wy_diff[projectionOutput]=(double*)LSTMAllocations::allocate(cellCount*sizeof(double),LSTMAllocationCategory_gradient);
+            fillDoubleArray(wy_diff[projectionOutput],cellCount,0.0);
+        }
+        fillDoubleArray(by_diff,outputCount,0.0);
+    }
+    double *projectedOutput=outputProjection?(double*)LSTMAllocations::allocate(outputCount*sizeof(double),LSTMAllocationCategory_scratch):0;
+    // GRU: the previous outputs multiplied by the reset gate values, which are the previous output inputs of the candidate networks
+    double *resetPreviousOutputs=cellVariant==LSTMCellVariant_gru?(double*)LSTMAllocations::allocate(cellCount*sizeof(double),LSTMAllocationCategory_scratch):0;
+    // Pruned networks: the error term sums of a layer are scattered along the kept weights of the layer above (the pattern has rows, not
+    // columns), and the inputs/previous outputs are gathered by column from one array.
+    double *errorTermSums=sparsity!=0?(double*)LSTMAllocations::allocate(getCurrentState()->getWidestGateLayerNeuronCount()*sizeof(double),LSTMAllocationCategory_scratch):0;
+    double *bottommostLayerInputs=sparsity!=0?(double*)LSTMAllocations::allocate(inputAndOutputCount*sizeof(double),LSTMAllocationCategory_scratch):0;
 
     LSTMState *latestState=getCurrentState();
 
@@ -527,21 +625,27 @@ void LSTM::learn(double **desiredOutputs)
 
     for(uint32_t stepsBack=0;stepsBack<=availableStepsBack;stepsBack++)
     {
+        LSTM_TIME_PHASE(backwardStepTimer,&phaseStats,LSTMPhase_backwardStep);
         // 0 = current state
         LSTMState *thisState=getState(stepsBack);
         bool hasDeeperState=stepsBack<availableStepsBack;
         bool hasHigherState=stepsBack>0;
         LSTMState *deeperState=hasDeeperState?getState(stepsBack+1):0;
         LSTMState *higherState=hasHigherState?getState(stepsBack-1):0;
-        double *_ds=(double*)malloc(outputCount*sizeof(double)); // Derivative of the loss function w.r.t. the cell states
-        double *_do=(double*)malloc(outputCount*sizeof(double)); // Derivative of the loss function w.r.t. the output gate values
-        double *_di=(double*)malloc(outputCount*sizeof(double)); // Derivative of the loss function w.r.t. the input gate values
-        double *_dg=(double*)malloc(outputCount*sizeof(double)); // Derivative of the loss function w.r.t. the candidate gate values
-        double *_df=(double*)malloc(outputCount*sizeof(double)); // Derivative of the loss function w.r.t. the forget gate values
-        double *_di_input=(double*)malloc(outputCount*sizeof(double)); // Derivative of the loss function w.r.t. the values inside the activation function calls of the input gates (e.g. tanh(x) <- x)
-        double *_df_input=(double*)malloc(outputCount*sizeof(double)); // Derivative of the loss function w.r.t. the values inside the activation function calls of the forget gates (e.g. tanh(x) <- x)
-        double *_do_input=(double*)malloc(outputCount*sizeof(double)); // Derivative of the loss function w.r.t. the values inside the activation function calls of the output gates (e.g. tanh(x) <- x)
-        double *_dg_input=(double*)malloc(outputCount*sizeof(double)); // Derivative of the loss function w.r.t. the values inside the activation function calls of the candidate gates (e.g. tanh(x) <- x)
+        // Compressed states are widened on the fly: only this state and the deeper state are needed as doubles at the same time.
+        thisState->widenActivations();
+        if(hasDeeperState)
+            deeperState->widenActivations();
+        double *_dh=(double*)LSTMAllocations::allocate(cellCount*sizeof(double),LSTMAllocationCategory_gradient); // Derivative of the loss of this step w.r.t. the cell outputs
+        double *_ds=(double*)LSTMAllocations::allocate(cellCount*sizeof(double),LSTMAllocationCategory_gradient); // Derivative of the loss function w.r.t. the cell states
+        double *_do=(double*)LSTMAllocations::allocate(cellCount*sizeof(double),LSTMAllocationCategory_gradient); // Derivative of the loss function w.r.t. the output gate values
+        double *_di=(double*)LSTMAllocations::allocate(cellCount*sizeof(double),LSTMAllocationCategory_gradient); // Derivative of the loss function w.r.t. the input gate values
+        double *_dg=(double*)LSTMAllocations::allocate(cellCount*sizeof(double),LSTMAllocationCategory_gradient); // Derivative of the loss function w.r.t. the candidate gate values
+        double *_df=(double*)LSTMAllocations::allocate(cellCount*sizeof(double),LSTMAllocationCategory_gradient); // Derivative of the loss function w.r.t. the forget gate values
+        double *_di_input=(double*)LSTMAllocations::allocate(cellCount*sizeof(double),LSTMAllocationCategory_gradient); // Derivative of the loss function w.r.t. the values inside the activation function calls of the input gates (e.g. tanh(x) <- x)
+        double *_df_input=(double*)LSTMAllocations::allocate(cellCount*sizeof(double),LSTMAllocationCategory_gradient); // Derivative of the loss function w.r.t. the values inside the activation function calls of the forget gates (e.g. tanh(x) <- x)
+        double *_do_input=(double*)LSTMAllocations::allocate(cellCount*sizeof(double),LSTMAllocationCategory_gradient); // Derivative of the loss function w.r.t. the values inside the activation function calls of the output gates (e.g. tanh(x) <- x)
+        double *_dg_input=(double*)LSTMAllocations::allocate(cellCount*sizeof(double),LSTMAllocationCategory_gradient); // Derivative of the loss function w.r.t. the values inside the activation function calls of the candidate gates (e.g. tanh(x) <- x)
         // top_diff_is: diff_h = s->bottom_diff_h
         // top_diff_is: diff_s = higherState->bottom_diff_s (topmost: 0)
 
@@ -563,22 +667,65 @@ void LSTM::learn(double **desiredOutputs)
         // What we need to do is to calculate the derivative of the loss function w.r.t. the biases of the gates,
         // and the weights and biases of the four feedforward neural networks
 
-        double *dxc=(double*)malloc((inputAndOutputCount)*sizeof(double)); // Derivative of loss function with respect to each single input/previous output value
-        bool dxcWeightsSet=false;
+        double *desiredOutput=desiredOutputs[availableStepsBack-stepsBack];
+        if(outputProjection)
+        {
+            // Only the projected outputs have a loss; each cell output receives the derivatives of all outputs through its projection weights.
+            thisState->projectOutputs(thisState->output,projectedOutput);
+            fillDoubleArray(_dh,cellCount,0.0);
+            for(uint32_t projectionOutput=0;projectionOutput<outputCount;projectionOutput++)
+            {
+                double _dy=2.0*(projectedOutput[projectionOutput]-desiredOutput[projectionOutput]);
+                double *projectionWeights=thisState->outputProjectionWeights[projectionOutput];
+                by_diff[projectionOutput]+=_dy;
+                for(uint32_t cell=0;cell<cellCount;cell++)
+                {
+                    wy_diff[projectionOutput][cell]+=_dy*thisState->output[cell];
+                    _dh[cell]+=_dy*projectionWeights[cell];
+                }
+            }
+        }
+        else
+        {
+            for(uint32_t cell=0;cell<cellCount;cell++)
+                _dh[cell]=2.0*(thisState->output[cell]-desiredOutput[cell]);
+        }
+
+        double *dxc=(double*)LSTMAllocations::allocate((inputAndOutputCount)*sizeof(double),LSTMAllocationCategory_gradient); // Derivative of loss function with respect to each single input/previous output value
 
-        for(uint32_t cell=0;cell<outputCount;cell++)
+        for(uint32_t cell=0;cell<cellCount;cell++)
         {
             // For each cell:
             double diff_s=hasHigherState?higherState->bottomDerivativesOfLossesFromThisStateUpwardsWithRespectToLastCellStates[cell]:0.0;
-            double diff_h=2.0*(thisState->output[cell]-desiredOutputs[availableStepsBack-stepsBack][cell]);
+            double diff_h=_dh[cell];
             if(hasHigherState)
                 diff_h+=higherState->bottomDerivativesOfLossesFromThisStateUpwardsWithRespectToLastOutputs[cell];
 
-            _ds[cell]=thisState->outputGateValues[cell]*diff_h+diff_s;
-            _do[cell]=thisState->cellStates[cell]*diff_h;
-            _di[cell]=thisState->candidateGateValues[cell]*_ds[cell];
+            double previousCellState=hasDeeperState?deeperState->cellStates[cell]:0.0;
+            if(cellVariant==LSTMCellVariant_gru)
+            {
+                // The output is the cell state. The derivative w.r.t. the reset gate values is only known once the candidate networks have
+                // been backpropagated (see below).
+                _ds[cell]=diff_h+diff_s;
+                _do[cell]=0.0;
+            }
+            else
+            {
+                _ds[cell]=thisState->outputGateValues[cell]*diff_h+diff_s;
+                _do[cell]=thisState->cellStates[cell]*diff_h;
+            }
+            if(cellVariant==LSTMCellVariant_standard)
+            {
+                _di[cell]=thisState->candidateGateValues[cell]*_ds[cell];
+                _df[cell]=previousCellState*_ds[cell];
+            }
+            else
+            {
+                // The forget gate value is 1-input gate value
+                _di[cell]=(thisState->candidateGateValues[cell]-previousCellState)*_ds[cell];
+                _df[cell]=0.0;
+            }
             _dg[cell]=thisState->inputGateValues[cell]*_ds[cell];
-            _df[cell]=(hasDeeperState?deeperState->cellStates[cell]:0.0)*_ds[cell];
             _di_input[cell]=(1.0-thisState->inputGateValues[cell])*thisState->inputGateValues[cell]*_di[cell];
             _df_input[cell]=(1.0-thisState->forgetGateValues[cell])*thisState->forgetGateValues[cell]*_df[cell];
             _do_input[cell]=(1.0-thisState->outputGateValues[cell])*thisState->outputGateValues[cell]*_do[cell];
@@ -597,298 +744,210 @@ void LSTM::learn(double **desiredOutputs)
             bo_diff[cell]+=_do_input[cell];
             bg_diff[cell]+=_dg_input[cell];
 
-            if(!weightsAllocated)
-            {
-                wi_diff[cell]=(double***)malloc(inputGateTotalLayerCount*sizeof(double**));
-                wf_diff[cell]=(double***)malloc(forgetGateTotalLayerCount*sizeof(double**));
-                wo_diff[cell]=(double***)malloc(outputGateTotalLayerCount*sizeof(double**));
-                wg_diff[cell]=(double***)malloc(candidateGateTotalLayerCount*sizeof(double**));
-
-                ibi_diff[cell]=(double**)malloc(inputGateTotalLayerCount*sizeof(double*));
-                ibf_diff[cell]=(double**)malloc(forgetGateTotalLayerCount*sizeof(double*));
-                ibo_diff[cell]=(double**)malloc(outputGateTotalLayerCount*sizeof(double*));
-                ibg_diff[cell]=(double**)malloc(candidateGateTotalLayerCount*sizeof(double*));
-
-                i_errorTerms[cell]=(double**)malloc(inputGateTotalLayerCount*sizeof(double*));
-                f_errorTerms[cell]=(double**)malloc(forgetGateTotalLayerCount*sizeof(double*));
-                o_errorTerms[cell]=(double**)malloc(outputGateTotalLayerCount*sizeof(double*));
-                g_errorTerms[cell]=(double**)malloc(candidateGateTotalLayerCount*sizeof(double*));
-            }
-
-            // Forget gate
-            for(uint32_t _currentLayer=forgetGateTotalLayerCount;_currentLayer>0;_currentLayer--) // Actual layer number: _currentLayer-1 (_currentLayer must be >=0 during the comparison)
-            {
-                uint32_t currentLayer=_currentLayer-1;
-                uint32_t neuronsInThisLayer=currentLayer==forgetGateTotalLayerCount-1?inputAndOutputCount:forgetGateHiddenLayerNeuronCounts[currentLayer];
-                uint32_t neuronsInPreviousLayer=currentLayer==0?inputAndOutputCount:forgetGateHiddenLayerNeuronCounts[currentLayer-1];
-                uint32_t neuronsInHigherLayer=currentLayer==forgetGateTotalLayerCount-1?0:((forgetGateTotalLayerCount>=2&&currentLayer==forgetGateTotalLayerCount-2)?inputAndOutputCount:forgetGateHiddenLayerNeuronCounts[currentLayer+1]);
+            // bottom_diff_s:
+            thisState->bottomDerivativesOfLossesFromThisStateUpwardsWithRespectToLastCellStates[cell]=_ds[cell]*thisState->forgetGateValues[cell];
+        }
 
-                if(!weightsAllocated)
-                {
-                    wf_diff[cell][currentLayer]=(double**)malloc(neuronsInThisLayer*sizeof(double*));
-                    ibf_diff[cell][currentLayer]=(double*)malloc(neuronsInThisLayer*sizeof(double));
-                    f_errorTerms[cell][currentLayer]=(double*)malloc(neuronsInThisLayer*sizeof(double));
-                }
+        // Backpropagate through the gate networks. The topmost layer neurons of a cell's own network all receive the derivative of the loss
+        // function w.r.t. the value inside the activation function call of the cell's gate (their values are summed up); the topmost layer
+        // neurons of a shared network receive the derivative of their cell each.
+
+        double ****thisStateGateLayerWeights[4]={thisState->forgetGateLayerWeights,thisState->inputGateLayerWeights,thisState->outputGateLayerWeights,thisState->candidateGateLayerWeights};
+        double ***thisStateGateLayerNeuronValues[4]={thisState->forgetGateLayerNeuronValues,thisState->inputGateLayerNeuronValues,thisState->outputGateLayerNeuronValues,thisState->candidateGateLayerNeuronValues};
+        double ****gateWeightDiffs[4]={wf_diff,wi_diff,wo_diff,wg_diff};
+        double ***gateBiasWeightDiffs[4]={ibf_diff,ibi_diff,ibo_diff,ibg_diff};
+        double ***gateErrorTerms[4]={f_errorTerms,i_errorTerms,o_errorTerms,g_errorTerms};
+        double *gateDerivatives[4]={_df_input,_di_input,_do_input,_dg_input};
+        uint32_t gateTotalLayerCounts[4]={forgetGateTotalLayerCount,inputGateTotalLayerCount,outputGateTotalLayerCount,candidateGateTotalLayerCount};
+        uint32_t *gateHiddenLayerNeuronCounts[4]={forgetGateHiddenLayerNeuronCounts,inputGateHiddenLayerNeuronCounts,outputGateHiddenLayerNeuronCounts,candidateGateHiddenLayerNeuronCounts};
+        uint8_t gateNetworkActivations[4]={forgetGateNetworkActivation,inputGateNetworkActivation,outputGateNetworkActivation,candidateGateNetworkActivation};
+
+        // GRU: the candidate networks are backpropagated first, as the derivatives w.r.t. their previous output inputs (reset gate values
+        // times previous outputs) yield the derivatives w.r.t. the reset gate values.
+        double *previousOutputs=hasDeeperState?deeperState->output:0;
+        if(resetPreviousOutputs!=0&&hasDeeperState)
+        {
+            for(uint32_t cell=0;cell<cellCount;cell++)
+                resetPreviousOutputs[cell]=thisState->outputGateValues[cell]*previousOutputs[cell];
+        }
+        uint8_t passCount=cellVariant==LSTMCellVariant_gru?2:1;
 
-                for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
+        fillDoubleArray(dxc,inputAndOutputCount,0.0);
+        for(uint8_t pass=0;pass<passCount;pass++)
+        {
+            for(uint32_t network=0;network<gateNetworkCount;network++)
+            {
+                for(uint8_t gate=0;gate<4;gate++)
                 {
-                    if(!weightsAllocated)
+                    if(gate==0&&!thisState->hasForgetGateNetwork())
+                        continue;
+                    if(passCount==2&&(gate==3)!=(pass==0))
+                        continue;
+                    double *gatePreviousOutputs=gate==3&&cellVariant==LSTMCellVariant_gru&&hasDeeperState?resetPreviousOutputs:previousOutputs;
+                    if(sparsity!=0)
                     {
-                        wf_diff[cell][currentLayer][neuronInThisLayer]=(double*)malloc(neuronsInPreviousLayer*sizeof(double));
-                        ibf_diff[cell][currentLayer][neuronInThisLayer]=0.0;
+                        memcpy(bottommostLayerInputs,thisState->input,inputCount*sizeof(double));
+                        for(uint32_t cell=0;cell<cellCount;cell++)
+                            bottommostLayerInputs[inputCount+cell]=gatePreviousOutputs!=0?gatePreviousOutputs[cell]:0.0;
                     }
+                    double ***gateLayerWeights=thisStateGateLayerWeights[gate][network];
+                    double **gateLayerNeuronValues=thisStateGateLayerNeuronValues[gate][network];
+                    uint32_t gateTotalLayerCount=gateTotalLayerCounts[gate];
 
-                    if(currentLayer==forgetGateTotalLayerCount-1)
-                        f_errorTerms[cell][currentLayer][neuronInThisLayer]=_df_input[cell];
-                    else
-                    {
-                        double f_errorTermSum=0.0;
-
-                        // Sum error terms of layer above multiplied by the respective weights
-
-                        for(uint32_t neuronInHigherLayer=0;neuronInHigherLayer<neuronsInHigherLayer;neuronInHigherLayer++)
-                            f_errorTermSum+=f_errorTerms[cell][currentLayer+1][neuronInHigherLayer]*thisState->forgetGateLayerWeights[cell][currentLayer][neuronInThisLayer][neuronInHigherLayer]/*Weight of this neuron to the neuron in the higher layer*/;
-
-                        f_errorTerms[cell][currentLayer][neuronInThisLayer]=(1.0-pow(thisState->forgetGateLayerNeuronValues[cell][currentLayer][neuronInThisLayer],2))*f_errorTermSum;
-                    }
-
-                    ibf_diff[cell][currentLayer][neuronInThisLayer]+=f_errorTerms[cell][currentLayer][neuronInThisLayer];
-
-                    for(uint32_t neuronInPreviousLayer=0;neuronInPreviousLayer<neuronsInPreviousLayer;neuronInPreviousLayer++)
-                    {
-                        if(!weightsAllocated)
-                            wf_diff[cell][currentLayer][neuronInThisLayer][neuronInPreviousLayer]=0.0;
-                        wf_diff[cell][currentLayer][neuronInThisLayer][neuronInPreviousLayer]+=f_errorTerms[cell][currentLayer][neuronInThisLayer]*(currentLayer==0?(neuronInPreviousLayer<inputCount?thisState->input[neuronInPreviousLayer]:(hasDeeperState?deeperState->output[neuronInPreviousLayer-inputCount]:0.0)):thisState->forgetGateLayerNeuronValues[cell][currentLayer-1][neuronInPreviousLayer]);
-                    }
-                }
-            }
-
-            // Input gate
-            for(uint32_t _currentLayer=inputGateTotalLayerCount;_currentLayer>0;_currentLayer--) // Actual layer number: _currentLayer-1 (_currentLayer must be >=0 during the comparison)
-            {
-                uint32_t currentLayer=_currentLayer-1;
-                uint32_t neuronsInThisLayer=currentLayer==inputGateTotalLayerCount-1?inputAndOutputCount:inputGateHiddenLayerNeuronCounts[currentLayer];
-                uint32_t neuronsInPreviousLayer=currentLayer==0?inputAndOutputCount:inputGateHiddenLayerNeuronCounts[currentLayer-1];
-                uint32_t neuronsInHigherLayer=currentLayer==inputGateTotalLayerCount-1?0:((inputGateTotalLayerCount>=2&&currentLayer==inputGateTotalLayerCount-2)?inputAndOutputCount:inputGateHiddenLayerNeuronCounts[currentLayer+1]);
-
-                if(!weightsAllocated)
-                {
-                    wi_diff[cell][currentLayer]=(double**)malloc(neuronsInThisLayer*sizeof(double*));
-                    ibi_diff[cell][currentLayer]=(double*)malloc(neuronsInThisLayer*sizeof(double));
-                    i_errorTerms[cell][currentLayer]=(double*)malloc(neuronsInThisLayer*sizeof(double));
-                }
-
-                for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
-                {
                     if(!weightsAllocated)
                     {
-                        wi_diff[cell][currentLayer][neuronInThisLayer]=(double*)malloc(neuronsInPreviousLayer*sizeof(double));
-                        ibi_diff[cell][currentLayer][neuronInThisLayer]=0.0;
+                        gateWeightDiffs[gate][network]=(double***)LSTMAllocations::allocate(gateTotalLayerCount*sizeof(double**),LSTMAllocationCategory_gradient);
+                        gateBiasWeightDiffs[gate][network]=(double**)LSTMAllocations::allocate(gateTotalLayerCount*sizeof(double*),LSTMAllocationCategory_gradient);
+                        gateErrorTerms[gate][network]=(double**)LSTMAllocations::allocate(gateTotalLayerCount*sizeof(double*),LSTMAllocationCategory_gradient);
                     }
+                    double ***gateLayerWeightDiffs=gateWeightDiffs[gate][network];
+                    double **gateLayerBiasWeightDiffs=gateBiasWeightDiffs[gate][network];
+                    double **gateLayerErrorTerms=gateErrorTerms[gate][network];
 
-                    if(currentLayer==inputGateTotalLayerCount-1)
-                        i_errorTerms[cell][currentLayer][neuronInThisLayer]=_di_input[cell];
-                    else
+                    for(uint32_t _currentLayer=gateTotalLayerCount;_currentLayer>0;_currentLayer--) // Actual layer number: _currentLayer-1 (_currentLayer must be >=0 during the comparison)
                     {
-                        double i_errorTermSum=0.0;
-
-                        // Sum error terms of layer above multiplied by the respective weights
-
-                        for(uint32_t neuronInHigherLayer=0;neuronInHigherLayer<neuronsInHigherLayer;neuronInHigherLayer++)
-                            i_errorTermSum+=i_errorTerms[cell][currentLayer+1][neuronInHigherLayer]*thisState->inputGateLayerWeights[cell][currentLayer][neuronInThisLayer][neuronInHigherLayer]/*Weight of this neuron to the neuron in the higher layer*/;
+                        uint32_t currentLayer=_currentLayer-1;
+                        uint32_t neuronsInThisLayer=currentLayer==gateTotalLayerCount-1?gateNetworkOutputCount:gateHiddenLayerNeuronCounts[gate][currentLayer];
+                        uint32_t neuronsInPreviousLayer=currentLayer==0?inputAndOutputCount:gateHiddenLayerNeuronCounts[gate][currentLayer-1];
+                        uint32_t neuronsInHigherLayer=currentLayer==gateTotalLayerCount-1?0:(currentLayer==gateTotalLayerCount-2?gateNetworkOutputCount:gateHiddenLayerNeuronCounts[gate][currentLayer+1]);
 
-                        i_errorTerms[cell][currentLayer][neuronInThisLayer]=(1.0-pow(thisState->inputGateLayerNeuronValues[cell][currentLayer][neuronInThisLayer],2))*i_errorTermSum;
-                    }
-
-                    ibi_diff[cell][currentLayer][neuronInThisLayer]+=i_errorTerms[cell][currentLayer][neuronInThisLayer];
-
-                    for(uint32_t neuronInPreviousLayer=0;neuronInPreviousLayer<neuronsInPreviousLayer;neuronInPreviousLayer++)
-                    {
                         if(!weightsAllocated)
-                            wi_diff[cell][currentLayer][neuronInThisLayer][neuronInPreviousLayer]=0.0;
-                        wi_diff[cell][currentLayer][neuronInThisLayer][neuronInPreviousLayer]+=i_errorTerms[cell][currentLayer][neuronInThisLayer]*(currentLayer==0?(neuronInPreviousLayer<inputCount?thisState->input[neuronInPreviousLayer]:(hasDeeperState?deeperState->output[neuronInPreviousLayer-inputCount]:0.0)):thisState->inputGateLayerNeuronValues[cell][currentLayer-1][neuronInPreviousLayer]);
+                        {
+                            gateLayerWeightDiffs[currentLayer]=(double**)LSTMAllocations::allocate(neuronsInThisLayer*sizeof(double*),LSTMAllocationCategory_gradient);
+                            gateLayerBiasWeightDiffs[currentLayer]=(double*)LSTMAllocations::allocate(neuronsInThisLayer*sizeof(double),LSTMAllocationCategory_gradient);
+                            gateLayerErrorTerms[currentLayer]=(double*)LSTMAllocations::allocate(neuronsInThisLayer*sizeof(double),LSTMAllocationCategory_gradient);
+                        }
+                        uint32_t *rowStarts=sparsity!=0?sparsity->rowStarts[gate][network][currentLayer]:0;
+                        uint32_t *columns=sparsity!=0?sparsity->columns[gate][network][currentLayer]:0;
+                        if(sparsity!=0&&currentLayer<gateTotalLayerCount-1)
+                        {
+                            uint32_t *higherLayerRowStarts=sparsity->rowStarts[gate][network][currentLayer+1];
+                            uint32_t *higherLayerColumns=sparsity->columns[gate][network][currentLayer+1];
+                            fillDoubleArray(errorTermSums,neuronsInThisLayer,0.0);
+                            for(uint32_t neuronInHigherLayer=0;neuronInHigherLayer<neuronsInHigherLayer;neuronInHigherLayer++)
+                            {
+                                double higherLayerErrorTerm=gateLayerErrorTerms[currentLayer+1][neuronInHigherLayer];
+                                double *higherLayerWeights=gateLayerWeights[currentLayer+1][neuronInHigherLayer];
+                                for(uint32_t kept=higherLayerRowStarts[neuronInHigherLayer];kept<higherLayerRowStarts[neuronInHigherLayer+1];kept++)
+                                    errorTermSums[higherLayerColumns[kept]]+=higherLayerErrorTerm*higherLayerWeights[higherLayerColumns[kept]];
+                            }
+                        }
+
+                        for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
+                        {
+                            if(!weightsAllocated)
+                            {
+                                gateLayerWeightDiffs[currentLayer][neuronInThisLayer]=(double*)LSTMAllocations::allocate(neuronsInPreviousLayer*sizeof(double),LSTMAllocationCategory_gradient);
+                                gateLayerBiasWeightDiffs[currentLayer][neuronInThisLayer]=0.0;
+                            }
+
+                            if(currentLayer==gateTotalLayerCount-1&&!sharedGateNetworks&&!hasDeeperState&&neuronInThisLayer>=inputCount)
+                                gateLayerErrorTerms[currentLayer][neuronInThisLayer]=0.0; // Without a previous state, process() leaves the previous output neurons out of the gate value sum.
+                            else if(currentLayer==gateTotalLayerCount-1)
+                                gateLayerErrorTerms[currentLayer][neuronInThisLayer]=LSTMState::getActivationDerivative(gateNetworkActivations[gate],gateLayerNeuronValues[currentLayer][neuronInThisLayer])*gateDerivatives[gate][sharedGateNetworks?neuronInThisLayer:network];
+                            else
+                            {
+                                double errorTermSum=0.0;
+
+                                // Sum error terms of layer above multiplied by the respective weights
+
+                                if(sparsity!=0)
+                                    errorTermSum=errorTermSums[neuronInThisLayer];
+                                else
+                                {
+                                    for(uint32_t neuronInHigherLayer=0;neuronInHigherLayer<neuronsInHigherLayer;neuronInHigherLayer++)
+                                        errorTermSum+=gateLayerErrorTerms[currentLayer+1][neuronInHigherLayer]*gateLayerWeights[currentLayer+1][neuronInHigherLayer][neuronInThisLayer]/*Weight of this neuron to the neuron in the higher layer*/;
+                                }
+
+                                gateLayerErrorTerms[currentLayer][neuronInThisLayer]=LSTMState::getActivationDerivative(gateNetworkActivations[gate],gateLayerNeuronValues[currentLayer][neuronInThisLayer])*errorTermSum;
+                            }
+
+                            gateLayerBiasWeightDiffs[currentLayer][neuronInThisLayer]+=gateLayerErrorTerms[currentLayer][neuronInThisLayer];
+
+                            if(sparsity!=0)
+                            {
+                                // The differentials of the pruned weights stay 0.
+                                double errorTerm=gateLayerErrorTerms[currentLayer][neuronInThisLayer];
+                                double *lastLayerValues=currentLayer==0?bottommostLayerInputs:gateLayerNeuronValues[currentLayer-1];
+                                double *weightDiffs=gateLayerWeightDiffs[currentLayer][neuronInThisLayer];
+                                if(!weightsAllocated)
+                                    fillDoubleArray(weightDiffs,neuronsInPreviousLayer,0.0);
+                                for(uint32_t kept=rowStarts[neuronInThisLayer];kept<rowStarts[neuronInThisLayer+1];kept++)
+                                    weightDiffs[columns[kept]]+=errorTerm*lastLayerValues[columns[kept]];
+                            }
+                            else
+                            {
+                                for(uint32_t neuronInPreviousLayer=0;neuronInPreviousLayer<neuronsInPreviousLayer;neuronInPreviousLayer++)
+                                {
+                                    if(!weightsAllocated)
+                                        gateLayerWeightDiffs[currentLayer][neuronInThisLayer][neuronInPreviousLayer]=0.0;
+                                    gateLayerWeightDiffs[currentLayer][neuronInThisLayer][neuronInPreviousLayer]+=gateLayerErrorTerms[currentLayer][neuronInThisLayer]*(currentLayer==0?(neuronInPreviousLayer<inputCount?thisState->input[neuronInPreviousLayer]:(gatePreviousOutputs!=0?gatePreviousOutputs[neuronInPreviousLayer-inputCount]:0.0)):gateLayerNeuronValues[currentLayer-1][neuronInPreviousLayer]);
+                                }
+                            }
+                        }
                     }
-                }
-            }
 
-            // Output gate
-            for(uint32_t _currentLayer=outputGateTotalLayerCount;_currentLayer>0;_currentLayer--) // Actual layer number: _currentLayer-1 (_currentLayer must be >=0 during the comparison)
-            {
-                uint32_t currentLayer=_currentLayer-1;
-                uint32_t neuronsInThisLayer=currentLayer==outputGateTotalLayerCount-1?inputAndOutputCount:outputGateHiddenLayerNeuronCounts[currentLayer];
-                uint32_t neuronsInPreviousLayer=currentLayer==0?inputAndOutputCount:outputGateHiddenLayerNeuronCounts[currentLayer-1];
-                uint32_t neuronsInHigherLayer=currentLayer==outputGateTotalLayerCount-1?0:((outputGateTotalLayerCount>=2&&currentLayer==outputGateTotalLayerCount-2)?inputAndOutputCount:outputGateHiddenLayerNeuronCounts[currentLayer+1]);
+                    // Calculate derivatives of loss function w.r.t. the inputs received from the last state
 
-                if(!weightsAllocated)
-                {
-                    wo_diff[cell][currentLayer]=(double**)malloc(neuronsInThisLayer*sizeof(double*));
-                    ibo_diff[cell][currentLayer]=(double*)malloc(neuronsInThisLayer*sizeof(double));
-                    o_errorTerms[cell][currentLayer]=(double*)malloc(neuronsInThisLayer*sizeof(double));
-                }
+                    // The bottommost layer has the inputs/outputs of the cell as its inputs.
+                    // The bottommost layer's weights are used to feed in the inputs into the bottommost layer of the neural network (by multiplying them by the bottommost layer's weights).
+                    // => Each input receives the error terms of the bottommost layer multiplied by the weights of that input, of all gate networks
 
-                for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
-                {
-                    if(!weightsAllocated)
+                    uint32_t neuronsInBottommostLayer=gateTotalLayerCount==1?gateNetworkOutputCount:gateHiddenLayerNeuronCounts[gate][0];
+                    for(uint32_t neuronInBottommostLayer=0;neuronInBottommostLayer<neuronsInBottommostLayer;neuronInBottommostLayer++)
                     {
-                        wo_diff[cell][currentLayer][neuronInThisLayer]=(double*)malloc(neuronsInPreviousLayer*sizeof(double));
-                        ibo_diff[cell][currentLayer][neuronInThisLayer]=0.0;
-                    }
-
-                    if(currentLayer==outputGateTotalLayerCount-1)
-                        o_errorTerms[cell][currentLayer][neuronInThisLayer]=_do_input[cell];
-                    else
-                    {
-                        double o_errorTermSum=0.0;
-
-                        // Sum error terms of layer above multiplied by the respective weights
-
-                        for(uint32_t neuronInHigherLayer=0;neuronInHigherLayer<neuronsInHigherLayer;neuronInHigherLayer++)
-                            o_errorTermSum+=o_errorTerms[cell][currentLayer+1][neuronInHigherLayer]*thisState->outputGateLayerWeights[cell][currentLayer][neuronInThisLayer][neuronInHigherLayer]/*Weight of this neuron to the neuron in the higher layer*/;
-
-                        o_errorTerms[cell][currentLayer][neuronInThisLayer]=(1.0-pow(thisState->outputGateLayerNeuronValues[cell][currentLayer][neuronInThisLayer],2))*o_errorTermSum;
-                    }
-
-                    ibo_diff[cell][currentLayer][neuronInThisLayer]+=o_errorTerms[cell][currentLayer][neuronInThisLayer];
-
-                    for(uint32_t neuronInPreviousLayer=0;neuronInPreviousLayer<neuronsInPreviousLayer;neuronInPreviousLayer++)
-                    {
-                        if(!weightsAllocated)
-                            wo_diff[cell][currentLayer][neuronInThisLayer][neuronInPreviousLayer]=0.0;
-                        wo_diff[cell][currentLayer][neuronInThisLayer][neuronInPreviousLayer]+=o_errorTerms[cell][currentLayer][neuronInThisLayer]*(currentLayer==0?(neuronInPreviousLayer<inputCount?thisState->input[neuronInPreviousLayer]:(hasDeeperState?deeperState->output[neuronInPreviousLayer-inputCount]:0.0)):thisState->outputGateLayerNeuronValues[cell][currentLayer-1][neuronInPreviousLayer]);
+                        double errorTerm=gateLayerErrorTerms[0 /*Bottommost layer*/][neuronInBottommostLayer];
+                        double *bottommostLayerWeights=gateLayerWeights[0 /*Bottommost layer*/][neuronInBottommostLayer];
+                        if(sparsity!=0)
+                        {
+                            uint32_t *rowStarts=sparsity->rowStarts[gate][network][0];
+                            uint32_t *columns=sparsity->columns[gate][network][0];
+                            for(uint32_t kept=rowStarts[neuronInBottommostLayer];kept<rowStarts[neuronInBottommostLayer+1];kept++)
+                                dxc[columns[kept]]+=errorTerm*bottommostLayerWeights[columns[kept]];
+                        }
+                        else
+                        {
+                            for(uint32_t weightInputOrOutput=0;weightInputOrOutput<inputAndOutputCount;weightInputOrOutput++)
+                                dxc[weightInputOrOutput]+=errorTerm*bottommostLayerWeights[weightInputOrOutput];
+                        }
                     }
                 }
             }
-
-            // Candidate gate
-            for(uint32_t _currentLayer=candidateGateTotalLayerCount;_currentLayer>0;_currentLayer--) // Actual layer number: _currentLayer-1 (_currentLayer must be >=0 during the comparison)
+            if(passCount==2&&pass==0)
             {
-                uint32_t currentLayer=_currentLayer-1;
-                uint32_t neuronsInThisLayer=currentLayer==candidateGateTotalLayerCount-1?inputAndOutputCount:candidateGateHiddenLayerNeuronCounts[currentLayer];
-                uint32_t neuronsInPreviousLayer=currentLayer==0?inputAndOutputCount:candidateGateHiddenLayerNeuronCounts[currentLayer-1];
-                uint32_t neuronsInHigherLayer=currentLayer==candidateGateTotalLayerCount-1?0:((candidateGateTotalLayerCount>=2&&currentLayer==candidateGateTotalLayerCount-2)?inputAndOutputCount:candidateGateHiddenLayerNeuronCounts[currentLayer+1]);
-
-                if(!weightsAllocated)
-                {
-                    wg_diff[cell][currentLayer]=(double**)malloc(neuronsInThisLayer*sizeof(double*));
-                    ibg_diff[cell][currentLayer]=(double*)malloc(neuronsInThisLayer*sizeof(double));
-                    g_errorTerms[cell][currentLayer]=(double*)malloc(neuronsInThisLayer*sizeof(double));
-                }
-
-                for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
+                // dxc holds the derivatives w.r.t. the candidate network inputs so far; the previous output part is split into the derivatives
+                // w.r.t. the reset gate values and the previous outputs.
+                for(uint32_t cell=0;cell<cellCount;cell++)
                 {
-                    if(!weightsAllocated)
-                    {
-                        wg_diff[cell][currentLayer][neuronInThisLayer]=(double*)malloc(neuronsInPreviousLayer*sizeof(double));
-                        ibg_diff[cell][currentLayer][neuronInThisLayer]=0.0;
-                    }
-
-                    if(currentLayer==candidateGateTotalLayerCount-1)
-                        g_errorTerms[cell][currentLayer][neuronInThisLayer]=_dg_input[cell];
-                    else
-                    {
-                        double g_errorTermSum=0.0;
-
-                        // Sum error terms of layer above multiplied by the respective weights
-
-                        for(uint32_t neuronInHigherLayer=0;neuronInHigherLayer<neuronsInHigherLayer;neuronInHigherLayer++)
-                            g_errorTermSum+=g_errorTerms[cell][currentLayer+1][neuronInHigherLayer]*thisState->candidateGateLayerWeights[cell][currentLayer][neuronInThisLayer][neuronInHigherLayer]/*Weight of this neuron to the neuron in the higher layer*/;
-
-                        g_errorTerms[cell][currentLayer][neuronInThisLayer]=(1.0-pow(thisState->candidateGateLayerNeuronValues[cell][currentLayer][neuronInThisLayer],2))*g_errorTermSum;
-                    }
-
-                    ibg_diff[cell][currentLayer][neuronInThisLayer]+=g_errorTerms[cell][currentLayer][neuronInThisLayer];
-
-                    for(uint32_t neuronInPreviousLayer=0;neuronInPreviousLayer<neuronsInPreviousLayer;neuronInPreviousLayer++)
-                    {
-                        if(!weightsAllocated)
-                            wg_diff[cell][currentLayer][neuronInThisLayer][neuronInPreviousLayer]=0.0;
-                        wg_diff[cell][currentLayer][neuronInThisLayer][neuronInPreviousLayer]+=g_errorTerms[cell][currentLayer][neuronInThisLayer]*(currentLayer==0?(neuronInPreviousLayer<inputCount?thisState->input[neuronInPreviousLayer]:(hasDeeperState?deeperState->output[neuronInPreviousLayer-inputCount]:0.0)):thisState->candidateGateLayerNeuronValues[cell][currentLayer-1][neuronInPreviousLayer]);
-                    }
+                    double resetGateValue=thisState->outputGateValues[cell];
+                    _do[cell]=dxc[inputCount+cell]*(hasDeeperState?previousOutputs[cell]:0.0);
+                    _do_input[cell]=(1.0-resetGateValue)*resetGateValue*_do[cell];
+                    bo_diff[cell]+=_do_input[cell];
+                    dxc[inputCount+cell]*=resetGateValue;
                 }
             }
-
-            // Calculate derivatives of loss function w.r.t. the inputs received from the last state
-
-            // The bottommost layer has the inputs/outputs of the cell as its inputs.
-            // The bottommost layer's weights are used to feed in the inputs into the bottommost layer of the neural network (by multiplying them by the bottommost layer's weights).
-            // => Calculate error term of bottommost layer
-
-            double i_errorTermSum=0.0;
-            double f_errorTermSum=0.0;
-            double o_errorTermSum=0.0;
-            double g_errorTermSum=0.0;
-
-            // Sum error terms of layer above multiplied by the respective weights
-
-            uint32_t neuronsInForgetGateBottommostLayer=forgetGateHiddenLayerCount==0?inputAndOutputCount:forgetGateHiddenLayerNeuronCounts[0];
-            uint32_t neuronsInInputGateBottommostLayer=inputGateHiddenLayerCount==0?inputAndOutputCount:inputGateHiddenLayerNeuronCounts[0];
-            uint32_t neuronsInOutputGateBottommostLayer=outputGateHiddenLayerCount==0?inputAndOutputCount:outputGateHiddenLayerNeuronCounts[0];
-            uint32_t neuronsInCandidateGateBottommostLayer=candidateGateHiddenLayerCount==0?inputAndOutputCount:candidateGateHiddenLayerNeuronCounts[0];
-
-            // Forget gate
-            for(uint32_t neuronInBottommostLayer=0;neuronInBottommostLayer<neuronsInForgetGateBottommostLayer;neuronInBottommostLayer++)
-            {
-                for(uint32_t weightInputOrOutput=0;weightInputOrOutput<inputAndOutputCount;weightInputOrOutput++)
-                    f_errorTermSum+=f_errorTerms[cell][0 /*Bottommost layer*/][neuronInBottommostLayer]*thisState->forgetGateLayerWeights[cell][0 /*Bottommost layer*/][neuronInBottommostLayer][weightInputOrOutput]; // Weight of this neuron to the neuron in the higher layer
-            }
-
-            // Input gate
-            for(uint32_t neuronInBottommostLayer=0;neuronInBottommostLayer<neuronsInInputGateBottommostLayer;neuronInBottommostLayer++)
-            {
-                for(uint32_t weightInputOrOutput=0;weightInputOrOutput<inputAndOutputCount;weightInputOrOutput++)
-                    i_errorTermSum+=i_errorTerms[cell][0 /*Bottommost layer*/][neuronInBottommostLayer]*thisState->inputGateLayerWeights[cell][0 /*Bottommost layer*/][neuronInBottommostLayer][weightInputOrOutput]; // Weight of this neuron to the neuron in the higher layer
-            }
-
-            // Output gate
-            for(uint32_t neuronInBottommostLayer=0;neuronInBottommostLayer<neuronsInOutputGateBottommostLayer;neuronInBottommostLayer++)
-            {
-                for(uint32_t weightInputOrOutput=0;weightInputOrOutput<inputAndOutputCount;weightInputOrOutput++)
-                    o_errorTermSum+=o_errorTerms[cell][0 /*Bottommost layer*/][neuronInBottommostLayer]*thisState->outputGateLayerWeights[cell][0 /*Bottommost layer*/][neuronInBottommostLayer][weightInputOrOutput]; // Weight of this neuron to the neuron in the higher layer
-            }
-
-            // Output gate
-            for(uint32_t neuronInBottommostLayer=0;neuronInBottommostLayer<neuronsInCandidateGateBottommostLayer;neuronInBottommostLayer++)
-            {
-                for(uint32_t weightInputOrOutput=0;weightInputOrOutput<inputAndOutputCount;weightInputOrOutput++)
-                    g_errorTermSum+=g_errorTerms[cell][0 /*Bottommost layer*/][neuronInBottommostLayer]*thisState->candidateGateLayerWeights[cell][0 /*Bottommost layer*/][neuronInBottommostLayer][weightInputOrOutput]; // Weight of this neuron to the neuron in the higher layer
-            }
-
-            for(uint32_t weightInput=0;weightInput<inputCount;weightInput++)
-            {
-                if(!dxcWeightsSet)
-                    dxc[weightInput]=0.0;
-                dxc[weightInput]=i_errorTermSum+f_errorTermSum+o_errorTermSum+g_errorTermSum;
-            }
-            for(uint32_t weightOutput=0;weightOutput<outputCount;weightOutput++)
-            {
-                if(!dxcWeightsSet)
-                    dxc[inputCount+weightOutput]=0.0;
-                dxc[inputCount+weightOutput]=i_errorTermSum+f_errorTermSum+o_errorTermSum+g_errorTermSum;
-            }
-
-            // bottom_diff_s:
-            thisState->bottomDerivativesOfLossesFromThisStateUpwardsWithRespectToLastCellStates[cell]=_ds[cell]*thisState->forgetGateValues[cell];
-            if(!dxcWeightsSet)
-                dxcWeightsSet=true;
         }
 
         // bottom_diff_x:
         memcpy(thisState->bottomDerivativesOfLossesFromThisStateUpwardsWithRespectToInputs,dxc,inputCount*sizeof(double));
         // bottom_diff_h:
-        memcpy(thisState->bottomDerivativesOfLossesFromThisStateUpwardsWithRespectToLastOutputs,dxc+inputCount,outputCount*sizeof(double));
-
-        free(dxc);
-        free(_ds);
-        free(_do);
-        free(_di);
-        free(_dg);
-        free(_df);
-        free(_di_input);
-        free(_df_input);
-        free(_do_input);
-        free(_dg_input);
+        memcpy(thisState->bottomDerivativesOfLossesFromThisStateUpwardsWithRespectToLastOutputs,dxc+inputCount,cellCount*sizeof(double));
+
+        LSTMAllocations::release(dxc);
+        LSTMAllocations::release(_dh);
+        LSTMAllocations::release(_ds);
+        LSTMAllocations::release(_do);
+        LSTMAllocations::release(_di);
+        LSTMAllocations::release(_dg);
+        LSTMAllocations::release(_df);
+        LSTMAllocations::release(_di_input);
+        LSTMAllocations::release(_df_input);
+        LSTMAllocations::release(_do_input);
+        LSTMAllocations::release(_dg_input);
         if(!weightsAllocated)
             weightsAllocated=true;
+        if(hasHigherState) // The current state is used as the previous state by the next process() call.
+            thisState->compressActivations(historyPrecision);
     }
 
     double ***gateLayerWeights;
@@ -905,8 +964,9 @@ void LSTM::learn(double **desiredOutputs)
     double gateNetworkWeightDecay;
 
     // Now that we have cycled through all states, apply all changes:
+    LSTM_TIME_PHASE(weightUpdateTimer,&phaseStats,LSTMPhase_weightUpdate);
 
-    for(uint32_t cell=0;cell<outputCount;cell++)
+    for(uint32_t network=0;network<gateNetworkCount;network++)
     {
         // For each gate
         for(uint8_t gate=1;gate<=4;gate++)
@@ -914,12 +974,14 @@ void LSTM::learn(double **desiredOutputs)
             if(gate==1)
             {
                 // Forget gate
-                gateLayerWeights=latestState->forgetGateLayerWeights[cell];
-                gateLayerBiasWeights=latestState->forgetGateLayerBiasWeights[cell];
+                if(!latestState->hasForgetGateNetwork())
+                    continue;
+                gateLayerWeights=latestState->forgetGateLayerWeights[network];
+                gateLayerBiasWeights=latestState->forgetGateLayerBiasWeights[network];
                 previousGateWeightDeltas=previousForgetGateWeightDeltas;
                 previousGateBiasWeightDeltas=previousForgetGateBiasWeightDeltas;
-                gateLayerWeightDiffs=wf_diff[cell];
-                gateLayerBiasWeightDiffs=ibf_diff[cell];
+                gateLayerWeightDiffs=wf_diff[network];
+                gateLayerBiasWeightDiffs=ibf_diff[network];
                 gateHiddenLayerCount=forgetGateHiddenLayerCount;
                 gateHiddenLayerNeuronCounts=forgetGateHiddenLayerNeuronCounts;
                 gateErrorTerms=f_errorTerms;
@@ -931,12 +993,12 @@ void LSTM::learn(double **desiredOutputs)
             {
                 // Input gate
 
-                gateLayerWeights=latestState->inputGateLayerWeights[cell];
-                gateLayerBiasWeights=latestState->inputGateLayerBiasWeights[cell];
+                gateLayerWeights=latestState->inputGateLayerWeights[network];
+                gateLayerBiasWeights=latestState->inputGateLayerBiasWeights[network];
                 previousGateWeightDeltas=previousInputGateWeightDeltas;
                 previousGateBiasWeightDeltas=previousInputGateBiasWeightDeltas;
-                gateLayerWeightDiffs=wi_diff[cell];
-                gateLayerBiasWeightDiffs=ibi_diff[cell];
+                gateLayerWeightDiffs=wi_diff[network];
+                gateLayerBiasWeightDiffs=ibi_diff[network];
                 gateHiddenLayerCount=inputGateHiddenLayerCount;
                 gateHiddenLayerNeuronCounts=inputGateHiddenLayerNeuronCounts;
                 gateErrorTerms=i_errorTerms;
@@ -948,12 +1010,12 @@ void LSTM::learn(double **desiredOutputs)
             {
                 // Output gate
 
-                gateLayerWeights=latestState->outputGateLayerWeights[cell];
-                gateLayerBiasWeights=latestState->outputGateLayerBiasWeights[cell];
+                gateLayerWeights=latestState->outputGateLayerWeights[network];
+                gateLayerBiasWeights=latestState->outputGateLayerBiasWeights[network];
                 previousGateWeightDeltas=previousOutputGateWeightDeltas;
                 previousGateBiasWeightDeltas=previousOutputGateBiasWeightDeltas;
-                gateLayerWeightDiffs=wo_diff[cell];
-                gateLayerBiasWeightDiffs=ibo_diff[cell];
+                gateLayerWeightDiffs=wo_diff[network];
+                gateLayerBiasWeightDiffs=ibo_diff[network];
                 gateHiddenLayerCount=outputGateHiddenLayerCount;
                 gateHiddenLayerNeuronCounts=outputGateHiddenLayerNeuronCounts;
                 gateErrorTerms=o_errorTerms;
@@ -965,12 +1027,12 @@ void LSTM::learn(double **desiredOutputs)
             {
                 // Candidate gate
 
-                gateLayerWeights=latestState->candidateGateLayerWeights[cell];
-                gateLayerBiasWeights=latestState->candidateGateLayerBiasWeights[cell];
+                gateLayerWeights=latestState->candidateGateLayerWeights[network];
+                gateLayerBiasWeights=latestState->candidateGateLayerBiasWeights[network];
                 previousGateWeightDeltas=previousCandidateGateWeightDeltas;
                 previousGateBiasWeightDeltas=previousCandidateGateBiasWeightDeltas;
-                gateLayerWeightDiffs=wg_diff[cell];
-                gateLayerBiasWeightDiffs=ibg_diff[cell];
+                gateLayerWeightDiffs=wg_diff[network];
+                gateLayerBiasWeightDiffs=ibg_diff[network];
                 gateHiddenLayerCount=candidateGateHiddenLayerCount;
                 gateHiddenLayerNeuronCounts=candidateGateHiddenLayerNeuronCounts;
                 gateErrorTerms=g_errorTerms;
@@ -982,8 +1044,10 @@ void LSTM::learn(double **desiredOutputs)
             for(uint32_t _currentLayer=gateHiddenLayerCount+1/*Include topmost output layer*/;_currentLayer>0;_currentLayer--)
             {
                 uint32_t currentLayer=_currentLayer-1;
-                uint32_t neuronsInThisLayer=currentLayer==gateHiddenLayerCount/*Is topmost output layer?*/?inputAndOutputCount:gateHiddenLayerNeuronCounts[currentLayer];
+                uint32_t neuronsInThisLayer=currentLayer==gateHiddenLayerCount/*Is topmost output layer?*/?gateNetworkOutputCount:gateHiddenLayerNeuronCounts[currentLayer];
                 uint32_t neuronsInPreviousLayer=currentLayer==0?inputAndOutputCount:gateHiddenLayerNeuronCounts[currentLayer-1];
+                uint32_t *rowStarts=sparsity!=0?sparsity->rowStarts[gate-1][network][currentLayer]:0;
+                uint32_t *columns=sparsity!=0?sparsity->columns[gate-1][network][currentLayer]:0;
                 for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
                 {
                     // Adjust bias of this neuron
@@ -992,8 +1056,11 @@ void LSTM::learn(double **desiredOutputs)
                     double biasWeightDelta=(1.0-gateNetworkMomentum)*-gateNetworkLearningRate*gateLayerBiasWeightDiffs[currentLayer][neuronInThisLayer]+gateNetworkMomentum*previousBiasWeightDelta-gateNetworkWeightDecay*currentBiasWeight;
                     gateLayerBiasWeights[currentLayer][neuronInThisLayer]+=biasWeightDelta;
                     previousGateBiasWeightDeltas[currentLayer][neuronInThisLayer]=biasWeightDelta;
-                    for(uint32_t neuronInPreviousLayer=0;neuronInPreviousLayer<neuronsInPreviousLayer;neuronInPreviousLayer++)
+                    // Pruned networks only adjust the kept weights, so the pruned ones stay 0.
+                    uint32_t keptEnd=rowStarts!=0?rowStarts[neuronInThisLayer+1]:neuronsInPreviousLayer;
+                    for(uint32_t kept=rowStarts!=0?rowStarts[neuronInThisLayer]:0;kept<keptEnd;kept++)
                     {
+                        uint32_t neuronInPreviousLayer=columns!=0?columns[kept]:kept;
                         // Adjust weight from neuronInPreviousLayer to neuronInThisLayer
                         double currentWeight=gateLayerWeights[currentLayer][neuronInThisLayer][neuronInPreviousLayer];
                         double previousWeightDelta=previousGateWeightDeltas[currentLayer][neuronInThisLayer][neuronInPreviousLayer];
@@ -1001,22 +1068,26 @@ void LSTM::learn(double **desiredOutputs)
                         gateLayerWeights[currentLayer][neuronInThisLayer][neuronInPreviousLayer]+=weightDelta;
                         previousGateWeightDeltas[currentLayer][neuronInThisLayer][neuronInPreviousLayer]=weightDelta;
                     }
-                    free(gateLayerWeightDiffs[currentLayer][neuronInThisLayer]);
+                    LSTMAllocations::release(gateLayerWeightDiffs[currentLayer][neuronInThisLayer]);
                 }
-                free(gateLayerBiasWeightDiffs[currentLayer]);
-                free(gateLayerWeightDiffs[currentLayer]);
-                free(gateErrorTerms[cell][currentLayer]);
+                LSTMAllocations::release(gateLayerBiasWeightDiffs[currentLayer]);
+                LSTMAllocations::release(gateLayerWeightDiffs[currentLayer]);
+                LSTMAllocations::release(gateErrorTerms[network][currentLayer]);
             }
-            free(gateLayerBiasWeightDiffs);
-            free(gateLayerWeightDiffs);
+            LSTMAllocations::release(gateLayerBiasWeightDiffs);
+            LSTMAllocations::release(gateLayerWeightDiffs);
         }
 
         // Free error terms
-        free(i_errorTerms[cell]);
-        free(f_errorTerms[cell]);
-        free(o_errorTerms[cell]);
-        free(g_errorTerms[cell]);
+        LSTMAllocations::release(i_errorTerms[network]);
+        if(latestState->hasForgetGateNetwork())
+            LSTMAllocations::release(f_errorTerms[network]);
+        LSTMAllocations::release(o_errorTerms[network]);
+        LSTMAllocations::release(g_errorTerms[network]);
+    }
 
+    for(uint32_t cell=0;cell<cellCount;cell++)
+    {
         double previousInputGateValueSumBiasWeightDelta=previousInputGateValueSumBiasWeightDeltas[cell];
         double previousForgetGateValueSumBiasWeightDelta=previousForgetGateValueSumBiasWeightDeltas[cell];
         double previousOutputGateValueSumBiasWeightDelta=previousOutputGateValueSumBiasWeightDeltas[cell];
@@ -1030,7 +1101,8 @@ void LSTM::learn(double **desiredOutputs)
         double outputGateValueSumBiasWeightDelta=(1.0-momentum)*-learningRate*bo_diff[cell]+momentum*previousOutputGateValueSumBiasWeightDelta-weightDecay*currentOutputGateValueSumBiasWeight;
         double candidateGateValueSumBiasWeightDelta=(1.0-momentum)*-learningRate*bg_diff[cell]+momentum*previousCandidateGateValueSumBiasWeightDelta-weightDecay*currentCandidateGateValueSumBiasWeight;
         latestState->inputGateValueSumBiasWeights[cell]+=inputGateValueSumBiasWeightDelta;
-        latestState->forgetGateValueSumBiasWeights[cell]+=forgetGateValueSumBiasWeightDelta;
+        if(latestState->hasForgetGateNetwork())
+            latestState->forgetGateValueSumBiasWeights[cell]+=forgetGateValueSumBiasWeightDelta;
         latestState->outputGateValueSumBiasWeights[cell]+=outputGateValueSumBiasWeightDelta;
         latestState->candidateGateValueSumBiasWeights[cell]+=candidateGateValueSumBiasWeightDelta;
         previousInputGateValueSumBiasWeightDeltas[cell]=forgetGateValueSumBiasWeightDelta;
@@ -1039,20 +1111,877 @@ void LSTM::learn(double **desiredOutputs)
         previousCandidateGateValueSumBiasWeightDeltas[cell]=candidateGateValueSumBiasWeightDelta;
     }
 
-    free(i_errorTerms);
-    free(f_errorTerms);
-    free(o_errorTerms);
-    free(g_errorTerms);
-    free(wi_diff);
-    free(wf_diff);
-    free(wo_diff);
-    free(wg_diff);
-    free(ibi_diff);
-    free(ibf_diff);
-    free(ibo_diff);
-    free(ibg_diff);
-    free(bi_diff);
-    free(bf_diff);
-    free(bo_diff);
-    free(bg_diff);
+    LSTMAllocations::release(i_errorTerms);
+    LSTMAllocations::release(f_errorTerms);
+    LSTMAllocations::release(o_errorTerms);
+    LSTMAllocations::release(g_errorTerms);
+    LSTMAllocations::release(wi_diff);
+    LSTMAllocations::release(wf_diff);
+    LSTMAllocations::release(wo_diff);
+    LSTMAllocations::release(wg_diff);
+    LSTMAllocations::release(ibi_diff);
+    LSTMAllocations::release(ibf_diff);
+    LSTMAllocations::release(ibo_diff);
+    LSTMAllocations::release(ibg_diff);
+    LSTMAllocations::release(bi_diff);
+    LSTMAllocations::release(bf_diff);
+    LSTMAllocations::release(bo_diff);
+    LSTMAllocations::release(bg_diff);
+    LSTMAllocations::release(resetPreviousOutputs);
+    LSTMAllocations::release(errorTermSums);
+    LSTMAllocations::release(bottommostLayerInputs);
+
+    if(outputProjection)
+    {
+        for(uint32_t projectionOutput=0;projectionOutput<outputCount;projectionOutput++)
+        {
+            double *projectionWeights=latestState->outputProjectionWeights[projectionOutput];
+            double *previousProjectionWeightDeltas=previousOutputProjectionWeightDeltas[projectionOutput];
+            for(uint32_t cell=0;cell<cellCount;cell++)
+            {
+                double weightDelta=(1.0-momentum)*-learningRate*wy_diff[projectionOutput][cell]+momentum*previousProjectionWeightDeltas[cell]-weightDecay*projectionWeights[cell];
+                projectionWeights[cell]+=weightDelta;
+                previousProjectionWeightDeltas[cell]=weightDelta;
+            }
+            double biasWeightDelta=(1.0-momentum)*-learningRate*by_diff[projectionOutput]+momentum*previousOutputProjectionBiasWeightDeltas[projectionOutput]-weightDecay*latestState->outputProjectionBiasWeights[projectionOutput];
+            latestState->outputProjectionBiasWeights[projectionOutput]+=biasWeightDelta;
+            previousOutputProjectionBiasWeightDeltas[projectionOutput]=biasWeightDelta;
+            LSTMAllocations::release(wy_diff[projectionOutput]);
+        }
+        LSTMAllocations::release(wy_diff);
+        LSTMAllocations::release(by_diff);
+        LSTMAllocations::release(projectedOutput);
+    }
+}
+
+LSTMStats LSTM::stats()
+{
+    return phaseStats;
+}
+
+void LSTM::resetStats()
+{
+    phaseStats.reset();
+}
+
+LSTMSession *LSTM::createSession()
+{
+    return new LSTMSession(cellCount);
+}
+
+void LSTM::destroySession(LSTMSession *session)
+{
+    delete session;
+}
+
+uint32_t LSTM::getSessionScratchSize()
+{
+    return getWeightState()->getSessionScratchSize();
+}
+
+double *LSTM::processSession(LSTMSession *session, double *input, double *output, double *scratch)
+{
+    LSTMState *weightState=getWeightState();
+    if(output==0)
+        output=(double*)LSTMAllocations::allocateOutput(outputCount*sizeof(double));
+    bool allocateScratch=scratch==0;
+    if(allocateScratch)
+        scratch=(double*)LSTMAllocations::allocate(weightState->getSessionScratchSize()*sizeof(double),LSTMAllocationCategory_scratch);
+    uint8_t gateNetworkActivations[4]={forgetGateNetworkActivation,inputGateNetworkActivation,outputGateNetworkActivation,candidateGateNetworkActivation};
+    weightState->processSession(session,input,output,scratch,gateNetworkActivations);
+    if(allocateScratch)
+        LSTMAllocations::release(scratch);
+    return output;
+}
+
+// Calls visit(gate,network,layer,weights,neuronsInThisLayer,neuronsInLastLayer) for each layer of each gate network of "state".
+template<typename Visitor> static void visitGateNetworkLayers(LSTMState *state, Visitor visit)
+{
+    double ****gateLayerWeights[4]={state->forgetGateLayerWeights,state->inputGateLayerWeights,state->outputGateLayerWeights,state->candidateGateLayerWeights};
+    uint32_t gateTotalLayerCounts[4]={state->forgetGateTotalLayerCount,state->inputGateTotalLayerCount,state->outputGateTotalLayerCount,state->candidateGateTotalLayerCount};
+    uint32_t *gateHiddenLayerNeuronCounts[4]={state->forgetGateHiddenLayerNeuronCounts,state->inputGateHiddenLayerNeuronCounts,state->outputGateHiddenLayerNeuronCounts,state->candidateGateHiddenLayerNeuronCounts};
+    for(uint8_t gate=0;gate<4;gate++)
+    {
+        for(uint32_t network=0;network<state->gateNetworkCount;network++)
+        {
+            uint32_t neuronsInLastLayer=state->inputAndOutputCount;
+            for(uint32_t thisLayer=0;thisLayer<gateTotalLayerCounts[gate];thisLayer++)
+            {
+                uint32_t neuronsInThisLayer=thisLayer==gateTotalLayerCounts[gate]-1?state->gateNetworkOutputCount:gateHiddenLayerNeuronCounts[gate][thisLayer];
+                visit(gate,network,thisLayer,gateLayerWeights[gate][network][thisLayer],neuronsInThisLayer,neuronsInLastLayer);
+                neuronsInLastLayer=neuronsInThisLayer;
+            }
+        }
+    }
+}
+
+// Returns the largest magnitude to prune so that "targetSparsity" of the "count" magnitudes are pruned (reorders "magnitudes"), or -1 if none.
+static double getPruningThreshold(double *magnitudes, fs_t count, double targetSparsity)
+{
+    fs_t prunedCount=(fs_t)(targetSparsity*count);
+    if(prunedCount==0)
+        return -1.0;
+    if(prunedCount>count)
+        prunedCount=count;
+    std::nth_element(magnitudes,magnitudes+prunedCount-1,magnitudes+count);
+    return magnitudes[prunedCount-1];
+}
+
+void LSTM::prune(double targetSparsity, bool perLayer)
+{
+    LSTMState *weightState=getWeightState();
+    if(weightState->externalWeights)
+    {
+        // Mapped weights are read-only, so the template state gets its own copy first.
+        templateState=new LSTMState(weightState);
+        delete weightState;
+        weightState=templateState;
+    }
+    bool forgetGateNetwork=weightState->hasForgetGateNetwork();
+
+    double globalThreshold=-1.0;
+    if(!perLayer)
+    {
+        fs_t weightCount=0;
+        visitGateNetworkLayers(weightState,[&](uint8_t gate,uint32_t,uint32_t,double **,uint32_t neuronsInThisLayer,uint32_t neuronsInLastLayer)
+        {
+            if(gate>0||forgetGateNetwork)
+                weightCount+=(fs_t)neuronsInThisLayer*neuronsInLastLayer;
+        });
+        double *magnitudes=(double*)LSTMAllocations::allocate(weightCount*sizeof(double),LSTMAllocationCategory_scratch);
+        fs_t pos=0;
+        visitGateNetworkLayers(weightState,[&](uint8_t gate,uint32_t,uint32_t,double **weights,uint32_t neuronsInThisLayer,uint32_t neuronsInLastLayer)
+        {
+            if(gate==0&&!forgetGateNetwork)
+                return;
+            for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
+            {
+                for(uint32_t neuronInLastLayer=0;neuronInLastLayer<neuronsInLastLayer;neuronInLastLayer++)
+                    magnitudes[pos++]=fabs(weights[neuronInThisLayer][neuronInLastLayer]);
+            }
+        });
+        globalThreshold=getPruningThreshold(magnitudes,weightCount,targetSparsity);
+        LSTMAllocations::release(magnitudes);
+    }
+
+    double *layerMagnitudes=perLayer?(double*)LSTMAllocations::allocate((fs_t)weightState->getWidestGateLayerNeuronCount()*weightState->getWidestGateLayerNeuronCount()*sizeof(double),LSTMAllocationCategory_scratch):0;
+    visitGateNetworkLayers(weightState,[&](uint8_t gate,uint32_t,uint32_t,double **weights,uint32_t neuronsInThisLayer,uint32_t neuronsInLastLayer)
+    {
+        double threshold=globalThreshold;
+        if(gate==0&&!forgetGateNetwork)
+            threshold=HUGE_VAL;
+        else if(perLayer)
+        {
+            fs_t pos=0;
+            for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
+            {
+                for(uint32_t neuronInLastLayer=0;neuronInLastLayer<neuronsInLastLayer;neuronInLastLayer++)
+                    layerMagnitudes[pos++]=fabs(weights[neuronInThisLayer][neuronInLastLayer]);
+            }
+            threshold=getPruningThreshold(layerMagnitudes,pos,targetSparsity);
+        }
+        for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
+        {
+            for(uint32_t neuronInLastLayer=0;neuronInLastLayer<neuronsInLastLayer;neuronInLastLayer++)
+            {
+                if(fabs(weights[neuronInThisLayer][neuronInLastLayer])<=threshold)
+                    weights[neuronInThisLayer][neuronInLastLayer]=0.0;
+            }
+        }
+    });
+    LSTMAllocations::release(layerMagnitudes);
+    buildSparsity();
+}
+
+void LSTM::buildSparsity()
+{
+    LSTMSparsity *previousSparsity=sparsity;
+    sparsity=new LSTMSparsity(getWeightState());
+    setStateSparsity();
+    if(previousSparsity!=0)
+        delete previousSparsity;
+}
+
+void LSTM::clearSparsity()
+{
+    if(sparsity==0)
+        return;
+    LSTMSparsity *previousSparsity=sparsity;
+    sparsity=0;
+    setStateSparsity();
+    delete previousSparsity;
+}
+
+void LSTM::setStateSparsity()
+{
+    if(templateState!=0)
+        templateState->sparsity=sparsity;
+    if(stateArrayPos!=0xffffffff)
+    {
+        for(uint32_t stepsBack=0;stepsBack<=getAvailableStepsBack();stepsBack++)
+            getState(stepsBack)->sparsity=sparsity;
+    }
+}
+
+void LSTM::copyParametersFrom(LSTM *source, bool includeMomentum)
+{
+    learningRate=source->learningRate;
+    momentum=source->momentum;
+    weightDecay=source->weightDecay;
+    forgetGateNetworkLearningRate=source->forgetGateNetworkLearningRate;
+    inputGateNetworkLearningRate=source->inputGateNetworkLearningRate;
+    outputGateNetworkLearningRate=source->outputGateNetworkLearningRate;
+    candidateGateNetworkLearningRate=source->candidateGateNetworkLearningRate;
+    forgetGateNetworkMomentum=source->forgetGateNetworkMomentum;
+    inputGateNetworkMomentum=source->inputGateNetworkMomentum;
+    outputGateNetworkMomentum=source->outputGateNetworkMomentum;
+    candidateGateNetworkMomentum=source->candidateGateNetworkMomentum;
+    forgetGateNetworkWeightDecay=source->forgetGateNetworkWeightDecay;
+    inputGateNetworkWeightDecay=source->inputGateNetworkWeightDecay;
+    outputGateNetworkWeightDecay=source->outputGateNetworkWeightDecay;
+    candidateGateNetworkWeightDecay=source->candidateGateNetworkWeightDecay;
+    forgetGateNetworkActivation=source->forgetGateNetworkActivation;
+    inputGateNetworkActivation=source->inputGateNetworkActivation;
+    outputGateNetworkActivation=source->outputGateNetworkActivation;
+    candidateGateNetworkActivation=source->candidateGateNetworkActivation;
+    getWeightState()->copyWeightsFrom(source->getWeightState());
+    // The pruned weights of "source" are 0 in the copied weights, so its pattern follows from them.
+    if(source->sparsity!=0)
+        buildSparsity();
+    else if(sparsity!=0)
+        clearSparsity();
+    if(!includeMomentum)
+        return;
+
+    uint32_t inputAndOutputCount=inputCount+cellCount;
+    uint32_t gateNetworkOutputCount=getGateNetworkOutputCount();
+    uint32_t gateTotalLayerCounts[4]={forgetGateTotalLayerCount,inputGateTotalLayerCount,outputGateTotalLayerCount,candidateGateTotalLayerCount};
+    uint32_t *gateHiddenLayerNeuronCounts[4]={forgetGateHiddenLayerNeuronCounts,inputGateHiddenLayerNeuronCounts,outputGateHiddenLayerNeuronCounts,candidateGateHiddenLayerNeuronCounts};
+    double ***previousGateWeightDeltas[4]={previousForgetGateWeightDeltas,previousInputGateWeightDeltas,previousOutputGateWeightDeltas,previousCandidateGateWeightDeltas};
+    double ***sourcePreviousGateWeightDeltas[4]={source->previousForgetGateWeightDeltas,source->previousInputGateWeightDeltas,source->previousOutputGateWeightDeltas,source->previousCandidateGateWeightDeltas};
+    double **previousGateBiasWeightDeltas[4]={previousForgetGateBiasWeightDeltas,previousInputGateBiasWeightDeltas,previousOutputGateBiasWeightDeltas,previousCandidateGateBiasWeightDeltas};
+    double **sourcePreviousGateBiasWeightDeltas[4]={source->previousForgetGateBiasWeightDeltas,source->previousInputGateBiasWeightDeltas,source->previousOutputGateBiasWeightDeltas,source->previousCandidateGateBiasWeightDeltas};
+    double *previousGateValueSumBiasWeightDeltas[4]={previousForgetGateValueSumBiasWeightDeltas,previousInputGateValueSumBiasWeightDeltas,previousOutputGateValueSumBiasWeightDeltas,previousCandidateGateValueSumBiasWeightDeltas};
+    double *sourcePreviousGateValueSumBiasWeightDeltas[4]={source->previousForgetGateValueSumBiasWeightDeltas,source->previousInputGateValueSumBiasWeightDeltas,source->previousOutputGateValueSumBiasWeightDeltas,source->previousCandidateGateValueSumBiasWeightDeltas};
+    for(uint8_t gate=0;gate<4;gate++)
+    {
+        uint32_t neuronsInPreviousLayer=inputAndOutputCount;
+        for(uint32_t currentLayer=0;currentLayer<gateTotalLayerCounts[gate];currentLayer++)
+        {
+            uint32_t neuronsInThisLayer=currentLayer==gateTotalLayerCounts[gate]-1?gateNetworkOutputCount:gateHiddenLayerNeuronCounts[gate][currentLayer];
+            memcpy(previousGateBiasWeightDeltas[gate][currentLayer],sourcePreviousGateBiasWeightDeltas[gate][currentLayer],neuronsInThisLayer*sizeof(double));
+            for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
+                memcpy(previousGateWeightDeltas[gate][currentLayer][neuronInThisLayer],sourcePreviousGateWeightDeltas[gate][currentLayer][neuronInThisLayer],neuronsInPreviousLayer*sizeof(double));
+            neuronsInPreviousLayer=neuronsInThisLayer;
+        }
+        memcpy(previousGateValueSumBiasWeightDeltas[gate],sourcePreviousGateValueSumBiasWeightDeltas[gate],cellCount*sizeof(double));
+    }
+    if(hasOutputProjection())
+    {
+        for(uint32_t projectionOutput=0;projectionOutput<outputCount;projectionOutput++)
+            memcpy(previousOutputProjectionWeightDeltas[projectionOutput],source->previousOutputProjectionWeightDeltas[projectionOutput],cellCount*sizeof(double));
+        memcpy(previousOutputProjectionBiasWeightDeltas,source->previousOutputProjectionBiasWeightDeltas,outputCount*sizeof(double));
+    }
+}
+
+// Checkpoint layout: see LSTMCheckpointInfo.
+
+// Calls visit(values,count) for the arrays of checkpoint section "section" in the order they are stored. The weights are the ones of
+// "weightState", the momentum buffers the ones of "lstm". "values" may be changed to point elsewhere.
+template<typename Visitor> static void visitCheckpointSection(LSTM *lstm, LSTMState *weightState, uint8_t section, Visitor visit)
+{
+    uint8_t gate=section%4;
+    uint32_t inputAndOutputCount=lstm->inputCount+lstm->cellCount;
+    uint32_t gateNetworkOutputCount=lstm->getGateNetworkOutputCount();
+    uint32_t gateHiddenLayerCounts[4]={lstm->forgetGateHiddenLayerCount,lstm->inputGateHiddenLayerCount,lstm->outputGateHiddenLayerCount,lstm->candidateGateHiddenLayerCount};
+    uint32_t *gateHiddenLayerNeuronCounts[4]={lstm->forgetGateHiddenLayerNeuronCounts,lstm->inputGateHiddenLayerNeuronCounts,lstm->outputGateHiddenLayerNeuronCounts,lstm->candidateGateHiddenLayerNeuronCounts};
+    if(section<4)
+    {
+        double ****gateLayerWeights[4]={weightState->forgetGateLayerWeights,weightState->inputGateLayerWeights,weightState->outputGateLayerWeights,weightState->candidateGateLayerWeights};
+        double ***gateLayerBiasWeights[4]={weightState->forgetGateLayerBiasWeights,weightState->inputGateLayerBiasWeights,weightState->outputGateLayerBiasWeights,weightState->candidateGateLayerBiasWeights};
+        double **gateValueSumBiasWeights[4]={&weightState->forgetGateValueSumBiasWeights,&weightState->inputGateValueSumBiasWeights,&weightState->outputGateValueSumBiasWeights,&weightState->candidateGateValueSumBiasWeights};
+        visit(*gateValueSumBiasWeights[gate],lstm->cellCount);
+        for(uint32_t cell=0;cell<lstm->getGateNetworkCount();cell++)
+        {
+            uint32_t neuronsInLastLayer=inputAndOutputCount;
+            for(uint32_t thisLayer=0;thisLayer<=gateHiddenLayerCounts[gate];thisLayer++)
+            {
+                uint32_t neuronsInThisLayer=thisLayer==gateHiddenLayerCounts[gate]?gateNetworkOutputCount:gateHiddenLayerNeuronCounts[gate][thisLayer];
+                visit(gateLayerBiasWeights[gate][cell][thisLayer],neuronsInThisLayer);
+                for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
+                    visit(gateLayerWeights[gate][cell][thisLayer][neuronInThisLayer],neuronsInLastLayer);
+                neuronsInLastLayer=neuronsInThisLayer;
+            }
+        }
+    }
+    else if(section>=LSTM_CHECKPOINT_OUTPUT_PROJECTION_SECTION)
+    {
+        if(!lstm->hasOutputProjection())
+            return;
+        bool momentum=section==LSTM_CHECKPOINT_OUTPUT_PROJECTION_MOMENTUM_SECTION;
+        double **projectionWeights=momentum?lstm->previousOutputProjectionWeightDeltas:weightState->outputProjectionWeights;
+        for(uint32_t projectionOutput=0;projectionOutput<lstm->outputCount;projectionOutput++)
+            visit(projectionWeights[projectionOutput],lstm->cellCount);
+        visit(momentum?lstm->previousOutputProjectionBiasWeightDeltas:weightState->outputProjectionBiasWeights,lstm->outputCount);
+    }
+    else
+    {
+        double ***previousGateWeightDeltas[4]={lstm->previousForgetGateWeightDeltas,lstm->previousInputGateWeightDeltas,lstm->previousOutputGateWeightDeltas,lstm->previousCandidateGateWeightDeltas};
+        double **previousGateBiasWeightDeltas[4]={lstm->previousForgetGateBiasWeightDeltas,lstm->previousInputGateBiasWeightDeltas,lstm->previousOutputGateBiasWeightDeltas,lstm->previousCandidateGateBiasWeightDeltas};
+        double **previousGateValueSumBiasWeightDeltas[4]={&lstm->previousForgetGateValueSumBiasWeightDeltas,&lstm->previousInputGateValueSumBiasWeightDeltas,&lstm->previousOutputGateValueSumBiasWeightDeltas,&lstm->previousCandidateGateValueSumBiasWeightDeltas};
+        uint32_t neuronsInLastLayer=inputAndOutputCount;
+        for(uint32_t thisLayer=0;thisLayer<=gateHiddenLayerCounts[gate];thisLayer++)
+        {
+            uint32_t neuronsInThisLayer=thisLayer==gateHiddenLayerCounts[gate]?gateNetworkOutputCount:gateHiddenLayerNeuronCounts[gate][thisLayer];
+            visit(previousGateBiasWeightDeltas[gate][thisLayer],neuronsInThisLayer);
+            for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
+                visit(previousGateWeightDeltas[gate][thisLayer][neuronInThisLayer],neuronsInLastLayer);
+            neuronsInLastLayer=neuronsInThisLayer;
+        }
+        visit(*previousGateValueSumBiasWeightDeltas[gate],lstm->cellCount);
+    }
+}
+
+// Reads a section (which must have been validated) into "lstm".
+static void readCheckpointSection(LSTM *lstm, uint8_t section, char *sectionData)
+{
+    bool systemIsLittleEndian=io::getSystemIsLittleEndian();
+    fs_t pos=0;
+    visitCheckpointSection(lstm,lstm->getWeightState(),section,[&](double *&values,fs_t count)
+    {
+        io::posBasedReadDoubles(sectionData,pos,values,count,systemIsLittleEndian);
+    });
+}
+
+uint64_t LSTM::getTopologyFingerprint()
+{
+    uint32_t gateHiddenLayerCounts[4]={forgetGateHiddenLayerCount,inputGateHiddenLayerCount,outputGateHiddenLayerCount,candidateGateHiddenLayerCount};
+    uint32_t *gateHiddenLayerNeuronCounts[4]={forgetGateHiddenLayerNeuronCounts,inputGateHiddenLayerNeuronCounts,outputGateHiddenLayerNeuronCounts,candidateGateHiddenLayerNeuronCounts};
+    return LSTMCheckpointInfo::getTopologyFingerprint(inputCount,outputCount,cellCount,gateHiddenLayerCounts,gateHiddenLayerNeuronCounts,sharedGateNetworks,cellVariant);
+}
+
+fs_t LSTM::getSerializedSize(bool includeMomentum)
+{
+    uint32_t gateHiddenLayerCounts[4]={forgetGateHiddenLayerCount,inputGateHiddenLayerCount,outputGateHiddenLayerCount,candidateGateHiddenLayerCount};
+    uint32_t *gateHiddenLayerNeuronCounts[4]={forgetGateHiddenLayerNeuronCounts,inputGateHiddenLayerNeuronCounts,outputGateHiddenLayerNeuronCounts,candidateGateHiddenLayerNeuronCounts};
+    uint32_t sectionCount;
+    fs_t sectionOffsets[LSTM_CHECKPOINT_MAX_SECTION_COUNT];
+    fs_t sectionSizes[LSTM_CHECKPOINT_MAX_SECTION_COUNT];
+    fs_t headerSize=LSTMCheckpointInfo::getHeaderSize(LSTM_CHECKPOINT_VERSION,gateHiddenLayerCounts[0]+gateHiddenLayerCounts[1]+gateHiddenLayerCounts[2]+gateHiddenLayerCounts[3],LSTMCheckpointInfo::getSectionCount(LSTM_CHECKPOINT_VERSION,includeMomentum));
+    LSTMCheckpointInfo::getSectionLayout(LSTM_CHECKPOINT_VERSION,headerSize,inputCount,outputCount,cellCount,gateHiddenLayerCounts,gateHiddenLayerNeuronCounts,sharedGateNetworks,includeMomentum,sectionCount,sectionOffsets,sectionSizes);
+    return sectionOffsets[sectionCount-1]+sectionSizes[sectionCount-1];
+}
+
+void LSTM::serialize(BufferWriter *writer, bool includeMomentum)
+{
+    LSTMState *weightState=getWeightState();
+    uint32_t gateHiddenLayerCounts[4]={forgetGateHiddenLayerCount,inputGateHiddenLayerCount,outputGateHiddenLayerCount,candidateGateHiddenLayerCount};
+    uint32_t *gateHiddenLayerNeuronCounts[4]={forgetGateHiddenLayerNeuronCounts,inputGateHiddenLayerNeuronCounts,outputGateHiddenLayerNeuronCounts,candidateGateHiddenLayerNeuronCounts};
+    double gateNetworkLearningRates[4]={forgetGateNetworkLearningRate,inputGateNetworkLearningRate,outputGateNetworkLearningRate,candidateGateNetworkLearningRate};
+    double gateNetworkMomentums[4]={forgetGateNetworkMomentum,inputGateNetworkMomentum,outputGateNetworkMomentum,candidateGateNetworkMomentum};
+    double gateNetworkWeightDecays[4]={forgetGateNetworkWeightDecay,inputGateNetworkWeightDecay,outputGateNetworkWeightDecay,candidateGateNetworkWeightDecay};
+
+    // The section table precedes the sections, so their hashes are calculated from the weights first.
+    uint32_t sectionCount;
+    fs_t sectionOffsets[LSTM_CHECKPOINT_MAX_SECTION_COUNT];
+    fs_t sectionSizes[LSTM_CHECKPOINT_MAX_SECTION_COUNT];
+    uint64_t sectionHashes[LSTM_CHECKPOINT_MAX_SECTION_COUNT];
+    fs_t headerSize=LSTMCheckpointInfo::getHeaderSize(LSTM_CHECKPOINT_VERSION,gateHiddenLayerCounts[0]+gateHiddenLayerCounts[1]+gateHiddenLayerCounts[2]+gateHiddenLayerCounts[3],LSTMCheckpointInfo::getSectionCount(LSTM_CHECKPOINT_VERSION,includeMomentum));
+    LSTMCheckpointInfo::getSectionLayout(LSTM_CHECKPOINT_VERSION,headerSize,inputCount,outputCount,cellCount,gateHiddenLayerCounts,gateHiddenLayerNeuronCounts,sharedGateNetworks,includeMomentum,sectionCount,sectionOffsets,sectionSizes);
+    for(uint8_t section=0;section<sectionCount;section++)
+    {
+        uint64_t hash=IO_HASH64_INITIAL_VALUE;
+        if(sectionSizes[section]>0) // Also skips the momentum sections if they are not included
+            visitCheckpointSection(this,weightState,section,[&hash](double *&values,fs_t count)
+        {
+            hash=io::hash64Doubles(values,count,hash);
+        });
+        sectionHashes[section]=hash;
+    }
+
+    // Header (built in memory, as its checksum covers all of it)
+    bool systemIsLittleEndian=io::getSystemIsLittleEndian();
+    char *header=(char*)calloc(headerSize,1); // The padding stays 0.
+    fs_t pos=0;
+    io::writeRawData(header,"LSTM",4,pos);
+    io::writeUInt32(header,LSTM_CHECKPOINT_VERSION,pos);
+    io::writeUInt32(header,(includeMomentum?1:0)|(sharedGateNetworks?2:0)|(cellVariant<<2)|(sparsity!=0?16:0),pos);
+    io::writeUInt32(header,(uint32_t)headerSize,pos);
+    io::writeUInt32(header,inputCount,pos);
+    io::writeUInt32(header,outputCount,pos);
+    io::writeUInt32(header,backpropagationSteps,pos);
+    io::writeUInt32(header,sectionCount,pos);
+    io::writeUInt64(header,getTopologyFingerprint(),pos);
+    io::writeUInt64(header,0,pos); // Checksum
+    io::writeUInt32(header,cellCount,pos);
+    io::writeUInt32(header,forgetGateNetworkActivation,pos);
+    io::writeUInt32(header,inputGateNetworkActivation,pos);
+    io::writeUInt32(header,outputGateNetworkActivation,pos);
+    io::writeUInt32(header,candidateGateNetworkActivation,pos);
+    for(uint8_t gate=0;gate<4;gate++)
+    {
+        io::writeUInt32(header,gateHiddenLayerCounts[gate],pos);
+        io::writeUInt32s(header,gateHiddenLayerNeuronCounts[gate],gateHiddenLayerCounts[gate],pos);
+    }
+    io::writeDouble(header,learningRate,pos,systemIsLittleEndian);
+    io::writeDouble(header,momentum,pos,systemIsLittleEndian);
+    io::writeDouble(header,weightDecay,pos,systemIsLittleEndian);
+    for(uint8_t gate=0;gate<4;gate++)
+    {
+        io::writeDouble(header,gateNetworkLearningRates[gate],pos,systemIsLittleEndian);
+        io::writeDouble(header,gateNetworkMomentums[gate],pos,systemIsLittleEndian);
+        io::writeDouble(header,gateNetworkWeightDecays[gate],pos,systemIsLittleEndian);
+    }
+    pos=headerSize-sectionCount*3*sizeof(uint64_t);
+    for(uint8_t section=0;section<sectionCount;section++)
+    {
+        io::writeUInt64(header,sectionOffsets[section],pos);
+        io::writeUInt64(header,sectionSizes[section],pos);
+        io::writeUInt64(header,sectionHashes[section],pos);
+    }
+    io::putUInt64(header,io::hash64(header,headerSize),40);
+    writer->writeRawData(header,headerSize);
+    free(header);
+
+    for(uint8_t section=0;section<sectionCount;section++)
+    {
+        if(sectionSizes[section]>0)
+            visitCheckpointSection(this,weightState,section,[writer](double *&values,fs_t count)
+        {
+            writer->writeDoubles(values,count);
+        });
+    }
+}
+
+char *LSTM::serialize(fs_t &size, bool includeMomentum)
+{
+    BufferWriter writer(8);
+    writer.reserve(getSerializedSize(includeMomentum)); // One exactly sized block, returned without copying
+    serialize(&writer,includeMomentum);
+    return writer.detach(size);
+}
+
+bool LSTM::save(const char *filePath, bool includeMomentum)
+{
+    // Streamed through one fixed-size buffer, so saving does not need memory for the whole checkpoint.
+    FILE *f=fopen(filePath,"wb");
+    if(f==0)
+        return false;
+    BufferWriter writer(f);
+    serialize(&writer,includeMomentum);
+    bool success=writer.flush();
+    success=fclose(f)==0&&success;
+    return success;
+}
+
+LSTM *LSTM::deserialize(char *data, fs_t size, uint32_t sectionMask)
+{
+    LSTMCheckpointInfo *info=LSTMCheckpointInfo::parse(data,size);
+    if(info==0)
+        return 0;
+    bool valid=info->size==size;
+    for(uint32_t section=0;section<info->sectionCount&&valid;section++)
+    {
+        if((sectionMask&(1U<<section))!=0&&info->hasSectionHashes)
+            valid=io::hash64(data+info->sectionOffsets[section],info->sectionSizes[section])==info->sectionHashes[section];
+    }
+    LSTM *lstm=0;
+    if(valid)
+    {
+        // No state has been pushed yet, so the weights are read into the template state the first state will be copied from.
+        lstm=info->createLSTM();
+        for(uint32_t section=0;section<info->sectionCount;section++)
+        {
+            if((sectionMask&(1U<<section))!=0&&info->sectionSizes[section]>0)
+                readCheckpointSection(lstm,section,data+info->sectionOffsets[section]);
+        }
+        if(info->pruned)
+            lstm->buildSparsity();
+    }
+    delete info;
+    return lstm;
+}
+
+LSTM *LSTM::load(const char *filePath)
+{
+    fs_t size;
+    char *data=readCheckpoint(filePath,size);
+    if(data==0)
+        return 0;
+    LSTM *lstm=deserialize(data,size);
+    free(data);
+    return lstm;
+}
+
+static bool seekFile(FILE *f, fs_t offset)
+{
+#ifdef _WIN32
+    return _fseeki64(f,(__int64)offset,SEEK_SET)==0;
+#else
+    return fseeko(f,(off_t)offset,SEEK_SET)==0;
+#endif
+}
+
+LSTM *LSTM::loadSections(const char *filePath, uint32_t sectionMask)
+{
+    FILE *f=fopen(filePath,"rb");
+    if(f==0)
+        return 0;
+    LSTMCheckpointInfo *info=LSTMCheckpointInfo::read(f);
+    if(info==0)
+    {
+        // Incremental and version 1 checkpoints have no section table to seek with, so they are read completely.
+        fclose(f);
+        fs_t size;
+        char *data=readCheckpoint(filePath,size);
+        if(data==0)
+            return 0;
+        LSTM *lstm=deserialize(data,size,sectionMask);
+        free(data);
+        return lstm;
+    }
+    LSTM *lstm=info->createLSTM();
+    char *sectionData=0;
+    bool valid=true;
+    for(uint32_t section=0;section<info->sectionCount&&valid;section++)
+    {
+        if((sectionMask&(1U<<section))==0||info->sectionSizes[section]==0)
+            continue;
+        fs_t sectionSize=info->sectionSizes[section];
+        sectionData=(char*)realloc(sectionData,sectionSize);
+        valid=seekFile(f,info->sectionOffsets[section])&&fread(sectionData,1,sectionSize,f)==sectionSize;
+        valid=valid&&io::hash64(sectionData,sectionSize)==info->sectionHashes[section];
+        if(valid)
+            readCheckpointSection(lstm,section,sectionData);
+    }
+    free(sectionData);
+    fclose(f);
+    if(valid&&info->pruned)
+        lstm->buildSparsity();
+    delete info;
+    if(!valid)
+    {
+        delete lstm;
+        return 0;
+    }
+    return lstm;
+}
+
+LSTM *LSTM::loadMapped(const char *filePath)
+{
+    // The weights are stored little-endian and 8-byte aligned (the header is padded), so on little-endian systems they can be used in place.
+    if(!io::getSystemIsLittleEndian())
+        return load(filePath);
+    fs_t size;
+    char *data=io::mapFile(filePath,size);
+    if(data==0)
+        return 0;
+    if(size>=4&&(memcmp(data,"LSTI",4)==0||memcmp(data,"LSTS",4)==0)) // Incremental and sparse checkpoints have to be decoded.
+    {
+        io::unmapFile(data,size);
+        return load(filePath);
+    }
+    // Only the header is validated: checking the section hashes would read all weights.
+    LSTMCheckpointInfo *info=LSTMCheckpointInfo::parse(data,size);
+    if(info==0||info->size!=size)
+    {
+        delete info;
+        io::unmapFile(data,size);
+        return 0;
+    }
+    LSTM *lstm=info->createLSTM();
+    lstm->mappedCheckpoint=data;
+    lstm->mappedCheckpointSize=size;
+
+    // Only the pointer tables are allocated; they are pointed to the weights in the mapping. No weight page is touched here, so they are read
+    // from disk (or shared from the page cache) when they are used first.
+    LSTMState *weightState=lstm->createState(false);
+    lstm->templateState=weightState;
+    for(uint8_t section=0;section<info->sectionCount;section++)
+    {
+        if(info->sectionSizes[section]==0)
+            continue;
+        if(section<4||section==LSTM_CHECKPOINT_OUTPUT_PROJECTION_SECTION)
+        {
+            fs_t pos=info->sectionOffsets[section];
+            visitCheckpointSection(lstm,weightState,section,[&](double *&values,fs_t count)
+            {
+                values=(double*)(data+pos);
+                pos+=count*sizeof(double);
+            });
+        }
+        else // The momentum buffers are updated by learn(), so they are copied.
+            readCheckpointSection(lstm,section,data+info->sectionOffsets[section]);
+    }
+    if(info->pruned)
+        lstm->buildSparsity(); // Reads all weights once
+    delete info;
+    return lstm;
+}
+
+// Incremental checkpoint layout (all values little-endian):
+// Header: "LSTI", version, flags (0), base path length (all uint32), size and hash (io::hash64()) of the resolved checkpoint, size and hash
+//         of the resolved base checkpoint (all uint64), base path (relative to the directory of this file unless absolute), zero padding up to
+//         a multiple of 8 bytes
+// The checkpoint is XORed with its base in 64 bit words. Then per word a nibble with the number of its high bytes which are 0 (0..8; two
+//         nibbles per byte, the first one in the lower bits), followed by the remaining low bytes of all words.
+// As weights change little between checkpoints, sign, exponent and the high mantissa bytes mostly cancel out; unchanged values take 4 bits.
+
+static const char *getFileNameStart(const char *filePath)
+{
+    const char *fileNameStart=filePath;
+    for(const char *c=filePath;*c!=0;c++)
+    {
+        if(*c=='/'||*c=='\\')
+            fileNameStart=c+1;
+    }
+    return fileNameStart;
+}
+
+static bool getPathIsAbsolute(const char *filePath)
+{
+    return filePath[0]=='/'||filePath[0]=='\\'||(filePath[0]!=0&&filePath[1]==':');
+}
+
+char *LSTM::encodeIncrementalCheckpoint(char *data, fs_t size, char *baseData, fs_t baseSize, const char *basePath, fs_t &incrementalSize)
+{
+    incrementalSize=0;
+    if(size!=baseSize||size%sizeof(uint64_t)!=0)
+        return 0;
+    fs_t wordCount=size/sizeof(uint64_t);
+    uint32_t basePathLength=(uint32_t)strlen(basePath);
+    fs_t headerSize=(4+3*sizeof(uint32_t)+4*sizeof(uint64_t)+basePathLength+7)&~(fs_t)7;
+    fs_t controlSize=(wordCount+1)/2;
+    char *out=(char*)calloc(headerSize+controlSize+size,1); // Worst case: nothing cancels out
+    fs_t pos=0;
+    io::writeRawData(out,"LSTI",4,pos);
+    io::writeUInt32(out,LSTM_INCREMENTAL_CHECKPOINT_VERSION,pos);
+    io::writeUInt32(out,0,pos);
+    io::writeUInt32(out,basePathLength,pos);
+    io::writeUInt64(out,size,pos);
+    io::writeUInt64(out,io::hash64(data,size),pos);
+    io::writeUInt64(out,baseSize,pos);
+    io::writeUInt64(out,io::hash64(baseData,baseSize),pos);
+    io::writeRawData(out,basePath,basePathLength,pos);
+
+    char *control=out+headerSize;
+    fs_t payloadPos=headerSize+controlSize;
+    for(fs_t word=0;word<wordCount;word++)
+    {
+        uint64_t difference=io::peekUInt64(data,word*sizeof(uint64_t))^io::peekUInt64(baseData,word*sizeof(uint64_t));
+        uint8_t usedByteCount=0;
+        while(usedByteCount<8&&(difference>>(8*usedByteCount))!=0)
+            usedByteCount++;
+        control[word/2]|=(char)((8-usedByteCount)<<(4*(word%2)));
+        for(uint8_t byte=0;byte<usedByteCount;byte++)
+            out[payloadPos++]=(char)(difference>>(8*byte));
+    }
+    incrementalSize=payloadPos;
+    return (char*)realloc(out,incrementalSize);
+}
+
+// Sparse checkpoint layout (all values little-endian):
+// Header: "LSTS", version, flags (0), 0 (all uint32), size and hash (io::hash64()) of the decoded checkpoint (both uint64)
+// Then a bit per 64 bit word of the decoded checkpoint which is set if the word is not 0 (the first word in the lowest bit of the first byte),
+//         zero padded to a multiple of 8 bytes, followed by the words which are not 0.
+#define LSTM_SPARSE_CHECKPOINT_HEADER_SIZE (4+3*sizeof(uint32_t)+2*sizeof(uint64_t))
+
+char *LSTM::encodeSparseCheckpoint(char *data, fs_t size, fs_t &sparseSize)
+{
+    sparseSize=0;
+    if(size%sizeof(uint64_t)!=0)
+        return 0;
+    fs_t wordCount=size/sizeof(uint64_t);
+    fs_t maskSize=(wordCount+63)/64*sizeof(uint64_t);
+    char *out=(char*)calloc(LSTM_SPARSE_CHECKPOINT_HEADER_SIZE+maskSize+size,1); // Worst case: no word is 0
+    fs_t pos=0;
+    io::writeRawData(out,"LSTS",4,pos);
+    io::writeUInt32(out,LSTM_SPARSE_CHECKPOINT_VERSION,pos);
+    io::writeUInt32(out,0,pos);
+    io::writeUInt32(out,0,pos);
+    io::writeUInt64(out,size,pos);
+    io::writeUInt64(out,io::hash64(data,size),pos);
+
+    char *mask=out+LSTM_SPARSE_CHECKPOINT_HEADER_SIZE;
+    fs_t payloadPos=LSTM_SPARSE_CHECKPOINT_HEADER_SIZE+maskSize;
+    for(fs_t word=0;word<wordCount;word++)
+    {
+        if(io::peekUInt64(data,word*sizeof(uint64_t))==0)
+            continue;
+        mask[word/8]|=(char)(1<<(word%8));
+        memcpy(out+payloadPos,data+word*sizeof(uint64_t),sizeof(uint64_t));
+        payloadPos+=sizeof(uint64_t);
+    }
+    sparseSize=payloadPos;
+    return (char*)realloc(out,sparseSize);
+}
+
+char *LSTM::decodeSparseCheckpoint(char *sparseData, fs_t sparseSize, fs_t &size)
+{
+    size=0;
+    if(sparseSize<LSTM_SPARSE_CHECKPOINT_HEADER_SIZE||memcmp(sparseData,"LSTS",4)!=0||io::peekUInt32(sparseData,4)!=LSTM_SPARSE_CHECKPOINT_VERSION)
+        return 0;
+    fs_t decodedSize=io::peekUInt64(sparseData,16);
+    fs_t wordCount=decodedSize/sizeof(uint64_t);
+    fs_t maskSize=(wordCount+63)/64*sizeof(uint64_t);
+    if(decodedSize%sizeof(uint64_t)!=0||sparseSize-LSTM_SPARSE_CHECKPOINT_HEADER_SIZE<maskSize)
+        return 0;
+    char *mask=sparseData+LSTM_SPARSE_CHECKPOINT_HEADER_SIZE;
+    fs_t payloadPos=LSTM_SPARSE_CHECKPOINT_HEADER_SIZE+maskSize;
+    // The payload size is checked before allocating, so a damaged size field cannot cause a huge allocation.
+    fs_t nonZeroWordCount=0;
+    for(fs_t word=0;word<wordCount;word++)
+        nonZeroWordCount+=(mask[word/8]>>(word%8))&1;
+    if(sparseSize!=payloadPos+nonZeroWordCount*sizeof(uint64_t))
+        return 0;
+    char *data=(char*)calloc(decodedSize,1);
+    for(fs_t word=0;word<wordCount;word++)
+    {
+        if(((mask[word/8]>>(word%8))&1)==0)
+            continue;
+        memcpy(data+word*sizeof(uint64_t),sparseData+payloadPos,sizeof(uint64_t));
+        payloadPos+=sizeof(uint64_t);
+    }
+    if(io::hash64(data,decodedSize)!=io::peekUInt64(sparseData,24))
+    {
+        free(data);
+        return 0;
+    }
+    size=decodedSize;
+    return data;
+}
+
+// Decodes "data" in place if it is a sparse checkpoint.
+static char *resolveSparseCheckpoint(char *data, fs_t &size)
+{
+    if(data==0||size<4||memcmp(data,"LSTS",4)!=0)
+        return data;
+    fs_t sparseSize=size;
+    char *decoded=LSTM::decodeSparseCheckpoint(data,sparseSize,size);
+    free(data);
+    return decoded;
+}
+
+bool LSTM::saveSparse(const char *filePath, bool includeMomentum)
+{
+    fs_t size;
+    char *data=serialize(size,includeMomentum);
+    fs_t sparseSize;
+    char *sparse=encodeSparseCheckpoint(data,size,sparseSize);
+    bool success=sparse!=0&&io::writeFileAtomically(filePath,sparse,sparseSize);
+    free(sparse);
+    free(data);
+    return success;
+}
+
+char *LSTM::readCheckpoint(const char *filePath, fs_t &size)
+{
+    char *data=resolveSparseCheckpoint(io::readFile(filePath,size),size);
+    // Each incremental checkpoint of the chain is kept until its base has been resolved:
+    uint32_t chainLength=0;
+    uint32_t chainSize=8;
+    char **chain=(char**)malloc(chainSize*sizeof(char*));
+    fs_t *chainSizes=(fs_t*)malloc(chainSize*sizeof(fs_t));
+    char *path=(char*)io::fixedLengthDataToString((char*)filePath,strlen(filePath));
+    while(data!=0&&size>=4+3*sizeof(uint32_t)+4*sizeof(uint64_t)&&memcmp(data,"LSTI",4)==0)
+    {
+        uint32_t basePathLength=io::peekUInt32(data,12);
+        if(io::peekUInt32(data,4)!=LSTM_INCREMENTAL_CHECKPOINT_VERSION||chainLength==LSTM_MAX_CHECKPOINT_CHAIN_LENGTH||basePathLength>size-(4+3*sizeof(uint32_t)+4*sizeof(uint64_t)))
+        {
+            free(data);
+            data=0;
+            break;
+        }
+        if(chainLength==chainSize)
+        {
+            chainSize*=2;
+            chain=(char**)realloc(chain,chainSize*sizeof(char*));
+            chainSizes=(fs_t*)realloc(chainSizes,chainSize*sizeof(fs_t));
+        }
+        chain[chainLength]=data;
+        chainSizes[chainLength++]=size;
+        char *basePath=(char*)io::fixedLengthDataToString(data+4+3*sizeof(uint32_t)+4*sizeof(uint64_t),basePathLength);
+        if(!getPathIsAbsolute(basePath))
+        {
+            fs_t directoryLength=(fs_t)(getFileNameStart(path)-path);
+            char *relativePath=basePath;
+            basePath=(char*)malloc(directoryLength+basePathLength+1);
+            memcpy(basePath,path,directoryLength);
+            memcpy(basePath+directoryLength,relativePath,basePathLength+1);
+            free(relativePath);
+        }
+        free(path);
+        path=basePath;
+        data=resolveSparseCheckpoint(io::readFile(path,size),size);
+    }
+    free(path);
+
+    // Apply the differences from the oldest to the newest incremental checkpoint:
+    while(chainLength>0)
+    {
+        char *incremental=chain[--chainLength];
+        fs_t incrementalSize=chainSizes[chainLength];
+        if(data!=0)
+        {
+            fs_t resolvedSize=io::peekUInt64(incremental,16);
+            uint64_t resolvedHash=io::peekUInt64(incremental,24);
+            bool valid=size==io::peekUInt64(incremental,32)&&size==resolvedSize&&size%sizeof(uint64_t)==0&&io::hash64(data,size)==io::peekUInt64(incremental,40);
+            fs_t headerSize=(4+3*sizeof(uint32_t)+4*sizeof(uint64_t)+io::peekUInt32(incremental,12)+7)&~(fs_t)7;
+            fs_t wordCount=size/sizeof(uint64_t);
+            fs_t controlSize=(wordCount+1)/2;
+            valid=valid&&incrementalSize>=headerSize+controlSize;
+            fs_t payloadPos=headerSize+controlSize;
+            for(fs_t word=0;valid&&word<wordCount;word++)
+            {
+                uint8_t usedByteCount=8-(((uint8_t)incremental[headerSize+word/2]>>(4*(word%2)))&15);
+                if(usedByteCount>8||payloadPos+usedByteCount>incrementalSize)
+                {
+                    valid=false;
+                    break;
+                }
+                for(uint8_t byte=0;byte<usedByteCount;byte++)
+                    data[word*sizeof(uint64_t)+byte]^=incremental[payloadPos++];
+            }
+            valid=valid&&payloadPos==incrementalSize&&io::hash64(data,size)==resolvedHash;
+            if(!valid)
+            {
+                free(data);
+                data=0;
+            }
+        }
+        free(incremental);
+    }
+    free(chain);
+    free(chainSizes);
+    if(data==0)
+        size=0;
+    return data;
+}
+
+bool LSTM::saveIncremental(const char *filePath, const char *basePath, bool includeMomentum)
+{
+    if(strcmp(filePath,basePath)==0)
+        return false;
+    fs_t baseSize;
+    char *baseData=readCheckpoint(basePath,baseSize);
+    if(baseData==0)
+        return false;
+    fs_t size;
+    char *data=serialize(size,includeMomentum);
+    fs_t incrementalSize;
+    char *incremental=encodeIncrementalCheckpoint(data,size,baseData,baseSize,getIncrementalBasePath(filePath,basePath),incrementalSize);
+    bool success=incremental!=0&&io::writeFileAtomically(filePath,incremental,incrementalSize);
+    free(incremental);
+    free(data);
+    free(baseData);
+    return success;
+}
+
+const char *LSTM::getIncrementalBasePath(const char *filePath, const char *basePath)
+{
+    const char *fileNameStart=getFileNameStart(filePath);
+    const char *baseFileNameStart=getFileNameStart(basePath);
+    if(fileNameStart-filePath==baseFileNameStart-basePath&&memcmp(filePath,basePath,fileNameStart-filePath)==0)
+        return baseFileNameStart; // Same directory: the checkpoints can be moved together.
+    return basePath;
 }
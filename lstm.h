@@ -10,19 +10,38 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <iostream>
 
+#ifndef __min
+#define __min(a,b) (((a)<(b))?(a):(b)) // Only defined by MSVC's stdlib.h
+#endif
+
+#include "io.h"
+#include "bufferwriter.h"
+#include "lstmcheckpointinfo.h"
 #include "text.h"
 #include "lstmstate.h"
+#include "lstmsession.h"
+#include "lstmstats.h"
+#include "lstmallocations.h"
 
 using namespace std;
 
+#define LSTM_CHECKPOINT_VERSION 4
+#define LSTM_INCREMENTAL_CHECKPOINT_VERSION 1
+#define LSTM_MAX_CHECKPOINT_CHAIN_LENGTH 1000
+#define LSTM_SPARSE_CHECKPOINT_VERSION 1
+
 class LSTM
 {
 public:
     uint32_t stateArrayPos;
     uint32_t stateArraySize;
     LSTMState **states; // Stores previous iterations
+    LSTMState *templateState; // Holds the weights while no state has been pushed yet (e.g. when sessions are processed before process() is called)
+    char *mappedCheckpoint; // Set by loadMapped(); the weights of the template state point into this read-only mapping.
+    fs_t mappedCheckpointSize;
 
     // Dimensions: Layers - neurons in this layer - weights from neurons in previous layer to neurons in this layer
     double ***previousForgetGateWeightDeltas;
@@ -39,6 +58,9 @@ public:
     double *previousInputGateValueSumBiasWeightDeltas;
     double *previousOutputGateValueSumBiasWeightDeltas;
     double *previousCandidateGateValueSumBiasWeightDeltas;
+    // Only if there is an output projection; dimensions: Outputs - cells, and outputs
+    double **previousOutputProjectionWeightDeltas;
+    double *previousOutputProjectionBiasWeightDeltas;
 
     double learningRate;
     double momentum;
@@ -55,8 +77,17 @@ public:
     double inputGateNetworkWeightDecay;
     double outputGateNetworkWeightDecay;
     double candidateGateNetworkWeightDecay;
+    // Activation functions of the gate network neurons (LSTMGateActivation); tanh unless set otherwise
+    uint8_t forgetGateNetworkActivation;
+    uint8_t inputGateNetworkActivation;
+    uint8_t outputGateNetworkActivation;
+    uint8_t candidateGateNetworkActivation;
     uint32_t inputCount;
     uint32_t outputCount;
+    uint32_t cellCount; // Equal to outputCount unless there is an output projection
+    bool sharedGateNetworks; // See the constructor
+    uint8_t cellVariant; // LSTMCellVariant, see the constructor
+    LSTMSparsity *sparsity; // Set by prune(); 0 while the gate networks are dense
     uint32_t backpropagationSteps;
     uint32_t forgetGateHiddenLayerCount;
     uint32_t inputGateHiddenLayerCount;
@@ -70,6 +101,9 @@ public:
     uint32_t *inputGateHiddenLayerNeuronCounts;
     uint32_t *outputGateHiddenLayerNeuronCounts;
     uint32_t *candidateGateHiddenLayerNeuronCounts;
+    // Precision of the activations of the states only kept for learn() (LSTMHistoryPrecision); the 16 bit precisions quarter their memory.
+    uint8_t historyPrecision;
+    LSTMStats phaseStats; // Only filled if compiled with LSTM_PHASE_TIMERS, see stats()
 
     static double sig(double input); // sigmoid function
     static double tanh(double input); // tanh function
@@ -91,15 +125,86 @@ public:
     bool hasState(uint32_t stepsBack);
     uint32_t getAvailableStepsBack();
     LSTMState *getState(uint32_t stepsBack);
+    LSTMState *getWeightState(); // Returns the state holding the current weights
+    LSTMState *createState(bool allocateWeights=true); // With random weights (or, if allocateWeights is false, weight pointer tables only)
+    bool hasOutputProjection();
+    uint32_t getGateNetworkCount(); // Per gate
+    uint32_t getGateNetworkOutputCount(); // Neurons in the topmost layer of a gate network
 
-    // Please note that the cell count is equal to the output count!
-    // To have more cells than outputs (essential in most situations, as it makes the network more powerful), you should use the first n required output values only!
-    LSTM(uint32_t _inputCount,uint32_t _outputCount,uint32_t _backpropagationSteps,double _learningRate,double _momentum,double _weightDecay,double _networkLearningRate=std::numeric_limits<double>::min(),double _networkMomentum=std::numeric_limits<double>::min(),double _networkWeightDecay=std::numeric_limits<double>::min(),uint32_t _forgetGateHiddenLayerCount=0,uint32_t *_forgetGateHiddenLayerNeuronCounts=0,uint32_t _inputGateHiddenLayerCount=0,uint32_t *_inputGateHiddenLayerNeuronCounts=0,uint32_t _outputGateHiddenLayerCount=0,uint32_t *_outputGateHiddenLayerNeuronCounts=0,uint32_t _candidateGateHiddenLayerCount=0,uint32_t *_candidateGateHiddenLayerNeuronCounts=0);
+    // If _cellCount is 0 or equal to _outputCount, the cell outputs are the outputs. Otherwise there are _cellCount cells (more cells than outputs
+    // usually make the network more powerful), and the outputs are a trainable linear projection of their outputs, so only the outputs enter
+    // the loss. The cell outputs, not the projected outputs, are fed back into the gates.
+    // By default, each cell has its own network per gate, whose topmost layer values are summed up into the gate value. With
+    // _sharedGateNetworks, there is only one network per gate, whose topmost layer has a neuron per cell that yields the gate value of that cell.
+    // This takes far fewer weights and steps through a few wide layers instead of many narrow ones.
+    // _cellVariant (LSTMCellVariant) selects a cell with coupled input and forget gates or a GRU-style cell instead of the standard cell; both
+    // evaluate three instead of four gate networks per step.
+    LSTM(uint32_t _inputCount,uint32_t _outputCount,uint32_t _backpropagationSteps,double _learningRate,double _momentum,double _weightDecay,double _networkLearningRate=std::numeric_limits<double>::min(),double _networkMomentum=std::numeric_limits<double>::min(),double _networkWeightDecay=std::numeric_limits<double>::min(),uint32_t _forgetGateHiddenLayerCount=0,uint32_t *_forgetGateHiddenLayerNeuronCounts=0,uint32_t _inputGateHiddenLayerCount=0,uint32_t *_inputGateHiddenLayerNeuronCounts=0,uint32_t _outputGateHiddenLayerCount=0,uint32_t *_outputGateHiddenLayerNeuronCounts=0,uint32_t _candidateGateHiddenLayerCount=0,uint32_t *_candidateGateHiddenLayerNeuronCounts=0,uint32_t _cellCount=0,bool _sharedGateNetworks=false,uint8_t _cellVariant=LSTMCellVariant_standard);
     ~LSTM();
 
     double *process(double *input);
     // Takes in the desired outputs of the last n=backpropagationSteps states and the current state, beginning with the oldest state and ending with the current state.
     void learn(double **desiredOutputs);
+    // Time spent in the phases of process() and learn() since the last resetStats() (see LSTMPhase). Empty unless compiled with
+    // LSTM_PHASE_TIMERS; then each phase costs two clock reads.
+    LSTMStats stats();
+    void resetStats();
+
+    // Sessions: many independent recurrent states which are all processed with the current weights of this LSTM. A session only holds its
+    // previous outputs and cell states. Sessions may be processed concurrently from multiple threads, but not while process() or learn() run.
+    LSTMSession *createSession();
+    void destroySession(LSTMSession *session);
+    uint32_t getSessionScratchSize(); // Number of doubles to pass as "scratch" to processSession()
+    // Returns "output" (allocated if 0, then the caller frees it). If "scratch" is 0, it is allocated for this call.
+    double *processSession(LSTMSession *session,double *input,double *output=0,double *scratch=0);
+
+    // Pruning: sets the gate network weights with the smallest magnitudes to 0 until "targetSparsity" (0 to 1) of them are 0, over all gate
+    // networks or, if perLayer is set, in each layer of each network. From then on, process(), learn() and sessions use sparse kernels which
+    // only touch the kept weights, and learn() keeps the pruned weights at 0. Forget gate networks which the cell variant does not evaluate
+    // are pruned completely. Pruning again raises the sparsity further. Replica sets have to be refreshed afterwards.
+    void prune(double targetSparsity,bool perLayer=false);
+    void buildSparsity(); // Keeps the gate network weights which are not 0 (e.g. after they have been set by hand) and uses the sparse kernels
+    void clearSparsity(); // Uses the dense kernels again; the pruned weights are trained again from 0.
+    void setStateSparsity(); // Points all states to "sparsity"
+
+    // Copies the learning parameters, the current weights and optionally the momentum buffers of "source", which must have the same topology.
+    // No memory is allocated if this LSTM already has a weight state, unless "source" is pruned (its sparsity pattern is rebuilt here).
+    void copyParametersFrom(LSTM *source,bool includeMomentum);
+
+    // Checkpoints: topology, learning parameters, weights and optionally the momentum buffers in a little-endian binary format with a section
+    // per gate (see LSTMCheckpointInfo, which also reads just the header).
+    uint64_t getTopologyFingerprint();
+    fs_t getSerializedSize(bool includeMomentum);
+    char *serialize(fs_t &size,bool includeMomentum=false); // The caller frees the returned buffer.
+    void serialize(BufferWriter *writer,bool includeMomentum=false);
+    bool save(const char *filePath,bool includeMomentum=false);
+    // Returns 0 if "data" is not a valid checkpoint. Only the sections with their bit set in "sectionMask" are read (and have their hashes
+    // checked); the others keep the random initial weights (or zero momentum buffers).
+    static LSTM *deserialize(char *data,fs_t size,uint32_t sectionMask=LSTM_CHECKPOINT_ALL_SECTIONS);
+    static LSTM *load(const char *filePath); // Returns 0 if the file cannot be read or is not a valid checkpoint.
+    // Like load(), but maps the file read-only and uses the weights in place instead of copying them, so startup does not depend on the weight
+    // count and processes that load the same checkpoint share its pages in the page cache. The first process() copies the weights into its
+    // own state, as learn() changes them; sessions are processed with the mapped weights directly. The file must not be changed while loaded.
+    static LSTM *loadMapped(const char *filePath);
+    // Like deserialize() with a section mask, but only reads the header and the selected sections from the file.
+    static LSTM *loadSections(const char *filePath,uint32_t sectionMask);
+
+    // Incremental checkpoints only store how a checkpoint differs from a base checkpoint (which may be incremental itself), see
+    // encodeIncrementalCheckpoint(). load() and loadMapped() resolve the chain of base checkpoints; all of them must still exist and be unchanged.
+    // A base path without directory is relative to the directory of the incremental checkpoint.
+    // Returns 0 if the sizes differ (other topology or momentum setting). The caller frees the returned buffer.
+    static char *encodeIncrementalCheckpoint(char *data,fs_t size,char *baseData,fs_t baseSize,const char *basePath,fs_t &incrementalSize);
+    // Reads a checkpoint file and resolves it if it is incremental. Returns 0 if a file of the chain cannot be read or does not match.
+    static char *readCheckpoint(const char *filePath,fs_t &size);
+    static const char *getIncrementalBasePath(const char *filePath,const char *basePath); // The base path to store in an incremental checkpoint
+    bool saveIncremental(const char *filePath,const char *basePath,bool includeMomentum=false);
+
+    // Sparse checkpoints leave out the 64 bit words of a checkpoint which are 0, such as the pruned weights (see prune()), so a checkpoint of a
+    // pruned LSTM shrinks to about its kept share. load() and readCheckpoint() decode them (also as the base of an incremental checkpoint);
+    // loadMapped() has to read them completely. The caller frees the returned buffer.
+    static char *encodeSparseCheckpoint(char *data,fs_t size,fs_t &sparseSize);
+    static char *decodeSparseCheckpoint(char *sparseData,fs_t sparseSize,fs_t &size); // Returns 0 if "sparseData" is not valid.
+    bool saveSparse(const char *filePath,bool includeMomentum=false);
 };
 
 #endif // LSTMLAYER_H
@@ -0,0 +1,103 @@
+#include "lstmallocations.h"
+
+#ifdef LSTM_ALLOCATION_TRACKING
+#include <atomic>
+
+#define LSTM_ALLOCATION_HEADER_SIZE 16 // Size and category in front of each tracked allocation; keeps the alignment of malloc()
+
+static std::atomic<uint64_t> allocationCounts[LSTM_ALLOCATION_CATEGORY_COUNT];
+static std::atomic<uint64_t> allocatedBytes[LSTM_ALLOCATION_CATEGORY_COUNT];
+static std::atomic<uint64_t> releaseCounts[LSTM_ALLOCATION_CATEGORY_COUNT];
+static std::atomic<uint64_t> liveBytes[LSTM_ALLOCATION_CATEGORY_COUNT];
+static std::atomic<uint64_t> peakLiveBytes[LSTM_ALLOCATION_CATEGORY_COUNT];
+static std::atomic<uint64_t> totalLiveBytes(0);
+static std::atomic<uint64_t> peakTotalLiveBytes(0);
+
+static void raisePeak(std::atomic<uint64_t> &peak, uint64_t value)
+{
+    uint64_t currentPeak=peak.load(std::memory_order_relaxed);
+    while(value>currentPeak&&!peak.compare_exchange_weak(currentPeak,value,std::memory_order_relaxed));
+}
+
+void *LSTMAllocations::allocate(size_t size, uint8_t category)
+{
+    char *block=(char*)malloc(LSTM_ALLOCATION_HEADER_SIZE+size);
+    if(block==0)
+        return 0;
+    ((uint64_t*)block)[0]=size;
+    ((uint64_t*)block)[1]=category;
+    allocationCounts[category].fetch_add(1,std::memory_order_relaxed);
+    allocatedBytes[category].fetch_add(size,std::memory_order_relaxed);
+    raisePeak(peakLiveBytes[category],liveBytes[category].fetch_add(size,std::memory_order_relaxed)+size);
+    raisePeak(peakTotalLiveBytes,totalLiveBytes.fetch_add(size,std::memory_order_relaxed)+size);
+    return block+LSTM_ALLOCATION_HEADER_SIZE;
+}
+
+void LSTMAllocations::release(void *pointer)
+{
+    if(pointer==0)
+        return;
+    char *block=(char*)pointer-LSTM_ALLOCATION_HEADER_SIZE;
+    uint64_t size=((uint64_t*)block)[0];
+    uint8_t category=(uint8_t)((uint64_t*)block)[1];
+    releaseCounts[category].fetch_add(1,std::memory_order_relaxed);
+    liveBytes[category].fetch_sub(size,std::memory_order_relaxed);
+    totalLiveBytes.fetch_sub(size,std::memory_order_relaxed);
+    free(block);
+}
+
+void *LSTMAllocations::allocateOutput(size_t size)
+{
+    // Plain malloc(), as the caller frees it; only the allocation itself is counted.
+    allocationCounts[LSTMAllocationCategory_output].fetch_add(1,std::memory_order_relaxed);
+    allocatedBytes[LSTMAllocationCategory_output].fetch_add(size,std::memory_order_relaxed);
+    return malloc(size);
+}
+#endif
+
+bool LSTMAllocations::isEnabled()
+{
+#ifdef LSTM_ALLOCATION_TRACKING
+    return true;
+#else
+    return false;
+#endif
+}
+
+const char *LSTMAllocations::getCategoryName(uint8_t category)
+{
+    static const char *categoryNames[LSTM_ALLOCATION_CATEGORY_COUNT]={"state","gradient","output","scratch"};
+    return category<LSTM_ALLOCATION_CATEGORY_COUNT?categoryNames[category]:"unknown";
+}
+
+LSTMAllocationStats LSTMAllocations::getStats()
+{
+    LSTMAllocationStats stats;
+    memset(&stats,0,sizeof(LSTMAllocationStats));
+#ifdef LSTM_ALLOCATION_TRACKING
+    for(uint8_t category=0;category<LSTM_ALLOCATION_CATEGORY_COUNT;category++)
+    {
+        stats.allocationCounts[category]=allocationCounts[category].load(std::memory_order_relaxed);
+        stats.allocatedBytes[category]=allocatedBytes[category].load(std::memory_order_relaxed);
+        stats.releaseCounts[category]=releaseCounts[category].load(std::memory_order_relaxed);
+        stats.liveBytes[category]=liveBytes[category].load(std::memory_order_relaxed);
+        stats.peakLiveBytes[category]=peakLiveBytes[category].load(std::memory_order_relaxed);
+    }
+    stats.peakTotalLiveBytes=peakTotalLiveBytes.load(std::memory_order_relaxed);
+#endif
+    return stats;
+}
+
+void LSTMAllocations::resetStats()
+{
+#ifdef LSTM_ALLOCATION_TRACKING
+    for(uint8_t category=0;category<LSTM_ALLOCATION_CATEGORY_COUNT;category++)
+    {
+        allocationCounts[category].store(0,std::memory_order_relaxed);
+        allocatedBytes[category].store(0,std::memory_order_relaxed);
+        releaseCounts[category].store(0,std::memory_order_relaxed);
+        peakLiveBytes[category].store(liveBytes[category].load(std::memory_order_relaxed),std::memory_order_relaxed);
+    }
+    peakTotalLiveBytes.store(totalLiveBytes.load(std::memory_order_relaxed),std::memory_order_relaxed);
+#endif
+}
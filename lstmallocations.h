@@ -0,0 +1,60 @@
+#ifndef LSTMALLOCATIONS_H
+#define LSTMALLOCATIONS_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <memory.h>
+
+// Categories of the heap allocations of the engine. The allocations are only counted if the engine is compiled with
+// LSTM_ALLOCATION_TRACKING (e.g. DEFINES += LSTM_ALLOCATION_TRACKING in the .pro file); without it, LSTMAllocations::allocate() and release()
+// are plain malloc() and free(), and the stats stay empty.
+enum LSTMAllocationCategory
+{
+    LSTMAllocationCategory_state=0, // LSTMStates (one per process() step), their weights and activations, sessions and sparsity patterns
+    LSTMAllocationCategory_gradient=1, // The weight differentials and derivatives of learn() and the momentum of the weight changes
+    LSTMAllocationCategory_output=2, // Outputs returned by process() and processSession() (freed by the caller, so they are not live bytes)
+    LSTMAllocationCategory_scratch=3 // Temporary buffers of a single call and session scratch
+};
+#define LSTM_ALLOCATION_CATEGORY_COUNT 4
+
+struct LSTMAllocationStats
+{
+    uint64_t allocationCounts[LSTM_ALLOCATION_CATEGORY_COUNT];
+    uint64_t allocatedBytes[LSTM_ALLOCATION_CATEGORY_COUNT];
+    uint64_t releaseCounts[LSTM_ALLOCATION_CATEGORY_COUNT];
+    uint64_t liveBytes[LSTM_ALLOCATION_CATEGORY_COUNT]; // Allocated and not released yet (always 0 for outputs)
+    uint64_t peakLiveBytes[LSTM_ALLOCATION_CATEGORY_COUNT]; // Since the last LSTMAllocations::resetStats()
+    uint64_t peakTotalLiveBytes; // Of all categories together
+};
+
+// Every allocation of the engine that it also frees goes through allocate() and release(); outputs that the caller frees with free() are
+// allocated by allocateOutput(). The counters are process wide and may be updated from multiple threads.
+class LSTMAllocations
+{
+public:
+    static bool isEnabled(); // Returns false if the tracking has been compiled out
+    static const char *getCategoryName(uint8_t category);
+    static LSTMAllocationStats getStats();
+    static void resetStats(); // Sets the counts to 0 and the peaks to the current live bytes
+#ifdef LSTM_ALLOCATION_TRACKING
+    static void *allocate(size_t size,uint8_t category);
+    static void release(void *pointer); // "pointer" has to be returned by allocate() (or 0)
+    static void *allocateOutput(size_t size);
+#else
+    static void *allocate(size_t size,uint8_t category)
+    {
+        (void)category;
+        return malloc(size);
+    }
+    static void release(void *pointer)
+    {
+        free(pointer);
+    }
+    static void *allocateOutput(size_t size)
+    {
+        return malloc(size);
+    }
+#endif
+};
+
+#endif // LSTMALLOCATIONS_H
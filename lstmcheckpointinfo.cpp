@@ -0,0 +1,339 @@
+#include "lstmcheckpointinfo.h"
+#include "lstm.h"
+
+#define LSTM_CHECKPOINT_SECTION_TABLE_ENTRY_SIZE (3*sizeof(uint64_t))
+
+uint64_t LSTMCheckpointInfo::getTopologyFingerprint(uint32_t _inputCount, uint32_t _outputCount, uint32_t _cellCount, uint32_t *_gateHiddenLayerCounts, uint32_t **_gateHiddenLayerNeuronCounts, bool _sharedGateNetworks, uint8_t _cellVariant)
+{
+    uint32_t totalHiddenLayerCount=_gateHiddenLayerCounts[0]+_gateHiddenLayerCounts[1]+_gateHiddenLayerCounts[2]+_gateHiddenLayerCounts[3];
+    char *topology=(char*)malloc((9+totalHiddenLayerCount)*sizeof(uint32_t));
+    fs_t pos=0;
+    io::writeUInt32(topology,_inputCount,pos);
+    io::writeUInt32(topology,_outputCount,pos);
+    for(uint8_t gate=0;gate<4;gate++)
+    {
+        io::writeUInt32(topology,_gateHiddenLayerCounts[gate],pos);
+        io::writeUInt32s(topology,_gateHiddenLayerNeuronCounts[gate],_gateHiddenLayerCounts[gate],pos);
+    }
+    if(_cellCount!=_outputCount)
+        io::writeUInt32(topology,_cellCount,pos);
+    if(_sharedGateNetworks)
+        io::writeUInt32(topology,0xFFFFFFFF,pos); // Marker: one network per gate
+    if(_cellVariant!=LSTMCellVariant_standard)
+        io::writeUInt32(topology,0xFFFFFF00|_cellVariant,pos); // Marker and cell variant
+    uint64_t fingerprint=io::hash64(topology,pos);
+    free(topology);
+    return fingerprint;
+}
+
+uint32_t LSTMCheckpointInfo::getSectionCount(uint32_t version, bool _includesMomentum)
+{
+    if(version>=3)
+        return LSTM_CHECKPOINT_MAX_SECTION_COUNT; // Sections which do not apply are empty.
+    return _includesMomentum?8:4;
+}
+
+fs_t LSTMCheckpointInfo::getHeaderSize(uint32_t version, uint32_t totalHiddenLayerCount, uint32_t _sectionCount)
+{
+    fs_t fixedHeaderSize=version==1?4/*Magic*/+5*sizeof(uint32_t):LSTM_CHECKPOINT_FIXED_HEADER_SIZE;
+    if(version>=3)
+        fixedHeaderSize+=sizeof(uint32_t); // Cell count
+    if(version>=4)
+        fixedHeaderSize+=4*sizeof(uint32_t); // Gate network activations
+    fs_t _headerSize=fixedHeaderSize+4*sizeof(uint32_t)+totalHiddenLayerCount*sizeof(uint32_t)+15*sizeof(double);
+    _headerSize=(_headerSize+7)&~(fs_t)7;
+    if(version>1)
+        _headerSize+=_sectionCount*LSTM_CHECKPOINT_SECTION_TABLE_ENTRY_SIZE;
+    return _headerSize;
+}
+
+fs_t LSTMCheckpointInfo::getCellSize(uint32_t _inputCount, uint32_t _cellCount, uint32_t hiddenLayerCount, uint32_t *hiddenLayerNeuronCounts, bool _sharedGateNetworks)
+{
+    uint32_t inputAndOutputCount=_inputCount+_cellCount;
+    uint32_t neuronsInTopmostLayer=_sharedGateNetworks?_cellCount:inputAndOutputCount;
+    fs_t valueCount=0;
+    uint32_t neuronsInLastLayer=inputAndOutputCount;
+    for(uint32_t thisLayer=0;thisLayer<=hiddenLayerCount;thisLayer++)
+    {
+        uint32_t neuronsInThisLayer=thisLayer==hiddenLayerCount?neuronsInTopmostLayer:hiddenLayerNeuronCounts[thisLayer];
+        valueCount+=(fs_t)neuronsInThisLayer*(1+neuronsInLastLayer);
+        neuronsInLastLayer=neuronsInThisLayer;
+    }
+    return valueCount*sizeof(double);
+}
+
+void LSTMCheckpointInfo::getSectionLayout(uint32_t version, fs_t _headerSize, uint32_t _inputCount, uint32_t _outputCount, uint32_t _cellCount, uint32_t *_gateHiddenLayerCounts, uint32_t **_gateHiddenLayerNeuronCounts, bool _sharedGateNetworks, bool _includesMomentum, uint32_t &_sectionCount, fs_t *_sectionOffsets, fs_t *_sectionSizes)
+{
+    _sectionCount=getSectionCount(version,_includesMomentum);
+    bool outputProjection=_cellCount!=_outputCount;
+    uint32_t gateNetworkCount=_sharedGateNetworks?1:_cellCount;
+    fs_t pos=_headerSize;
+    for(uint32_t section=0;section<_sectionCount;section++)
+    {
+        _sectionOffsets[section]=pos;
+        if(section>=LSTM_CHECKPOINT_OUTPUT_PROJECTION_SECTION)
+        {
+            bool present=outputProjection&&(section==LSTM_CHECKPOINT_OUTPUT_PROJECTION_SECTION||_includesMomentum);
+            _sectionSizes[section]=present?(fs_t)_outputCount*(_cellCount+1)*sizeof(double):0;
+        }
+        else
+        {
+            uint8_t gate=section%4;
+            fs_t cellSize=getCellSize(_inputCount,_cellCount,_gateHiddenLayerCounts[gate],_gateHiddenLayerNeuronCounts[gate],_sharedGateNetworks);
+            if(section<4)
+                _sectionSizes[section]=_cellCount*sizeof(double)+gateNetworkCount*cellSize;
+            else if(_includesMomentum)
+                _sectionSizes[section]=cellSize+_cellCount*sizeof(double); // The previous deltas are shared by all cells.
+            else
+                _sectionSizes[section]=0;
+        }
+        pos+=_sectionSizes[section];
+    }
+}
+
+LSTMCheckpointInfo *LSTMCheckpointInfo::parse(char *data, fs_t dataSize)
+{
+    bool systemIsLittleEndian=io::getSystemIsLittleEndian();
+    if(dataSize<4+2*sizeof(uint32_t)||memcmp(data,"LSTM",4)!=0)
+        return 0;
+    fs_t pos=4;
+    uint32_t _version=io::posBasedReadUInt32(data,pos);
+    if(_version<1||_version>LSTM_CHECKPOINT_VERSION)
+        return 0;
+    fs_t fixedHeaderSize=_version==1?4+5*sizeof(uint32_t):LSTM_CHECKPOINT_FIXED_HEADER_SIZE;
+    if(dataSize<fixedHeaderSize)
+        return 0;
+    uint32_t flags=io::posBasedReadUInt32(data,pos);
+    fs_t storedHeaderSize=0;
+    if(_version>1)
+    {
+        storedHeaderSize=io::posBasedReadUInt32(data,pos);
+        if(storedHeaderSize<fixedHeaderSize||storedHeaderSize>dataSize||storedHeaderSize%8!=0)
+            return 0;
+        // The checksum covers the whole header, so the rest of it can be trusted once it matches.
+        uint64_t zero=0;
+        uint64_t checksum=io::hash64(data,40);
+        checksum=io::hash64((const char*)&zero,sizeof(uint64_t),checksum);
+        checksum=io::hash64(data+LSTM_CHECKPOINT_FIXED_HEADER_SIZE,storedHeaderSize-LSTM_CHECKPOINT_FIXED_HEADER_SIZE,checksum);
+        if(checksum!=io::peekUInt64(data,40))
+            return 0;
+        dataSize=storedHeaderSize;
+    }
+
+    LSTMCheckpointInfo *info=new LSTMCheckpointInfo();
+    info->version=_version;
+    info->includesMomentum=(flags&1)!=0;
+    info->sharedGateNetworks=(flags&2)!=0;
+    info->cellVariant=(flags>>2)&3;
+    info->pruned=(flags&16)!=0;
+    if(info->cellVariant>=LSTM_CELL_VARIANT_COUNT)
+    {
+        delete info;
+        return 0;
+    }
+    info->inputCount=io::posBasedReadUInt32(data,pos);
+    info->outputCount=io::posBasedReadUInt32(data,pos);
+    info->backpropagationSteps=io::posBasedReadUInt32(data,pos);
+    uint32_t storedSectionCount=0;
+    uint64_t storedTopologyFingerprint=0;
+    if(_version>1)
+    {
+        storedSectionCount=io::posBasedReadUInt32(data,pos);
+        storedTopologyFingerprint=io::posBasedReadUInt64(data,pos);
+        pos+=sizeof(uint64_t); // Checksum
+    }
+    info->cellCount=info->outputCount;
+    if(_version>=3)
+    {
+        if(pos+sizeof(uint32_t)>dataSize)
+        {
+            delete info;
+            return 0;
+        }
+        info->cellCount=io::posBasedReadUInt32(data,pos);
+    }
+    if(_version>=4)
+    {
+        if(pos+4*sizeof(uint32_t)>dataSize)
+        {
+            delete info;
+            return 0;
+        }
+        bool activationsValid=true;
+        for(uint8_t gate=0;gate<4;gate++)
+        {
+            uint32_t activation=io::posBasedReadUInt32(data,pos);
+            activationsValid=activationsValid&&activation<LSTM_GATE_ACTIVATION_COUNT;
+            info->gateNetworkActivations[gate]=(uint8_t)activation;
+        }
+        if(!activationsValid)
+        {
+            delete info;
+            return 0;
+        }
+    }
+
+    // The topology is read in steps, as its size depends on the hidden layer counts:
+    uint32_t totalHiddenLayerCount=0;
+    bool valid=true;
+    for(uint8_t gate=0;gate<4&&valid;gate++)
+    {
+        if(pos+sizeof(uint32_t)>dataSize)
+        {
+            valid=false;
+            break;
+        }
+        info->gateHiddenLayerCounts[gate]=io::posBasedReadUInt32(data,pos);
+        if((dataSize-pos)/sizeof(uint32_t)<info->gateHiddenLayerCounts[gate])
+        {
+            valid=false;
+            break;
+        }
+        totalHiddenLayerCount+=info->gateHiddenLayerCounts[gate];
+        info->gateHiddenLayerNeuronCounts[gate]=(uint32_t*)malloc(info->gateHiddenLayerCounts[gate]*sizeof(uint32_t));
+        io::posBasedReadUInt32s(data,pos,info->gateHiddenLayerNeuronCounts[gate],info->gateHiddenLayerCounts[gate]);
+    }
+    if(valid)
+    {
+        uint32_t expectedSectionCount=getSectionCount(_version,info->includesMomentum);
+        info->headerSize=getHeaderSize(_version,totalHiddenLayerCount,expectedSectionCount);
+        valid=dataSize>=info->headerSize&&(_version==1||(storedHeaderSize==info->headerSize&&storedSectionCount==expectedSectionCount));
+    }
+    if(!valid)
+    {
+        delete info;
+        return 0;
+    }
+
+    info->learningRate=io::posBasedReadDouble(data,pos,systemIsLittleEndian);
+    info->momentum=io::posBasedReadDouble(data,pos,systemIsLittleEndian);
+    info->weightDecay=io::posBasedReadDouble(data,pos,systemIsLittleEndian);
+    for(uint8_t gate=0;gate<4;gate++)
+    {
+        info->gateNetworkLearningRates[gate]=io::posBasedReadDouble(data,pos,systemIsLittleEndian);
+        info->gateNetworkMomentums[gate]=io::posBasedReadDouble(data,pos,systemIsLittleEndian);
+        info->gateNetworkWeightDecays[gate]=io::posBasedReadDouble(data,pos,systemIsLittleEndian);
+    }
+
+    info->topologyFingerprint=getTopologyFingerprint(info->inputCount,info->outputCount,info->cellCount,info->gateHiddenLayerCounts,info->gateHiddenLayerNeuronCounts,info->sharedGateNetworks,info->cellVariant);
+    getSectionLayout(_version,info->headerSize,info->inputCount,info->outputCount,info->cellCount,info->gateHiddenLayerCounts,info->gateHiddenLayerNeuronCounts,info->sharedGateNetworks,info->includesMomentum,info->sectionCount,info->sectionOffsets,info->sectionSizes);
+    info->size=info->sectionOffsets[info->sectionCount-1]+info->sectionSizes[info->sectionCount-1];
+    if(_version>1)
+    {
+        // The sections always follow the layout; the table lets readers find them without knowing it.
+        valid=storedTopologyFingerprint==info->topologyFingerprint;
+        pos=info->headerSize-info->sectionCount*LSTM_CHECKPOINT_SECTION_TABLE_ENTRY_SIZE;
+        for(uint32_t section=0;section<info->sectionCount;section++)
+        {
+            valid=valid&&io::posBasedReadUInt64(data,pos)==info->sectionOffsets[section];
+            valid=valid&&io::posBasedReadUInt64(data,pos)==info->sectionSizes[section];
+            info->sectionHashes[section]=io::posBasedReadUInt64(data,pos);
+        }
+        info->hasSectionHashes=true;
+        if(!valid)
+        {
+            delete info;
+            return 0;
+        }
+    }
+    return info;
+}
+
+// Size of the whole file; the position of "f" is kept. Returns 0 if it cannot be determined.
+static fs_t getFileSize(FILE *f)
+{
+#ifdef _WIN32
+    __int64 position=_ftelli64(f);
+    if(position<0||_fseeki64(f,0,SEEK_END)!=0)
+        return 0;
+    __int64 size=_ftelli64(f);
+    if(_fseeki64(f,position,SEEK_SET)!=0||size<0)
+        return 0;
+#else
+    off_t position=ftello(f);
+    if(position<0||fseeko(f,0,SEEK_END)!=0)
+        return 0;
+    off_t size=ftello(f);
+    if(fseeko(f,position,SEEK_SET)!=0||size<0)
+        return 0;
+#endif
+    return (fs_t)size;
+}
+
+LSTMCheckpointInfo *LSTMCheckpointInfo::read(FILE *f)
+{
+    char fixedHeader[LSTM_CHECKPOINT_FIXED_HEADER_SIZE];
+    if(fread(fixedHeader,1,LSTM_CHECKPOINT_FIXED_HEADER_SIZE,f)!=LSTM_CHECKPOINT_FIXED_HEADER_SIZE)
+        return 0;
+    if(memcmp(fixedHeader,"LSTM",4)!=0||io::peekUInt32(fixedHeader,4)<2||io::peekUInt32(fixedHeader,4)>LSTM_CHECKPOINT_VERSION)
+        return 0;
+    fs_t _headerSize=io::peekUInt32(fixedHeader,12);
+    // Checked before allocating, as the header size of a damaged file could be anything (parse() checks the same against the data size):
+    if(_headerSize<LSTM_CHECKPOINT_FIXED_HEADER_SIZE||_headerSize%8!=0||_headerSize>LSTM_CHECKPOINT_MAX_HEADER_SIZE||_headerSize>getFileSize(f))
+        return 0;
+    char *header=(char*)malloc(_headerSize);
+    memcpy(header,fixedHeader,LSTM_CHECKPOINT_FIXED_HEADER_SIZE);
+    LSTMCheckpointInfo *info=0;
+    fs_t remainingSize=_headerSize-LSTM_CHECKPOINT_FIXED_HEADER_SIZE;
+    if(fread(header+LSTM_CHECKPOINT_FIXED_HEADER_SIZE,1,remainingSize,f)==remainingSize)
+        info=parse(header,_headerSize);
+    free(header);
+    return info;
+}
+
+LSTMCheckpointInfo *LSTMCheckpointInfo::read(const char *filePath)
+{
+    FILE *f=fopen(filePath,"rb");
+    if(f==0)
+        return 0;
+    LSTMCheckpointInfo *info=read(f);
+    fclose(f);
+    return info;
+}
+
+LSTMCheckpointInfo::LSTMCheckpointInfo()
+{
+    for(uint8_t gate=0;gate<4;gate++)
+    {
+        gateHiddenLayerCounts[gate]=0;
+        gateHiddenLayerNeuronCounts[gate]=0;
+    }
+    cellCount=0;
+    sharedGateNetworks=false;
+    cellVariant=LSTMCellVariant_standard;
+    pruned=false;
+    for(uint8_t gate=0;gate<4;gate++)
+        gateNetworkActivations[gate]=LSTMGateActivation_tanh;
+    sectionCount=0;
+    hasSectionHashes=false;
+}
+
+fs_t LSTMCheckpointInfo::getCellOffset(uint8_t gate, uint32_t cell)
+{
+    return sectionOffsets[gate]+cellCount*sizeof(double)+cell*getCellSize(inputCount,cellCount,gateHiddenLayerCounts[gate],gateHiddenLayerNeuronCounts[gate],sharedGateNetworks);
+}
+
+LSTM *LSTMCheckpointInfo::createLSTM()
+{
+    LSTM *lstm=new LSTM(inputCount,outputCount,backpropagationSteps,learningRate,momentum,weightDecay,gateNetworkLearningRates[0],gateNetworkMomentums[0],gateNetworkWeightDecays[0],gateHiddenLayerCounts[0],gateHiddenLayerNeuronCounts[0],gateHiddenLayerCounts[1],gateHiddenLayerNeuronCounts[1],gateHiddenLayerCounts[2],gateHiddenLayerNeuronCounts[2],gateHiddenLayerCounts[3],gateHiddenLayerNeuronCounts[3],cellCount,sharedGateNetworks,cellVariant);
+    lstm->inputGateNetworkLearningRate=gateNetworkLearningRates[1];
+    lstm->outputGateNetworkLearningRate=gateNetworkLearningRates[2];
+    lstm->candidateGateNetworkLearningRate=gateNetworkLearningRates[3];
+    lstm->inputGateNetworkMomentum=gateNetworkMomentums[1];
+    lstm->outputGateNetworkMomentum=gateNetworkMomentums[2];
+    lstm->candidateGateNetworkMomentum=gateNetworkMomentums[3];
+    lstm->inputGateNetworkWeightDecay=gateNetworkWeightDecays[1];
+    lstm->outputGateNetworkWeightDecay=gateNetworkWeightDecays[2];
+    lstm->candidateGateNetworkWeightDecay=gateNetworkWeightDecays[3];
+    lstm->forgetGateNetworkActivation=gateNetworkActivations[0];
+    lstm->inputGateNetworkActivation=gateNetworkActivations[1];
+    lstm->outputGateNetworkActivation=gateNetworkActivations[2];
+    lstm->candidateGateNetworkActivation=gateNetworkActivations[3];
+    return lstm;
+}
+
+LSTMCheckpointInfo::~LSTMCheckpointInfo()
+{
+    for(uint8_t gate=0;gate<4;gate++)
+        free(gateHiddenLayerNeuronCounts[gate]);
+}
@@ -0,0 +1,94 @@
+#ifndef LSTMCHECKPOINTINFO_H
+#define LSTMCHECKPOINTINFO_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "io.h"
+
+#define LSTM_CHECKPOINT_FIXED_HEADER_SIZE 48
+#define LSTM_CHECKPOINT_MAX_SECTION_COUNT 10
+#define LSTM_CHECKPOINT_MAX_HEADER_SIZE (1<<20) // Far above the header of any topology; bounds what read() allocates for a damaged header
+#define LSTM_CHECKPOINT_ALL_SECTIONS 0x3FF
+#define LSTM_CHECKPOINT_OUTPUT_PROJECTION_SECTION 8
+#define LSTM_CHECKPOINT_OUTPUT_PROJECTION_MOMENTUM_SECTION 9
+
+class LSTM;
+
+// Checkpoint layout, version 4 (all values little-endian):
+// Fixed header: "LSTM", version, flags (bit 0: momentum buffers included, bit 1: shared gate networks, bits 2-3: cell variant (LSTMCellVariant),
+//         bit 4: pruned, i.e. the gate network weights which are 0 are pruned (see LSTM::prune())), header size, inputCount, outputCount, backpropagationSteps,
+//         section count (all uint32), topology fingerprint (getTopologyFingerprint()), header checksum (io::hash64() of the whole header with
+//         this field set to 0) (both uint64)
+// Then: cellCount, per gate (forget, input, output, candidate): network activation (LSTMGateActivation), then per gate: hidden layer count,
+//         hidden layer neuron counts (all uint32), learningRate, momentum, weightDecay, per gate: network learning rate, network momentum,
+//         network weight decay (all double),
+//         zero padding up to a multiple of 8 bytes (so that the doubles which follow are aligned if the file is mapped into memory)
+// Section table: per section: offset (from the start of the checkpoint), size, io::hash64() of the section (all uint64)
+// Sections 0-3, per gate: value sum bias weights (per cell), then per cell (or once with shared gate networks) and layer: bias weights (per
+//         neuron), weights (per neuron: per neuron in the last layer)
+// Sections 4-7 (empty unless momentum buffers are included), per gate: per layer: previous bias weight deltas (per neuron), previous weight
+//         deltas (per neuron: per neuron in the last layer), then the previous value sum bias weight deltas (per cell)
+// Section 8 (empty without output projection): projection weights (per output: per cell), then projection bias weights (per output)
+// Section 9 (empty without output projection or momentum buffers): the previous deltas of section 8 in the same order
+// The sections follow the header in this order. All networks of a gate have the same size, so their offsets follow from getCellOffset().
+// Version 3 checkpoints have no network activations (they are tanh). Version 2 checkpoints have no cellCount either (it is equal to
+// outputCount) and only sections 0-3 or 0-7. Version 1 checkpoints have the layout of version 2 without header size, section count,
+// fingerprint, checksum and section table (the fixed header ends after backpropagationSteps); they are still read, but without section hashes.
+
+class LSTMCheckpointInfo
+{
+public:
+    uint32_t version;
+    bool includesMomentum;
+    bool sharedGateNetworks;
+    uint8_t cellVariant; // LSTMCellVariant
+    bool pruned;
+    fs_t headerSize;
+    fs_t size; // Of the whole checkpoint, as given by the header
+    uint32_t inputCount;
+    uint32_t outputCount;
+    uint32_t cellCount;
+    uint32_t backpropagationSteps;
+    uint32_t gateHiddenLayerCounts[4];
+    uint32_t *gateHiddenLayerNeuronCounts[4]; // Dimensions: Gates, hidden layers
+    uint8_t gateNetworkActivations[4]; // LSTMGateActivation
+    double learningRate;
+    double momentum;
+    double weightDecay;
+    double gateNetworkLearningRates[4];
+    double gateNetworkMomentums[4];
+    double gateNetworkWeightDecays[4];
+    uint64_t topologyFingerprint;
+    uint32_t sectionCount;
+    fs_t sectionOffsets[LSTM_CHECKPOINT_MAX_SECTION_COUNT];
+    fs_t sectionSizes[LSTM_CHECKPOINT_MAX_SECTION_COUNT];
+    uint64_t sectionHashes[LSTM_CHECKPOINT_MAX_SECTION_COUNT];
+    bool hasSectionHashes; // False for version 1
+
+    // Hash of the input, output and cell counts and the hidden layers of all gates: checkpoints with the same fingerprint have interchangeable
+    // weights. The cell count is only included if it differs from the output count, a marker only for shared gate networks and the cell
+    // variant only if it is not the standard cell, so fingerprints of version 2 checkpoints stay the same.
+    static uint64_t getTopologyFingerprint(uint32_t _inputCount,uint32_t _outputCount,uint32_t _cellCount,uint32_t *_gateHiddenLayerCounts,uint32_t **_gateHiddenLayerNeuronCounts,bool _sharedGateNetworks,uint8_t _cellVariant);
+    static uint32_t getSectionCount(uint32_t version,bool _includesMomentum);
+    static fs_t getHeaderSize(uint32_t version,uint32_t totalHiddenLayerCount,uint32_t _sectionCount);
+    static fs_t getCellSize(uint32_t _inputCount,uint32_t _cellCount,uint32_t hiddenLayerCount,uint32_t *hiddenLayerNeuronCounts,bool _sharedGateNetworks); // Bytes of one gate network
+    // Fills the section table from the topology; the hashes are not set.
+    static void getSectionLayout(uint32_t version,fs_t _headerSize,uint32_t _inputCount,uint32_t _outputCount,uint32_t _cellCount,uint32_t *_gateHiddenLayerCounts,uint32_t **_gateHiddenLayerNeuronCounts,bool _sharedGateNetworks,bool _includesMomentum,uint32_t &_sectionCount,fs_t *_sectionOffsets,fs_t *_sectionSizes);
+
+    // Validates the header at the start of "data" ("dataSize" bytes, which only have to cover the header). The sections are not checked.
+    // Returns 0 if it is not a valid header.
+    static LSTMCheckpointInfo *parse(char *data,fs_t dataSize);
+    // Reads only the header of a version 2 or later checkpoint from the start of "f". Returns 0 if it cannot be read, is incremental or of
+    // version 1.
+    static LSTMCheckpointInfo *read(FILE *f);
+    static LSTMCheckpointInfo *read(const char *filePath);
+
+    LSTMCheckpointInfo();
+    fs_t getCellOffset(uint8_t gate,uint32_t cell); // Of the network of "cell" in section "gate" (cell 0 with shared gate networks)
+    LSTM *createLSTM(); // With this topology and these learning parameters, and random weights
+    ~LSTMCheckpointInfo();
+};
+
+#endif // LSTMCHECKPOINTINFO_H
@@ -0,0 +1,135 @@
+#include "lstmcheckpointwriter.h"
+
+#include <chrono>
+
+static uint64_t getNanoseconds()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+LSTMCheckpointWriter::LSTMCheckpointWriter(LSTM *_lstm, uint32_t _fullCheckpointInterval)
+{
+    lstm=_lstm;
+    snapshot=new LSTM(lstm->inputCount,lstm->outputCount,lstm->backpropagationSteps,lstm->learningRate,lstm->momentum,lstm->weightDecay,lstm->forgetGateNetworkLearningRate,lstm->forgetGateNetworkMomentum,lstm->forgetGateNetworkWeightDecay,lstm->forgetGateHiddenLayerCount,lstm->forgetGateHiddenLayerNeuronCounts,lstm->inputGateHiddenLayerCount,lstm->inputGateHiddenLayerNeuronCounts,lstm->outputGateHiddenLayerCount,lstm->outputGateHiddenLayerNeuronCounts,lstm->candidateGateHiddenLayerCount,lstm->candidateGateHiddenLayerNeuronCounts,lstm->cellCount,lstm->sharedGateNetworks,lstm->cellVariant);
+    snapshot->getWeightState(); // Allocates the weights now instead of during the first checkpoint
+    writing=false;
+    filePath=0;
+    includeMomentum=false;
+    fullCheckpointInterval=_fullCheckpointInterval;
+    checkpointsSinceFullCheckpoint=0;
+    previousData=0;
+    previousSize=0;
+    previousFilePath=0;
+    chainFilePaths=fullCheckpointInterval>1?(char**)malloc(fullCheckpointInterval*sizeof(char*)):0;
+    chainFilePathCount=0;
+    checkpointCount=0;
+    skippedCheckpointCount=0;
+    lastStallTime=0;
+    maxStallTime=0;
+    totalStallTime=0;
+    lastWriteTime=0;
+    lastWrittenSize=0;
+    lastCheckpointWasIncremental=false;
+    failedCheckpointCount=0;
+    lastCheckpointSucceeded=true;
+}
+
+bool LSTMCheckpointWriter::checkpoint(const char *_filePath, bool _includeMomentum, bool waitIfWriting)
+{
+    uint64_t startTime=getNanoseconds();
+    if(writing.load(std::memory_order_acquire)&&!waitIfWriting)
+    {
+        skippedCheckpointCount++;
+        return false;
+    }
+    waitUntilWritten();
+
+    snapshot->copyParametersFrom(lstm,_includeMomentum);
+    includeMomentum=_includeMomentum;
+    for(uint32_t chainFile=0;chainFile<chainFilePathCount&&previousData!=0;chainFile++)
+    {
+        if(strcmp(chainFilePaths[chainFile],_filePath)==0)
+        {
+            // Overwriting a base of an incremental checkpoint would break the chain.
+            free(previousData);
+            previousData=0;
+        }
+    }
+    free(previousFilePath);
+    previousFilePath=filePath;
+    filePath=(char*)io::fixedLengthDataToString((char*)_filePath,strlen(_filePath));
+    writing.store(true,std::memory_order_release);
+    writerThread=std::thread([this]()
+    {
+        uint64_t writeStartTime=getNanoseconds();
+        fs_t size;
+        char *data=snapshot->serialize(size,includeMomentum);
+        char *incremental=0;
+        fs_t incrementalSize=0;
+        if(fullCheckpointInterval>1&&previousData!=0&&checkpointsSinceFullCheckpoint+1<fullCheckpointInterval)
+            incremental=LSTM::encodeIncrementalCheckpoint(data,size,previousData,previousSize,LSTM::getIncrementalBasePath(filePath,previousFilePath),incrementalSize);
+        lastCheckpointWasIncremental=incremental!=0;
+        if(lastCheckpointWasIncremental)
+        {
+            lastCheckpointSucceeded=io::writeFileAtomically(filePath,incremental,incrementalSize);
+            lastWrittenSize=incrementalSize;
+            free(incremental);
+        }
+        else
+        {
+            lastCheckpointSucceeded=io::writeFileAtomically(filePath,data,size);
+            lastWrittenSize=size;
+        }
+        free(previousData);
+        previousData=0;
+        if(lastCheckpointSucceeded)
+        {
+            checkpointsSinceFullCheckpoint=lastCheckpointWasIncremental?checkpointsSinceFullCheckpoint+1:0;
+            if(fullCheckpointInterval>1)
+            {
+                previousData=data;
+                previousSize=size;
+                data=0;
+                if(!lastCheckpointWasIncremental)
+                    clearChainFilePaths();
+                chainFilePaths[chainFilePathCount++]=(char*)io::fixedLengthDataToString(filePath,strlen(filePath));
+            }
+        }
+        else
+            failedCheckpointCount++;
+        free(data);
+        lastWriteTime=getNanoseconds()-writeStartTime;
+        writing.store(false,std::memory_order_release);
+    });
+
+    checkpointCount++;
+    lastStallTime=getNanoseconds()-startTime;
+    totalStallTime+=lastStallTime;
+    if(lastStallTime>maxStallTime)
+        maxStallTime=lastStallTime;
+    return true;
+}
+
+void LSTMCheckpointWriter::waitUntilWritten()
+{
+    if(writerThread.joinable())
+        writerThread.join();
+}
+
+LSTMCheckpointWriter::~LSTMCheckpointWriter()
+{
+    waitUntilWritten();
+    delete snapshot;
+    free(filePath);
+    free(previousFilePath);
+    free(previousData);
+    clearChainFilePaths();
+    free(chainFilePaths);
+}
+
+void LSTMCheckpointWriter::clearChainFilePaths()
+{
+    for(uint32_t chainFile=0;chainFile<chainFilePathCount;chainFile++)
+        free(chainFilePaths[chainFile]);
+    chainFilePathCount=0;
+}
@@ -0,0 +1,63 @@
+#ifndef LSTMCHECKPOINTWRITER_H
+#define LSTMCHECKPOINTWRITER_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+
+#include "io.h"
+#include "lstm.h"
+
+// Writes checkpoints of an LSTM without stalling training for the serialization and the disk write. checkpoint() must be called between two
+// learn() calls (or process() calls); it only copies the parameters into a snapshot LSTM allocated once in the constructor, so the training
+// thread is stalled for one copy of the weights. A background thread serializes the snapshot and writes it with io::writeFileAtomically(), so
+// a crash never leaves a partially written checkpoint behind.
+// While a checkpoint is still being written, the snapshot is in use: checkpoint() then skips the new checkpoint (or waits, if asked to).
+// If fullCheckpointInterval is larger than 1, only every fullCheckpointInterval-th checkpoint is written in full; the ones in between are
+// incremental checkpoints against the previous checkpoint (see LSTM::encodeIncrementalCheckpoint()), so each needs its own file name and the
+// files of a chain must be kept together. The previous serialized checkpoint is kept in memory for this.
+
+class LSTMCheckpointWriter
+{
+public:
+    LSTM *lstm;
+    LSTM *snapshot; // Same topology as "lstm"
+    std::thread writerThread;
+    std::atomic<bool> writing;
+    char *filePath;
+    bool includeMomentum;
+    uint32_t fullCheckpointInterval; // 0 or 1: only full checkpoints
+    uint32_t checkpointsSinceFullCheckpoint;
+    char *previousData; // Serialized previous checkpoint; 0 if the next one has to be a full checkpoint
+    fs_t previousSize;
+    char *previousFilePath;
+    // Paths of the current chain, from its full checkpoint to the last incremental one (at most fullCheckpointInterval); a checkpoint to
+    // one of them is written in full, as overwriting a base of the chain would break it.
+    char **chainFilePaths;
+    uint32_t chainFilePathCount;
+
+    // Statistics; times in nanoseconds. The stall time is the time checkpoint() blocked the calling thread.
+    uint64_t checkpointCount;
+    uint64_t skippedCheckpointCount;
+    uint64_t lastStallTime;
+    uint64_t maxStallTime;
+    uint64_t totalStallTime;
+    // Written by the background thread; read them after waitUntilWritten() or while "writing" is false.
+    uint64_t lastWriteTime;
+    fs_t lastWrittenSize;
+    bool lastCheckpointWasIncremental;
+    uint64_t failedCheckpointCount;
+    bool lastCheckpointSucceeded;
+
+    LSTMCheckpointWriter(LSTM *_lstm,uint32_t _fullCheckpointInterval=0);
+    // Returns false if the checkpoint was skipped because the previous one is still being written and waitIfWriting is false.
+    bool checkpoint(const char *_filePath,bool _includeMomentum=false,bool waitIfWriting=false);
+    void waitUntilWritten();
+    ~LSTMCheckpointWriter(); // Waits for the checkpoint being written
+
+private:
+    void clearChainFilePaths();
+};
+
+#endif // LSTMCHECKPOINTWRITER_H
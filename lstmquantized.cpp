@@ -0,0 +1,510 @@
+#include "lstmquantized.h"
+
+#include <chrono>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#define LSTM_QUANTIZED_TABLE_RESOLUTION ((LSTM_QUANTIZED_TABLE_SIZE-1)/(2.0*LSTM_QUANTIZED_TABLE_RANGE)) // Entries per 1.0
+
+static uint32_t padToRowAlignment(uint32_t count)
+{
+    return (count+LSTM_QUANTIZED_ROW_ALIGNMENT-1)/LSTM_QUANTIZED_ROW_ALIGNMENT*LSTM_QUANTIZED_ROW_ALIGNMENT;
+}
+
+// Code of "value" as an unsigned byte (see LSTMQuantizedLayer); values beyond the calibrated range are clamped.
+static inline uint8_t quantize(float value, float inverseScale)
+{
+    float scaled=value*inverseScale;
+    if(!(scaled>-127.0f)) // Also catches NaN
+        return 1;
+    if(scaled>127.0f)
+        return 255;
+    return (uint8_t)(int32_t)(scaled+128.5f); // Positive, so the conversion rounds down
+}
+
+static inline float lookUp(const float *table, float value)
+{
+    float position=value*(float)LSTM_QUANTIZED_TABLE_RESOLUTION+(float)((LSTM_QUANTIZED_TABLE_SIZE-1)/2.0);
+    if(!(position>0.0f))
+        return table[0];
+    if(position>=(float)(LSTM_QUANTIZED_TABLE_SIZE-1))
+        return table[LSTM_QUANTIZED_TABLE_SIZE-1];
+    return table[(uint32_t)(position+0.5f)];
+}
+
+// Sum of codes[i]*weights[i]; "count" is a multiple of LSTM_QUANTIZED_ROW_ALIGNMENT.
+static inline int32_t dotProduct(const uint8_t *codes, const int8_t *weights, uint32_t count)
+{
+#if defined(__AVX2__)
+    __m256i sums=_mm256_setzero_si256();
+    for(uint32_t i=0;i<count;i+=32)
+    {
+        __m256i codeVector=_mm256_loadu_si256((const __m256i*)(codes+i));
+        __m256i weightVector=_mm256_loadu_si256((const __m256i*)(weights+i));
+#if defined(__AVX512VNNI__)&&defined(__AVX512VL__)
+        sums=_mm256_dpbusd_epi32(sums,codeVector,weightVector);
+#elif defined(__AVXVNNI__)
+        sums=_mm256_dpbusd_avx_epi32(sums,codeVector,weightVector);
+#else
+        // Widened to 16 bits: vpmaddubsw would add the two products of each pair in 16 bits, which saturates for codes above 128.
+        __m256i lowCodes=_mm256_cvtepu8_epi16(_mm256_castsi256_si128(codeVector));
+        __m256i highCodes=_mm256_cvtepu8_epi16(_mm256_extracti128_si256(codeVector,1));
+        __m256i lowWeights=_mm256_cvtepi8_epi16(_mm256_castsi256_si128(weightVector));
+        __m256i highWeights=_mm256_cvtepi8_epi16(_mm256_extracti128_si256(weightVector,1));
+        sums=_mm256_add_epi32(sums,_mm256_madd_epi16(lowCodes,lowWeights));
+        sums=_mm256_add_epi32(sums,_mm256_madd_epi16(highCodes,highWeights));
+#endif
+    }
+    __m128i sum=_mm_add_epi32(_mm256_castsi256_si128(sums),_mm256_extracti128_si256(sums,1));
+    sum=_mm_add_epi32(sum,_mm_shuffle_epi32(sum,0x4E));
+    sum=_mm_add_epi32(sum,_mm_shuffle_epi32(sum,0xB1));
+    return _mm_cvtsi128_si32(sum);
+#else
+    int32_t sum=0;
+    for(uint32_t i=0;i<count;i++)
+        sum+=(int32_t)codes[i]*weights[i];
+    return sum;
+#endif
+}
+
+// Same as LSTMState::activate(), with tanh taken from "tanhTable"
+static void activate(uint8_t activation, float *values, uint32_t count, const float *tanhTable)
+{
+    if(activation==LSTMGateActivation_relu)
+    {
+        for(uint32_t i=0;i<count;i++)
+            values[i]=values[i]>0.0f?values[i]:0.0f;
+    }
+    else if(activation==LSTMGateActivation_leakyRelu)
+    {
+        for(uint32_t i=0;i<count;i++)
+            values[i]=values[i]>0.0f?values[i]:(float)LSTM_LEAKY_RELU_SLOPE*values[i];
+    }
+    else if(activation==LSTMGateActivation_hardTanh)
+    {
+        for(uint32_t i=0;i<count;i++)
+            values[i]=values[i]<-1.0f?-1.0f:(values[i]>1.0f?1.0f:values[i]);
+    }
+    else if(activation!=LSTMGateActivation_identity)
+    {
+        for(uint32_t i=0;i<count;i++)
+            values[i]=lookUp(tanhTable,values[i]);
+    }
+}
+
+static float getScale(double largestMagnitude)
+{
+    return (float)(largestMagnitude>0.0?largestMagnitude/127.0:1.0/127.0);
+}
+
+// The calibration and the evaluation step a copy, as process() pushes states onto the LSTM.
+static LSTM *copyLSTM(LSTM *lstm)
+{
+    fs_t size;
+    char *data=lstm->serialize(size);
+    LSTM *copy=LSTM::deserialize(data,size);
+    free(data);
+    return copy;
+}
+
+LSTMQuantized *LSTMQuantized::create(LSTM *lstm, double **calibrationInputs, uint64_t calibrationStepCount)
+{
+    LSTMQuantized *quantized=new LSTMQuantized(lstm);
+    if(!quantized->calibrate(lstm,calibrationInputs,calibrationStepCount))
+    {
+        delete quantized;
+        return 0;
+    }
+    return quantized;
+}
+
+LSTMQuantized::LSTMQuantized(LSTM *lstm)
+{
+    LSTMState *weightState=lstm->getWeightState();
+    inputCount=lstm->inputCount;
+    cellCount=lstm->cellCount;
+    outputCount=lstm->outputCount;
+    inputAndCellCount=inputCount+cellCount;
+    sharedGateNetworks=lstm->sharedGateNetworks;
+    cellVariant=lstm->cellVariant;
+    gateNetworkActivations[0]=lstm->forgetGateNetworkActivation;
+    gateNetworkActivations[1]=lstm->inputGateNetworkActivation;
+    gateNetworkActivations[2]=lstm->outputGateNetworkActivation;
+    gateNetworkActivations[3]=lstm->candidateGateNetworkActivation;
+    gateNetworkCount=lstm->getGateNetworkCount();
+    gateNetworkOutputCount=lstm->getGateNetworkOutputCount();
+
+    double ****gateLayerWeights[4]={weightState->forgetGateLayerWeights,weightState->inputGateLayerWeights,weightState->outputGateLayerWeights,weightState->candidateGateLayerWeights};
+    double ***gateLayerBiasWeights[4]={weightState->forgetGateLayerBiasWeights,weightState->inputGateLayerBiasWeights,weightState->outputGateLayerBiasWeights,weightState->candidateGateLayerBiasWeights};
+    double *stateGateValueSumBiasWeights[4]={weightState->forgetGateValueSumBiasWeights,weightState->inputGateValueSumBiasWeights,weightState->outputGateValueSumBiasWeights,weightState->candidateGateValueSumBiasWeights};
+    uint32_t stateGateTotalLayerCounts[4]={weightState->forgetGateTotalLayerCount,weightState->inputGateTotalLayerCount,weightState->outputGateTotalLayerCount,weightState->candidateGateTotalLayerCount};
+    uint32_t *gateHiddenLayerNeuronCounts[4]={weightState->forgetGateHiddenLayerNeuronCounts,weightState->inputGateHiddenLayerNeuronCounts,weightState->outputGateHiddenLayerNeuronCounts,weightState->candidateGateHiddenLayerNeuronCounts};
+
+    widestLayer=padToRowAlignment(inputAndCellCount);
+    bottommostInputScale=1.0f/127.0f;
+    gateLayers=(LSTMQuantizedLayer***)LSTMAllocations::allocate(4*sizeof(LSTMQuantizedLayer**),LSTMAllocationCategory_state);
+    for(uint8_t gate=0;gate<4;gate++)
+    {
+        gateTotalLayerCounts[gate]=gate==0&&!weightState->hasForgetGateNetwork()?0:stateGateTotalLayerCounts[gate];
+        gateLayers[gate]=(LSTMQuantizedLayer**)LSTMAllocations::allocate(gateNetworkCount*sizeof(LSTMQuantizedLayer*),LSTMAllocationCategory_state);
+        for(uint32_t network=0;network<gateNetworkCount;network++)
+        {
+            gateLayers[gate][network]=(LSTMQuantizedLayer*)LSTMAllocations::allocate(gateTotalLayerCounts[gate]*sizeof(LSTMQuantizedLayer),LSTMAllocationCategory_state);
+            uint32_t neuronsInLastLayer=inputAndCellCount;
+            for(uint32_t thisLayer=0;thisLayer<gateTotalLayerCounts[gate];thisLayer++)
+            {
+                LSTMQuantizedLayer *layer=&gateLayers[gate][network][thisLayer];
+                layer->neuronCount=thisLayer==gateTotalLayerCounts[gate]-1?gateNetworkOutputCount:gateHiddenLayerNeuronCounts[gate][thisLayer];
+                layer->paddedInputCount=padToRowAlignment(neuronsInLastLayer);
+                layer->weights=(int8_t*)LSTMAllocations::allocate(layer->neuronCount*layer->paddedInputCount,LSTMAllocationCategory_state);
+                layer->weightScales=(float*)LSTMAllocations::allocate(layer->neuronCount*sizeof(float),LSTMAllocationCategory_state);
+                layer->zeroPointCorrections=(int32_t*)LSTMAllocations::allocate(layer->neuronCount*sizeof(int32_t),LSTMAllocationCategory_state);
+                layer->biasWeights=(float*)LSTMAllocations::allocate(layer->neuronCount*sizeof(float),LSTMAllocationCategory_state);
+                layer->inputScale=1.0f/127.0f;
+                for(uint32_t neuronInThisLayer=0;neuronInThisLayer<layer->neuronCount;neuronInThisLayer++)
+                {
+                    double *weights=gateLayerWeights[gate][network][thisLayer][neuronInThisLayer];
+                    int8_t *quantizedWeights=layer->weights+neuronInThisLayer*layer->paddedInputCount;
+                    double largestMagnitude=0.0;
+                    for(uint32_t neuronInLastLayer=0;neuronInLastLayer<neuronsInLastLayer;neuronInLastLayer++)
+                        largestMagnitude=fabs(weights[neuronInLastLayer])>largestMagnitude?fabs(weights[neuronInLastLayer]):largestMagnitude;
+                    double scale=largestMagnitude/127.0;
+                    int32_t weightSum=0;
+                    for(uint32_t neuronInLastLayer=0;neuronInLastLayer<neuronsInLastLayer;neuronInLastLayer++)
+                    {
+                        quantizedWeights[neuronInLastLayer]=scale>0.0?(int8_t)lround(weights[neuronInLastLayer]/scale):0;
+                        weightSum+=quantizedWeights[neuronInLastLayer];
+                    }
+                    for(uint32_t padding=neuronsInLastLayer;padding<layer->paddedInputCount;padding++)
+                        quantizedWeights[padding]=0;
+                    layer->weightScales[neuronInThisLayer]=(float)scale;
+                    layer->zeroPointCorrections[neuronInThisLayer]=-128*weightSum;
+                    layer->biasWeights[neuronInThisLayer]=(float)gateLayerBiasWeights[gate][network][thisLayer][neuronInThisLayer];
+                }
+                widestLayer=padToRowAlignment(layer->neuronCount)>widestLayer?padToRowAlignment(layer->neuronCount):widestLayer;
+                neuronsInLastLayer=layer->neuronCount;
+            }
+        }
+        gateValueSumBiasWeights[gate]=(float*)LSTMAllocations::allocate(cellCount*sizeof(float),LSTMAllocationCategory_state);
+        for(uint32_t cell=0;cell<cellCount;cell++)
+            gateValueSumBiasWeights[gate][cell]=(float)stateGateValueSumBiasWeights[gate][cell];
+    }
+
+    outputProjectionWeights=0;
+    outputProjectionBiasWeights=0;
+    if(lstm->hasOutputProjection())
+    {
+        outputProjectionWeights=(float**)LSTMAllocations::allocate(outputCount*sizeof(float*),LSTMAllocationCategory_state);
+        outputProjectionBiasWeights=(float*)LSTMAllocations::allocate(outputCount*sizeof(float),LSTMAllocationCategory_state);
+        for(uint32_t projectionOutput=0;projectionOutput<outputCount;projectionOutput++)
+        {
+            outputProjectionWeights[projectionOutput]=(float*)LSTMAllocations::allocate(cellCount*sizeof(float),LSTMAllocationCategory_state);
+            for(uint32_t cell=0;cell<cellCount;cell++)
+                outputProjectionWeights[projectionOutput][cell]=(float)weightState->outputProjectionWeights[projectionOutput][cell];
+            outputProjectionBiasWeights[projectionOutput]=(float)weightState->outputProjectionBiasWeights[projectionOutput];
+        }
+    }
+
+    for(uint32_t entry=0;entry<LSTM_QUANTIZED_TABLE_SIZE;entry++)
+    {
+        double value=(entry-(LSTM_QUANTIZED_TABLE_SIZE-1)/2.0)/LSTM_QUANTIZED_TABLE_RESOLUTION;
+        sigmoidTable[entry]=(float)LSTMState::sig(value);
+        tanhTable[entry]=(float)LSTMState::tanh(value);
+    }
+}
+
+bool LSTMQuantized::calibrate(LSTM *lstm, double **inputs, uint64_t stepCount)
+{
+    if(stepCount==0)
+        return false;
+    LSTM *reference=copyLSTM(lstm);
+    if(reference==0)
+        return false;
+
+    // The bottommost layers of all gates see the inputs and the cell outputs (with the GRU-style cell, the candidate networks see smaller ones).
+    double largestBottommostMagnitude=0.0;
+    // Dimensions: Gates - networks - hidden layers
+    double ***largestHiddenLayerMagnitudes=(double***)LSTMAllocations::allocate(4*sizeof(double**),LSTMAllocationCategory_scratch);
+    for(uint8_t gate=0;gate<4;gate++)
+    {
+        largestHiddenLayerMagnitudes[gate]=(double**)LSTMAllocations::allocate(gateNetworkCount*sizeof(double*),LSTMAllocationCategory_scratch);
+        for(uint32_t network=0;network<gateNetworkCount;network++)
+        {
+            uint32_t hiddenLayerCount=gateTotalLayerCounts[gate]>0?gateTotalLayerCounts[gate]-1:0;
+            largestHiddenLayerMagnitudes[gate][network]=(double*)LSTMAllocations::allocate(hiddenLayerCount*sizeof(double),LSTMAllocationCategory_scratch);
+            for(uint32_t hiddenLayer=0;hiddenLayer<hiddenLayerCount;hiddenLayer++)
+                largestHiddenLayerMagnitudes[gate][network][hiddenLayer]=0.0;
+        }
+    }
+
+    for(uint64_t step=0;step<stepCount;step++)
+    {
+        free(reference->process(inputs[step]));
+        LSTMState *state=reference->getCurrentState();
+        for(uint32_t inputN=0;inputN<inputCount;inputN++)
+            largestBottommostMagnitude=fabs(state->input[inputN])>largestBottommostMagnitude?fabs(state->input[inputN]):largestBottommostMagnitude;
+        for(uint32_t cell=0;cell<cellCount;cell++)
+            largestBottommostMagnitude=fabs(state->output[cell])>largestBottommostMagnitude?fabs(state->output[cell]):largestBottommostMagnitude;
+        double ***gateLayerNeuronValues[4]={state->forgetGateLayerNeuronValues,state->inputGateLayerNeuronValues,state->outputGateLayerNeuronValues,state->candidateGateLayerNeuronValues};
+        for(uint8_t gate=0;gate<4;gate++)
+        {
+            for(uint32_t network=0;network<gateNetworkCount;network++)
+            {
+                for(uint32_t hiddenLayer=0;hiddenLayer+1<gateTotalLayerCounts[gate];hiddenLayer++)
+                {
+                    double *values=gateLayerNeuronValues[gate][network][hiddenLayer];
+                    double &largestMagnitude=largestHiddenLayerMagnitudes[gate][network][hiddenLayer];
+                    for(uint32_t neuron=0;neuron<gateLayers[gate][network][hiddenLayer].neuronCount;neuron++)
+                        largestMagnitude=fabs(values[neuron])>largestMagnitude?fabs(values[neuron]):largestMagnitude;
+                }
+            }
+        }
+    }
+
+    bottommostInputScale=getScale(largestBottommostMagnitude);
+    for(uint8_t gate=0;gate<4;gate++)
+    {
+        for(uint32_t network=0;network<gateNetworkCount;network++)
+        {
+            for(uint32_t thisLayer=0;thisLayer<gateTotalLayerCounts[gate];thisLayer++)
+                gateLayers[gate][network][thisLayer].inputScale=thisLayer==0?bottommostInputScale:getScale(largestHiddenLayerMagnitudes[gate][network][thisLayer-1]);
+            LSTMAllocations::release(largestHiddenLayerMagnitudes[gate][network]);
+        }
+        LSTMAllocations::release(largestHiddenLayerMagnitudes[gate]);
+    }
+    LSTMAllocations::release(largestHiddenLayerMagnitudes);
+    delete reference;
+    return true;
+}
+
+bool LSTMQuantized::evaluate(LSTM *lstm, double **inputs, uint64_t stepCount, LSTMQuantizationReport &report)
+{
+    if(stepCount==0)
+        return false;
+    LSTM *reference=copyLSTM(lstm);
+    if(reference==0)
+        return false;
+    // Dimensions: Steps - outputs
+    double *referenceOutputs=(double*)LSTMAllocations::allocate(stepCount*outputCount*sizeof(double),LSTMAllocationCategory_scratch);
+    double *quantizedOutputs=(double*)LSTMAllocations::allocate(stepCount*outputCount*sizeof(double),LSTMAllocationCategory_scratch);
+
+    std::chrono::steady_clock::time_point start=std::chrono::steady_clock::now();
+    for(uint64_t step=0;step<stepCount;step++)
+    {
+        double *output=reference->process(inputs[step]);
+        memcpy(referenceOutputs+step*outputCount,output,outputCount*sizeof(double));
+        free(output);
+    }
+    uint64_t processTime=(uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-start).count();
+    delete reference;
+
+    LSTMSession *session=lstm->createSession();
+    double *scratch=(double*)LSTMAllocations::allocate(lstm->getSessionScratchSize()*sizeof(double),LSTMAllocationCategory_scratch);
+    start=std::chrono::steady_clock::now();
+    for(uint64_t step=0;step<stepCount;step++)
+        lstm->processSession(session,inputs[step],quantizedOutputs+step*outputCount,scratch); // Overwritten below
+    uint64_t sessionTime=(uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-start).count();
+    LSTMAllocations::release(scratch);
+    lstm->destroySession(session);
+
+    session=createSession();
+    uint8_t *quantizedScratch=(uint8_t*)LSTMAllocations::allocate(getSessionScratchSize(),LSTMAllocationCategory_scratch);
+    start=std::chrono::steady_clock::now();
+    for(uint64_t step=0;step<stepCount;step++)
+        processSession(session,inputs[step],quantizedOutputs+step*outputCount,quantizedScratch);
+    uint64_t quantizedTime=(uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-start).count();
+    LSTMAllocations::release(quantizedScratch);
+    destroySession(session);
+
+    double absoluteErrorSum=0.0;
+    uint64_t agreeingStepCount=0;
+    report.maxAbsoluteError=0.0;
+    for(uint64_t step=0;step<stepCount;step++)
+    {
+        double *referenceOutput=referenceOutputs+step*outputCount;
+        double *quantizedOutput=quantizedOutputs+step*outputCount;
+        uint32_t highestReferenceOutput=0;
+        uint32_t highestQuantizedOutput=0;
+        for(uint32_t outputN=0;outputN<outputCount;outputN++)
+        {
+            double absoluteError=fabs(quantizedOutput[outputN]-referenceOutput[outputN]);
+            absoluteErrorSum+=absoluteError;
+            report.maxAbsoluteError=absoluteError>report.maxAbsoluteError?absoluteError:report.maxAbsoluteError;
+            if(referenceOutput[outputN]>referenceOutput[highestReferenceOutput])
+                highestReferenceOutput=outputN;
+            if(quantizedOutput[outputN]>quantizedOutput[highestQuantizedOutput])
+                highestQuantizedOutput=outputN;
+        }
+        if(highestReferenceOutput==highestQuantizedOutput)
+            agreeingStepCount++;
+    }
+    report.stepCount=stepCount;
+    report.meanAbsoluteError=absoluteErrorSum/((double)stepCount*outputCount);
+    report.highestOutputAgreement=(double)agreeingStepCount/stepCount;
+    report.processNanosecondsPerStep=(double)processTime/stepCount;
+    report.sessionNanosecondsPerStep=(double)sessionTime/stepCount;
+    report.quantizedNanosecondsPerStep=(double)quantizedTime/stepCount;
+    report.speedup=quantizedTime>0?(double)processTime/quantizedTime:0.0;
+    LSTMAllocations::release(referenceOutputs);
+    LSTMAllocations::release(quantizedOutputs);
+    return true;
+}
+
+LSTMSession *LSTMQuantized::createSession()
+{
+    return new LSTMSession(cellCount);
+}
+
+void LSTMQuantized::destroySession(LSTMSession *session)
+{
+    delete session;
+}
+
+uint32_t LSTMQuantized::getSessionScratchSize()
+{
+    // Layer values and gate values (float), then the bottommost layer codes and two alternating layer code buffers
+    return (widestLayer+4*cellCount)*sizeof(float)+3*widestLayer;
+}
+
+double *LSTMQuantized::processSession(LSTMSession *session, double *input, double *output, uint8_t *scratch)
+{
+    // Same computation as LSTMState::processSession(), with the layers evaluated on the quantized values.
+
+    if(output==0)
+        output=(double*)LSTMAllocations::allocateOutput(outputCount*sizeof(double));
+    bool allocateScratch=scratch==0;
+    if(allocateScratch)
+        scratch=(uint8_t*)LSTMAllocations::allocate(getSessionScratchSize(),LSTMAllocationCategory_scratch);
+    float *layerValues=(float*)scratch;
+    float *gateValues=layerValues+widestLayer; // Dimensions: gates (forget, input, output, candidate) - cells
+    uint8_t *bottommostLayerCodes=(uint8_t*)(gateValues+4*cellCount);
+    uint8_t *layerCodeBuffers[2]={bottommostLayerCodes+widestLayer,bottommostLayerCodes+2*widestLayer};
+    bool hasPreviousState=session->hasPreviousState;
+    // The previous outputs are quantized below, so projected sessions can store the new cell outputs there directly.
+    double *cellOutputs=outputProjectionWeights!=0?session->previousOutputs:output;
+
+    float inverseBottommostInputScale=1.0f/bottommostInputScale;
+    for(uint32_t inputN=0;inputN<inputCount;inputN++)
+        bottommostLayerCodes[inputN]=quantize((float)input[inputN],inverseBottommostInputScale);
+    for(uint32_t cell=0;cell<cellCount;cell++)
+        bottommostLayerCodes[inputCount+cell]=hasPreviousState?quantize((float)session->previousOutputs[cell],inverseBottommostInputScale):128;
+    memset(bottommostLayerCodes+inputAndCellCount,128,padToRowAlignment(inputAndCellCount)-inputAndCellCount);
+
+    for(uint8_t gate=0;gate<4;gate++)
+    {
+        if(gateTotalLayerCounts[gate]==0)
+            continue; // The forget gate networks of the reduced cell variants
+        for(uint32_t network=0;network<gateNetworkCount;network++)
+        {
+            uint8_t *lastLayerCodes=bottommostLayerCodes;
+            for(uint32_t thisLayer=0;thisLayer<gateTotalLayerCounts[gate];thisLayer++)
+            {
+                LSTMQuantizedLayer *layer=&gateLayers[gate][network][thisLayer];
+                for(uint32_t neuronInThisLayer=0;neuronInThisLayer<layer->neuronCount;neuronInThisLayer++)
+                {
+                    int32_t sum=dotProduct(lastLayerCodes,layer->weights+neuronInThisLayer*layer->paddedInputCount,layer->paddedInputCount)+layer->zeroPointCorrections[neuronInThisLayer];
+                    layerValues[neuronInThisLayer]=(float)sum*layer->weightScales[neuronInThisLayer]*layer->inputScale+layer->biasWeights[neuronInThisLayer];
+                }
+                activate(gateNetworkActivations[gate],layerValues,layer->neuronCount,tanhTable);
+                if(thisLayer<gateTotalLayerCounts[gate]-1)
+                {
+                    uint8_t *thisLayerCodes=layerCodeBuffers[thisLayer%2];
+                    float inverseScale=1.0f/gateLayers[gate][network][thisLayer+1].inputScale;
+                    for(uint32_t neuronInThisLayer=0;neuronInThisLayer<layer->neuronCount;neuronInThisLayer++)
+                        thisLayerCodes[neuronInThisLayer]=quantize(layerValues[neuronInThisLayer],inverseScale);
+                    memset(thisLayerCodes+layer->neuronCount,128,padToRowAlignment(layer->neuronCount)-layer->neuronCount);
+                    lastLayerCodes=thisLayerCodes;
+                }
+            }
+
+            // layerValues now holds the topmost layer values of this network's cell, or of all cells if the network is shared
+            uint32_t firstCell=sharedGateNetworks?0:network;
+            uint32_t lastCell=sharedGateNetworks?cellCount-1:network;
+            for(uint32_t cell=firstCell;cell<=lastCell;cell++)
+            {
+                float gateValueSum;
+                if(sharedGateNetworks)
+                    gateValueSum=layerValues[cell];
+                else
+                {
+                    // See LSTMState::getGateValueSum()
+                    gateValueSum=0.0f;
+                    uint32_t summedValueCount=hasPreviousState?inputAndCellCount:inputCount;
+                    for(uint32_t i=0;i<summedValueCount;i++)
+                        gateValueSum+=layerValues[i];
+                }
+                gateValueSum+=gateValueSumBiasWeights[gate][cell];
+                gateValues[gate*cellCount+cell]=gate==3?lookUp(tanhTable,gateValueSum):lookUp(sigmoidTable,gateValueSum);
+            }
+        }
+
+        if(gate==2&&cellVariant==LSTMCellVariant_gru&&hasPreviousState)
+        {
+            // The candidate networks see the previous outputs multiplied by the reset gate values
+            for(uint32_t cell=0;cell<cellCount;cell++)
+                bottommostLayerCodes[inputCount+cell]=quantize(gateValues[2*cellCount+cell]*(float)session->previousOutputs[cell],inverseBottommostInputScale);
+        }
+    }
+
+    if(gateTotalLayerCounts[0]==0)
+    {
+        for(uint32_t cell=0;cell<cellCount;cell++)
+            gateValues[cell]=1.0f-gateValues[cellCount+cell];
+    }
+    for(uint32_t cell=0;cell<cellCount;cell++)
+    {
+        // Each cell only reads its own previous cell state, so the new one can replace it right away.
+        float cellState=(hasPreviousState?gateValues[cell]*(float)session->cellStates[cell]:0.0f)+gateValues[cellCount+cell]*gateValues[3*cellCount+cell];
+        session->cellStates[cell]=cellState;
+        cellOutputs[cell]=cellVariant==LSTMCellVariant_gru?cellState:gateValues[2*cellCount+cell]*cellState;
+    }
+
+    if(outputProjectionWeights!=0)
+    {
+        for(uint32_t projectionOutput=0;projectionOutput<outputCount;projectionOutput++)
+        {
+            float *weights=outputProjectionWeights[projectionOutput];
+            float sum=outputProjectionBiasWeights[projectionOutput];
+            for(uint32_t cell=0;cell<cellCount;cell++)
+                sum+=weights[cell]*(float)cellOutputs[cell];
+            output[projectionOutput]=sum;
+        }
+    }
+    else
+        memcpy(session->previousOutputs,output,cellCount*sizeof(double));
+    session->hasPreviousState=true;
+    if(allocateScratch)
+        LSTMAllocations::release(scratch);
+    return output;
+}
+
+LSTMQuantized::~LSTMQuantized()
+{
+    for(uint8_t gate=0;gate<4;gate++)
+    {
+        for(uint32_t network=0;network<gateNetworkCount;network++)
+        {
+            for(uint32_t thisLayer=0;thisLayer<gateTotalLayerCounts[gate];thisLayer++)
+            {
+                LSTMQuantizedLayer *layer=&gateLayers[gate][network][thisLayer];
+                LSTMAllocations::release(layer->weights);
+                LSTMAllocations::release(layer->weightScales);
+                LSTMAllocations::release(layer->zeroPointCorrections);
+                LSTMAllocations::release(layer->biasWeights);
+            }
+            LSTMAllocations::release(gateLayers[gate][network]);
+        }
+        LSTMAllocations::release(gateLayers[gate]);
+        LSTMAllocations::release(gateValueSumBiasWeights[gate]);
+    }
+    LSTMAllocations::release(gateLayers);
+    if(outputProjectionWeights!=0)
+    {
+        for(uint32_t projectionOutput=0;projectionOutput<outputCount;projectionOutput++)
+            LSTMAllocations::release(outputProjectionWeights[projectionOutput]);
+        LSTMAllocations::release(outputProjectionWeights);
+        LSTMAllocations::release(outputProjectionBiasWeights);
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef LSTMQUANTIZED_H
+#define LSTMQUANTIZED_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <memory.h>
+
+#include "lstm.h"
+#include "lstmstate.h"
+#include "lstmsession.h"
+
+#define LSTM_QUANTIZED_ROW_ALIGNMENT 32 // Bytes; the weight rows and layer values are padded to this size for the vector kernels
+#define LSTM_QUANTIZED_TABLE_SIZE 4096
+#define LSTM_QUANTIZED_TABLE_RANGE 8.0 // The sigmoid and tanh tables cover -LSTM_QUANTIZED_TABLE_RANGE to LSTM_QUANTIZED_TABLE_RANGE
+
+// One layer of a quantized gate network. A neuron's value is
+// (sum of codes*weights+zeroPointCorrection)*weightScale*inputScale+biasWeight, where the codes are the values of the last layer stored as
+// unsigned bytes: code=round(value/inputScale)+128.
+struct LSTMQuantizedLayer
+{
+    uint32_t neuronCount;
+    uint32_t paddedInputCount; // Neurons in the last layer, rounded up to LSTM_QUANTIZED_ROW_ALIGNMENT
+    int8_t *weights; // Dimensions: Neurons - padded inputs (the padding weights are 0)
+    float *weightScales; // Dimensions: Neurons; the largest weight magnitude of the row/127
+    int32_t *zeroPointCorrections; // Dimensions: Neurons; -128*sum of the row's weights
+    float *biasWeights; // Dimensions: Neurons
+    float inputScale; // Set by calibrate()
+};
+
+// Accuracy and speed of an LSTMQuantized compared to the LSTM it was created from (see LSTMQuantized::evaluate())
+struct LSTMQuantizationReport
+{
+    uint64_t stepCount;
+    double maxAbsoluteError; // Of the outputs
+    double meanAbsoluteError;
+    double highestOutputAgreement; // Share of the steps in which the same output is the highest
+    double processNanosecondsPerStep; // LSTM::process()
+    double sessionNanosecondsPerStep; // LSTM::processSession()
+    double quantizedNanosecondsPerStep; // LSTMQuantized::processSession()
+    double speedup; // Over LSTM::process()
+};
+
+// Int8 inference engine for serving: a read-only copy of the gate networks of an LSTM with 8 bit weights (one scale per neuron, i.e. weight row)
+// and 8 bit layer values (one scale per layer, found by calibrate() from the values the LSTM produces for sample inputs). The products are
+// summed in 32 bit integers, and sigmoid and tanh are looked up in tables. The cell states, gate value sums and the output projection are
+// kept in float. Sessions are the same as those of the LSTM (see LSTM::createSession()); like the replicas of LSTMReplicaSet, an LSTMQuantized
+// does not follow learn(), so it has to be created again after the weights have been changed.
+// The dot products use AVX-512 VNNI or AVX-VNNI (vpdpbusd) or AVX2 (widened to 16 bits, as the 16 bit pair sums of vpmaddubsw could saturate)
+// if the compiler targets them (e.g. with -march=native); all kernels give the same results.
+
+class LSTMQuantized
+{
+public:
+    uint32_t inputCount;
+    uint32_t cellCount;
+    uint32_t outputCount; // Equal to cellCount unless there is an output projection
+    uint32_t inputAndCellCount;
+    bool sharedGateNetworks;
+    uint8_t cellVariant; // LSTMCellVariant
+    uint8_t gateNetworkActivations[4]; // LSTMGateActivation per gate (forget, input, output, candidate)
+    uint32_t gateNetworkCount; // Per gate
+    uint32_t gateNetworkOutputCount;
+    uint32_t gateTotalLayerCounts[4]; // 0 for the forget gate if the cell variant does not evaluate its networks
+    // Dimensions: Gates - networks - layers
+    LSTMQuantizedLayer ***gateLayers;
+    float bottommostInputScale; // Shared by the bottommost layers of all gate networks (the inputScale of their layer 0)
+    // Dimensions: Gates - cells
+    float *gateValueSumBiasWeights[4];
+    // Only if there is an output projection; dimensions: Outputs - cells, and outputs
+    float **outputProjectionWeights;
+    float *outputProjectionBiasWeights;
+    uint32_t widestLayer; // Padded neurons of the widest layer (including the bottommost layer inputs)
+    float sigmoidTable[LSTM_QUANTIZED_TABLE_SIZE];
+    float tanhTable[LSTM_QUANTIZED_TABLE_SIZE];
+
+    // Returns 0 if there are no calibration inputs or "lstm" cannot be copied. The calibration inputs are processed as one sequence.
+    static LSTMQuantized *create(LSTM *lstm,double **calibrationInputs,uint64_t calibrationStepCount);
+    LSTMQuantized(LSTM *lstm); // Quantizes the weights; until calibrate() is called, all layer values are assumed to be within [-1,1].
+    // Sets the layer scales to the largest magnitudes of the layer values of a copy of "lstm" (which itself is not changed) processing "inputs".
+    // Returns false if "lstm" cannot be copied or stepCount is 0.
+    bool calibrate(LSTM *lstm,double **inputs,uint64_t stepCount);
+    // Processes "inputs" (one sequence) with a copy of "lstm", with a session of "lstm" and with a session of this LSTMQuantized.
+    bool evaluate(LSTM *lstm,double **inputs,uint64_t stepCount,LSTMQuantizationReport &report);
+
+    LSTMSession *createSession();
+    void destroySession(LSTMSession *session);
+    uint32_t getSessionScratchSize(); // Number of bytes to pass as "scratch" to processSession()
+    // Same as LSTM::processSession(): "output" is allocated if 0 (then the caller frees it); if "scratch" is 0, it is allocated for this call.
+    // Sessions may be processed concurrently from multiple threads.
+    double *processSession(LSTMSession *session,double *input,double *output=0,uint8_t *scratch=0);
+    ~LSTMQuantized();
+};
+
+#endif // LSTMQUANTIZED_H
@@ -0,0 +1,180 @@
+#include "lstmreplicaset.h"
+
+#include <stdio.h>
+#include <new>
+#include <thread>
+
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+uint32_t LSTMReplicaSet::detectNodes(uint32_t *&_cpuNodes, uint32_t &_cpuCount)
+{
+    _cpuCount=std::thread::hardware_concurrency();
+    uint32_t _nodeCount=1;
+#ifdef __linux__
+    long configuredCpuCount=sysconf(_SC_NPROCESSORS_CONF);
+    if(configuredCpuCount>0)
+        _cpuCount=(uint32_t)configuredCpuCount;
+#endif
+    if(_cpuCount==0)
+        _cpuCount=1;
+    _cpuNodes=(uint32_t*)LSTMAllocations::allocate(_cpuCount*sizeof(uint32_t),LSTMAllocationCategory_state);
+    for(uint32_t cpu=0;cpu<_cpuCount;cpu++)
+        _cpuNodes[cpu]=0;
+#ifdef __linux__
+    // Node directories may have gaps (e.g. node0 and node2), so the nodes found are numbered consecutively.
+    uint32_t foundNodeCount=0;
+    for(uint32_t node=0;node<1024;node++)
+    {
+        char path[64];
+        sprintf(path,"/sys/devices/system/node/node%u/cpulist",node);
+        FILE *f=fopen(path,"r");
+        if(f==0)
+            continue;
+        // Format: comma-separated CPU numbers or ranges, e.g. "0-15,32-47"
+        uint32_t from;
+        uint32_t to;
+        bool nodeHasCpus=false;
+        while(fscanf(f,"%u",&from)==1)
+        {
+            to=from;
+            int separator=fgetc(f);
+            if(separator=='-')
+            {
+                if(fscanf(f,"%u",&to)!=1)
+                    break;
+                separator=fgetc(f);
+            }
+            for(uint32_t cpu=from;cpu<=to&&cpu<_cpuCount;cpu++)
+                _cpuNodes[cpu]=foundNodeCount;
+            nodeHasCpus=true;
+            if(separator!=',')
+                break;
+        }
+        fclose(f);
+        if(nodeHasCpus) // Memory-only nodes cannot run workers
+            foundNodeCount++;
+    }
+    if(foundNodeCount>1)
+        _nodeCount=foundNodeCount;
+    else
+    {
+        for(uint32_t cpu=0;cpu<_cpuCount;cpu++)
+            _cpuNodes[cpu]=0;
+    }
+#endif
+    return _nodeCount;
+}
+
+LSTMReplicaSet::LSTMReplicaSet(LSTM *lstm, bool replicatePerNode)
+{
+    nodeCount=detectNodes(cpuNodes,cpuCount);
+    if(!replicatePerNode)
+    {
+        nodeCount=1;
+        for(uint32_t cpu=0;cpu<cpuCount;cpu++)
+            cpuNodes[cpu]=0;
+    }
+    replicas=(LSTMState**)LSTMAllocations::allocate(nodeCount*sizeof(LSTMState*),LSTMAllocationCategory_state);
+    nodeStepCounts=(std::atomic<uint64_t>*)LSTMAllocations::allocate(nodeCount*sizeof(std::atomic<uint64_t>),LSTMAllocationCategory_state);
+    for(uint32_t node=0;node<nodeCount;node++)
+    {
+        replicas[node]=0;
+        new(&nodeStepCounts[node]) std::atomic<uint64_t>(0);
+    }
+    resetNodeStepCounts();
+    refresh(lstm);
+}
+
+void LSTMReplicaSet::refresh(LSTM *lstm)
+{
+    LSTMState *weightState=lstm->getWeightState();
+    gateNetworkActivations[0]=lstm->forgetGateNetworkActivation;
+    gateNetworkActivations[1]=lstm->inputGateNetworkActivation;
+    gateNetworkActivations[2]=lstm->outputGateNetworkActivation;
+    gateNetworkActivations[3]=lstm->candidateGateNetworkActivation;
+    for(uint32_t node=0;node<nodeCount;node++)
+    {
+        if(replicas[node]!=0)
+            delete replicas[node];
+        if(nodeCount==1)
+            replicas[node]=new LSTMState(weightState);
+        else
+        {
+            // The copy constructor allocates and writes all weight arrays, so running it on the target node places the pages there (first touch).
+            std::thread replicaThread([this,node,weightState]()
+            {
+                pinCurrentThreadToNode(node);
+                replicas[node]=new LSTMState(weightState);
+            });
+            replicaThread.join();
+        }
+    }
+}
+
+bool LSTMReplicaSet::pinCurrentThreadToNode(uint32_t node)
+{
+#ifdef __linux__
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    for(uint32_t cpu=0;cpu<cpuCount&&cpu<CPU_SETSIZE;cpu++)
+    {
+        if(cpuNodes[cpu]==node)
+            CPU_SET(cpu,&cpuSet);
+    }
+    return sched_setaffinity(0,sizeof(cpu_set_t),&cpuSet)==0;
+#else
+    (void)node;
+    return false;
+#endif
+}
+
+uint32_t LSTMReplicaSet::getCurrentNode()
+{
+    if(nodeCount==1)
+        return 0;
+#ifdef __linux__
+    int cpu=sched_getcpu();
+    if(cpu>=0&&(uint32_t)cpu<cpuCount)
+        return cpuNodes[cpu];
+#endif
+    return 0;
+}
+
+LSTMState *LSTMReplicaSet::getLocalReplica()
+{
+    return replicas[getCurrentNode()];
+}
+
+double *LSTMReplicaSet::processSession(LSTMSession *session, double *input, double *output, double *scratch)
+{
+    uint32_t node=getCurrentNode();
+    replicas[node]->processSession(session,input,output,scratch,gateNetworkActivations);
+    nodeStepCounts[node].fetch_add(1,std::memory_order_relaxed);
+    return output;
+}
+
+uint64_t LSTMReplicaSet::getNodeStepCount(uint32_t node)
+{
+    return nodeStepCounts[node].load(std::memory_order_relaxed);
+}
+
+void LSTMReplicaSet::resetNodeStepCounts()
+{
+    for(uint32_t node=0;node<nodeCount;node++)
+        nodeStepCounts[node].store(0,std::memory_order_relaxed);
+}
+
+LSTMReplicaSet::~LSTMReplicaSet()
+{
+    for(uint32_t node=0;node<nodeCount;node++)
+    {
+        if(replicas[node]!=0)
+            delete replicas[node];
+    }
+    LSTMAllocations::release(replicas);
+    LSTMAllocations::release(cpuNodes);
+    LSTMAllocations::release(nodeStepCounts); // std::atomic has a trivial destructor
+}
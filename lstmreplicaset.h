@@ -0,0 +1,42 @@
+#ifndef LSTMREPLICASET_H
+#define LSTMREPLICASET_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <atomic>
+
+#include "lstm.h"
+#include "lstmstate.h"
+#include "lstmsession.h"
+
+// Read-only copies of the weights of an LSTM, one per NUMA node, so that inference threads read the gate weights from local memory.
+// Each replica is created by a thread pinned to the CPUs of its node; as the pages are first touched (copied) there, the kernel places them on
+// that node. On machines with only one node, on non-Linux systems or if replicatePerNode is false, a single copy is used.
+// The replicas do not follow learn(): call refresh() after the weights have been changed (and while no thread processes sessions).
+
+class LSTMReplicaSet
+{
+public:
+    uint32_t nodeCount;
+    LSTMState **replicas; // Dimensions: NUMA nodes
+    uint32_t cpuCount;
+    uint32_t *cpuNodes; // Dimensions: CPUs; NUMA node of each CPU
+    std::atomic<uint64_t> *nodeStepCounts; // Dimensions: NUMA nodes; steps processed with each replica
+    uint8_t gateNetworkActivations[4]; // Of the LSTM, as of the last refresh()
+
+    // Returns the NUMA node count (1 if unknown); "_cpuNodes" is allocated with LSTMAllocations::allocate() and released with release().
+    static uint32_t detectNodes(uint32_t *&_cpuNodes,uint32_t &_cpuCount);
+
+    LSTMReplicaSet(LSTM *lstm,bool replicatePerNode=true);
+    void refresh(LSTM *lstm);
+    bool pinCurrentThreadToNode(uint32_t node); // Returns false if pinning is not supported
+    uint32_t getCurrentNode();
+    LSTMState *getLocalReplica();
+    // Same as LSTM::processSession(), but uses the replica of the NUMA node the calling thread runs on. "output" and "scratch" must not be 0.
+    double *processSession(LSTMSession *session,double *input,double *output,double *scratch);
+    uint64_t getNodeStepCount(uint32_t node);
+    void resetNodeStepCounts();
+    ~LSTMReplicaSet();
+};
+
+#endif // LSTMREPLICASET_H
@@ -0,0 +1,20 @@
+#include "lstmsession.h"
+
+LSTMSession::LSTMSession(uint32_t _outputCount)
+{
+    outputCount=_outputCount;
+    hasPreviousState=false;
+    // One allocation per session keeps creating and destroying sessions cheap:
+    previousOutputs=(double*)LSTMAllocations::allocate(2*outputCount*sizeof(double),LSTMAllocationCategory_state);
+    cellStates=previousOutputs+outputCount;
+}
+
+void LSTMSession::reset()
+{
+    hasPreviousState=false; // The values are not read until they have been written by the next step.
+}
+
+LSTMSession::~LSTMSession()
+{
+    LSTMAllocations::release(previousOutputs); // Also frees cellStates
+}
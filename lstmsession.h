@@ -0,0 +1,36 @@
+#ifndef LSTMSESSION_H
+#define LSTMSESSION_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <memory.h>
+
+#include "lstmallocations.h"
+
+// The recurrent state of one independent inference stream. It does not own any weights: a session is stepped against a shared, read-only
+// LSTMState (see LSTMState::processSession() and LSTM::processSession()), so it only holds the previous outputs and cell states.
+
+class LSTMSession
+{
+public:
+    uint32_t outputCount;
+    bool hasPreviousState;
+    // Dimensions: Cells (both arrays share one allocation)
+    double *previousOutputs;
+    double *cellStates;
+
+    LSTMSession(uint32_t _outputCount);
+    void reset(); // Forgets the previous outputs and cell states; the next step behaves like the first step of a new sequence.
+    ~LSTMSession();
+
+    static void *operator new(size_t size)
+    {
+        return LSTMAllocations::allocate(size,LSTMAllocationCategory_state);
+    }
+    static void operator delete(void *pointer)
+    {
+        LSTMAllocations::release(pointer);
+    }
+};
+
+#endif // LSTMSESSION_H
@@ -0,0 +1,88 @@
+#include "lstmsparsity.h"
+#include "lstmstate.h"
+
+LSTMSparsity::LSTMSparsity(LSTMState *state)
+{
+    gateNetworkCount=state->gateNetworkCount;
+    gateTotalLayerCounts[0]=state->forgetGateTotalLayerCount;
+    gateTotalLayerCounts[1]=state->inputGateTotalLayerCount;
+    gateTotalLayerCounts[2]=state->outputGateTotalLayerCount;
+    gateTotalLayerCounts[3]=state->candidateGateTotalLayerCount;
+    double ****gateLayerWeights[4]={state->forgetGateLayerWeights,state->inputGateLayerWeights,state->outputGateLayerWeights,state->candidateGateLayerWeights};
+    uint32_t *gateHiddenLayerNeuronCounts[4]={state->forgetGateHiddenLayerNeuronCounts,state->inputGateHiddenLayerNeuronCounts,state->outputGateHiddenLayerNeuronCounts,state->candidateGateHiddenLayerNeuronCounts};
+    keptWeightCount=0;
+    weightCount=0;
+
+    rowStarts=(uint32_t****)LSTMAllocations::allocate(4*sizeof(uint32_t***),LSTMAllocationCategory_state);
+    columns=(uint32_t****)LSTMAllocations::allocate(4*sizeof(uint32_t***),LSTMAllocationCategory_state);
+    for(uint8_t gate=0;gate<4;gate++)
+    {
+        rowStarts[gate]=(uint32_t***)LSTMAllocations::allocate(gateNetworkCount*sizeof(uint32_t**),LSTMAllocationCategory_state);
+        columns[gate]=(uint32_t***)LSTMAllocations::allocate(gateNetworkCount*sizeof(uint32_t**),LSTMAllocationCategory_state);
+        for(uint32_t network=0;network<gateNetworkCount;network++)
+        {
+            rowStarts[gate][network]=(uint32_t**)LSTMAllocations::allocate(gateTotalLayerCounts[gate]*sizeof(uint32_t*),LSTMAllocationCategory_state);
+            columns[gate][network]=(uint32_t**)LSTMAllocations::allocate(gateTotalLayerCounts[gate]*sizeof(uint32_t*),LSTMAllocationCategory_state);
+            uint32_t neuronsInLastLayer=state->inputAndOutputCount;
+            for(uint32_t thisLayer=0;thisLayer<gateTotalLayerCounts[gate];thisLayer++)
+            {
+                uint32_t neuronsInThisLayer=thisLayer==gateTotalLayerCounts[gate]-1?state->gateNetworkOutputCount:gateHiddenLayerNeuronCounts[gate][thisLayer];
+                double **weights=gateLayerWeights[gate][network][thisLayer];
+                uint32_t *layerRowStarts=(uint32_t*)LSTMAllocations::allocate((neuronsInThisLayer+1)*sizeof(uint32_t),LSTMAllocationCategory_state);
+                // Counted first, so the columns take one exactly sized allocation per layer:
+                uint32_t keptInLayer=0;
+                for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
+                {
+                    layerRowStarts[neuronInThisLayer]=keptInLayer;
+                    for(uint32_t neuronInLastLayer=0;neuronInLastLayer<neuronsInLastLayer;neuronInLastLayer++)
+                    {
+                        if(weights[neuronInThisLayer][neuronInLastLayer]!=0.0)
+                            keptInLayer++;
+                    }
+                }
+                layerRowStarts[neuronsInThisLayer]=keptInLayer;
+                uint32_t *layerColumns=(uint32_t*)LSTMAllocations::allocate(keptInLayer*sizeof(uint32_t),LSTMAllocationCategory_state);
+                uint32_t pos=0;
+                for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
+                {
+                    for(uint32_t neuronInLastLayer=0;neuronInLastLayer<neuronsInLastLayer;neuronInLastLayer++)
+                    {
+                        if(weights[neuronInThisLayer][neuronInLastLayer]!=0.0)
+                            layerColumns[pos++]=neuronInLastLayer;
+                    }
+                }
+                rowStarts[gate][network][thisLayer]=layerRowStarts;
+                columns[gate][network][thisLayer]=layerColumns;
+                keptWeightCount+=keptInLayer;
+                weightCount+=(uint64_t)neuronsInThisLayer*neuronsInLastLayer;
+                neuronsInLastLayer=neuronsInThisLayer;
+            }
+        }
+    }
+}
+
+double LSTMSparsity::getSparsity()
+{
+    return weightCount>0?1.0-(double)keptWeightCount/weightCount:0.0;
+}
+
+LSTMSparsity::~LSTMSparsity()
+{
+    for(uint8_t gate=0;gate<4;gate++)
+    {
+        for(uint32_t network=0;network<gateNetworkCount;network++)
+        {
+            for(uint32_t thisLayer=0;thisLayer<gateTotalLayerCounts[gate];thisLayer++)
+            {
+                LSTMAllocations::release(rowStarts[gate][network][thisLayer]);
+                LSTMAllocations::release(columns[gate][network][thisLayer]);
+            }
+            LSTMAllocations::release(rowStarts[gate][network]);
+            LSTMAllocations::release(columns[gate][network]);
+        }
+        LSTMAllocations::release(rowStarts[gate]);
+        LSTMAllocations::release(columns[gate]);
+    }
+    LSTMAllocations::release(rowStarts);
+    LSTMAllocations::release(columns);
+}
@@ -0,0 +1,34 @@
+#ifndef LSTMSPARSITY_H
+#define LSTMSPARSITY_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <memory.h>
+
+#include "lstmallocations.h"
+
+class LSTMState;
+
+// Sparsity pattern of the gate network layers of a pruned LSTM (see LSTM::prune()) in compressed sparse row (CSR) format. The weights stay in
+// the weight rows of the states, where the pruned weights are 0; the pattern lists the columns (neurons in the last layer) of the weights
+// which are kept, so the sparse kernels of LSTMState and LSTM::learn() only touch those. It is owned by the LSTM and shared by its states.
+
+class LSTMSparsity
+{
+public:
+    uint32_t gateNetworkCount;
+    uint32_t gateTotalLayerCounts[4];
+    // Dimensions: Gates (forget, input, output, candidate) - networks - layers - neurons in this layer+1. The kept weights of a neuron's row
+    // are rowStarts[neuron] to rowStarts[neuron+1]-1.
+    uint32_t ****rowStarts;
+    // Dimensions: Gates - networks - layers - kept weights (ascending columns within a row)
+    uint32_t ****columns;
+    uint64_t keptWeightCount;
+    uint64_t weightCount;
+
+    LSTMSparsity(LSTMState *state); // Keeps the weights of "state" which are not 0.
+    double getSparsity(); // Share of the gate network weights which are pruned
+    ~LSTMSparsity();
+};
+
+#endif // LSTMSPARSITY_H
@@ -12,11 +12,118 @@ double LSTMState::tanh(double input)
     return (1.0-pow(M_E,-2.0*input))/(1.0+pow(M_E,-2.0*input));
 }
 
-LSTMState::LSTMState(LSTMState *copyFrom, uint32_t _inputCount, uint32_t _outputCount, uint32_t _forgetGateHiddenLayerCount, uint32_t *_forgetGateHiddenLayerNeuronCounts, uint32_t _inputGateHiddenLayerCount, uint32_t *_inputGateHiddenLayerNeuronCounts, uint32_t _outputGateHiddenLayerCount, uint32_t *_outputGateHiddenLayerNeuronCounts, uint32_t _candidateGateHiddenLayerCount, uint32_t *_candidateGateHiddenLayerNeuronCounts)
+void LSTMState::activate(uint8_t activation, double *values, uint32_t count)
+{
+    if(activation==LSTMGateActivation_relu)
+    {
+        for(uint32_t i=0;i<count;i++)
+            values[i]=values[i]>0.0?values[i]:0.0;
+    }
+    else if(activation==LSTMGateActivation_leakyRelu)
+    {
+        for(uint32_t i=0;i<count;i++)
+            values[i]=values[i]>0.0?values[i]:LSTM_LEAKY_RELU_SLOPE*values[i];
+    }
+    else if(activation==LSTMGateActivation_hardTanh)
+    {
+        for(uint32_t i=0;i<count;i++)
+            values[i]=values[i]<-1.0?-1.0:(values[i]>1.0?1.0:values[i]);
+    }
+    else if(activation!=LSTMGateActivation_identity)
+    {
+        for(uint32_t i=0;i<count;i++)
+            values[i]=tanh(values[i]);
+    }
+}
+
+double LSTMState::getActivationDerivative(uint8_t activation, double activatedValue)
+{
+    if(activation==LSTMGateActivation_relu)
+        return activatedValue>0.0?1.0:0.0;
+    if(activation==LSTMGateActivation_leakyRelu)
+        return activatedValue>0.0?1.0:LSTM_LEAKY_RELU_SLOPE;
+    if(activation==LSTMGateActivation_hardTanh)
+        return activatedValue>-1.0&&activatedValue<1.0?1.0:0.0;
+    if(activation==LSTMGateActivation_identity)
+        return 1.0;
+    return 1.0-pow(activatedValue,2);
+}
+
+static uint16_t doubleToSmallFloat(double in, uint32_t exponentBits, uint32_t mantissaBits)
+{
+    // Shared by float16 (5/10) and bfloat16 (8/7); rounds the 53 bit significand of the double to nearest even.
+    uint64_t bits;
+    memcpy(&bits,&in,sizeof(double));
+    uint16_t sign=(uint16_t)((bits>>63)<<(exponentBits+mantissaBits));
+    int32_t exponent=(int32_t)((bits>>52)&0x7ff);
+    uint64_t significand=bits&0xfffffffffffffULL;
+    int32_t maxExponent=(1<<exponentBits)-1;
+    if(exponent==0x7ff) // Infinity or NaN
+        return sign|(uint16_t)(maxExponent<<mantissaBits)|(significand!=0?(uint16_t)(1<<(mantissaBits-1)):0);
+    if(exponent==0) // Zero or double subnormal (far below the smallest representable value)
+        return sign;
+    significand|=1ULL<<52; // Implicit bit
+    int32_t smallExponent=exponent-1023+(maxExponent>>1);
+    if(smallExponent>=maxExponent)
+        return sign|(uint16_t)(maxExponent<<mantissaBits); // Overflow: infinity
+    // Normal values keep mantissaBits bits after the implicit bit; subnormal values are shifted further.
+    uint32_t shift=52-mantissaBits+(smallExponent<=0?1-smallExponent:0);
+    if(shift>53)
+        return sign; // Less than half of the smallest subnormal value
+    uint64_t rounded=significand>>shift;
+    uint64_t remainder=significand&((1ULL<<shift)-1);
+    uint64_t halfway=1ULL<<(shift-1);
+    if(remainder>halfway||(remainder==halfway&&(rounded&1)))
+        rounded++;
+    // For normal values, "rounded" includes the implicit bit, which increments the exponent field by one (hence smallExponent-1); a carry out
+    // of the mantissa correctly increments the exponent as well (up to infinity). Subnormal values that round up to the smallest normal value
+    // work the same way.
+    return sign|(uint16_t)((smallExponent>0?(uint64_t)(smallExponent-1)<<mantissaBits:0)+rounded);
+}
+
+static double smallFloatToDouble(uint16_t in, uint32_t exponentBits, uint32_t mantissaBits)
+{
+    int32_t maxExponent=(1<<exponentBits)-1;
+    int32_t bias=maxExponent>>1;
+    int32_t exponent=(in>>mantissaBits)&maxExponent;
+    uint32_t mantissa=in&((1<<mantissaBits)-1);
+    double out;
+    if(exponent==0)
+        out=ldexp((double)mantissa,1-bias-(int32_t)mantissaBits); // Subnormal
+    else if(exponent==maxExponent)
+        out=mantissa!=0?NAN:INFINITY;
+    else
+        out=ldexp((double)(mantissa|(1<<mantissaBits)),exponent-bias-(int32_t)mantissaBits);
+    return (in>>(exponentBits+mantissaBits))!=0?-out:out;
+}
+
+uint16_t LSTMState::doubleToFloat16(double in)
+{
+    return doubleToSmallFloat(in,5,10);
+}
+
+double LSTMState::float16ToDouble(uint16_t in)
+{
+    return smallFloatToDouble(in,5,10);
+}
+
+uint16_t LSTMState::doubleToBFloat16(double in)
+{
+    return doubleToSmallFloat(in,8,7);
+}
+
+double LSTMState::bFloat16ToDouble(uint16_t in)
+{
+    return smallFloatToDouble(in,8,7);
+}
+
+LSTMState::LSTMState(LSTMState *copyFrom, uint32_t _inputCount, uint32_t _outputCount, uint32_t _forgetGateHiddenLayerCount, uint32_t *_forgetGateHiddenLayerNeuronCounts, uint32_t _inputGateHiddenLayerCount, uint32_t *_inputGateHiddenLayerNeuronCounts, uint32_t _outputGateHiddenLayerCount, uint32_t *_outputGateHiddenLayerNeuronCounts, uint32_t _candidateGateHiddenLayerCount, uint32_t *_candidateGateHiddenLayerNeuronCounts, bool allocateWeights, uint32_t _projectionOutputCount, bool _sharedGateNetworks, uint8_t _cellVariant)
 {
     bool copy=copyFrom!=0;
+    externalWeights=!copy&&!allocateWeights;
     inputCount=copy?copyFrom->inputCount:_inputCount;
     outputCount=copy?copyFrom->outputCount:_outputCount;
+    projectionOutputCount=copy?copyFrom->projectionOutputCount:_projectionOutputCount;
     forgetGateTotalLayerCount=copy?copyFrom->forgetGateTotalLayerCount:_forgetGateHiddenLayerCount+1/*Topmost output layer*/;
     inputGateTotalLayerCount=copy?copyFrom->inputGateTotalLayerCount:_inputGateHiddenLayerCount+1/*Topmost output layer*/;
     outputGateTotalLayerCount=copy?copyFrom->outputGateTotalLayerCount:_outputGateHiddenLayerCount+1/*Topmost output layer*/;
@@ -29,80 +136,133 @@ LSTMState::LSTMState(LSTMState *copyFrom, uint32_t _inputCount, uint32_t _output
     uint32_t inputGateHiddenLayerCountBasedArraySize=(copy?copyFrom->inputGateTotalLayerCount-1:_inputGateHiddenLayerCount)*sizeof(uint32_t);
     uint32_t outputGateHiddenLayerCountBasedArraySize=(copy?copyFrom->outputGateTotalLayerCount-1:_outputGateHiddenLayerCount)*sizeof(uint32_t);
     uint32_t candidateGateHiddenLayerCountBasedArraySize=(copy?copyFrom->candidateGateTotalLayerCount-1:_candidateGateHiddenLayerCount)*sizeof(uint32_t);
-    forgetGateHiddenLayerNeuronCounts=(uint32_t*)malloc(forgetGateHiddenLayerCountBasedArraySize);
-    inputGateHiddenLayerNeuronCounts=(uint32_t*)malloc(inputGateHiddenLayerCountBasedArraySize);
-    outputGateHiddenLayerNeuronCounts=(uint32_t*)malloc(outputGateHiddenLayerCountBasedArraySize);
-    candidateGateHiddenLayerNeuronCounts=(uint32_t*)malloc(candidateGateHiddenLayerCountBasedArraySize);
+    forgetGateHiddenLayerNeuronCounts=(uint32_t*)LSTMAllocations::allocate(forgetGateHiddenLayerCountBasedArraySize,LSTMAllocationCategory_state);
+    inputGateHiddenLayerNeuronCounts=(uint32_t*)LSTMAllocations::allocate(inputGateHiddenLayerCountBasedArraySize,LSTMAllocationCategory_state);
+    outputGateHiddenLayerNeuronCounts=(uint32_t*)LSTMAllocations::allocate(outputGateHiddenLayerCountBasedArraySize,LSTMAllocationCategory_state);
+    candidateGateHiddenLayerNeuronCounts=(uint32_t*)LSTMAllocations::allocate(candidateGateHiddenLayerCountBasedArraySize,LSTMAllocationCategory_state);
     memcpy(forgetGateHiddenLayerNeuronCounts,copy?copyFrom->forgetGateHiddenLayerNeuronCounts:_forgetGateHiddenLayerNeuronCounts,forgetGateHiddenLayerCountBasedArraySize);
     memcpy(inputGateHiddenLayerNeuronCounts,copy?copyFrom->inputGateHiddenLayerNeuronCounts:_inputGateHiddenLayerNeuronCounts,inputGateHiddenLayerCountBasedArraySize);
     memcpy(outputGateHiddenLayerNeuronCounts,copy?copyFrom->outputGateHiddenLayerNeuronCounts:_outputGateHiddenLayerNeuronCounts,outputGateHiddenLayerCountBasedArraySize);
     memcpy(candidateGateHiddenLayerNeuronCounts,copy?copyFrom->candidateGateHiddenLayerNeuronCounts:_candidateGateHiddenLayerNeuronCounts,candidateGateHiddenLayerCountBasedArraySize);
 
     inputAndOutputCount=inputCount+outputCount;
+    sharedGateNetworks=copy?copyFrom->sharedGateNetworks:_sharedGateNetworks;
+    cellVariant=copy?copyFrom->cellVariant:_cellVariant;
+    sparsity=copy?copyFrom->sparsity:0;
+    gateNetworkCount=sharedGateNetworks?1:outputCount;
+    gateNetworkOutputCount=sharedGateNetworks?outputCount:inputAndOutputCount;
+    activationPrecision=LSTMHistoryPrecision_double;
+    compressedActivations=0;
 
     uint32_t outputBasedDoubleArraySize=outputCount*sizeof(double);
-    uint32_t outputBasedDoublePointerArraySize=outputCount*sizeof(double*);
-    uint32_t outputBasedDoublePointerPointerArraySize=outputCount*sizeof(double**); // Will be the same as outputBasedDoublePointerArraySize.
-    uint32_t outputBasedDoublePointerPointerPointerArraySize=outputCount*sizeof(double***); // Will be the same as outputBasedDoublePointerArraySize.
-    uint32_t inputAndOutputBasedDoubleArraySize=inputAndOutputCount*sizeof(double);
-    forgetGatePreValues=(double**)malloc(outputBasedDoublePointerArraySize);
-    inputGatePreValues=(double**)malloc(outputBasedDoublePointerArraySize);
-    outputGatePreValues=(double**)malloc(outputBasedDoublePointerArraySize);
-    candidateGatePreValues=(double**)malloc(outputBasedDoublePointerArraySize);
-    forgetGateLayerBiasWeights=(double***)malloc(outputBasedDoublePointerPointerArraySize); // First dimension: cells
-    inputGateLayerBiasWeights=(double***)malloc(outputBasedDoublePointerPointerArraySize); // First dimension: cells
-    outputGateLayerBiasWeights=(double***)malloc(outputBasedDoublePointerPointerArraySize); // First dimension: cells
-    candidateGateLayerBiasWeights=(double***)malloc(outputBasedDoublePointerPointerArraySize); // First dimension: cells
-    forgetGateLayerNeuronValues=(double***)malloc(outputBasedDoublePointerPointerArraySize); // First dimension: cells
-    inputGateLayerNeuronValues=(double***)malloc(outputBasedDoublePointerPointerArraySize); // First dimension: cells
-    outputGateLayerNeuronValues=(double***)malloc(outputBasedDoublePointerPointerArraySize); // First dimension: cells
-    candidateGateLayerNeuronValues=(double***)malloc(outputBasedDoublePointerPointerArraySize); // First dimension: cells
-    forgetGateLayerWeights=(double****)malloc(outputBasedDoublePointerPointerPointerArraySize); // First dimension: cells
-    inputGateLayerWeights=(double****)malloc(outputBasedDoublePointerPointerPointerArraySize); // First dimension: cells
-    outputGateLayerWeights=(double****)malloc(outputBasedDoublePointerPointerPointerArraySize); // First dimension: cells
-    candidateGateLayerWeights=(double****)malloc(outputBasedDoublePointerPointerPointerArraySize); // First dimension: cells
-    input=(double*)malloc(inputCount*sizeof(double));
-    output=(double*)malloc(outputBasedDoubleArraySize);
-    desiredOutput=(double*)malloc(outputBasedDoubleArraySize);
-    cellStates=(double*)malloc(outputBasedDoubleArraySize);
-    forgetGateValues=(double*)malloc(outputBasedDoubleArraySize);
-    inputGateValues=(double*)malloc(outputBasedDoubleArraySize);
-    outputGateValues=(double*)malloc(outputBasedDoubleArraySize);
-    candidateGateValues=(double*)malloc(outputBasedDoubleArraySize);
-    forgetGateValueSumBiasWeights=(double*)malloc(outputBasedDoubleArraySize);
-    inputGateValueSumBiasWeights=(double*)malloc(outputBasedDoubleArraySize);
-    outputGateValueSumBiasWeights=(double*)malloc(outputBasedDoubleArraySize);
-    candidateGateValueSumBiasWeights=(double*)malloc(outputBasedDoubleArraySize);
+    uint32_t gateNetworkBasedDoublePointerArraySize=gateNetworkCount*sizeof(double*);
+    uint32_t gateNetworkBasedDoublePointerPointerArraySize=gateNetworkCount*sizeof(double**); // Will be the same as gateNetworkBasedDoublePointerArraySize.
+    uint32_t gateNetworkBasedDoublePointerPointerPointerArraySize=gateNetworkCount*sizeof(double***); // Will be the same as gateNetworkBasedDoublePointerArraySize.
+    uint32_t gateNetworkOutputBasedDoubleArraySize=gateNetworkOutputCount*sizeof(double);
+    forgetGatePreValues=(double**)LSTMAllocations::allocate(gateNetworkBasedDoublePointerArraySize,LSTMAllocationCategory_state);
+    inputGatePreValues=(double**)LSTMAllocations::allocate(gateNetworkBasedDoublePointerArraySize,LSTMAllocationCategory_state);
+    outputGatePreValues=(double**)LSTMAllocations::allocate(gateNetworkBasedDoublePointerArraySize,LSTMAllocationCategory_state);
+    candidateGatePreValues=(double**)LSTMAllocations::allocate(gateNetworkBasedDoublePointerArraySize,LSTMAllocationCategory_state);
+    forgetGateLayerBiasWeights=(double***)LSTMAllocations::allocate(gateNetworkBasedDoublePointerPointerArraySize,LSTMAllocationCategory_state); // First dimension: cells
+    inputGateLayerBiasWeights=(double***)LSTMAllocations::allocate(gateNetworkBasedDoublePointerPointerArraySize,LSTMAllocationCategory_state); // First dimension: cells
+    outputGateLayerBiasWeights=(double***)LSTMAllocations::allocate(gateNetworkBasedDoublePointerPointerArraySize,LSTMAllocationCategory_state); // First dimension: cells
+    candidateGateLayerBiasWeights=(double***)LSTMAllocations::allocate(gateNetworkBasedDoublePointerPointerArraySize,LSTMAllocationCategory_state); // First dimension: cells
+    forgetGateLayerNeuronValues=(double***)LSTMAllocations::allocate(gateNetworkBasedDoublePointerPointerArraySize,LSTMAllocationCategory_state); // First dimension: cells
+    inputGateLayerNeuronValues=(double***)LSTMAllocations::allocate(gateNetworkBasedDoublePointerPointerArraySize,LSTMAllocationCategory_state); // First dimension: cells
+    outputGateLayerNeuronValues=(double***)LSTMAllocations::allocate(gateNetworkBasedDoublePointerPointerArraySize,LSTMAllocationCategory_state); // First dimension: cells
+    candidateGateLayerNeuronValues=(double***)LSTMAllocations::allocate(gateNetworkBasedDoublePointerPointerArraySize,LSTMAllocationCategory_state); // First dimension: cells
+    forgetGateLayerWeights=(double****)LSTMAllocations::allocate(gateNetworkBasedDoublePointerPointerPointerArraySize,LSTMAllocationCategory_state); // First dimension: cells
+    inputGateLayerWeights=(double****)LSTMAllocations::allocate(gateNetworkBasedDoublePointerPointerPointerArraySize,LSTMAllocationCategory_state); // First dimension: cells
+    outputGateLayerWeights=(double****)LSTMAllocations::allocate(gateNetworkBasedDoublePointerPointerPointerArraySize,LSTMAllocationCategory_state); // First dimension: cells
+    candidateGateLayerWeights=(double****)LSTMAllocations::allocate(gateNetworkBasedDoublePointerPointerPointerArraySize,LSTMAllocationCategory_state); // First dimension: cells
+    input=(double*)LSTMAllocations::allocate(inputCount*sizeof(double),LSTMAllocationCategory_state);
+    output=(double*)LSTMAllocations::allocate(outputBasedDoubleArraySize,LSTMAllocationCategory_state);
+    desiredOutput=(double*)LSTMAllocations::allocate(outputBasedDoubleArraySize,LSTMAllocationCategory_state);
+    cellStates=(double*)LSTMAllocations::allocate(outputBasedDoubleArraySize,LSTMAllocationCategory_state);
+    forgetGateValues=(double*)LSTMAllocations::allocate(outputBasedDoubleArraySize,LSTMAllocationCategory_state);
+    inputGateValues=(double*)LSTMAllocations::allocate(outputBasedDoubleArraySize,LSTMAllocationCategory_state);
+    outputGateValues=(double*)LSTMAllocations::allocate(outputBasedDoubleArraySize,LSTMAllocationCategory_state);
+    candidateGateValues=(double*)LSTMAllocations::allocate(outputBasedDoubleArraySize,LSTMAllocationCategory_state);
+    forgetGateValueSumBiasWeights=externalWeights?0:(double*)LSTMAllocations::allocate(outputBasedDoubleArraySize,LSTMAllocationCategory_state);
+    inputGateValueSumBiasWeights=externalWeights?0:(double*)LSTMAllocations::allocate(outputBasedDoubleArraySize,LSTMAllocationCategory_state);
+    outputGateValueSumBiasWeights=externalWeights?0:(double*)LSTMAllocations::allocate(outputBasedDoubleArraySize,LSTMAllocationCategory_state);
+    candidateGateValueSumBiasWeights=externalWeights?0:(double*)LSTMAllocations::allocate(outputBasedDoubleArraySize,LSTMAllocationCategory_state);
     // The derivatives do not need to be initialized.
-    bottomDerivativesOfLossesFromThisStateUpwardsWithRespectToLastCellStates=(double*)malloc(outputBasedDoubleArraySize); // bottom_diff_s
-    bottomDerivativesOfLossesFromThisStateUpwardsWithRespectToLastOutputs=(double*)malloc(outputBasedDoubleArraySize); // bottom_diff_h
-    bottomDerivativesOfLossesFromThisStateUpwardsWithRespectToInputs=(double*)malloc(outputBasedDoubleArraySize); // bottom_diff_x
-    if(copyFrom==0)
+    bottomDerivativesOfLossesFromThisStateUpwardsWithRespectToLastCellStates=(double*)LSTMAllocations::allocate(outputBasedDoubleArraySize,LSTMAllocationCategory_gradient); // bottom_diff_s
+    bottomDerivativesOfLossesFromThisStateUpwardsWithRespectToLastOutputs=(double*)LSTMAllocations::allocate(outputBasedDoubleArraySize,LSTMAllocationCategory_gradient); // bottom_diff_h
+    bottomDerivativesOfLossesFromThisStateUpwardsWithRespectToInputs=(double*)LSTMAllocations::allocate(inputCount*sizeof(double),LSTMAllocationCategory_gradient); // bottom_diff_x (one derivative per input, not per output)
+    outputProjectionWeights=0;
+    outputProjectionBiasWeights=0;
+    if(projectionOutputCount>0)
+    {
+        outputProjectionWeights=(double**)LSTMAllocations::allocate(projectionOutputCount*sizeof(double*),LSTMAllocationCategory_state);
+        if(!externalWeights)
+        {
+            outputProjectionBiasWeights=(double*)LSTMAllocations::allocate(projectionOutputCount*sizeof(double),LSTMAllocationCategory_state);
+            for(uint32_t projectionOutput=0;projectionOutput<projectionOutputCount;projectionOutput++)
+            {
+                outputProjectionWeights[projectionOutput]=(double*)LSTMAllocations::allocate(outputBasedDoubleArraySize,LSTMAllocationCategory_state);
+                if(copy)
+                    memcpy(outputProjectionWeights[projectionOutput],copyFrom->outputProjectionWeights[projectionOutput],outputBasedDoubleArraySize);
+            }
+            if(copy)
+                memcpy(outputProjectionBiasWeights,copyFrom->outputProjectionBiasWeights,projectionOutputCount*sizeof(double));
+        }
+    }
+    if(externalWeights)
+    {
+        // Only the pointer tables are created; the caller points them to the weight and bias arrays (see LSTM::loadMapped()).
+        double ****gateLayerWeights[4]={forgetGateLayerWeights,inputGateLayerWeights,outputGateLayerWeights,candidateGateLayerWeights};
+        double ***gateLayerBiasWeights[4]={forgetGateLayerBiasWeights,inputGateLayerBiasWeights,outputGateLayerBiasWeights,candidateGateLayerBiasWeights};
+        double ***gateLayerNeuronValues[4]={forgetGateLayerNeuronValues,inputGateLayerNeuronValues,outputGateLayerNeuronValues,candidateGateLayerNeuronValues};
+        double **gatePreValues[4]={forgetGatePreValues,inputGatePreValues,outputGatePreValues,candidateGatePreValues};
+        uint32_t gateTotalLayerCounts[4]={forgetGateTotalLayerCount,inputGateTotalLayerCount,outputGateTotalLayerCount,candidateGateTotalLayerCount};
+        uint32_t *gateHiddenLayerNeuronCounts[4]={forgetGateHiddenLayerNeuronCounts,inputGateHiddenLayerNeuronCounts,outputGateHiddenLayerNeuronCounts,candidateGateHiddenLayerNeuronCounts};
+        for(uint32_t cell=0;cell<gateNetworkCount;cell++)
+        {
+            for(uint8_t gate=0;gate<4;gate++)
+            {
+                gateLayerWeights[gate][cell]=(double***)LSTMAllocations::allocate(gateTotalLayerCounts[gate]*sizeof(double**),LSTMAllocationCategory_state);
+                gateLayerBiasWeights[gate][cell]=(double**)LSTMAllocations::allocate(gateTotalLayerCounts[gate]*sizeof(double*),LSTMAllocationCategory_state);
+                gateLayerNeuronValues[gate][cell]=(double**)LSTMAllocations::allocate(gateTotalLayerCounts[gate]*sizeof(double*),LSTMAllocationCategory_state);
+                for(uint32_t thisLayer=0;thisLayer<gateTotalLayerCounts[gate];thisLayer++)
+                {
+                    uint32_t neuronsInThisLayer=thisLayer==gateTotalLayerCounts[gate]-1?gateNetworkOutputCount:gateHiddenLayerNeuronCounts[gate][thisLayer];
+                    gateLayerWeights[gate][cell][thisLayer]=(double**)LSTMAllocations::allocate(neuronsInThisLayer*sizeof(double*),LSTMAllocationCategory_state);
+                    gateLayerNeuronValues[gate][cell][thisLayer]=(double*)LSTMAllocations::allocate(neuronsInThisLayer*sizeof(double),LSTMAllocationCategory_state);
+                }
+                gatePreValues[gate][cell]=(double*)LSTMAllocations::allocate(gateNetworkOutputBasedDoubleArraySize,LSTMAllocationCategory_state);
+            }
+        }
+    }
+    else if(copyFrom==0)
     {
         srand((uint32_t)time(0));
         for(uint32_t cell=0;cell<outputCount;cell++)
         {
-            // First dimension: cells
-
             forgetGateValueSumBiasWeights[cell]=0.0;
             inputGateValueSumBiasWeights[cell]=0.0;
             outputGateValueSumBiasWeights[cell]=0.0;
             candidateGateValueSumBiasWeights[cell]=0.0;
+        }
+        for(uint32_t cell=0;cell<gateNetworkCount;cell++)
+        {
+            // First dimension: cells (gate networks)
 
-            forgetGateLayerBiasWeights[cell]=(double**)malloc(forgetGateTotalLayerBasedDoublePointerArraySize);
-            inputGateLayerBiasWeights[cell]=(double**)malloc(inputGateTotalLayerBasedDoublePointerArraySize);
-            outputGateLayerBiasWeights[cell]=(double**)malloc(outputGateTotalLayerBasedDoublePointerArraySize);
-            candidateGateLayerBiasWeights[cell]=(double**)malloc(candidateGateTotalLayerBasedDoublePointerArraySize);
+            forgetGateLayerBiasWeights[cell]=(double**)LSTMAllocations::allocate(forgetGateTotalLayerBasedDoublePointerArraySize,LSTMAllocationCategory_state);
+            inputGateLayerBiasWeights[cell]=(double**)LSTMAllocations::allocate(inputGateTotalLayerBasedDoublePointerArraySize,LSTMAllocationCategory_state);
+            outputGateLayerBiasWeights[cell]=(double**)LSTMAllocations::allocate(outputGateTotalLayerBasedDoublePointerArraySize,LSTMAllocationCategory_state);
+            candidateGateLayerBiasWeights[cell]=(double**)LSTMAllocations::allocate(candidateGateTotalLayerBasedDoublePointerArraySize,LSTMAllocationCategory_state);
 
-            forgetGateLayerNeuronValues[cell]=(double**)malloc(forgetGateTotalLayerBasedDoublePointerArraySize);
-            inputGateLayerNeuronValues[cell]=(double**)malloc(inputGateTotalLayerBasedDoublePointerArraySize);
-            outputGateLayerNeuronValues[cell]=(double**)malloc(outputGateTotalLayerBasedDoublePointerArraySize);
-            candidateGateLayerNeuronValues[cell]=(double**)malloc(candidateGateTotalLayerBasedDoublePointerArraySize);
+            forgetGateLayerNeuronValues[cell]=(double**)LSTMAllocations::allocate(forgetGateTotalLayerBasedDoublePointerArraySize,LSTMAllocationCategory_state);
+            inputGateLayerNeuronValues[cell]=(double**)LSTMAllocations::allocate(inputGateTotalLayerBasedDoublePointerArraySize,LSTMAllocationCategory_state);
+            outputGateLayerNeuronValues[cell]=(double**)LSTMAllocations::allocate(outputGateTotalLayerBasedDoublePointerArraySize,LSTMAllocationCategory_state);
+            candidateGateLayerNeuronValues[cell]=(double**)LSTMAllocations::allocate(candidateGateTotalLayerBasedDoublePointerArraySize,LSTMAllocationCategory_state);
 
-            forgetGateLayerWeights[cell]=(double***)malloc(forgetGateTotalLayerBasedDoublePointerArraySize);
-            inputGateLayerWeights[cell]=(double***)malloc(inputGateTotalLayerBasedDoublePointerArraySize);
-            outputGateLayerWeights[cell]=(double***)malloc(outputGateTotalLayerBasedDoublePointerArraySize);
-            candidateGateLayerWeights[cell]=(double***)malloc(candidateGateTotalLayerBasedDoublePointerArraySize);
+            forgetGateLayerWeights[cell]=(double***)LSTMAllocations::allocate(forgetGateTotalLayerBasedDoublePointerArraySize,LSTMAllocationCategory_state);
+            inputGateLayerWeights[cell]=(double***)LSTMAllocations::allocate(inputGateTotalLayerBasedDoublePointerArraySize,LSTMAllocationCategory_state);
+            outputGateLayerWeights[cell]=(double***)LSTMAllocations::allocate(outputGateTotalLayerBasedDoublePointerArraySize,LSTMAllocationCategory_state);
+            candidateGateLayerWeights[cell]=(double***)LSTMAllocations::allocate(candidateGateTotalLayerBasedDoublePointerArraySize,LSTMAllocationCategory_state);
 
 
             uint32_t neuronsInLastLayer=inputAndOutputCount; // First layer: inputs and previous outputs
@@ -112,12 +272,12 @@ LSTMState::LSTMState(LSTMState *copyFrom, uint32_t _inputCount, uint32_t _output
             {
                 // Next dimension: layers
 
-                uint32_t neuronsInThisLayer=thisLayer==forgetGateTotalLayerCount-1?inputAndOutputCount:forgetGateHiddenLayerNeuronCounts[thisLayer];
+                uint32_t neuronsInThisLayer=thisLayer==forgetGateTotalLayerCount-1?gateNetworkOutputCount:forgetGateHiddenLayerNeuronCounts[thisLayer];
                 uint32_t neuronsInThisLayerBasedDoubleArraySize=neuronsInThisLayer*sizeof(double);
                 uint32_t neuronsInThisLayerBasedDoublePointerArraySize=neuronsInThisLayer*sizeof(double*);
-                forgetGateLayerBiasWeights[cell][thisLayer]=(double*)malloc(neuronsInThisLayerBasedDoubleArraySize);
-                forgetGateLayerNeuronValues[cell][thisLayer]=(double*)malloc(neuronsInThisLayerBasedDoubleArraySize);
-                forgetGateLayerWeights[cell][thisLayer]=(double**)malloc(neuronsInThisLayerBasedDoublePointerArraySize);
+                forgetGateLayerBiasWeights[cell][thisLayer]=(double*)LSTMAllocations::allocate(neuronsInThisLayerBasedDoubleArraySize,LSTMAllocationCategory_state);
+                forgetGateLayerNeuronValues[cell][thisLayer]=(double*)LSTMAllocations::allocate(neuronsInThisLayerBasedDoubleArraySize,LSTMAllocationCategory_state);
+                forgetGateLayerWeights[cell][thisLayer]=(double**)LSTMAllocations::allocate(neuronsInThisLayerBasedDoublePointerArraySize,LSTMAllocationCategory_state);
 
                 for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
                 {
@@ -129,7 +289,7 @@ LSTMState::LSTMState(LSTMState *copyFrom, uint32_t _inputCount, uint32_t _output
 
                     uint32_t neuronsInLastLayerBasedDoubleArraySize=neuronsInLastLayer*sizeof(double);
 
-                    forgetGateLayerWeights[cell][thisLayer][neuronInThisLayer]=(double*)malloc(neuronsInLastLayerBasedDoubleArraySize);
+                    forgetGateLayerWeights[cell][thisLayer][neuronInThisLayer]=(double*)LSTMAllocations::allocate(neuronsInLastLayerBasedDoubleArraySize,LSTMAllocationCategory_state);
 
                     for(uint32_t neuronInLastLayer=0;neuronInLastLayer<neuronsInLastLayer;neuronInLastLayer++)
                     {
@@ -142,16 +302,17 @@ LSTMState::LSTMState(LSTMState *copyFrom, uint32_t _inputCount, uint32_t _output
             }
 
             // Input gate
+            neuronsInLastLayer=inputAndOutputCount;
             for(uint32_t thisLayer=0;thisLayer<inputGateTotalLayerCount;thisLayer++)
             {
                 // Next dimension: layers
 
-                uint32_t neuronsInThisLayer=thisLayer==inputGateTotalLayerCount-1?inputAndOutputCount:inputGateHiddenLayerNeuronCounts[thisLayer];
+                uint32_t neuronsInThisLayer=thisLayer==inputGateTotalLayerCount-1?gateNetworkOutputCount:inputGateHiddenLayerNeuronCounts[thisLayer];
                 uint32_t neuronsInThisLayerBasedDoubleArraySize=neuronsInThisLayer*sizeof(double);
                 uint32_t neuronsInThisLayerBasedDoublePointerArraySize=neuronsInThisLayer*sizeof(double*);
-                inputGateLayerBiasWeights[cell][thisLayer]=(double*)malloc(neuronsInThisLayerBasedDoubleArraySize);
-                inputGateLayerNeuronValues[cell][thisLayer]=(double*)malloc(neuronsInThisLayerBasedDoubleArraySize);
-                inputGateLayerWeights[cell][thisLayer]=(double**)malloc(neuronsInThisLayerBasedDoublePointerArraySize);
+                inputGateLayerBiasWeights[cell][thisLayer]=(double*)LSTMAllocations::allocate(neuronsInThisLayerBasedDoubleArraySize,LSTMAllocationCategory_state);
+                inputGateLayerNeuronValues[cell][thisLayer]=(double*)LSTMAllocations::allocate(neuronsInThisLayerBasedDoubleArraySize,LSTMAllocationCategory_state);
+                inputGateLayerWeights[cell][thisLayer]=(double**)LSTMAllocations::allocate(neuronsInThisLayerBasedDoublePointerArraySize,LSTMAllocationCategory_state);
 
                 for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
                 {
@@ -163,7 +324,7 @@ LSTMState::LSTMState(LSTMState *copyFrom, uint32_t _inputCount, uint32_t _output
 
                     uint32_t neuronsInLastLayerBasedDoubleArraySize=neuronsInLastLayer*sizeof(double);
 
-                    inputGateLayerWeights[cell][thisLayer][neuronInThisLayer]=(double*)malloc(neuronsInLastLayerBasedDoubleArraySize);
+                    inputGateLayerWeights[cell][thisLayer][neuronInThisLayer]=(double*)LSTMAllocations::allocate(neuronsInLastLayerBasedDoubleArraySize,LSTMAllocationCategory_state);
 
                     for(uint32_t neuronInLastLayer=0;neuronInLastLayer<neuronsInLastLayer;neuronInLastLayer++)
                     {
@@ -176,16 +337,17 @@ LSTMState::LSTMState(LSTMState *copyFrom, uint32_t _inputCount, uint32_t _output
             }
 
             // Output gate
+            neuronsInLastLayer=inputAndOutputCount;
             for(uint32_t thisLayer=0;thisLayer<outputGateTotalLayerCount;thisLayer++)
             {
                 // Next dimension: layers
 
-                uint32_t neuronsInThisLayer=thisLayer==outputGateTotalLayerCount-1?inputAndOutputCount:outputGateHiddenLayerNeuronCounts[thisLayer];
+                uint32_t neuronsInThisLayer=thisLayer==outputGateTotalLayerCount-1?gateNetworkOutputCount:outputGateHiddenLayerNeuronCounts[thisLayer];
                 uint32_t neuronsInThisLayerBasedDoubleArraySize=neuronsInThisLayer*sizeof(double);
                 uint32_t neuronsInThisLayerBasedDoublePointerArraySize=neuronsInThisLayer*sizeof(double*);
-                outputGateLayerBiasWeights[cell][thisLayer]=(double*)malloc(neuronsInThisLayerBasedDoubleArraySize);
-                outputGateLayerNeuronValues[cell][thisLayer]=(double*)malloc(neuronsInThisLayerBasedDoubleArraySize);
-                outputGateLayerWeights[cell][thisLayer]=(double**)malloc(neuronsInThisLayerBasedDoublePointerArraySize);
+                outputGateLayerBiasWeights[cell][thisLayer]=(double*)LSTMAllocations::allocate(neuronsInThisLayerBasedDoubleArraySize,LSTMAllocationCategory_state);
+                outputGateLayerNeuronValues[cell][thisLayer]=(double*)LSTMAllocations::allocate(neuronsInThisLayerBasedDoubleArraySize,LSTMAllocationCategory_state);
+                outputGateLayerWeights[cell][thisLayer]=(double**)LSTMAllocations::allocate(neuronsInThisLayerBasedDoublePointerArraySize,LSTMAllocationCategory_state);
 
                 for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
                 {
@@ -197,7 +359,7 @@ LSTMState::LSTMState(LSTMState *copyFrom, uint32_t _inputCount, uint32_t _output
 
                     uint32_t neuronsInLastLayerBasedDoubleArraySize=neuronsInLastLayer*sizeof(double);
 
-                    outputGateLayerWeights[cell][thisLayer][neuronInThisLayer]=(double*)malloc(neuronsInLastLayerBasedDoubleArraySize);
+                    outputGateLayerWeights[cell][thisLayer][neuronInThisLayer]=(double*)LSTMAllocations::allocate(neuronsInLastLayerBasedDoubleArraySize,LSTMAllocationCategory_state);
 
                     for(uint32_t neuronInLastLayer=0;neuronInLastLayer<neuronsInLastLayer;neuronInLastLayer++)
                     {
@@ -210,16 +372,17 @@ LSTMState::LSTMState(LSTMState *copyFrom, uint32_t _inputCount, uint32_t _output
             }
 
             // Candidate gate
+            neuronsInLastLayer=inputAndOutputCount;
             for(uint32_t thisLayer=0;thisLayer<candidateGateTotalLayerCount;thisLayer++)
             {
                 // Next dimension: layers
 
-                uint32_t neuronsInThisLayer=thisLayer==candidateGateTotalLayerCount-1?inputAndOutputCount:candidateGateHiddenLayerNeuronCounts[thisLayer];
+                uint32_t neuronsInThisLayer=thisLayer==candidateGateTotalLayerCount-1?gateNetworkOutputCount:candidateGateHiddenLayerNeuronCounts[thisLayer];
                 uint32_t neuronsInThisLayerBasedDoubleArraySize=neuronsInThisLayer*sizeof(double);
                 uint32_t neuronsInThisLayerBasedDoublePointerArraySize=neuronsInThisLayer*sizeof(double*);
-                candidateGateLayerBiasWeights[cell][thisLayer]=(double*)malloc(neuronsInThisLayerBasedDoubleArraySize);
-                candidateGateLayerNeuronValues[cell][thisLayer]=(double*)malloc(neuronsInThisLayerBasedDoubleArraySize);
-                candidateGateLayerWeights[cell][thisLayer]=(double**)malloc(neuronsInThisLayerBasedDoublePointerArraySize);
+                candidateGateLayerBiasWeights[cell][thisLayer]=(double*)LSTMAllocations::allocate(neuronsInThisLayerBasedDoubleArraySize,LSTMAllocationCategory_state);
+                candidateGateLayerNeuronValues[cell][thisLayer]=(double*)LSTMAllocations::allocate(neuronsInThisLayerBasedDoubleArraySize,LSTMAllocationCategory_state);
+                candidateGateLayerWeights[cell][thisLayer]=(double**)LSTMAllocations::allocate(neuronsInThisLayerBasedDoublePointerArraySize,LSTMAllocationCategory_state);
 
                 for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
                 {
@@ -231,7 +394,7 @@ LSTMState::LSTMState(LSTMState *copyFrom, uint32_t _inputCount, uint32_t _output
 
                     uint32_t neuronsInLastLayerBasedDoubleArraySize=neuronsInLastLayer*sizeof(double);
 
-                    candidateGateLayerWeights[cell][thisLayer][neuronInThisLayer]=(double*)malloc(neuronsInLastLayerBasedDoubleArraySize);
+                    candidateGateLayerWeights[cell][thisLayer][neuronInThisLayer]=(double*)LSTMAllocations::allocate(neuronsInLastLayerBasedDoubleArraySize,LSTMAllocationCategory_state);
 
                     for(uint32_t neuronInLastLayer=0;neuronInLastLayer<neuronsInLastLayer;neuronInLastLayer++)
                     {
@@ -244,38 +407,48 @@ LSTMState::LSTMState(LSTMState *copyFrom, uint32_t _inputCount, uint32_t _output
             }
 
             // These 4 arrays do not need to be initialized yet:
-            forgetGatePreValues[cell]=(double*)malloc(inputAndOutputBasedDoubleArraySize);
-            inputGatePreValues[cell]=(double*)malloc(inputAndOutputBasedDoubleArraySize);
-            outputGatePreValues[cell]=(double*)malloc(inputAndOutputBasedDoubleArraySize);
-            candidateGatePreValues[cell]=(double*)malloc(inputAndOutputBasedDoubleArraySize);
+            forgetGatePreValues[cell]=(double*)LSTMAllocations::allocate(gateNetworkOutputBasedDoubleArraySize,LSTMAllocationCategory_state);
+            inputGatePreValues[cell]=(double*)LSTMAllocations::allocate(gateNetworkOutputBasedDoubleArraySize,LSTMAllocationCategory_state);
+            outputGatePreValues[cell]=(double*)LSTMAllocations::allocate(gateNetworkOutputBasedDoubleArraySize,LSTMAllocationCategory_state);
+            candidateGatePreValues[cell]=(double*)LSTMAllocations::allocate(gateNetworkOutputBasedDoubleArraySize,LSTMAllocationCategory_state);
+        }
+
+        // Glorot range: with weights as small as the gate weights, the cell outputs and the projection weights would both start close to 0 and
+        // pass back almost no gradient to each other.
+        double projectionWeightRange=sqrt(6.0/(double)(outputCount+projectionOutputCount));
+        for(uint32_t projectionOutput=0;projectionOutput<projectionOutputCount;projectionOutput++)
+        {
+            outputProjectionBiasWeights[projectionOutput]=-0.1+0.2*((double)rand()/(double)RAND_MAX);
+            for(uint32_t cell=0;cell<outputCount;cell++)
+                outputProjectionWeights[projectionOutput][cell]=projectionWeightRange*(-1.0+2.0*((double)rand()/(double)RAND_MAX));
         }
     }
     else
     {
         memcpy(forgetGateValueSumBiasWeights,copyFrom->forgetGateValueSumBiasWeights,outputBasedDoubleArraySize);
-        memcpy(inputGateValueSumBiasWeights,copyFrom->forgetGateValueSumBiasWeights,outputBasedDoubleArraySize);
-        memcpy(outputGateValueSumBiasWeights,copyFrom->forgetGateValueSumBiasWeights,outputBasedDoubleArraySize);
-        memcpy(candidateGateValueSumBiasWeights,copyFrom->forgetGateValueSumBiasWeights,outputBasedDoubleArraySize);
+        memcpy(inputGateValueSumBiasWeights,copyFrom->inputGateValueSumBiasWeights,outputBasedDoubleArraySize);
+        memcpy(outputGateValueSumBiasWeights,copyFrom->outputGateValueSumBiasWeights,outputBasedDoubleArraySize);
+        memcpy(candidateGateValueSumBiasWeights,copyFrom->candidateGateValueSumBiasWeights,outputBasedDoubleArraySize);
 
         // Create deep copies of the two-dimensional weight arrays, the three-dimensional layer bias weight arrays and the four-dimensional layer weight arrays:
-        for(uint32_t cell=0;cell<outputCount;cell++)
+        for(uint32_t cell=0;cell<gateNetworkCount;cell++)
         {
             // First dimension: cells
 
-            forgetGateLayerBiasWeights[cell]=(double**)malloc(forgetGateTotalLayerBasedDoublePointerArraySize);
-            inputGateLayerBiasWeights[cell]=(double**)malloc(inputGateTotalLayerBasedDoublePointerArraySize);
-            outputGateLayerBiasWeights[cell]=(double**)malloc(outputGateTotalLayerBasedDoublePointerArraySize);
-            candidateGateLayerBiasWeights[cell]=(double**)malloc(candidateGateTotalLayerBasedDoublePointerArraySize);
+            forgetGateLayerBiasWeights[cell]=(double**)LSTMAllocations::allocate(forgetGateTotalLayerBasedDoublePointerArraySize,LSTMAllocationCategory_state);
+            inputGateLayerBiasWeights[cell]=(double**)LSTMAllocations::allocate(inputGateTotalLayerBasedDoublePointerArraySize,LSTMAllocationCategory_state);
+            outputGateLayerBiasWeights[cell]=(double**)LSTMAllocations::allocate(outputGateTotalLayerBasedDoublePointerArraySize,LSTMAllocationCategory_state);
+            candidateGateLayerBiasWeights[cell]=(double**)LSTMAllocations::allocate(candidateGateTotalLayerBasedDoublePointerArraySize,LSTMAllocationCategory_state);
 
-            forgetGateLayerNeuronValues[cell]=(double**)malloc(forgetGateTotalLayerBasedDoublePointerArraySize);
-            inputGateLayerNeuronValues[cell]=(double**)malloc(inputGateTotalLayerBasedDoublePointerArraySize);
-            outputGateLayerNeuronValues[cell]=(double**)malloc(outputGateTotalLayerBasedDoublePointerArraySize);
-            candidateGateLayerNeuronValues[cell]=(double**)malloc(candidateGateTotalLayerBasedDoublePointerArraySize);
+            forgetGateLayerNeuronValues[cell]=(double**)LSTMAllocations::allocate(forgetGateTotalLayerBasedDoublePointerArraySize,LSTMAllocationCategory_state);
+            inputGateLayerNeuronValues[cell]=(double**)LSTMAllocations::allocate(inputGateTotalLayerBasedDoublePointerArraySize,LSTMAllocationCategory_state);
+            outputGateLayerNeuronValues[cell]=(double**)LSTMAllocations::allocate(outputGateTotalLayerBasedDoublePointerArraySize,LSTMAllocationCategory_state);
+            candidateGateLayerNeuronValues[cell]=(double**)LSTMAllocations::allocate(candidateGateTotalLayerBasedDoublePointerArraySize,LSTMAllocationCategory_state);
 
-            forgetGateLayerWeights[cell]=(double***)malloc(forgetGateTotalLayerBasedDoublePointerArraySize);
-            inputGateLayerWeights[cell]=(double***)malloc(inputGateTotalLayerBasedDoublePointerArraySize);
-            outputGateLayerWeights[cell]=(double***)malloc(outputGateTotalLayerBasedDoublePointerArraySize);
-            candidateGateLayerWeights[cell]=(double***)malloc(candidateGateTotalLayerBasedDoublePointerArraySize);
+            forgetGateLayerWeights[cell]=(double***)LSTMAllocations::allocate(forgetGateTotalLayerBasedDoublePointerArraySize,LSTMAllocationCategory_state);
+            inputGateLayerWeights[cell]=(double***)LSTMAllocations::allocate(inputGateTotalLayerBasedDoublePointerArraySize,LSTMAllocationCategory_state);
+            outputGateLayerWeights[cell]=(double***)LSTMAllocations::allocate(outputGateTotalLayerBasedDoublePointerArraySize,LSTMAllocationCategory_state);
+            candidateGateLayerWeights[cell]=(double***)LSTMAllocations::allocate(candidateGateTotalLayerBasedDoublePointerArraySize,LSTMAllocationCategory_state);
 
             uint32_t neuronsInLastLayer=inputAndOutputCount; // First layer: inputs and previous outputs
 
@@ -284,12 +457,12 @@ LSTMState::LSTMState(LSTMState *copyFrom, uint32_t _inputCount, uint32_t _output
             {
                 // Next dimension: layers
 
-                uint32_t neuronsInThisLayer=thisLayer==forgetGateTotalLayerCount-1?inputAndOutputCount:forgetGateHiddenLayerNeuronCounts[thisLayer];
+                uint32_t neuronsInThisLayer=thisLayer==forgetGateTotalLayerCount-1?gateNetworkOutputCount:forgetGateHiddenLayerNeuronCounts[thisLayer];
                 uint32_t neuronsInThisLayerBasedDoubleArraySize=neuronsInThisLayer*sizeof(double);
                 uint32_t neuronsInThisLayerBasedDoublePointerArraySize=neuronsInThisLayer*sizeof(double*);
-                forgetGateLayerBiasWeights[cell][thisLayer]=(double*)malloc(neuronsInThisLayerBasedDoubleArraySize);
-                forgetGateLayerNeuronValues[cell][thisLayer]=(double*)malloc(neuronsInThisLayerBasedDoubleArraySize);
-                forgetGateLayerWeights[cell][thisLayer]=(double**)malloc(neuronsInThisLayerBasedDoublePointerArraySize);
+                forgetGateLayerBiasWeights[cell][thisLayer]=(double*)LSTMAllocations::allocate(neuronsInThisLayerBasedDoubleArraySize,LSTMAllocationCategory_state);
+                forgetGateLayerNeuronValues[cell][thisLayer]=(double*)LSTMAllocations::allocate(neuronsInThisLayerBasedDoubleArraySize,LSTMAllocationCategory_state);
+                forgetGateLayerWeights[cell][thisLayer]=(double**)LSTMAllocations::allocate(neuronsInThisLayerBasedDoublePointerArraySize,LSTMAllocationCategory_state);
 
                 // Next dimension: neurons in this layer
 
@@ -303,7 +476,7 @@ LSTMState::LSTMState(LSTMState *copyFrom, uint32_t _inputCount, uint32_t _output
                 {
                     // Next dimension: weights from neurons in previous layer to neurons in this layer
 
-                    forgetGateLayerWeights[cell][thisLayer][neuronInThisLayer]=(double*)malloc(neuronsInLastLayerBasedDoubleArraySize);
+                    forgetGateLayerWeights[cell][thisLayer][neuronInThisLayer]=(double*)LSTMAllocations::allocate(neuronsInLastLayerBasedDoubleArraySize,LSTMAllocationCategory_state);
                     memcpy(forgetGateLayerWeights[cell][thisLayer][neuronInThisLayer],copyFrom->forgetGateLayerWeights[cell][thisLayer][neuronInThisLayer],neuronsInLastLayerBasedDoubleArraySize);
                 }
 
@@ -311,16 +484,17 @@ LSTMState::LSTMState(LSTMState *copyFrom, uint32_t _inputCount, uint32_t _output
             }
 
             // Input gate
+            neuronsInLastLayer=inputAndOutputCount;
             for(uint32_t thisLayer=0;thisLayer<inputGateTotalLayerCount;thisLayer++)
             {
                 // Next dimension: layers
 
-                uint32_t neuronsInThisLayer=thisLayer==inputGateTotalLayerCount-1?inputAndOutputCount:inputGateHiddenLayerNeuronCounts[thisLayer];
+                uint32_t neuronsInThisLayer=thisLayer==inputGateTotalLayerCount-1?gateNetworkOutputCount:inputGateHiddenLayerNeuronCounts[thisLayer];
                 uint32_t neuronsInThisLayerBasedDoubleArraySize=neuronsInThisLayer*sizeof(double);
                 uint32_t neuronsInThisLayerBasedDoublePointerArraySize=neuronsInThisLayer*sizeof(double*);
-                inputGateLayerBiasWeights[cell][thisLayer]=(double*)malloc(neuronsInThisLayerBasedDoubleArraySize);
-                inputGateLayerNeuronValues[cell][thisLayer]=(double*)malloc(neuronsInThisLayerBasedDoubleArraySize);
-                inputGateLayerWeights[cell][thisLayer]=(double**)malloc(neuronsInThisLayerBasedDoublePointerArraySize);
+                inputGateLayerBiasWeights[cell][thisLayer]=(double*)LSTMAllocations::allocate(neuronsInThisLayerBasedDoubleArraySize,LSTMAllocationCategory_state);
+                inputGateLayerNeuronValues[cell][thisLayer]=(double*)LSTMAllocations::allocate(neuronsInThisLayerBasedDoubleArraySize,LSTMAllocationCategory_state);
+                inputGateLayerWeights[cell][thisLayer]=(double**)LSTMAllocations::allocate(neuronsInThisLayerBasedDoublePointerArraySize,LSTMAllocationCategory_state);
 
                 // Next dimension: neurons in this layer
 
@@ -334,7 +508,7 @@ LSTMState::LSTMState(LSTMState *copyFrom, uint32_t _inputCount, uint32_t _output
                 {
                     // Next dimension: weights from neurons in previous layer to neurons in this layer
 
-                    inputGateLayerWeights[cell][thisLayer][neuronInThisLayer]=(double*)malloc(neuronsInLastLayerBasedDoubleArraySize);
+                    inputGateLayerWeights[cell][thisLayer][neuronInThisLayer]=(double*)LSTMAllocations::allocate(neuronsInLastLayerBasedDoubleArraySize,LSTMAllocationCategory_state);
                     memcpy(inputGateLayerWeights[cell][thisLayer][neuronInThisLayer],copyFrom->inputGateLayerWeights[cell][thisLayer][neuronInThisLayer],neuronsInLastLayerBasedDoubleArraySize);
                 }
 
@@ -342,16 +516,17 @@ LSTMState::LSTMState(LSTMState *copyFrom, uint32_t _inputCount, uint32_t _output
             }
 
             // Output gate
+            neuronsInLastLayer=inputAndOutputCount;
             for(uint32_t thisLayer=0;thisLayer<outputGateTotalLayerCount;thisLayer++)
             {
                 // Next dimension: layers
 
-                uint32_t neuronsInThisLayer=thisLayer==outputGateTotalLayerCount-1?inputAndOutputCount:outputGateHiddenLayerNeuronCounts[thisLayer];
+                uint32_t neuronsInThisLayer=thisLayer==outputGateTotalLayerCount-1?gateNetworkOutputCount:outputGateHiddenLayerNeuronCounts[thisLayer];
                 uint32_t neuronsInThisLayerBasedDoubleArraySize=neuronsInThisLayer*sizeof(double);
                 uint32_t neuronsInThisLayerBasedDoublePointerArraySize=neuronsInThisLayer*sizeof(double*);
-                outputGateLayerBiasWeights[cell][thisLayer]=(double*)malloc(neuronsInThisLayerBasedDoubleArraySize);
-                outputGateLayerNeuronValues[cell][thisLayer]=(double*)malloc(neuronsInThisLayerBasedDoubleArraySize);
-                outputGateLayerWeights[cell][thisLayer]=(double**)malloc(neuronsInThisLayerBasedDoublePointerArraySize);
+                outputGateLayerBiasWeights[cell][thisLayer]=(double*)LSTMAllocations::allocate(neuronsInThisLayerBasedDoubleArraySize,LSTMAllocationCategory_state);
+                outputGateLayerNeuronValues[cell][thisLayer]=(double*)LSTMAllocations::allocate(neuronsInThisLayerBasedDoubleArraySize,LSTMAllocationCategory_state);
+                outputGateLayerWeights[cell][thisLayer]=(double**)LSTMAllocations::allocate(neuronsInThisLayerBasedDoublePointerArraySize,LSTMAllocationCategory_state);
 
                 // Next dimension: neurons in this layer
 
@@ -365,7 +540,7 @@ LSTMState::LSTMState(LSTMState *copyFrom, uint32_t _inputCount, uint32_t _output
                 {
                     // Next dimension: weights from neurons in previous layer to neurons in this layer
 
-                    outputGateLayerWeights[cell][thisLayer][neuronInThisLayer]=(double*)malloc(neuronsInLastLayerBasedDoubleArraySize);
+                    outputGateLayerWeights[cell][thisLayer][neuronInThisLayer]=(double*)LSTMAllocations::allocate(neuronsInLastLayerBasedDoubleArraySize,LSTMAllocationCategory_state);
                     memcpy(outputGateLayerWeights[cell][thisLayer][neuronInThisLayer],copyFrom->outputGateLayerWeights[cell][thisLayer][neuronInThisLayer],neuronsInLastLayerBasedDoubleArraySize);
                 }
 
@@ -373,16 +548,17 @@ LSTMState::LSTMState(LSTMState *copyFrom, uint32_t _inputCount, uint32_t _output
             }
 
             // Candidate gate
+            neuronsInLastLayer=inputAndOutputCount;
             for(uint32_t thisLayer=0;thisLayer<candidateGateTotalLayerCount;thisLayer++)
             {
                 // Next dimension: layers
 
-                uint32_t neuronsInThisLayer=thisLayer==candidateGateTotalLayerCount-1?inputAndOutputCount:candidateGateHiddenLayerNeuronCounts[thisLayer];
+                uint32_t neuronsInThisLayer=thisLayer==candidateGateTotalLayerCount-1?gateNetworkOutputCount:candidateGateHiddenLayerNeuronCounts[thisLayer];
                 uint32_t neuronsInThisLayerBasedDoubleArraySize=neuronsInThisLayer*sizeof(double);
                 uint32_t neuronsInThisLayerBasedDoublePointerArraySize=neuronsInThisLayer*sizeof(double*);
-                candidateGateLayerBiasWeights[cell][thisLayer]=(double*)malloc(neuronsInThisLayerBasedDoubleArraySize);
-                candidateGateLayerNeuronValues[cell][thisLayer]=(double*)malloc(neuronsInThisLayerBasedDoubleArraySize);
-                candidateGateLayerWeights[cell][thisLayer]=(double**)malloc(neuronsInThisLayerBasedDoublePointerArraySize);
+                candidateGateLayerBiasWeights[cell][thisLayer]=(double*)LSTMAllocations::allocate(neuronsInThisLayerBasedDoubleArraySize,LSTMAllocationCategory_state);
+                candidateGateLayerNeuronValues[cell][thisLayer]=(double*)LSTMAllocations::allocate(neuronsInThisLayerBasedDoubleArraySize,LSTMAllocationCategory_state);
+                candidateGateLayerWeights[cell][thisLayer]=(double**)LSTMAllocations::allocate(neuronsInThisLayerBasedDoublePointerArraySize,LSTMAllocationCategory_state);
 
                 // Next dimension: neurons in this layer
 
@@ -396,7 +572,7 @@ LSTMState::LSTMState(LSTMState *copyFrom, uint32_t _inputCount, uint32_t _output
                 {
                     // Next dimension: weights from neurons in previous layer to neurons in this layer
 
-                    candidateGateLayerWeights[cell][thisLayer][neuronInThisLayer]=(double*)malloc(neuronsInLastLayerBasedDoubleArraySize);
+                    candidateGateLayerWeights[cell][thisLayer][neuronInThisLayer]=(double*)LSTMAllocations::allocate(neuronsInLastLayerBasedDoubleArraySize,LSTMAllocationCategory_state);
                     memcpy(candidateGateLayerWeights[cell][thisLayer][neuronInThisLayer],copyFrom->candidateGateLayerWeights[cell][thisLayer][neuronInThisLayer],neuronsInLastLayerBasedDoubleArraySize);
                 }
 
@@ -404,15 +580,15 @@ LSTMState::LSTMState(LSTMState *copyFrom, uint32_t _inputCount, uint32_t _output
             }
 
             // These 4 arrays do not need to be initialized yet:
-            forgetGatePreValues[cell]=(double*)malloc(inputAndOutputBasedDoubleArraySize);
-            inputGatePreValues[cell]=(double*)malloc(inputAndOutputBasedDoubleArraySize);
-            outputGatePreValues[cell]=(double*)malloc(inputAndOutputBasedDoubleArraySize);
-            candidateGatePreValues[cell]=(double*)malloc(inputAndOutputBasedDoubleArraySize);
+            forgetGatePreValues[cell]=(double*)LSTMAllocations::allocate(gateNetworkOutputBasedDoubleArraySize,LSTMAllocationCategory_state);
+            inputGatePreValues[cell]=(double*)LSTMAllocations::allocate(gateNetworkOutputBasedDoubleArraySize,LSTMAllocationCategory_state);
+            outputGatePreValues[cell]=(double*)LSTMAllocations::allocate(gateNetworkOutputBasedDoubleArraySize,LSTMAllocationCategory_state);
+            candidateGatePreValues[cell]=(double*)LSTMAllocations::allocate(gateNetworkOutputBasedDoubleArraySize,LSTMAllocationCategory_state);
         }
     }
 }
 
-void LSTMState::calculateGatePreValues(double *previousOutputs)
+void LSTMState::calculateGatePreValues(double *previousOutputs, uint8_t *gateNetworkActivations)
 {
     // Inputs used: "input"; previous outputs used: "previousOutputs"
     // First layer: inputs and previous outputs
@@ -421,208 +597,594 @@ void LSTMState::calculateGatePreValues(double *previousOutputs)
 
     // (Basic multilayer feedforward neural network principle)
 
-    // One MLFFNNT for each cell's forget, input, output and candidate gates.
+    // One MLFFNNT for each cell's forget, input, output and candidate gates (or, with shared gate networks, one per gate for all cells).
 
     // For each gate
 
     double ****gateLayerWeights;
     double ***gateLayerBiasWeights;
     double **gatePreValues;
-    double **gateNeuronValues;
+    double ***gateNeuronValues;
     uint32_t gateTotalLayerCount;
     uint32_t *gateHiddenLayerNeuronCounts;
+    double *gatePreviousOutputs=previousOutputs;
+    double *resetPreviousOutputs=0;
+    // The sparse kernels gather the inputs/previous outputs by column, so they are put into one array:
+    double *bottommostLayerInputs=sparsity!=0?(double*)LSTMAllocations::allocate(inputAndOutputCount*sizeof(double),LSTMAllocationCategory_scratch):0;
 
-    for(uint32_t cell=0;cell<outputCount;cell++)
+    for(uint8_t gate=1;gate<=4;gate++)
     {
-        uint32_t neuronsInLastLayer;
-
-        for(uint8_t gate=1;gate<=4;gate++)
+        if(gate==1)
         {
-            if(gate==1)
-            {
-                // Forget gate
-                gateLayerWeights=forgetGateLayerWeights;
-                gateLayerBiasWeights=forgetGateLayerBiasWeights;
-                gatePreValues=forgetGatePreValues;
-                gateNeuronValues=forgetGateLayerNeuronValues[cell];
-                gateTotalLayerCount=forgetGateTotalLayerCount;
-                gateHiddenLayerNeuronCounts=forgetGateHiddenLayerNeuronCounts;
-            }
-            else if(gate==2)
-            {
-                // Input gate
-                gateLayerWeights=inputGateLayerWeights;
-                gateLayerBiasWeights=inputGateLayerBiasWeights;
-                gatePreValues=inputGatePreValues;
-                gateNeuronValues=inputGateLayerNeuronValues[cell];
-                gateTotalLayerCount=inputGateTotalLayerCount;
-                gateHiddenLayerNeuronCounts=inputGateHiddenLayerNeuronCounts;
-            }
-            else if(gate==3)
-            {
-                // Output gate
-                gateLayerWeights=outputGateLayerWeights;
-                gateLayerBiasWeights=outputGateLayerBiasWeights;
-                gatePreValues=outputGatePreValues;
-                gateNeuronValues=outputGateLayerNeuronValues[cell];
-                gateTotalLayerCount=outputGateTotalLayerCount;
-                gateHiddenLayerNeuronCounts=outputGateHiddenLayerNeuronCounts;
-            }
-            else // if(gate==4)
+            // Forget gate
+            if(!hasForgetGateNetwork())
+                continue;
+            gateLayerWeights=forgetGateLayerWeights;
+            gateLayerBiasWeights=forgetGateLayerBiasWeights;
+            gatePreValues=forgetGatePreValues;
+            gateNeuronValues=forgetGateLayerNeuronValues;
+            gateTotalLayerCount=forgetGateTotalLayerCount;
+            gateHiddenLayerNeuronCounts=forgetGateHiddenLayerNeuronCounts;
+        }
+        else if(gate==2)
+        {
+            // Input gate
+            gateLayerWeights=inputGateLayerWeights;
+            gateLayerBiasWeights=inputGateLayerBiasWeights;
+            gatePreValues=inputGatePreValues;
+            gateNeuronValues=inputGateLayerNeuronValues;
+            gateTotalLayerCount=inputGateTotalLayerCount;
+            gateHiddenLayerNeuronCounts=inputGateHiddenLayerNeuronCounts;
+        }
+        else if(gate==3)
+        {
+            // Output gate
+            gateLayerWeights=outputGateLayerWeights;
+            gateLayerBiasWeights=outputGateLayerBiasWeights;
+            gatePreValues=outputGatePreValues;
+            gateNeuronValues=outputGateLayerNeuronValues;
+            gateTotalLayerCount=outputGateTotalLayerCount;
+            gateHiddenLayerNeuronCounts=outputGateHiddenLayerNeuronCounts;
+        }
+        else // if(gate==4)
+        {
+            // Candidate gate
+            gateLayerWeights=candidateGateLayerWeights;
+            gateLayerBiasWeights=candidateGateLayerBiasWeights;
+            gatePreValues=candidateGatePreValues;
+            gateNeuronValues=candidateGateLayerNeuronValues;
+            gateTotalLayerCount=candidateGateTotalLayerCount;
+            gateHiddenLayerNeuronCounts=candidateGateHiddenLayerNeuronCounts;
+            if(cellVariant==LSTMCellVariant_gru&&previousOutputs!=0)
             {
-                // Candidate gate
-                gateLayerWeights=candidateGateLayerWeights;
-                gateLayerBiasWeights=candidateGateLayerBiasWeights;
-                gatePreValues=candidateGatePreValues;
-                gateNeuronValues=candidateGateLayerNeuronValues[cell];
-                gateTotalLayerCount=candidateGateTotalLayerCount;
-                gateHiddenLayerNeuronCounts=candidateGateHiddenLayerNeuronCounts;
+                // The candidate networks see the previous outputs multiplied by the reset gate values (the output gate values, see below).
+                resetPreviousOutputs=(double*)LSTMAllocations::allocate(outputCount*sizeof(double),LSTMAllocationCategory_scratch);
+                for(uint32_t outputN=0;outputN<outputCount;outputN++)
+                    resetPreviousOutputs[outputN]=outputGateValues[outputN]*previousOutputs[outputN];
+                gatePreviousOutputs=resetPreviousOutputs;
             }
+        }
+        if(bottommostLayerInputs!=0)
+        {
+            memcpy(bottommostLayerInputs,input,inputCount*sizeof(double));
+            for(uint32_t outputN=0;outputN<outputCount;outputN++)
+                bottommostLayerInputs[inputCount+outputN]=gatePreviousOutputs!=0?gatePreviousOutputs[outputN]:0.0;
+        }
 
-            neuronsInLastLayer=inputAndOutputCount;
+        for(uint32_t cell=0;cell<gateNetworkCount;cell++)
+        {
+            uint32_t neuronsInLastLayer=inputAndOutputCount;
             for(uint32_t thisLayer=0;thisLayer<gateTotalLayerCount/*Topmost output layer included*/;thisLayer++)
             {
-                uint32_t neuronsInThisLayer=thisLayer==gateTotalLayerCount-1?inputAndOutputCount:gateHiddenLayerNeuronCounts[thisLayer];
-                // Get previous layer's values, multiply by weights, add biases, and put the output through the tanh function.
+                uint32_t neuronsInThisLayer=thisLayer==gateTotalLayerCount-1?gateNetworkOutputCount:gateHiddenLayerNeuronCounts[thisLayer];
+                // Get previous layer's values, multiply by weights, add biases, and put the output through the activation function.
 
                 for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
                 {
                     double inputsTimesWeightsSum=0.0;
-                    if(thisLayer==0)
+                    if(sparsity!=0)
+                    {
+                        double *lastLayerValues=thisLayer==0?bottommostLayerInputs:gateNeuronValues[cell][thisLayer-1];
+                        double *weights=gateLayerWeights[cell][thisLayer][neuronInThisLayer];
+                        uint32_t *rowStarts=sparsity->rowStarts[gate-1][cell][thisLayer];
+                        uint32_t *columns=sparsity->columns[gate-1][cell][thisLayer];
+                        for(uint32_t kept=rowStarts[neuronInThisLayer];kept<rowStarts[neuronInThisLayer+1];kept++)
+                            inputsTimesWeightsSum+=lastLayerValues[columns[kept]]*weights[columns[kept]];
+                    }
+                    else if(thisLayer==0)
                     {
                         // Use input/previous output values
                         for(uint32_t inputN=0;inputN<inputCount;inputN++)
                             inputsTimesWeightsSum+=input[inputN]*gateLayerWeights[cell][thisLayer][neuronInThisLayer][inputN];
-                        if(previousOutputs!=0)
+                        if(gatePreviousOutputs!=0)
                         {
                             for(uint32_t outputN=0;outputN<outputCount;outputN++)
-                                inputsTimesWeightsSum+=previousOutputs[outputN]*gateLayerWeights[cell][thisLayer][neuronInThisLayer][inputCount+outputN];
+                                inputsTimesWeightsSum+=gatePreviousOutputs[outputN]*gateLayerWeights[cell][thisLayer][neuronInThisLayer][inputCount+outputN];
                         }
                     }
                     else
                     {
                         for(uint32_t neuronInLastLayer=0;neuronInLastLayer<neuronsInLastLayer;neuronInLastLayer++)
-                            inputsTimesWeightsSum+=gateNeuronValues[thisLayer-1][neuronInLastLayer]*gateLayerWeights[cell][thisLayer][neuronInThisLayer][neuronInLastLayer];
+                            inputsTimesWeightsSum+=gateNeuronValues[cell][thisLayer-1][neuronInLastLayer]*gateLayerWeights[cell][thisLayer][neuronInThisLayer][neuronInLastLayer];
                     }
-                    gateNeuronValues[thisLayer][neuronInThisLayer]=tanh(inputsTimesWeightsSum+gateLayerBiasWeights[cell][thisLayer][neuronInThisLayer]);
+                    gateNeuronValues[cell][thisLayer][neuronInThisLayer]=inputsTimesWeightsSum+gateLayerBiasWeights[cell][thisLayer][neuronInThisLayer];
                 }
+                activate(gateNetworkActivations[gate-1],gateNeuronValues[cell][thisLayer],neuronsInThisLayer);
 
                 neuronsInLastLayer=neuronsInThisLayer;
             }
             // Copy values of topmost layer into pre-value array
-            memcpy(gatePreValues[cell],gateNeuronValues[gateTotalLayerCount-1/*The topmost layer which outputs the values into the gate pre-value array*/],inputAndOutputCount*sizeof(double));
+            memcpy(gatePreValues[cell],gateNeuronValues[cell][gateTotalLayerCount-1/*The topmost layer which outputs the values into the gate pre-value array*/],gateNetworkOutputCount*sizeof(double));
+        }
+
+        if(gate==3&&cellVariant==LSTMCellVariant_gru)
+        {
+            // The reset gate values are needed by the candidate networks, so they are calculated here instead of in LSTM::process().
+            for(uint32_t cell=0;cell<outputCount;cell++)
+                outputGateValues[cell]=sig(getGateValueSum(outputGatePreValues[sharedGateNetworks?0:cell],cell,previousOutputs!=0)+outputGateValueSumBiasWeights[cell]);
         }
     }
+    LSTMAllocations::release(resetPreviousOutputs);
+    LSTMAllocations::release(bottommostLayerInputs);
 }
 
-void LSTMState::freeMemory()
+void LSTMState::projectOutputs(double *cellOutputs, double *projectedOutputs)
+{
+    for(uint32_t projectionOutput=0;projectionOutput<projectionOutputCount;projectionOutput++)
+    {
+        double *weights=outputProjectionWeights[projectionOutput];
+        double sum=outputProjectionBiasWeights[projectionOutput];
+        for(uint32_t cell=0;cell<outputCount;cell++)
+            sum+=weights[cell]*cellOutputs[cell];
+        projectedOutputs[projectionOutput]=sum;
+    }
+}
+
+void LSTMState::copyWeightsFrom(LSTMState *source)
+{
+    double ****gateLayerWeights[4]={forgetGateLayerWeights,inputGateLayerWeights,outputGateLayerWeights,candidateGateLayerWeights};
+    double ****sourceGateLayerWeights[4]={source->forgetGateLayerWeights,source->inputGateLayerWeights,source->outputGateLayerWeights,source->candidateGateLayerWeights};
+    double ***gateLayerBiasWeights[4]={forgetGateLayerBiasWeights,inputGateLayerBiasWeights,outputGateLayerBiasWeights,candidateGateLayerBiasWeights};
+    double ***sourceGateLayerBiasWeights[4]={source->forgetGateLayerBiasWeights,source->inputGateLayerBiasWeights,source->outputGateLayerBiasWeights,source->candidateGateLayerBiasWeights};
+    double *gateValueSumBiasWeights[4]={forgetGateValueSumBiasWeights,inputGateValueSumBiasWeights,outputGateValueSumBiasWeights,candidateGateValueSumBiasWeights};
+    double *sourceGateValueSumBiasWeights[4]={source->forgetGateValueSumBiasWeights,source->inputGateValueSumBiasWeights,source->outputGateValueSumBiasWeights,source->candidateGateValueSumBiasWeights};
+    uint32_t gateTotalLayerCounts[4]={forgetGateTotalLayerCount,inputGateTotalLayerCount,outputGateTotalLayerCount,candidateGateTotalLayerCount};
+    uint32_t *gateHiddenLayerNeuronCounts[4]={forgetGateHiddenLayerNeuronCounts,inputGateHiddenLayerNeuronCounts,outputGateHiddenLayerNeuronCounts,candidateGateHiddenLayerNeuronCounts};
+    for(uint8_t gate=0;gate<4;gate++)
+    {
+        memcpy(gateValueSumBiasWeights[gate],sourceGateValueSumBiasWeights[gate],outputCount*sizeof(double));
+        for(uint32_t cell=0;cell<gateNetworkCount;cell++)
+        {
+            uint32_t neuronsInPreviousLayer=inputAndOutputCount;
+            for(uint32_t thisLayer=0;thisLayer<gateTotalLayerCounts[gate];thisLayer++)
+            {
+                uint32_t neuronsInThisLayer=thisLayer==gateTotalLayerCounts[gate]-1?gateNetworkOutputCount:gateHiddenLayerNeuronCounts[gate][thisLayer];
+                memcpy(gateLayerBiasWeights[gate][cell][thisLayer],sourceGateLayerBiasWeights[gate][cell][thisLayer],neuronsInThisLayer*sizeof(double));
+                for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
+                    memcpy(gateLayerWeights[gate][cell][thisLayer][neuronInThisLayer],sourceGateLayerWeights[gate][cell][thisLayer][neuronInThisLayer],neuronsInPreviousLayer*sizeof(double));
+                neuronsInPreviousLayer=neuronsInThisLayer;
+            }
+        }
+    }
+    for(uint32_t projectionOutput=0;projectionOutput<projectionOutputCount;projectionOutput++)
+        memcpy(outputProjectionWeights[projectionOutput],source->outputProjectionWeights[projectionOutput],outputCount*sizeof(double));
+    if(projectionOutputCount>0)
+        memcpy(outputProjectionBiasWeights,source->outputProjectionBiasWeights,projectionOutputCount*sizeof(double));
+}
+
+uint32_t LSTMState::getWidestGateLayerNeuronCount()
 {
+    uint32_t widestLayer=inputAndOutputCount; // Bottommost inputs and topmost output layers
+    for(uint32_t hiddenLayer=0;hiddenLayer<forgetGateTotalLayerCount-1;hiddenLayer++)
+        widestLayer=forgetGateHiddenLayerNeuronCounts[hiddenLayer]>widestLayer?forgetGateHiddenLayerNeuronCounts[hiddenLayer]:widestLayer;
+    for(uint32_t hiddenLayer=0;hiddenLayer<inputGateTotalLayerCount-1;hiddenLayer++)
+        widestLayer=inputGateHiddenLayerNeuronCounts[hiddenLayer]>widestLayer?inputGateHiddenLayerNeuronCounts[hiddenLayer]:widestLayer;
+    for(uint32_t hiddenLayer=0;hiddenLayer<outputGateTotalLayerCount-1;hiddenLayer++)
+        widestLayer=outputGateHiddenLayerNeuronCounts[hiddenLayer]>widestLayer?outputGateHiddenLayerNeuronCounts[hiddenLayer]:widestLayer;
+    for(uint32_t hiddenLayer=0;hiddenLayer<candidateGateTotalLayerCount-1;hiddenLayer++)
+        widestLayer=candidateGateHiddenLayerNeuronCounts[hiddenLayer]>widestLayer?candidateGateHiddenLayerNeuronCounts[hiddenLayer]:widestLayer;
+    return widestLayer;
+}
+
+uint32_t LSTMState::getSessionScratchSize()
+{
+    // Bottommost layer inputs (inputs and previous outputs), two alternating layer value buffers, the new cell states and the gate values
+    return inputAndOutputCount+2*getWidestGateLayerNeuronCount()+5*outputCount;
+}
+
+double LSTMState::getGateValueSum(double *topmostLayerValues, uint32_t cell, bool hasPreviousState)
+{
+    if(sharedGateNetworks)
+        return topmostLayerValues[cell];
+    double gateValueSum=0.0;
+    for(uint32_t i=0;i<inputCount;i++)
+        gateValueSum+=topmostLayerValues[i]; // Single-layer version: gateValueSum+=gateWeights[cell][i]*input[i];
+    if(hasPreviousState) // Else each product simply yields 0, eliminating the need to add it to the sum.
+    {
+        for(uint32_t i=0;i<outputCount;i++)
+            gateValueSum+=topmostLayerValues[inputCount+i]; // Single-layer version: gateValueSum+=gateWeights[cell][inputCount+i]*previousOutputs[i]
+    }
+    return gateValueSum;
+}
+
+bool LSTMState::hasForgetGateNetwork()
+{
+    return cellVariant==LSTMCellVariant_standard;
+}
+
+void LSTMState::processSession(LSTMSession *session, double *_input, double *_output, double *scratch, uint8_t *gateNetworkActivations)
+{
+    // Same computation as LSTM::process() and calculateGatePreValues(), but the neuron values only live in "scratch" and the recurrent
+    // values are taken from and written back to the session.
+
+    uint32_t widestLayer=getWidestGateLayerNeuronCount();
+    double *bottommostLayerInputs=scratch;
+    double *layerValueBuffers[2]={scratch+inputAndOutputCount,scratch+inputAndOutputCount+widestLayer};
+    double *newCellStates=scratch+inputAndOutputCount+2*widestLayer;
+    double *gateValues=newCellStates+outputCount; // Dimensions: gates (forget, input, output, candidate) - cells
+    bool hasPreviousState=session->hasPreviousState;
+    // The previous outputs are copied to the bottommost layer inputs below, so projected sessions can store the new cell outputs there directly.
+    double *cellOutputs=projectionOutputCount>0?session->previousOutputs:_output;
+
+    memcpy(bottommostLayerInputs,_input,inputCount*sizeof(double));
+    if(hasPreviousState)
+        memcpy(bottommostLayerInputs+inputCount,session->previousOutputs,outputCount*sizeof(double));
+    else
+    {
+        for(uint32_t outputN=0;outputN<outputCount;outputN++)
+            bottommostLayerInputs[inputCount+outputN]=0.0; // Same as calculateGatePreValues(0)
+    }
+
+    double ****gateLayerWeights;
+    double ***gateLayerBiasWeights;
+    double *gateValueSumBiasWeights;
+    uint32_t gateTotalLayerCount;
+    uint32_t *gateHiddenLayerNeuronCounts;
+
+    for(uint8_t gate=1;gate<=4;gate++)
+    {
+        if(gate==1)
+        {
+            // Forget gate
+            if(!hasForgetGateNetwork())
+                continue;
+            gateLayerWeights=forgetGateLayerWeights;
+            gateLayerBiasWeights=forgetGateLayerBiasWeights;
+            gateValueSumBiasWeights=forgetGateValueSumBiasWeights;
+            gateTotalLayerCount=forgetGateTotalLayerCount;
+            gateHiddenLayerNeuronCounts=forgetGateHiddenLayerNeuronCounts;
+        }
+        else if(gate==2)
+        {
+            // Input gate
+            gateLayerWeights=inputGateLayerWeights;
+            gateLayerBiasWeights=inputGateLayerBiasWeights;
+            gateValueSumBiasWeights=inputGateValueSumBiasWeights;
+            gateTotalLayerCount=inputGateTotalLayerCount;
+            gateHiddenLayerNeuronCounts=inputGateHiddenLayerNeuronCounts;
+        }
+        else if(gate==3)
+        {
+            // Output gate
+            gateLayerWeights=outputGateLayerWeights;
+            gateLayerBiasWeights=outputGateLayerBiasWeights;
+            gateValueSumBiasWeights=outputGateValueSumBiasWeights;
+            gateTotalLayerCount=outputGateTotalLayerCount;
+            gateHiddenLayerNeuronCounts=outputGateHiddenLayerNeuronCounts;
+        }
+        else // if(gate==4)
+        {
+            // Candidate gate
+            gateLayerWeights=candidateGateLayerWeights;
+            gateLayerBiasWeights=candidateGateLayerBiasWeights;
+            gateValueSumBiasWeights=candidateGateValueSumBiasWeights;
+            gateTotalLayerCount=candidateGateTotalLayerCount;
+            gateHiddenLayerNeuronCounts=candidateGateHiddenLayerNeuronCounts;
+        }
+
+        for(uint32_t network=0;network<gateNetworkCount;network++)
+        {
+            double *lastLayerValues=bottommostLayerInputs;
+            uint32_t neuronsInLastLayer=inputAndOutputCount;
+            for(uint32_t thisLayer=0;thisLayer<gateTotalLayerCount/*Topmost output layer included*/;thisLayer++)
+            {
+                uint32_t neuronsInThisLayer=thisLayer==gateTotalLayerCount-1?gateNetworkOutputCount:gateHiddenLayerNeuronCounts[thisLayer];
+                double *thisLayerValues=layerValueBuffers[thisLayer%2];
+                for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
+                {
+                    double *weights=gateLayerWeights[network][thisLayer][neuronInThisLayer];
+                    double inputsTimesWeightsSum=0.0;
+                    if(sparsity!=0)
+                    {
+                        uint32_t *rowStarts=sparsity->rowStarts[gate-1][network][thisLayer];
+                        uint32_t *columns=sparsity->columns[gate-1][network][thisLayer];
+                        for(uint32_t kept=rowStarts[neuronInThisLayer];kept<rowStarts[neuronInThisLayer+1];kept++)
+                            inputsTimesWeightsSum+=lastLayerValues[columns[kept]]*weights[columns[kept]];
+                    }
+                    else
+                    {
+                        for(uint32_t neuronInLastLayer=0;neuronInLastLayer<neuronsInLastLayer;neuronInLastLayer++)
+                            inputsTimesWeightsSum+=lastLayerValues[neuronInLastLayer]*weights[neuronInLastLayer];
+                    }
+                    thisLayerValues[neuronInThisLayer]=inputsTimesWeightsSum+gateLayerBiasWeights[network][thisLayer][neuronInThisLayer];
+                }
+                activate(gateNetworkActivations[gate-1],thisLayerValues,neuronsInThisLayer);
+                lastLayerValues=thisLayerValues;
+                neuronsInLastLayer=neuronsInThisLayer;
+            }
+
+            // lastLayerValues now holds the gate pre-values of this network's cell, or of all cells if the network is shared
+            uint32_t firstCell=sharedGateNetworks?0:network;
+            uint32_t lastCell=sharedGateNetworks?outputCount-1:network;
+            for(uint32_t cell=firstCell;cell<=lastCell;cell++)
+            {
+                double gateValueSum=getGateValueSum(lastLayerValues,cell,hasPreviousState); // See LSTM::process()
+                gateValues[(gate-1)*outputCount+cell]=gate==4?tanh(gateValueSum+gateValueSumBiasWeights[cell]):sig(gateValueSum+gateValueSumBiasWeights[cell]);
+            }
+        }
+
+        if(gate==3&&cellVariant==LSTMCellVariant_gru)
+        {
+            // The candidate networks see the previous outputs multiplied by the reset gate values (see calculateGatePreValues())
+            for(uint32_t outputN=0;outputN<outputCount;outputN++)
+                bottommostLayerInputs[inputCount+outputN]*=gateValues[2*outputCount+outputN];
+        }
+    }
+
+    if(!hasForgetGateNetwork())
+    {
+        for(uint32_t cell=0;cell<outputCount;cell++)
+            gateValues[cell]=1.0-gateValues[outputCount+cell];
+    }
     for(uint32_t cell=0;cell<outputCount;cell++)
+    {
+        // gateValues: forget, input, output, candidate
+        newCellStates[cell]=(hasPreviousState?gateValues[cell]*session->cellStates[cell]:0.0)+gateValues[outputCount+cell]*gateValues[3*outputCount+cell];
+        cellOutputs[cell]=cellVariant==LSTMCellVariant_gru?newCellStates[cell]:gateValues[2*outputCount+cell]*newCellStates[cell];
+    }
+
+    // The previous values are needed by all cells, so they can only be replaced once all cells have been processed:
+    memcpy(session->cellStates,newCellStates,outputCount*sizeof(double));
+    if(projectionOutputCount>0)
+        projectOutputs(cellOutputs,_output);
+    else
+        memcpy(session->previousOutputs,_output,outputCount*sizeof(double));
+    session->hasPreviousState=true;
+}
+
+uint32_t LSTMState::getActivationCount()
+{
+    uint32_t activationCount=inputCount+6*outputCount; // Inputs, outputs, cell states and the four gate values
+    uint32_t gateTotalLayerCounts[4]={forgetGateTotalLayerCount,inputGateTotalLayerCount,outputGateTotalLayerCount,candidateGateTotalLayerCount};
+    uint32_t *gateHiddenLayerNeuronCounts[4]={forgetGateHiddenLayerNeuronCounts,inputGateHiddenLayerNeuronCounts,outputGateHiddenLayerNeuronCounts,candidateGateHiddenLayerNeuronCounts};
+    for(uint8_t gate=0;gate<4;gate++)
+    {
+        for(uint32_t thisLayer=0;thisLayer<gateTotalLayerCounts[gate];thisLayer++)
+            activationCount+=gateNetworkCount*(thisLayer==gateTotalLayerCounts[gate]-1?gateNetworkOutputCount:gateHiddenLayerNeuronCounts[gate][thisLayer]);
+    }
+    return activationCount;
+}
+
+static void compressActivationArray(double *&array, uint32_t size, uint16_t *compressed, uint32_t &pos, uint16_t (*convert)(double))
+{
+    for(uint32_t i=0;i<size;i++)
+        compressed[pos++]=convert(array[i]);
+    LSTMAllocations::release(array);
+    array=0;
+}
+
+static void widenActivationArray(double *&array, uint32_t size, uint16_t *compressed, uint32_t &pos, double (*convert)(uint16_t))
+{
+    array=(double*)LSTMAllocations::allocate(size*sizeof(double),LSTMAllocationCategory_state);
+    for(uint32_t i=0;i<size;i++)
+        array[i]=convert(compressed[pos++]);
+}
+
+void LSTMState::compressActivations(uint8_t precision)
+{
+    if(precision==LSTMHistoryPrecision_double||activationPrecision!=LSTMHistoryPrecision_double)
+        return;
+    uint16_t (*convert)(double)=precision==LSTMHistoryPrecision_float16?doubleToFloat16:doubleToBFloat16;
+    compressedActivations=(uint16_t*)LSTMAllocations::allocate(getActivationCount()*sizeof(uint16_t),LSTMAllocationCategory_state);
+    uint32_t pos=0;
+
+    compressActivationArray(input,inputCount,compressedActivations,pos,convert);
+    compressActivationArray(output,outputCount,compressedActivations,pos,convert);
+    compressActivationArray(cellStates,outputCount,compressedActivations,pos,convert);
+    compressActivationArray(forgetGateValues,outputCount,compressedActivations,pos,convert);
+    compressActivationArray(inputGateValues,outputCount,compressedActivations,pos,convert);
+    compressActivationArray(outputGateValues,outputCount,compressedActivations,pos,convert);
+    compressActivationArray(candidateGateValues,outputCount,compressedActivations,pos,convert);
+
+    double ***gateLayerNeuronValues[4]={forgetGateLayerNeuronValues,inputGateLayerNeuronValues,outputGateLayerNeuronValues,candidateGateLayerNeuronValues};
+    double **gatePreValues[4]={forgetGatePreValues,inputGatePreValues,outputGatePreValues,candidateGatePreValues};
+    uint32_t gateTotalLayerCounts[4]={forgetGateTotalLayerCount,inputGateTotalLayerCount,outputGateTotalLayerCount,candidateGateTotalLayerCount};
+    uint32_t *gateHiddenLayerNeuronCounts[4]={forgetGateHiddenLayerNeuronCounts,inputGateHiddenLayerNeuronCounts,outputGateHiddenLayerNeuronCounts,candidateGateHiddenLayerNeuronCounts};
+    for(uint32_t cell=0;cell<gateNetworkCount;cell++)
+    {
+        for(uint8_t gate=0;gate<4;gate++)
+        {
+            for(uint32_t thisLayer=0;thisLayer<gateTotalLayerCounts[gate];thisLayer++)
+            {
+                uint32_t neuronsInThisLayer=thisLayer==gateTotalLayerCounts[gate]-1?gateNetworkOutputCount:gateHiddenLayerNeuronCounts[gate][thisLayer];
+                compressActivationArray(gateLayerNeuronValues[gate][cell][thisLayer],neuronsInThisLayer,compressedActivations,pos,convert);
+            }
+            // Not needed by learn() (copies of the topmost layer neuron values):
+            LSTMAllocations::release(gatePreValues[gate][cell]);
+            gatePreValues[gate][cell]=0;
+        }
+    }
+    activationPrecision=precision;
+}
+
+void LSTMState::widenActivations()
+{
+    if(activationPrecision==LSTMHistoryPrecision_double)
+        return;
+    double (*convert)(uint16_t)=activationPrecision==LSTMHistoryPrecision_float16?float16ToDouble:bFloat16ToDouble;
+    uint32_t pos=0;
+
+    widenActivationArray(input,inputCount,compressedActivations,pos,convert);
+    widenActivationArray(output,outputCount,compressedActivations,pos,convert);
+    widenActivationArray(cellStates,outputCount,compressedActivations,pos,convert);
+    widenActivationArray(forgetGateValues,outputCount,compressedActivations,pos,convert);
+    widenActivationArray(inputGateValues,outputCount,compressedActivations,pos,convert);
+    widenActivationArray(outputGateValues,outputCount,compressedActivations,pos,convert);
+    widenActivationArray(candidateGateValues,outputCount,compressedActivations,pos,convert);
+
+    double ***gateLayerNeuronValues[4]={forgetGateLayerNeuronValues,inputGateLayerNeuronValues,outputGateLayerNeuronValues,candidateGateLayerNeuronValues};
+    uint32_t gateTotalLayerCounts[4]={forgetGateTotalLayerCount,inputGateTotalLayerCount,outputGateTotalLayerCount,candidateGateTotalLayerCount};
+    uint32_t *gateHiddenLayerNeuronCounts[4]={forgetGateHiddenLayerNeuronCounts,inputGateHiddenLayerNeuronCounts,outputGateHiddenLayerNeuronCounts,candidateGateHiddenLayerNeuronCounts};
+    for(uint32_t cell=0;cell<gateNetworkCount;cell++)
+    {
+        for(uint8_t gate=0;gate<4;gate++)
+        {
+            for(uint32_t thisLayer=0;thisLayer<gateTotalLayerCounts[gate];thisLayer++)
+            {
+                uint32_t neuronsInThisLayer=thisLayer==gateTotalLayerCounts[gate]-1?gateNetworkOutputCount:gateHiddenLayerNeuronCounts[gate][thisLayer];
+                widenActivationArray(gateLayerNeuronValues[gate][cell][thisLayer],neuronsInThisLayer,compressedActivations,pos,convert);
+            }
+        }
+    }
+    LSTMAllocations::release(compressedActivations);
+    compressedActivations=0;
+    activationPrecision=LSTMHistoryPrecision_double;
+}
+
+void LSTMState::freeMemory()
+{
+    for(uint32_t cell=0;cell<gateNetworkCount;cell++)
     {
         // Forget gate
         for(uint32_t thisLayer=0;thisLayer<forgetGateTotalLayerCount;thisLayer++)
         {
-            // Free layer bias weights
-            free(forgetGateLayerBiasWeights[cell][thisLayer]);
-            free(forgetGateLayerNeuronValues[cell][thisLayer]);
-            // Free weights from neurons in previous layer to neurons in this layer
-            uint32_t neuronsInThisLayer=thisLayer==forgetGateTotalLayerCount-1?inputAndOutputCount:forgetGateHiddenLayerNeuronCounts[thisLayer];
-            for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
-                free(forgetGateLayerWeights[cell][thisLayer][neuronInThisLayer]);
-            free(forgetGateLayerWeights[cell][thisLayer]);
+            LSTMAllocations::release(forgetGateLayerNeuronValues[cell][thisLayer]);
+            if(!externalWeights)
+            {
+                // Free layer bias weights
+                LSTMAllocations::release(forgetGateLayerBiasWeights[cell][thisLayer]);
+                // Free weights from neurons in previous layer to neurons in this layer
+                uint32_t neuronsInThisLayer=thisLayer==forgetGateTotalLayerCount-1?gateNetworkOutputCount:forgetGateHiddenLayerNeuronCounts[thisLayer];
+                for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
+                    LSTMAllocations::release(forgetGateLayerWeights[cell][thisLayer][neuronInThisLayer]);
+            }
+            LSTMAllocations::release(forgetGateLayerWeights[cell][thisLayer]);
         }
 
         // Input gate
         for(uint32_t thisLayer=0;thisLayer<inputGateTotalLayerCount;thisLayer++)
         {
-            // Free layer bias weights
-            free(inputGateLayerBiasWeights[cell][thisLayer]);
-            free(inputGateLayerNeuronValues[cell][thisLayer]);
-            // Free weights from neurons in previous layer to neurons in this layer
-            uint32_t neuronsInThisLayer=thisLayer==inputGateTotalLayerCount-1?inputAndOutputCount:inputGateHiddenLayerNeuronCounts[thisLayer];
-            for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
-                free(inputGateLayerWeights[cell][thisLayer][neuronInThisLayer]);
-            free(inputGateLayerWeights[cell][thisLayer]);
+            LSTMAllocations::release(inputGateLayerNeuronValues[cell][thisLayer]);
+            if(!externalWeights)
+            {
+                // Free layer bias weights
+                LSTMAllocations::release(inputGateLayerBiasWeights[cell][thisLayer]);
+                // Free weights from neurons in previous layer to neurons in this layer
+                uint32_t neuronsInThisLayer=thisLayer==inputGateTotalLayerCount-1?gateNetworkOutputCount:inputGateHiddenLayerNeuronCounts[thisLayer];
+                for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
+                    LSTMAllocations::release(inputGateLayerWeights[cell][thisLayer][neuronInThisLayer]);
+            }
+            LSTMAllocations::release(inputGateLayerWeights[cell][thisLayer]);
         }
 
         // Output gate
         for(uint32_t thisLayer=0;thisLayer<outputGateTotalLayerCount;thisLayer++)
         {
-            // Free layer bias weights
-            free(outputGateLayerBiasWeights[cell][thisLayer]);
-            free(outputGateLayerNeuronValues[cell][thisLayer]);
-            // Free weights from neurons in previous layer to neurons in this layer
-            uint32_t neuronsInThisLayer=thisLayer==outputGateTotalLayerCount-1?inputAndOutputCount:outputGateHiddenLayerNeuronCounts[thisLayer];
-            for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
-                free(outputGateLayerWeights[cell][thisLayer][neuronInThisLayer]);
-            free(outputGateLayerWeights[cell][thisLayer]);
+            LSTMAllocations::release(outputGateLayerNeuronValues[cell][thisLayer]);
+            if(!externalWeights)
+            {
+                // Free layer bias weights
+                LSTMAllocations::release(outputGateLayerBiasWeights[cell][thisLayer]);
+                // Free weights from neurons in previous layer to neurons in this layer
+                uint32_t neuronsInThisLayer=thisLayer==outputGateTotalLayerCount-1?gateNetworkOutputCount:outputGateHiddenLayerNeuronCounts[thisLayer];
+                for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
+                    LSTMAllocations::release(outputGateLayerWeights[cell][thisLayer][neuronInThisLayer]);
+            }
+            LSTMAllocations::release(outputGateLayerWeights[cell][thisLayer]);
         }
 
         // Candidate gate
         for(uint32_t thisLayer=0;thisLayer<candidateGateTotalLayerCount;thisLayer++)
         {
-            // Free layer bias weights
-            free(candidateGateLayerBiasWeights[cell][thisLayer]);
-            free(candidateGateLayerNeuronValues[cell][thisLayer]);
-            // Free weights from neurons in previous layer to neurons in this layer
-            uint32_t neuronsInThisLayer=thisLayer==candidateGateTotalLayerCount-1?inputAndOutputCount:candidateGateHiddenLayerNeuronCounts[thisLayer];
-            for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
-                free(candidateGateLayerWeights[cell][thisLayer][neuronInThisLayer]);
-            free(candidateGateLayerWeights[cell][thisLayer]);
+            LSTMAllocations::release(candidateGateLayerNeuronValues[cell][thisLayer]);
+            if(!externalWeights)
+            {
+                // Free layer bias weights
+                LSTMAllocations::release(candidateGateLayerBiasWeights[cell][thisLayer]);
+                // Free weights from neurons in previous layer to neurons in this layer
+                uint32_t neuronsInThisLayer=thisLayer==candidateGateTotalLayerCount-1?gateNetworkOutputCount:candidateGateHiddenLayerNeuronCounts[thisLayer];
+                for(uint32_t neuronInThisLayer=0;neuronInThisLayer<neuronsInThisLayer;neuronInThisLayer++)
+                    LSTMAllocations::release(candidateGateLayerWeights[cell][thisLayer][neuronInThisLayer]);
+            }
+            LSTMAllocations::release(candidateGateLayerWeights[cell][thisLayer]);
         }
 
-        free(forgetGateLayerBiasWeights[cell]);
-        free(inputGateLayerBiasWeights[cell]);
-        free(outputGateLayerBiasWeights[cell]);
-        free(candidateGateLayerBiasWeights[cell]);
-        free(forgetGateLayerNeuronValues[cell]);
-        free(inputGateLayerNeuronValues[cell]);
-        free(outputGateLayerNeuronValues[cell]);
-        free(candidateGateLayerNeuronValues[cell]);
-        free(forgetGateLayerWeights[cell]);
-        free(inputGateLayerWeights[cell]);
-        free(outputGateLayerWeights[cell]);
-        free(candidateGateLayerWeights[cell]);
-        free(forgetGatePreValues[cell]);
-        free(inputGatePreValues[cell]);
-        free(outputGatePreValues[cell]);
-        free(candidateGatePreValues[cell]);
+        LSTMAllocations::release(forgetGateLayerBiasWeights[cell]);
+        LSTMAllocations::release(inputGateLayerBiasWeights[cell]);
+        LSTMAllocations::release(outputGateLayerBiasWeights[cell]);
+        LSTMAllocations::release(candidateGateLayerBiasWeights[cell]);
+        LSTMAllocations::release(forgetGateLayerNeuronValues[cell]);
+        LSTMAllocations::release(inputGateLayerNeuronValues[cell]);
+        LSTMAllocations::release(outputGateLayerNeuronValues[cell]);
+        LSTMAllocations::release(candidateGateLayerNeuronValues[cell]);
+        LSTMAllocations::release(forgetGateLayerWeights[cell]);
+        LSTMAllocations::release(inputGateLayerWeights[cell]);
+        LSTMAllocations::release(outputGateLayerWeights[cell]);
+        LSTMAllocations::release(candidateGateLayerWeights[cell]);
+        LSTMAllocations::release(forgetGatePreValues[cell]);
+        LSTMAllocations::release(inputGatePreValues[cell]);
+        LSTMAllocations::release(outputGatePreValues[cell]);
+        LSTMAllocations::release(candidateGatePreValues[cell]);
+    }
+    LSTMAllocations::release(input);
+    LSTMAllocations::release(output);
+    LSTMAllocations::release(desiredOutput);
+    LSTMAllocations::release(cellStates);
+    LSTMAllocations::release(forgetGateLayerBiasWeights);
+    LSTMAllocations::release(inputGateLayerBiasWeights);
+    LSTMAllocations::release(outputGateLayerBiasWeights);
+    LSTMAllocations::release(candidateGateLayerBiasWeights);
+    LSTMAllocations::release(forgetGateLayerNeuronValues);
+    LSTMAllocations::release(inputGateLayerNeuronValues);
+    LSTMAllocations::release(outputGateLayerNeuronValues);
+    LSTMAllocations::release(candidateGateLayerNeuronValues);
+    LSTMAllocations::release(forgetGatePreValues);
+    LSTMAllocations::release(inputGatePreValues);
+    LSTMAllocations::release(outputGatePreValues);
+    LSTMAllocations::release(candidateGatePreValues);
+    LSTMAllocations::release(forgetGateValues);
+    LSTMAllocations::release(inputGateValues);
+    LSTMAllocations::release(outputGateValues);
+    LSTMAllocations::release(candidateGateValues);
+    if(!externalWeights)
+    {
+        LSTMAllocations::release(forgetGateValueSumBiasWeights);
+        LSTMAllocations::release(inputGateValueSumBiasWeights);
+        LSTMAllocations::release(outputGateValueSumBiasWeights);
+        LSTMAllocations::release(candidateGateValueSumBiasWeights);
+    }
+    LSTMAllocations::release(forgetGateLayerWeights);
+    LSTMAllocations::release(inputGateLayerWeights);
+    LSTMAllocations::release(outputGateLayerWeights);
+    LSTMAllocations::release(candidateGateLayerWeights);
+    LSTMAllocations::release(bottomDerivativesOfLossesFromThisStateUpwardsWithRespectToLastCellStates);
+    LSTMAllocations::release(bottomDerivativesOfLossesFromThisStateUpwardsWithRespectToInputs);
+    LSTMAllocations::release(bottomDerivativesOfLossesFromThisStateUpwardsWithRespectToLastOutputs);
+    if(projectionOutputCount>0)
+    {
+        if(!externalWeights)
+        {
+            for(uint32_t projectionOutput=0;projectionOutput<projectionOutputCount;projectionOutput++)
+                LSTMAllocations::release(outputProjectionWeights[projectionOutput]);
+            LSTMAllocations::release(outputProjectionBiasWeights);
+        }
+        LSTMAllocations::release(outputProjectionWeights);
     }
-    free(input);
-    free(output);
-    free(desiredOutput);
-    free(cellStates);
-    free(forgetGateLayerBiasWeights);
-    free(inputGateLayerBiasWeights);
-    free(outputGateLayerBiasWeights);
-    free(candidateGateLayerBiasWeights);
-    free(forgetGateLayerNeuronValues);
-    free(inputGateLayerNeuronValues);
-    free(outputGateLayerNeuronValues);
-    free(candidateGateLayerNeuronValues);
-    free(forgetGatePreValues);
-    free(inputGatePreValues);
-    free(outputGatePreValues);
-    free(candidateGatePreValues);
-    free(forgetGateValues);
-    free(inputGateValues);
-    free(outputGateValues);
-    free(candidateGateValues);
-    free(forgetGateValueSumBiasWeights);
-    free(inputGateValueSumBiasWeights);
-    free(outputGateValueSumBiasWeights);
-    free(candidateGateValueSumBiasWeights);
-    free(forgetGateLayerWeights);
-    free(inputGateLayerWeights);
-    free(outputGateLayerWeights);
-    free(candidateGateLayerWeights);
-    free(bottomDerivativesOfLossesFromThisStateUpwardsWithRespectToLastCellStates);
-    free(bottomDerivativesOfLossesFromThisStateUpwardsWithRespectToInputs);
-    free(bottomDerivativesOfLossesFromThisStateUpwardsWithRespectToLastOutputs);
-    free(forgetGateHiddenLayerNeuronCounts);
-    free(inputGateHiddenLayerNeuronCounts);
-    free(outputGateHiddenLayerNeuronCounts);
-    free(candidateGateHiddenLayerNeuronCounts);
+    LSTMAllocations::release(forgetGateHiddenLayerNeuronCounts);
+    LSTMAllocations::release(inputGateHiddenLayerNeuronCounts);
+    LSTMAllocations::release(outputGateHiddenLayerNeuronCounts);
+    LSTMAllocations::release(candidateGateHiddenLayerNeuronCounts);
+    LSTMAllocations::release(compressedActivations); // 0 unless compressed (the arrays it replaces are 0 then)
 }
 
 LSTMState::~LSTMState()
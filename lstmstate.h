@@ -11,9 +11,47 @@
 #include <math.h>
 #include <time.h>
 
+#include "lstmsession.h"
+#include "lstmsparsity.h"
+#include "lstmallocations.h"
+
+// Precision used to store the activations of states that are only kept for learn() (see LSTMState::compressActivations())
+enum LSTMHistoryPrecision
+{
+    LSTMHistoryPrecision_double=0,
+    LSTMHistoryPrecision_float16=1, // IEEE 754 half precision: 11 significant bits, range +-65504
+    LSTMHistoryPrecision_bfloat16=2 // Upper half of a float: 8 significant bits, float range
+};
+
+// Activation function of the hidden and topmost layer neurons of a gate network (see LSTMState::activate())
+enum LSTMGateActivation
+{
+    LSTMGateActivation_tanh=0,
+    LSTMGateActivation_relu=1,
+    LSTMGateActivation_leakyRelu=2, // Slope LSTM_LEAKY_RELU_SLOPE below 0
+    LSTMGateActivation_hardTanh=3, // Clamped to [-1,1]
+    LSTMGateActivation_identity=4
+};
+#define LSTM_GATE_ACTIVATION_COUNT 5
+#define LSTM_LEAKY_RELU_SLOPE 0.01
+
+// How the gate values are combined into the cell state and output. The reduced variants evaluate three gate networks per step instead of four.
+enum LSTMCellVariant
+{
+    LSTMCellVariant_standard=0,
+    // The forget gate value is 1-input gate value, so the forget gate networks are not evaluated.
+    LSTMCellVariant_coupledInputForget=1,
+    // GRU-style: the input gate is the update gate z (forget gate value 1-z), the output gate is the reset gate r, which multiplies the previous
+    // outputs before they enter the candidate networks, and the output is the cell state. The forget gate networks are not evaluated.
+    LSTMCellVariant_gru=2
+};
+#define LSTM_CELL_VARIANT_COUNT 3
+
 class LSTMState
 {
 public:
+    // The gate networks ("Cells" below) are either one per cell, or, with shared gate networks, a single one per gate whose topmost layer has
+    // a neuron per cell (see gateNetworkCount and gateNetworkOutputCount).
     // Dimensions: Cells - layers - neurons in this layer - weights from neurons in previous layer to neurons in this layer
     double ****forgetGateLayerWeights;
     double ****inputGateLayerWeights;
@@ -47,10 +85,20 @@ public:
     double *output;
     double *desiredOutput;
     double *cellStates;
+    // Output projection (only if projectionOutputCount is not 0): the outputs are outputProjectionWeights*cell outputs+outputProjectionBiasWeights.
+    // Dimensions: Outputs - cells
+    double **outputProjectionWeights;
+    // Dimensions: Outputs
+    double *outputProjectionBiasWeights;
 
     uint32_t inputCount;
-    uint32_t outputCount;
+    uint32_t outputCount; // Of the cells; "output" holds the cell outputs, which are fed back, also if they are projected
     uint32_t inputAndOutputCount;
+    uint32_t projectionOutputCount; // 0 if the cell outputs are the outputs
+    bool sharedGateNetworks;
+    uint8_t cellVariant; // LSTMCellVariant
+    uint32_t gateNetworkCount; // Per gate: outputCount, or 1 with shared gate networks
+    uint32_t gateNetworkOutputCount; // Neurons in the topmost layer of a gate network: inputAndOutputCount, or outputCount with shared gate networks
 
     uint32_t forgetGateTotalLayerCount;
     uint32_t inputGateTotalLayerCount;
@@ -66,13 +114,61 @@ public:
     double *bottomDerivativesOfLossesFromThisStateUpwardsWithRespectToLastOutputs; // bottom_diff_h
     double *bottomDerivativesOfLossesFromThisStateUpwardsWithRespectToInputs; // bottom_diff_x
 
+    // While compressed, input, output, cellStates, the gate values and the gate layer neuron values are only stored in compressedActivations
+    // (their pointers are 0). The gate pre-values, which are copies of the topmost gate layer neuron values, are dropped.
+    uint8_t activationPrecision; // LSTMHistoryPrecision
+    // If set, the weight and bias arrays (not their pointer tables) belong to someone else, e.g. a mapped checkpoint, and are read-only.
+    // Created by passing allocateWeights=false without copyFrom.
+    bool externalWeights;
+    // If not 0, the gate networks are pruned and evaluated with the sparse kernels, which only touch the kept weights (owned by the LSTM).
+    LSTMSparsity *sparsity;
+    uint16_t *compressedActivations;
+
     static double sig(double input); // sigmoid function
     static double tanh(double input); // tanh function
+    // Applies "activation" (LSTMGateActivation) to "count" values in place. The cheaper activations do not call any function, so the loops
+    // can be vectorized.
+    static void activate(uint8_t activation,double *values,uint32_t count);
+    static double getActivationDerivative(uint8_t activation,double activatedValue); // Calculated from the value after the activation
+
+    static uint16_t doubleToFloat16(double in); // Rounds to nearest even
+    static double float16ToDouble(uint16_t in);
+    static uint16_t doubleToBFloat16(double in); // Rounds to nearest even
+    static double bFloat16ToDouble(uint16_t in);
 
-    LSTMState(LSTMState *copyFrom=0,uint32_t _inputCount=0,uint32_t _outputCount=0,uint32_t _forgetGateHiddenLayerCount=0,uint32_t *_forgetGateHiddenLayerNeuronCounts=0,uint32_t _inputGateHiddenLayerCount=0,uint32_t *_inputGateHiddenLayerNeuronCounts=0,uint32_t _outputGateHiddenLayerCount=0,uint32_t *_outputGateHiddenLayerNeuronCounts=0,uint32_t _candidateGateHiddenLayerCount=0,uint32_t *_candidateGateHiddenLayerNeuronCounts=0);
-    void calculateGatePreValues(double *previousOutputs); // Takes "input" and calculates the values to be multiplied by the weights of the gates (in single-layer LSTM: inputGateWeights[cell][i]*input[i]; here: inputGatePreValues[cell][i]).
+    LSTMState(LSTMState *copyFrom=0,uint32_t _inputCount=0,uint32_t _outputCount=0,uint32_t _forgetGateHiddenLayerCount=0,uint32_t *_forgetGateHiddenLayerNeuronCounts=0,uint32_t _inputGateHiddenLayerCount=0,uint32_t *_inputGateHiddenLayerNeuronCounts=0,uint32_t _outputGateHiddenLayerCount=0,uint32_t *_outputGateHiddenLayerNeuronCounts=0,uint32_t _candidateGateHiddenLayerCount=0,uint32_t *_candidateGateHiddenLayerNeuronCounts=0,bool allocateWeights=true,uint32_t _projectionOutputCount=0,bool _sharedGateNetworks=false,uint8_t _cellVariant=LSTMCellVariant_standard);
+    // "gateNetworkActivations": LSTMGateActivation per gate (forget, input, output, candidate). With the GRU-style cell, this also sets the output
+    // gate values (the reset gate values), which the candidate networks need.
+    void calculateGatePreValues(double *previousOutputs,uint8_t *gateNetworkActivations); // Takes "input" and calculates the values to be multiplied by the weights of the gates (in single-layer LSTM: inputGateWeights[cell][i]*input[i]; here: inputGatePreValues[cell][i]).
+    // Sum of the topmost layer values of a gate network that goes into the gate value of "cell" (before the value sum bias weight is added).
+    // Per-cell networks sum all values (the previous output values only if there is a previous state); a shared network has one value per cell.
+    double getGateValueSum(double *topmostLayerValues,uint32_t cell,bool hasPreviousState);
+    // The forget gate networks keep their weights in all variants (so the checkpoint layout does not depend on the variant), but they are only
+    // evaluated and trained by the standard cell.
+    bool hasForgetGateNetwork();
+    void copyWeightsFrom(LSTMState *source); // "source" must have the same topology; the weights of this state must not be external.
+    void projectOutputs(double *cellOutputs,double *projectedOutputs); // Writes projectionOutputCount values to "projectedOutputs"
+    uint32_t getWidestGateLayerNeuronCount();
+    uint32_t getSessionScratchSize(); // Number of doubles processSession() needs as scratch space
+    // Performs one step of "session" using the weights of this state, which are only read (multiple threads may step different sessions concurrently).
+    // None of the activation arrays of this state are touched. "scratch" must hold getSessionScratchSize() doubles. "_output" receives the
+    // projected outputs if there is a projection.
+    void processSession(LSTMSession *session,double *_input,double *_output,double *scratch,uint8_t *gateNetworkActivations);
+    uint32_t getActivationCount(); // Number of values stored by compressActivations()
+    void compressActivations(uint8_t precision); // Replaces the activations needed by learn() by 16 bit values (precision: LSTMHistoryPrecision)
+    void widenActivations(); // Restores double activation arrays from the compressed values
     void freeMemory();
     ~LSTMState();
+
+    // A state is pushed per process() step, so the objects themselves are counted as allocations as well.
+    static void *operator new(size_t size)
+    {
+        return LSTMAllocations::allocate(size,LSTMAllocationCategory_state);
+    }
+    static void operator delete(void *pointer)
+    {
+        LSTMAllocations::release(pointer);
+    }
 };
 
 #endif // LSTMSTATE_H
@@ -0,0 +1,30 @@
+#include "lstmstats.h"
+
+bool LSTMStats::isEnabled()
+{
+#ifdef LSTM_PHASE_TIMERS
+    return true;
+#else
+    return false;
+#endif
+}
+
+const char *LSTMStats::getPhaseName(uint8_t phase)
+{
+    static const char *phaseNames[LSTM_PHASE_COUNT]={"process","pushState","gatePreValues","gateCombination","historyCompression","learn","backwardStep","weightUpdate"};
+    return phase<LSTM_PHASE_COUNT?phaseNames[phase]:"unknown";
+}
+
+LSTMStats::LSTMStats()
+{
+    reset();
+}
+
+void LSTMStats::reset()
+{
+    for(uint8_t phase=0;phase<LSTM_PHASE_COUNT;phase++)
+    {
+        phaseCounts[phase]=0;
+        phaseNanoseconds[phase]=0;
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef LSTMSTATS_H
+#define LSTMSTATS_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <memory.h>
+
+#ifdef LSTM_PHASE_TIMERS
+#include <chrono>
+#endif
+
+// Phases of process() and learn() that are timed if the engine is compiled with LSTM_PHASE_TIMERS (e.g. DEFINES += LSTM_PHASE_TIMERS in
+// the .pro file). Without it, the timers are not compiled in at all and LSTM::stats() stays empty.
+enum LSTMPhase
+{
+    LSTMPhase_process=0, // All of process(), including the phases up to LSTMPhase_historyCompression
+    LSTMPhase_pushState=1, // Copying the previous state, weights included, into the new state
+    LSTMPhase_gatePreValues=2, // LSTMState::calculateGatePreValues(): the gate networks
+    LSTMPhase_gateCombination=3, // Gate values, cell states, outputs and the output projection
+    LSTMPhase_historyCompression=4, // LSTMState::compressActivations() of the previous state
+    LSTMPhase_learn=5, // All of learn(), including the phases below
+    LSTMPhase_backwardStep=6, // Backpropagation through one state (counted once per state)
+    LSTMPhase_weightUpdate=7 // Applying the summed weight differentials with momentum and weight decay
+};
+#define LSTM_PHASE_COUNT 8
+
+class LSTMStats
+{
+public:
+    uint64_t phaseCounts[LSTM_PHASE_COUNT]; // Number of times each phase has been run
+    uint64_t phaseNanoseconds[LSTM_PHASE_COUNT];
+
+    static bool isEnabled(); // Returns false if the timers have been compiled out
+    static const char *getPhaseName(uint8_t phase);
+    LSTMStats();
+    void reset();
+};
+
+#ifdef LSTM_PHASE_TIMERS
+// Adds the time from its construction until it goes out of scope (or until stop()) to a phase of "stats".
+class LSTMPhaseTimer
+{
+public:
+    LSTMStats *stats;
+    uint8_t phase;
+    std::chrono::steady_clock::time_point start;
+
+    LSTMPhaseTimer(LSTMStats *_stats,uint8_t _phase) : stats(_stats), phase(_phase), start(std::chrono::steady_clock::now()) {}
+    void stop()
+    {
+        if(stats==0)
+            return;
+        stats->phaseNanoseconds[phase]+=(uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-start).count();
+        stats->phaseCounts[phase]++;
+        stats=0;
+    }
+    ~LSTMPhaseTimer()
+    {
+        stop();
+    }
+};
+#define LSTM_TIME_PHASE(timer,stats,phase) LSTMPhaseTimer timer(stats,phase)
+#define LSTM_STOP_PHASE(timer) timer.stop()
+#else
+#define LSTM_TIME_PHASE(timer,stats,phase)
+#define LSTM_STOP_PHASE(timer)
+#endif
+
+#endif // LSTMSTATS_H
@@ -0,0 +1,68 @@
+#include "lstmworkmodel.h"
+
+LSTMWorkModel::LSTMWorkModel(LSTM *lstm)
+{
+    LSTMState *state=lstm->getWeightState();
+    LSTMSparsity *sparsity=lstm->sparsity;
+    uint32_t gateTotalLayerCounts[4]={state->forgetGateTotalLayerCount,state->inputGateTotalLayerCount,state->outputGateTotalLayerCount,state->candidateGateTotalLayerCount};
+    uint32_t *gateHiddenLayerNeuronCounts[4]={state->forgetGateHiddenLayerNeuronCounts,state->inputGateHiddenLayerNeuronCounts,state->outputGateHiddenLayerNeuronCounts,state->candidateGateHiddenLayerNeuronCounts};
+    uint32_t cellCount=state->outputCount;
+    learnWindowStepCount=lstm->backpropagationSteps+1;
+
+    // The gate networks
+    uint64_t networkWeightCount=0; // Of the evaluated networks (kept weights only)
+    uint64_t networkNeuronCount=0;
+    storedParameterCount=0;
+    for(uint8_t gate=0;gate<4;gate++)
+    {
+        bool evaluated=gate!=0||state->hasForgetGateNetwork();
+        for(uint32_t network=0;network<state->gateNetworkCount;network++)
+        {
+            uint32_t neuronsInLastLayer=state->inputAndOutputCount;
+            for(uint32_t thisLayer=0;thisLayer<gateTotalLayerCounts[gate];thisLayer++)
+            {
+                uint32_t neuronsInThisLayer=thisLayer==gateTotalLayerCounts[gate]-1?state->gateNetworkOutputCount:gateHiddenLayerNeuronCounts[gate][thisLayer];
+                uint64_t layerWeightCount=(uint64_t)neuronsInThisLayer*neuronsInLastLayer;
+                storedParameterCount+=layerWeightCount+neuronsInThisLayer;
+                if(evaluated)
+                {
+                    networkWeightCount+=sparsity!=0?sparsity->rowStarts[gate][network][thisLayer][neuronsInThisLayer]:layerWeightCount;
+                    networkNeuronCount+=neuronsInThisLayer;
+                }
+                neuronsInLastLayer=neuronsInThisLayer;
+            }
+        }
+    }
+    uint32_t evaluatedGateCount=state->hasForgetGateNetwork()?4:3;
+    storedParameterCount+=4*(uint64_t)cellCount; // Gate value sum bias weights
+    uint64_t projectionWeightCount=(uint64_t)state->projectionOutputCount*cellCount;
+    storedParameterCount+=projectionWeightCount+state->projectionOutputCount;
+    parameterCount=networkWeightCount+networkNeuronCount+evaluatedGateCount*(uint64_t)cellCount+projectionWeightCount+state->projectionOutputCount;
+
+    // process(): a multiplication and an addition per weight, and the bias weight and activation function per neuron. A per-cell network
+    // sums its topmost layer into the gate value; then each gate adds its bias weight and calls its activation function. The cells take
+    // about 6 operations to combine the gates, and a projected output one multiplication and addition per cell plus its bias weight.
+    uint32_t gateValueSumCount=state->sharedGateNetworks?1:state->gateNetworkOutputCount;
+    processFlops=2.0*networkWeightCount+2.0*networkNeuronCount;
+    processFlops+=(double)evaluatedGateCount*cellCount*(gateValueSumCount+2);
+    processFlops+=6.0*cellCount;
+    processFlops+=2.0*projectionWeightCount+state->projectionOutputCount;
+    processParameterBytes=(double)parameterCount*sizeof(double);
+    processStateCopyBytes=2.0*storedParameterCount*sizeof(double);
+
+    // learn(), per state of the window: a weight differential (multiplication and addition) and the error term sum of the layer below,
+    // or of the inputs for the bottommost layer (another multiplication and addition), per weight; the activation derivative, error term and
+    // bias weight differential per neuron; about 30 operations for the derivatives of a cell; and the differentials and derivatives of the
+    // projection (two multiplications and additions per weight). Each weight and its differential are read and the differential written.
+    // The weight update takes about 7 operations per parameter (learning rate, momentum and weight decay), reading the parameter, its
+    // differential and previous change and writing the parameter and its change.
+    double stepFlops=4.0*networkWeightCount+3.0*networkNeuronCount+30.0*cellCount+4.0*projectionWeightCount;
+    double stepBytes=3.0*(networkWeightCount+networkNeuronCount+projectionWeightCount)*sizeof(double);
+    learnFlops=learnWindowStepCount*stepFlops+7.0*parameterCount;
+    learnParameterBytes=learnWindowStepCount*stepBytes+5.0*parameterCount*sizeof(double);
+}
+
+double LSTMWorkModel::getProcessBytes()
+{
+    return processParameterBytes+processStateCopyBytes;
+}
@@ -0,0 +1,29 @@
+#ifndef LSTMWORKMODEL_H
+#define LSTMWORKMODEL_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "lstm.h"
+
+// Analytic work of process() and learn() for the topology of an LSTM: floating point operations (each addition, multiplication and
+// activation function call counts as one) and the bytes of parameters touched. The values are determined by the layer sizes alone (and by
+// the kept weights if the LSTM has been pruned), so dividing them by measured times gives the achieved GFLOP/s and GB/s (see the --roofline
+// mode of LSTMBenchmark). Activations and other per-neuron values are not counted as bytes, as they are small compared to the weights.
+class LSTMWorkModel
+{
+public:
+    uint64_t parameterCount; // Weights and bias weights read per process() step (the kept ones if pruned)
+    uint64_t storedParameterCount; // Weights and bias weights of a state, pruned ones and forget gate networks the cell variant skips included
+    uint32_t learnWindowStepCount; // States a learn() call backpropagates through once the history is full (backpropagationSteps+1)
+    double processFlops;
+    double processParameterBytes; // Read by the gate networks, gate value sums and output projection
+    double processStateCopyBytes; // Read and written by pushState(), which copies all stored parameters into the new state
+    double learnFlops; // Of a full window
+    double learnParameterBytes; // Weights and weight differentials touched by the backward steps and momentum touched by the weight update
+
+    LSTMWorkModel(LSTM *lstm);
+    double getProcessBytes(); // processParameterBytes+processStateCopyBytes
+};
+
+#endif // LSTMWORKMODEL_H
@@ -4,11 +4,13 @@
 #include <stdlib.h>
 #include <iostream>
 #include <stdint.h>
+#include <chrono>
 
 #include "io.h"
 #include "text.h"
 
 #include "lstm.h"
+#include "trainingeventlog.h"
 
 using namespace std;
 
@@ -22,14 +24,14 @@ string doubleArrayToString(double *array,uint32_t elementCount,bool includeHighe
     {
         if(i>0)
             out+=", ";
-        char *str=text::doubleToString(array[i]);
+        char str[TEXT_DOUBLE_BUFFER_SIZE];
+        text::formatDouble(array[i],str);
         if(includeHighest&&array[i]>highest)
         {
             highest=array[i];
             highestIndex=i;
         }
         out+=str;
-        free(str);
     }
     if(includeHighest&&elementCount>0)
     {
@@ -55,15 +57,14 @@ int main(int argc, char *argv[])
     const char *helloString="hello";
     uint32_t inputCount=3; // h, e, l
     uint32_t outputCount=3; // e, l, o
-    uint32_t additionalMemoryCellCount=3; // These cells help the LSTM adapt by effectively turning into adjustable parameters during training
-    uint32_t effectiveOutputCount=outputCount+additionalMemoryCellCount;
+    uint32_t cellCount=6; // More cells than outputs help the LSTM adapt; the outputs are a trained projection of the cell outputs
     uint32_t backpropagationSteps=3;
     double learningRate=0.1;
-    double momentum=0.9;
+    double momentum=0.5;
     double weightDecay=0.0001;
 
     // Learning rate, momentum and weight decay of multi-layer networks inside gates:
-    double networkLearningRate=0.1;
+    double networkLearningRate=0.01;
     double networkMomentum=0.5;
     double networkWeightDecay=0.0001;
 
@@ -71,8 +72,27 @@ int main(int argc, char *argv[])
     uint32_t inputGateHiddenLayers=2;
     uint32_t outputGateHiddenLayers=3;
     uint32_t candidateGateHiddenLayers=1;
-
-    LSTM *lstm=new LSTM(inputCount,effectiveOutputCount,backpropagationSteps,learningRate,momentum,weightDecay,networkLearningRate,networkMomentum,networkWeightDecay,forgetGateHiddenLayers,0,inputGateHiddenLayers,0,outputGateHiddenLayers,0,candidateGateHiddenLayers,0);
+    // Activation function of the gate network neurons (LSTMGateActivation); LSTMGateActivation_relu and the other piecewise linear ones are cheaper:
+    uint8_t gateNetworkActivation=LSTMGateActivation_tanh;
+    // LSTMCellVariant_coupledInputForget or LSTMCellVariant_gru evaluate three instead of four gate networks per step:
+    uint8_t cellVariant=LSTMCellVariant_standard;
+
+    // LSTMHistoryPrecision_float16 or LSTMHistoryPrecision_bfloat16 store the states kept for learning with a quarter of the memory:
+    uint8_t historyPrecision=LSTMHistoryPrecision_double;
+
+    // Printing every step slows training down considerably. Unless printSteps is set, each step is written to a binary event log instead (render
+    // it with TrainingLogDecoder) and only a short progress line is printed every progressInterval steps.
+    bool printSteps=false;
+    const char *eventLogPath="training_events.log";
+    uint64_t progressInterval=10000;
+
+    LSTM *lstm=new LSTM(inputCount,outputCount,backpropagationSteps,learningRate,momentum,weightDecay,networkLearningRate,networkMomentum,networkWeightDecay,forgetGateHiddenLayers,0,inputGateHiddenLayers,0,outputGateHiddenLayers,0,candidateGateHiddenLayers,0,cellCount,false,cellVariant);
+    lstm->historyPrecision=historyPrecision;
+    lstm->forgetGateNetworkActivation=gateNetworkActivation;
+    lstm->inputGateNetworkActivation=gateNetworkActivation;
+    lstm->outputGateNetworkActivation=gateNetworkActivation;
+    lstm->candidateGateNetworkActivation=gateNetworkActivation;
+    TrainingEventLog *eventLog=printSteps?0:TrainingEventLog::create(eventLogPath);
     uint64_t cycle=0;
     char *str;
     double **desiredOutputs=(double**)malloc((backpropagationSteps+1)*sizeof(double*));
@@ -85,7 +105,7 @@ int main(int argc, char *argv[])
     {
         double *input=(double*)malloc(inputCount*sizeof(double));
         uint64_t currentPos=current%4; // "o" of "hello" not used!
-        if(currentPos==0)
+        if(currentPos==0&&printSteps)
         {
             str=text::unsignedLongToString(cycle);
             cout<<"*** New cycle (#"<<str<<") ***"<<endl<<endl;
@@ -98,16 +118,22 @@ int main(int argc, char *argv[])
             currentChar=1;
         else // if(currentPos==2||currentPos==3)
             currentChar=2;
-        str=text::unsignedLongToString(currentPos);
-        cout<<"Current position: "<<str<<" ("<<helloString[currentPos]<<")"<<endl;
-        free(str);
+        if(printSteps)
+        {
+            str=text::unsignedLongToString(currentPos);
+            cout<<"Current position: "<<str<<" ("<<helloString[currentPos]<<")"<<endl;
+            free(str);
+        }
         for(uint32_t i=0;i<inputCount;i++)
             input[i]=(i==currentChar?1.0:0.0);
         double *output;
+        std::chrono::steady_clock::time_point processStart=std::chrono::steady_clock::now();
         output=lstm->process(input);
-        cout<<"Output:           "<<doubleArrayToString(output,outputCount /*Do not include the additional memory cells*/,true)<<endl;
+        uint64_t processTime=(uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-processStart).count();
+        if(printSteps)
+            cout<<"Output:           "<<doubleArrayToString(output,outputCount,true)<<endl;
 
-        double *desiredOutput=(double*)malloc(effectiveOutputCount*sizeof(double));
+        double *desiredOutput=(double*)malloc(outputCount*sizeof(double));
         // Desired output: next char!
         uint8_t desiredOut;
         if(currentPos==0) // "h"
@@ -118,16 +144,20 @@ int main(int argc, char *argv[])
             desiredOut=1; // => l
         else // if(currentPos==3) // "l"
             desiredOut=2; // => o
-        for(uint32_t i=0;i<effectiveOutputCount;i++)
-            desiredOutput[i]=(i==desiredOut?1.0:(i>=outputCount?output[i]:0.0 /*Do not indicate an error if this is an additional memory cell*/));
+        for(uint32_t i=0;i<outputCount;i++)
+            desiredOutput[i]=(i==desiredOut?1.0:0.0);
 
-        cout<<"Desired output:   "<<doubleArrayToString(desiredOutput,outputCount /*Do not include the additional memory cells*/,false)<<endl;
+        if(printSteps)
+            cout<<"Desired output:   "<<doubleArrayToString(desiredOutput,outputCount,false)<<endl;
+        double loss=0.0;
+        for(uint32_t i=0;i<outputCount;i++)
+            loss+=(output[i]-desiredOutput[i])*(output[i]-desiredOutput[i]);
 
         desiredOutputs[currentPos]=desiredOutput;
 
         uint8_t highestIndex=255;
         double highestValue=std::numeric_limits<double>::min();
-        for(uint8_t i=0;i<effectiveOutputCount;i++)
+        for(uint8_t i=0;i<outputCount;i++)
         {
             if(output[i]>highestValue) // Not newOutput!
             {
@@ -148,25 +178,42 @@ int main(int argc, char *argv[])
         accuracyVector.push_back(wasCorrect);
         accuracySum+=wasCorrect?1.0:0.0;
 
-        str=text::doubleToStringWithFixedPrecision((accuracySum/((double)avSize))*100.0,0);
-        cout<<"Accuracy of last 100 outputs :    "<<str<<"%"<<endl;
-        free(str);
+        double accuracy=accuracySum/((double)avSize);
+        if(printSteps||(current+1)%progressInterval==0)
+        {
+            if(!printSteps)
+            {
+                str=text::unsignedLongToString(current+1);
+                cout<<"Step "<<str<<": ";
+                free(str);
+            }
+            str=text::doubleToStringWithFixedPrecision(accuracy*100.0,0);
+            cout<<"Accuracy of last 100 outputs :    "<<str<<"%"<<endl;
+            free(str);
+        }
 
+        uint64_t learnTime=0;
         if(currentPos==3)
         {
+            std::chrono::steady_clock::time_point learnStart=std::chrono::steady_clock::now();
             lstm->learn(desiredOutputs);
+            learnTime=(uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-learnStart).count();
             free(desiredOutputs[0]);
             free(desiredOutputs[1]);
             free(desiredOutputs[2]);
             free(desiredOutputs[3]);
             cycle++;
         }
+        if(eventLog!=0)
+            eventLog->log(current,loss,accuracy,processTime,learnTime);
         free(output);
         free(input);
 
-        cout<<endl;
+        if(printSteps)
+            cout<<endl;
     }
     free(desiredOutputs);
+    delete eventLog;
     delete lstm;
 }
 
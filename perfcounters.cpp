@@ -0,0 +1,141 @@
+#include "perfcounters.h"
+
+#include <errno.h>
+
+#ifdef __linux__
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+PerfCounters *PerfCounters::create()
+{
+#ifdef __linux__
+    static const uint64_t eventConfigs[PERF_COUNTER_COUNT]={PERF_COUNT_HW_CPU_CYCLES,PERF_COUNT_HW_INSTRUCTIONS,PERF_COUNT_HW_CACHE_MISSES,PERF_COUNT_HW_BRANCH_MISSES};
+    PerfCounters *counters=new PerfCounters();
+    int openError=0;
+    for(uint8_t counter=0;counter<PERF_COUNTER_COUNT;counter++)
+    {
+        perf_event_attr attributes;
+        memset(&attributes,0,sizeof(perf_event_attr));
+        attributes.size=sizeof(perf_event_attr);
+        attributes.type=PERF_TYPE_HARDWARE;
+        attributes.config=eventConfigs[counter];
+        attributes.disabled=counters->groupFileDescriptor==-1?1:0; // The group is enabled at once below
+        attributes.exclude_kernel=1; // Also allowed with perf_event_paranoid 2
+        attributes.exclude_hv=1;
+        attributes.read_format=PERF_FORMAT_GROUP|PERF_FORMAT_TOTAL_TIME_ENABLED|PERF_FORMAT_TOTAL_TIME_RUNNING;
+        int fileDescriptor=(int)syscall(__NR_perf_event_open,&attributes,0/*This thread*/,-1/*Any CPU*/,counters->groupFileDescriptor,0);
+        if(fileDescriptor==-1)
+        {
+            openError=errno;
+            continue;
+        }
+        if(counters->groupFileDescriptor==-1)
+            counters->groupFileDescriptor=fileDescriptor;
+        counters->fileDescriptors[counter]=fileDescriptor;
+        counters->groupPositions[counter]=counters->groupSize++;
+    }
+    if(counters->groupSize==0)
+    {
+        delete counters;
+        errno=openError;
+        return 0;
+    }
+    ioctl(counters->groupFileDescriptor,PERF_EVENT_IOC_RESET,PERF_IOC_FLAG_GROUP);
+    ioctl(counters->groupFileDescriptor,PERF_EVENT_IOC_ENABLE,PERF_IOC_FLAG_GROUP);
+    return counters;
+#else
+    errno=ENOSYS;
+    return 0;
+#endif
+}
+
+const char *PerfCounters::getCounterName(uint8_t counter)
+{
+    static const char *counterNames[PERF_COUNTER_COUNT]={"cycles","instructions","cacheMisses","branchMisses"};
+    return counter<PERF_COUNTER_COUNT?counterNames[counter]:"unknown";
+}
+
+void PerfCounters::clearSums(PerfCounterSums *sums)
+{
+    for(uint8_t counter=0;counter<PERF_COUNTER_COUNT;counter++)
+        sums->values[counter]=0.0;
+    sums->intervalCount=0;
+}
+
+PerfCounters::PerfCounters()
+{
+    groupFileDescriptor=-1;
+    groupSize=0;
+    for(uint8_t counter=0;counter<PERF_COUNTER_COUNT;counter++)
+    {
+        fileDescriptors[counter]=-1;
+        groupPositions[counter]=0;
+        startValues[counter]=0;
+    }
+    startTimeEnabled=0;
+    startTimeRunning=0;
+}
+
+bool PerfCounters::isAvailable(uint8_t counter)
+{
+    return counter<PERF_COUNTER_COUNT&&fileDescriptors[counter]!=-1;
+}
+
+bool PerfCounters::readGroup(uint64_t *values, uint64_t &timeEnabled, uint64_t &timeRunning)
+{
+#ifdef __linux__
+    // Layout of PERF_FORMAT_GROUP with both times: counter count, time enabled, time running, then one value per counter
+    uint64_t buffer[3+PERF_COUNTER_COUNT];
+    ssize_t expectedSize=(ssize_t)((3+groupSize)*sizeof(uint64_t));
+    if(read(groupFileDescriptor,buffer,sizeof(buffer))<expectedSize)
+        return false;
+    timeEnabled=buffer[1];
+    timeRunning=buffer[2];
+    for(uint8_t counter=0;counter<PERF_COUNTER_COUNT;counter++)
+        values[counter]=isAvailable(counter)?buffer[3+groupPositions[counter]]:0;
+    return true;
+#else
+    (void)values;
+    (void)timeEnabled;
+    (void)timeRunning;
+    return false;
+#endif
+}
+
+void PerfCounters::start()
+{
+    if(!readGroup(startValues,startTimeEnabled,startTimeRunning))
+        startTimeRunning=startTimeEnabled=0;
+}
+
+void PerfCounters::stop(PerfCounterSums *sums)
+{
+    uint64_t values[PERF_COUNTER_COUNT];
+    uint64_t timeEnabled;
+    uint64_t timeRunning;
+    if(!readGroup(values,timeEnabled,timeRunning)||timeRunning==startTimeRunning)
+        return; // Not scheduled at all during the interval, so nothing is known about it
+    // Extrapolated to the whole interval if the group was only on the PMU for part of it:
+    double scale=(double)(timeEnabled-startTimeEnabled)/(double)(timeRunning-startTimeRunning);
+    for(uint8_t counter=0;counter<PERF_COUNTER_COUNT;counter++)
+        sums->values[counter]+=scale*(double)(values[counter]-startValues[counter]);
+    sums->intervalCount++;
+}
+
+PerfCounters::~PerfCounters()
+{
+#ifdef __linux__
+    // Members first, then the group leader
+    for(uint8_t counter=0;counter<PERF_COUNTER_COUNT;counter++)
+    {
+        if(fileDescriptors[counter]!=-1&&fileDescriptors[counter]!=groupFileDescriptor)
+            close(fileDescriptors[counter]);
+    }
+    if(groupFileDescriptor!=-1)
+        close(groupFileDescriptor);
+#endif
+}
@@ -0,0 +1,52 @@
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+enum PerfCounter
+{
+    PerfCounter_cycles=0,
+    PerfCounter_instructions=1,
+    PerfCounter_cacheMisses=2, // Last level cache misses
+    PerfCounter_branchMisses=3
+};
+#define PERF_COUNTER_COUNT 4
+
+// Events counted between PerfCounters::start() and stop(), summed over any number of such intervals
+struct PerfCounterSums
+{
+    double values[PERF_COUNTER_COUNT];
+    uint64_t intervalCount;
+};
+
+// Hardware counters of the calling thread (user space only) read with Linux perf_event. They are opened as one group, so they count over the
+// same intervals; if the kernel multiplexes the group with other events, the counts are scaled to the whole interval. Counters the CPU or
+// the kernel does not provide are left out.
+class PerfCounters
+{
+public:
+    int groupFileDescriptor; // Of the first counter that could be opened
+    int fileDescriptors[PERF_COUNTER_COUNT]; // -1 if not available
+    uint8_t groupPositions[PERF_COUNTER_COUNT]; // Position of each available counter in a read of the group
+    uint8_t groupSize;
+    uint64_t startValues[PERF_COUNTER_COUNT];
+    uint64_t startTimeEnabled;
+    uint64_t startTimeRunning;
+
+    // Returns 0 if no counter can be opened, e.g. when not on Linux, if perf_event_paranoid forbids it or in containers that block
+    // perf_event_open(); errno is then that of the last attempt.
+    static PerfCounters *create();
+    static const char *getCounterName(uint8_t counter);
+    static void clearSums(PerfCounterSums *sums);
+    PerfCounters();
+    bool isAvailable(uint8_t counter);
+    void start();
+    void stop(PerfCounterSums *sums); // Adds the events since start() to "sums"
+    ~PerfCounters();
+
+private:
+    bool readGroup(uint64_t *values,uint64_t &timeEnabled,uint64_t &timeRunning);
+};
+
+#endif // PERFCOUNTERS_H
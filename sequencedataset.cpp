@@ -0,0 +1,235 @@
+#include "sequencedataset.h"
+
+#define SEQUENCE_DATASET_HEADER_SIZE 40
+
+uint64_t SequenceDatasetWriter::getTargetOffset(uint32_t _inputCount, bool _inputsAsIndices)
+{
+    uint64_t inputSize=_inputsAsIndices?sizeof(uint32_t):(uint64_t)_inputCount*sizeof(double);
+    return (inputSize+7)&~(uint64_t)7;
+}
+
+uint64_t SequenceDatasetWriter::getRowSize(uint32_t _inputCount, uint32_t _outputCount, bool _inputsAsIndices, bool _targetsAsIndices)
+{
+    uint64_t targetSize=_targetsAsIndices?sizeof(uint32_t):(uint64_t)_outputCount*sizeof(double);
+    return getTargetOffset(_inputCount,_inputsAsIndices)+((targetSize+7)&~(uint64_t)7);
+}
+
+SequenceDatasetWriter *SequenceDatasetWriter::create(const char *filePath, uint32_t _inputCount, uint32_t _outputCount, bool _inputsAsIndices, bool _targetsAsIndices)
+{
+    if(getRowSize(_inputCount,_outputCount,_inputsAsIndices,_targetsAsIndices)>UINT32_MAX)
+        return 0; // The header stores the row size as uint32.
+    FILE *f=fopen(filePath,"wb");
+    if(f==0)
+        return 0;
+    return new SequenceDatasetWriter(f,_inputCount,_outputCount,_inputsAsIndices,_targetsAsIndices);
+}
+
+SequenceDatasetWriter::SequenceDatasetWriter(FILE *_file, uint32_t _inputCount, uint32_t _outputCount, bool _inputsAsIndices, bool _targetsAsIndices)
+{
+    file=_file;
+    inputCount=_inputCount;
+    outputCount=_outputCount;
+    inputsAsIndices=_inputsAsIndices;
+    targetsAsIndices=_targetsAsIndices;
+    targetOffset=getTargetOffset(inputCount,inputsAsIndices);
+    rowSize=getRowSize(inputCount,outputCount,inputsAsIndices,targetsAsIndices);
+    rowCount=0;
+    sequenceCount=0;
+    sequenceStartsSize=64;
+    sequenceStarts=(uint64_t*)malloc(sequenceStartsSize*sizeof(uint64_t));
+    failed=false;
+    writer=new BufferWriter(file); // Rows are collected and written in large blocks.
+    // The header is written again by close(), when the counts are known.
+    char header[SEQUENCE_DATASET_HEADER_SIZE];
+    memset(header,0,SEQUENCE_DATASET_HEADER_SIZE);
+    writer->writeRawData(header,SEQUENCE_DATASET_HEADER_SIZE);
+}
+
+void SequenceDatasetWriter::beginSequence()
+{
+    if(sequenceCount>0&&sequenceStarts[sequenceCount-1]==rowCount)
+        return; // Empty sequences are not stored.
+    if(sequenceCount==sequenceStartsSize)
+    {
+        sequenceStartsSize*=2;
+        sequenceStarts=(uint64_t*)realloc(sequenceStarts,sequenceStartsSize*sizeof(uint64_t));
+    }
+    sequenceStarts[sequenceCount++]=rowCount;
+}
+
+void SequenceDatasetWriter::writeRow(double *input, double *target, uint32_t inputIndex, uint32_t targetIndex)
+{
+    if(sequenceCount==0)
+        beginSequence();
+    // The header and each part of a row are 8-byte aligned, so padding to 8 bytes in the file also pads within the row.
+    if(inputsAsIndices)
+        writer->writeUInt32(inputIndex);
+    else
+        writer->writeDoubles(input,inputCount);
+    writer->pad(8);
+    if(targetsAsIndices)
+        writer->writeUInt32(targetIndex);
+    else
+        writer->writeDoubles(target,outputCount);
+    writer->pad(8);
+    rowCount++;
+}
+
+bool SequenceDatasetWriter::close()
+{
+    if(file==0)
+        return !failed;
+    if(sequenceCount>0&&sequenceStarts[sequenceCount-1]==rowCount)
+        sequenceCount--; // beginSequence() without rows after it
+    for(uint64_t sequence=0;sequence<=sequenceCount;sequence++)
+        writer->writeUInt64(sequence==sequenceCount?rowCount:sequenceStarts[sequence]);
+    if(!writer->flush())
+        failed=true;
+    delete writer;
+    writer=0;
+
+    char header[SEQUENCE_DATASET_HEADER_SIZE];
+    fs_t pos=0;
+    io::writeRawData(header,"LSEQ",4,pos);
+    io::writeUInt32(header,SEQUENCE_DATASET_VERSION,pos);
+    io::writeUInt32(header,(inputsAsIndices?1:0)|(targetsAsIndices?2:0),pos);
+    io::writeUInt32(header,inputCount,pos);
+    io::writeUInt32(header,outputCount,pos);
+    io::writeUInt32(header,rowSize,pos);
+    io::writeUInt64(header,rowCount,pos);
+    io::writeUInt64(header,sequenceCount,pos);
+    if(fseek(file,0,SEEK_SET)!=0||fwrite(header,1,SEQUENCE_DATASET_HEADER_SIZE,file)!=SEQUENCE_DATASET_HEADER_SIZE)
+        failed=true;
+    if(fclose(file)!=0)
+        failed=true;
+    file=0;
+    return !failed;
+}
+
+SequenceDatasetWriter::~SequenceDatasetWriter()
+{
+    close();
+    free(sequenceStarts);
+}
+
+SequenceDataset *SequenceDataset::open(const char *filePath)
+{
+    fs_t size;
+    char *data=io::mapFile(filePath,size);
+    if(data==0)
+        return 0;
+    bool valid=size>=SEQUENCE_DATASET_HEADER_SIZE&&memcmp(data,"LSEQ",4)==0&&io::peekUInt32(data,4)==SEQUENCE_DATASET_VERSION;
+    if(valid)
+    {
+        uint32_t flags=io::peekUInt32(data,8);
+        uint32_t _inputCount=io::peekUInt32(data,12);
+        uint32_t _outputCount=io::peekUInt32(data,16);
+        uint32_t _rowSize=io::peekUInt32(data,20);
+        uint64_t _rowCount=io::peekUInt64(data,24);
+        uint64_t _sequenceCount=io::peekUInt64(data,32);
+        // Compared in 64 bits, so counts whose row size does not fit into the uint32 field are rejected instead of wrapping around:
+        valid=_rowSize==SequenceDatasetWriter::getRowSize(_inputCount,_outputCount,(flags&1)!=0,(flags&2)!=0)&&_rowSize>0;
+        // Checked by division, as the counts of a damaged file could overflow the multiplication:
+        uint64_t available=size-SEQUENCE_DATASET_HEADER_SIZE;
+        valid=valid&&_rowCount<=available/_rowSize&&_sequenceCount<(available-_rowCount*_rowSize)/sizeof(uint64_t);
+        valid=valid&&size==SEQUENCE_DATASET_HEADER_SIZE+_rowCount*_rowSize+(_sequenceCount+1)*sizeof(uint64_t);
+        // The sequence table has to start at row 0, never decrease and end at the row count, so no sequence reaches past the rows:
+        char *_sequenceStarts=data+SEQUENCE_DATASET_HEADER_SIZE+_rowCount*_rowSize;
+        uint64_t previousStart=0;
+        for(uint64_t sequence=0;valid&&sequence<=_sequenceCount;sequence++)
+        {
+            uint64_t start=io::peekUInt64(_sequenceStarts,sequence*sizeof(uint64_t));
+            valid=(sequence>0||start==0)&&start>=previousStart&&(sequence<_sequenceCount||start==_rowCount);
+            previousStart=start;
+        }
+    }
+    if(!valid)
+    {
+        io::unmapFile(data,size);
+        return 0;
+    }
+    return new SequenceDataset(data,size);
+}
+
+SequenceDataset::SequenceDataset(char *_data, fs_t _size)
+{
+    data=_data;
+    size=_size;
+    uint32_t flags=io::peekUInt32(data,8);
+    inputsAsIndices=(flags&1)!=0;
+    targetsAsIndices=(flags&2)!=0;
+    inputCount=io::peekUInt32(data,12);
+    outputCount=io::peekUInt32(data,16);
+    rowSize=io::peekUInt32(data,20);
+    rowCount=io::peekUInt64(data,24);
+    sequenceCount=io::peekUInt64(data,32);
+    targetOffset=SequenceDatasetWriter::getTargetOffset(inputCount,inputsAsIndices);
+    rows=data+SEQUENCE_DATASET_HEADER_SIZE;
+    sequenceStarts=rows+rowCount*rowSize;
+    systemIsLittleEndian=io::getSystemIsLittleEndian();
+}
+
+uint64_t SequenceDataset::getSequenceStart(uint64_t sequence)
+{
+    return io::peekUInt64(sequenceStarts,sequence*sizeof(uint64_t));
+}
+
+uint64_t SequenceDataset::getSequenceLength(uint64_t sequence)
+{
+    return getSequenceStart(sequence+1)-getSequenceStart(sequence);
+}
+
+// Expands or converts one part of a row if it cannot be used in place
+static double *getRowPart(char *part, uint32_t count, bool asIndex, bool systemIsLittleEndian, double *scratch)
+{
+    if(asIndex)
+    {
+        uint32_t index=io::peekUInt32(part,0);
+        for(uint32_t i=0;i<count;i++)
+            scratch[i]=i==index?1.0:0.0;
+        return scratch;
+    }
+    if(systemIsLittleEndian)
+        return (double*)part;
+    fs_t pos=0;
+    io::posBasedReadDoubles(part,pos,scratch,count,systemIsLittleEndian);
+    return scratch;
+}
+
+double *SequenceDataset::getInput(uint64_t row, double *scratch)
+{
+    return getRowPart(rows+row*rowSize,inputCount,inputsAsIndices,systemIsLittleEndian,scratch);
+}
+
+double *SequenceDataset::getTarget(uint64_t row, double *scratch)
+{
+    return getRowPart(rows+row*rowSize+targetOffset,outputCount,targetsAsIndices,systemIsLittleEndian,scratch);
+}
+
+uint64_t SequenceDataset::getWindowScratchSize(uint32_t length)
+{
+    uint64_t rowScratchSize=0;
+    if(inputsAsIndices||!systemIsLittleEndian)
+        rowScratchSize+=inputCount;
+    if(targetsAsIndices||!systemIsLittleEndian)
+        rowScratchSize+=outputCount;
+    return length*rowScratchSize;
+}
+
+void SequenceDataset::getWindow(uint64_t firstRow, uint32_t length, double **inputs, double **targets, double *scratch)
+{
+    for(uint32_t step=0;step<length;step++)
+    {
+        inputs[step]=getInput(firstRow+step,scratch);
+        if(inputs[step]==scratch)
+            scratch+=inputCount;
+        targets[step]=getTarget(firstRow+step,scratch);
+        if(targets[step]==scratch)
+            scratch+=outputCount;
+    }
+}
+
+SequenceDataset::~SequenceDataset()
+{
+    io::unmapFile(data,size);
+}
@@ -0,0 +1,83 @@
+#ifndef SEQUENCEDATASET_H
+#define SEQUENCEDATASET_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "io.h"
+#include "bufferwriter.h"
+
+#define SEQUENCE_DATASET_VERSION 1
+
+// Binary sequence dataset (all values little-endian):
+// Header (40 bytes): "LSEQ", version, flags (bit 0: inputs index-encoded, bit 1: targets index-encoded), inputCount, outputCount, row size in bytes
+//         (all uint32), row count, sequence count (both uint64)
+// Rows: per row the input, then the target, each either dense (one double per input/output) or index-encoded (one uint32: the index of the
+//         single 1.0, all other values are 0.0), each part starting at a multiple of 8 bytes; the row size is a multiple of 8 bytes.
+// Sequence table: per sequence the index of its first row (uint64), followed by the row count
+// As the header and the rows are 8-byte aligned, dense rows of a mapped file can be passed to LSTM::process() and LSTM::learn() in place.
+
+class SequenceDatasetWriter
+{
+public:
+    FILE *file;
+    uint32_t inputCount;
+    uint32_t outputCount;
+    bool inputsAsIndices;
+    bool targetsAsIndices;
+    uint32_t targetOffset; // In a row
+    uint32_t rowSize;
+    uint64_t rowCount;
+    uint64_t sequenceCount;
+    uint64_t sequenceStartsSize;
+    uint64_t *sequenceStarts; // Dimensions: Sequences
+    BufferWriter *writer; // Streams to "file"
+    bool failed;
+
+    // In bytes; 64-bit, as the sizes of large counts do not fit into the uint32 row size field of the header
+    static uint64_t getTargetOffset(uint32_t _inputCount,bool _inputsAsIndices);
+    static uint64_t getRowSize(uint32_t _inputCount,uint32_t _outputCount,bool _inputsAsIndices,bool _targetsAsIndices);
+
+    // Returns 0 if the file cannot be created or a row would be larger than UINT32_MAX bytes.
+    static SequenceDatasetWriter *create(const char *filePath,uint32_t _inputCount,uint32_t _outputCount,bool _inputsAsIndices=false,bool _targetsAsIndices=false);
+    SequenceDatasetWriter(FILE *_file,uint32_t _inputCount,uint32_t _outputCount,bool _inputsAsIndices,bool _targetsAsIndices);
+    void beginSequence(); // Rows written before the first call belong to a first sequence as well.
+    // For index-encoded inputs or targets, "inputIndex"/"targetIndex" is written and "input"/"target" is not read (it may be 0).
+    void writeRow(double *input,double *target,uint32_t inputIndex=0,uint32_t targetIndex=0);
+    bool close(); // Writes the sequence table and the header. Returns false if any write failed.
+    ~SequenceDatasetWriter(); // Calls close() if it has not been called
+};
+
+class SequenceDataset
+{
+public:
+    char *data; // Read-only mapping of the file
+    fs_t size;
+    uint32_t inputCount;
+    uint32_t outputCount;
+    bool inputsAsIndices;
+    bool targetsAsIndices;
+    uint32_t targetOffset;
+    uint32_t rowSize;
+    uint64_t rowCount;
+    uint64_t sequenceCount;
+    char *rows;
+    char *sequenceStarts;
+    bool systemIsLittleEndian;
+
+    static SequenceDataset *open(const char *filePath); // Returns 0 if the file cannot be mapped or is not a valid dataset.
+    SequenceDataset(char *_data,fs_t _size);
+    uint64_t getSequenceStart(uint64_t sequence); // Index of the first row
+    uint64_t getSequenceLength(uint64_t sequence);
+    // Return a pointer into the mapping if the row is stored dense (on little-endian systems); otherwise the values are written to "scratch"
+    // (inputCount or outputCount doubles), which is returned.
+    double *getInput(uint64_t row,double *scratch);
+    double *getTarget(uint64_t row,double *scratch);
+    uint64_t getWindowScratchSize(uint32_t length); // Number of doubles getWindow() may write to "scratch" (0 if nothing is expanded)
+    // Fills inputs[0..length-1] and targets[0..length-1] with rows firstRow..firstRow+length-1, e.g. the "desiredOutputs" of LSTM::learn().
+    void getWindow(uint64_t firstRow,uint32_t length,double **inputs,double **targets,double *scratch);
+    ~SequenceDataset();
+};
+
+#endif // SEQUENCEDATASET_H
@@ -0,0 +1,242 @@
+#include "stackedlstm.h"
+
+uint32_t StackedLSTMQueue::getSlotCount(uint32_t _slotCount)
+{
+    uint32_t roundedSlotCount=1;
+    while(roundedSlotCount<_slotCount)
+        roundedSlotCount*=2;
+    return roundedSlotCount;
+}
+
+StackedLSTMQueue::StackedLSTMQueue(uint32_t _slotCount, uint32_t _valueCount)
+{
+    slotCount=getSlotCount(_slotCount);
+    valueCount=_valueCount;
+    values=(double*)LSTMAllocations::allocate((size_t)slotCount*valueCount*sizeof(double),LSTMAllocationCategory_scratch);
+    sequenceStarts=(bool*)LSTMAllocations::allocate(slotCount*sizeof(bool),LSTMAllocationCategory_scratch);
+    clear();
+}
+
+double *StackedLSTMQueue::getPushSlot()
+{
+    uint64_t pushed=pushedCount.load(std::memory_order_relaxed); // Only written by this side
+    if(pushed-poppedCount.load(std::memory_order_acquire)==slotCount)
+        return 0;
+    return values+(size_t)(pushed&(slotCount-1))*valueCount;
+}
+
+void StackedLSTMQueue::commitPush(bool sequenceStart)
+{
+    uint64_t pushed=pushedCount.load(std::memory_order_relaxed);
+    sequenceStarts[pushed&(slotCount-1)]=sequenceStart;
+    pushedCount.store(pushed+1,std::memory_order_release); // Publishes the values
+}
+
+double *StackedLSTMQueue::getPopSlot(bool &sequenceStart)
+{
+    uint64_t popped=poppedCount.load(std::memory_order_relaxed); // Only written by this side
+    if(popped==pushedCount.load(std::memory_order_acquire))
+        return 0;
+    sequenceStart=sequenceStarts[popped&(slotCount-1)];
+    return values+(size_t)(popped&(slotCount-1))*valueCount;
+}
+
+void StackedLSTMQueue::commitPop()
+{
+    poppedCount.store(poppedCount.load(std::memory_order_relaxed)+1,std::memory_order_release); // The slot may be overwritten now.
+}
+
+void StackedLSTMQueue::clear()
+{
+    pushedCount.store(0);
+    poppedCount.store(0);
+}
+
+StackedLSTMQueue::~StackedLSTMQueue()
+{
+    LSTMAllocations::release(values);
+    LSTMAllocations::release(sequenceStarts);
+}
+
+StackedLSTM *StackedLSTM::create(LSTM **_layers, uint32_t _layerCount)
+{
+    if(_layerCount==0)
+        return 0;
+    for(uint32_t layer=1;layer<_layerCount;layer++)
+    {
+        if(_layers[layer]->inputCount!=_layers[layer-1]->outputCount)
+            return 0;
+    }
+    return new StackedLSTM(_layers,_layerCount);
+}
+
+StackedLSTM::StackedLSTM(LSTM **_layers, uint32_t _layerCount)
+{
+    layerCount=_layerCount;
+    layers=(LSTM**)LSTMAllocations::allocate(layerCount*sizeof(LSTM*),LSTMAllocationCategory_state);
+    memcpy(layers,_layers,layerCount*sizeof(LSTM*));
+    inputCount=layers[0]->inputCount;
+    outputCount=layers[layerCount-1]->outputCount;
+    queues=0;
+    sessions=0;
+    scratches=0;
+    layerThreads=0;
+    stopping=false;
+    streaming=false;
+}
+
+double *StackedLSTM::process(double *input)
+{
+    double *output=layers[0]->process(input);
+    for(uint32_t layer=1;layer<layerCount;layer++)
+    {
+        double *layerOutput=layers[layer]->process(output);
+        free(output);
+        output=layerOutput;
+    }
+    return output;
+}
+
+void StackedLSTM::startStreaming(uint32_t queueSize)
+{
+    if(streaming)
+        return;
+    if(queues==0)
+    {
+        // Kept until destruction, so streaming can be restarted without allocating.
+        queues=(StackedLSTMQueue**)LSTMAllocations::allocate((layerCount+1)*sizeof(StackedLSTMQueue*),LSTMAllocationCategory_scratch);
+        sessions=(LSTMSession**)LSTMAllocations::allocate(layerCount*sizeof(LSTMSession*),LSTMAllocationCategory_state);
+        scratches=(double**)LSTMAllocations::allocate(layerCount*sizeof(double*),LSTMAllocationCategory_scratch);
+        for(uint32_t layer=0;layer<=layerCount;layer++)
+            queues[layer]=0;
+        for(uint32_t layer=0;layer<layerCount;layer++)
+        {
+            sessions[layer]=layers[layer]->createSession();
+            scratches[layer]=(double*)LSTMAllocations::allocate(layers[layer]->getSessionScratchSize()*sizeof(double),LSTMAllocationCategory_scratch);
+        }
+    }
+    // A restart with the same queue size reuses the queues; another size replaces them.
+    bool queueSizeChanged=queues[0]==0||queues[0]->slotCount!=StackedLSTMQueue::getSlotCount(queueSize);
+    for(uint32_t layer=0;layer<=layerCount;layer++)
+    {
+        if(queueSizeChanged)
+        {
+            delete queues[layer];
+            queues[layer]=new StackedLSTMQueue(queueSize,layer==layerCount?outputCount:layers[layer]->inputCount);
+        }
+        else
+            queues[layer]->clear();
+    }
+    for(uint32_t layer=0;layer<layerCount;layer++)
+        sessions[layer]->reset();
+    stopping=false;
+    layerThreads=new std::thread[layerCount];
+    for(uint32_t layer=0;layer<layerCount;layer++)
+        layerThreads[layer]=std::thread(&StackedLSTM::runLayer,this,layer);
+    streaming=true;
+}
+
+void StackedLSTM::runLayer(uint32_t layer)
+{
+    StackedLSTMQueue *inputQueue=queues[layer];
+    StackedLSTMQueue *outputQueue=queues[layer+1];
+    LSTM *lstm=layers[layer];
+    while(true)
+    {
+        // Waiting spins (yielding the CPU), as steps typically arrive faster than a thread could be woken up.
+        bool sequenceStart;
+        double *input;
+        while((input=inputQueue->getPopSlot(sequenceStart))==0)
+        {
+            if(stopping.load(std::memory_order_relaxed))
+                return;
+            std::this_thread::yield();
+        }
+        double *output;
+        while((output=outputQueue->getPushSlot())==0)
+        {
+            if(stopping.load(std::memory_order_relaxed))
+                return;
+            std::this_thread::yield();
+        }
+        if(sequenceStart)
+            sessions[layer]->reset();
+        lstm->processSession(sessions[layer],input,output,scratches[layer]);
+        inputQueue->commitPop();
+        outputQueue->commitPush(sequenceStart);
+    }
+}
+
+bool StackedLSTM::pushInput(double *input, bool sequenceStart, bool wait)
+{
+    if(!streaming)
+        return false;
+    double *slot;
+    while((slot=queues[0]->getPushSlot())==0)
+    {
+        if(!wait)
+            return false;
+        std::this_thread::yield();
+    }
+    memcpy(slot,input,inputCount*sizeof(double));
+    queues[0]->commitPush(sequenceStart);
+    return true;
+}
+
+bool StackedLSTM::popOutput(double *output, bool wait)
+{
+    if(getStepsInFlight()==0)
+        return false;
+    bool sequenceStart;
+    double *slot;
+    while((slot=queues[layerCount]->getPopSlot(sequenceStart))==0)
+    {
+        if(!wait)
+            return false;
+        std::this_thread::yield();
+    }
+    memcpy(output,slot,outputCount*sizeof(double));
+    queues[layerCount]->commitPop();
+    return true;
+}
+
+uint64_t StackedLSTM::getStepsInFlight()
+{
+    if(!streaming)
+        return 0;
+    // The first queue's push count is only written by pushInput() and the last queue's pop count only by popOutput().
+    return queues[0]->pushedCount.load(std::memory_order_acquire)-queues[layerCount]->poppedCount.load(std::memory_order_acquire);
+}
+
+void StackedLSTM::stopStreaming()
+{
+    if(!streaming)
+        return;
+    stopping=true;
+    for(uint32_t layer=0;layer<layerCount;layer++)
+        layerThreads[layer].join();
+    delete[] layerThreads;
+    layerThreads=0;
+    streaming=false;
+}
+
+StackedLSTM::~StackedLSTM()
+{
+    stopStreaming();
+    if(queues!=0)
+    {
+        for(uint32_t layer=0;layer<=layerCount;layer++)
+            delete queues[layer];
+        for(uint32_t layer=0;layer<layerCount;layer++)
+        {
+            layers[layer]->destroySession(sessions[layer]);
+            LSTMAllocations::release(scratches[layer]);
+        }
+        LSTMAllocations::release(queues);
+        LSTMAllocations::release(sessions);
+        LSTMAllocations::release(scratches);
+    }
+    for(uint32_t layer=0;layer<layerCount;layer++)
+        delete layers[layer];
+    LSTMAllocations::release(layers);
+}
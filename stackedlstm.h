@@ -0,0 +1,90 @@
+#ifndef STACKEDLSTM_H
+#define STACKEDLSTM_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+
+#include "lstm.h"
+#include "lstmsession.h"
+
+// Single-producer single-consumer queue of steps between two layers. Each slot holds the values of one step; they are written and read in
+// place (getPushSlot()/commitPush(), getPopSlot()/commitPop()), so handing a step over copies nothing and takes no lock.
+
+class StackedLSTMQueue
+{
+public:
+    double *values; // Dimensions: Slots, values
+    bool *sequenceStarts; // Dimensions: Slots; the step is the first one of a new sequence
+    uint32_t slotCount; // Power of 2
+    uint32_t valueCount;
+    std::atomic<uint64_t> pushedCount;
+    char padding[64]; // Keeps the counters, which are written by different threads, on separate cache lines
+    std::atomic<uint64_t> poppedCount;
+
+    static uint32_t getSlotCount(uint32_t _slotCount); // Rounded up to a power of 2
+    StackedLSTMQueue(uint32_t _slotCount,uint32_t _valueCount);
+    double *getPushSlot(); // Returns 0 if the queue is full
+    void commitPush(bool sequenceStart);
+    double *getPopSlot(bool &sequenceStart); // Returns 0 if the queue is empty
+    void commitPop();
+    void clear(); // Only while neither side uses the queue
+    ~StackedLSTMQueue();
+
+    static void *operator new(size_t size)
+    {
+        return LSTMAllocations::allocate(size,LSTMAllocationCategory_scratch);
+    }
+    static void operator delete(void *pointer)
+    {
+        LSTMAllocations::release(pointer);
+    }
+};
+
+// Several LSTM layers, each feeding its outputs to the inputs of the next one. Each layer keeps its own gate network configuration.
+// process() runs a step through all layers on the calling thread (pushing a state in each, like LSTM::process()).
+// In streaming mode, each layer runs on its own thread with its own session: while layer k processes step t, layer k+1 processes step t-1.
+// Steps are handed over through StackedLSTMQueues, so with as many cores as layers the throughput is that of the slowest layer instead of the
+// sum of all layers. Streaming only reads the weights; do not change them (e.g. learn()) while streaming.
+
+class StackedLSTM
+{
+public:
+    LSTM **layers; // Owned
+    uint32_t layerCount;
+    uint32_t inputCount;
+    uint32_t outputCount;
+
+    // Streaming
+    StackedLSTMQueue **queues; // Dimensions: Layers+1; queue k holds the inputs of layer k, the last one the outputs of the last layer.
+    LSTMSession **sessions; // Dimensions: Layers
+    double **scratches; // Dimensions: Layers
+    std::thread *layerThreads; // Dimensions: Layers
+    std::atomic<bool> stopping;
+    bool streaming;
+
+    // Takes ownership of the layers. Returns 0 (and deletes nothing) if the input count of a layer differs from the output count of the previous one.
+    static StackedLSTM *create(LSTM **_layers,uint32_t _layerCount);
+    StackedLSTM(LSTM **_layers,uint32_t _layerCount);
+    double *process(double *input); // The caller frees the returned array.
+
+    // "queueSize" is the number of steps each queue between two layers holds (rounded up to a power of 2). Restarting with another size
+    // replaces the queues.
+    void startStreaming(uint32_t queueSize=64);
+    // Adds a step. If the queue to the first layer is full, waits for room, or returns false if "wait" is false.
+    // If "sequenceStart" is true, all layers reset their session before the step. Returns false if not streaming.
+    bool pushInput(double *input,bool sequenceStart=false,bool wait=true);
+    // Takes the outputs of the oldest step which has passed all layers. If there is none, waits, or returns false if "wait" is false.
+    // Returns false if not streaming or if no step is in flight (as waiting would never end).
+    bool popOutput(double *output,bool wait=true);
+    uint64_t getStepsInFlight(); // Steps pushed but not popped yet (0 if not streaming)
+    void stopStreaming(); // Steps still in the pipeline are discarded.
+
+    ~StackedLSTM();
+
+private:
+    void runLayer(uint32_t layer);
+};
+
+#endif // STACKEDLSTM_H
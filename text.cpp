@@ -1,5 +1,7 @@
 #include "text.h"
 
+#include <stdio.h>
+
 int32_t text::int32Pow(int32_t base, int32_t exp)
 {
     int32_t out=1;
@@ -855,20 +857,436 @@ double text::roundToPrecision(double in, int32_t precision)
     return round(in*pow((double)10,(double)precision))/pow((double)10,(double)precision);
 }
 
+// Shortest round-trip formatting of doubles with Grisu2 (F. Loitsch, "Printing Floating-Point Numbers Quickly and Accurately with Integers",
+// 2010): the digits are generated with 64 bit integer arithmetic from a cached power of ten. The output always reads back as the same double
+// and is the shortest such output for more than 99% of all doubles (otherwise one digit longer).
+
+// Normalized 64 bit significands and binary exponents of 10^-348, 10^-340, ..., 10^340
+static const uint64_t cachedPowerSignificands[87]=
+{
+    0xfa8fd5a0081c0288ULL,0xbaaee17fa23ebf76ULL,0x8b16fb203055ac76ULL,0xcf42894a5dce35eaULL,
+    0x9a6bb0aa55653b2dULL,0xe61acf033d1a45dfULL,0xab70fe17c79ac6caULL,0xff77b1fcbebcdc4fULL,
+    0xbe5691ef416bd60cULL,0x8dd01fad907ffc3cULL,0xd3515c2831559a83ULL,0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL,0xaecc49914078536dULL,0x823c12795db6ce57ULL,0xc21094364dfb5637ULL,
+    0x9096ea6f3848984fULL,0xd77485cb25823ac7ULL,0xa086cfcd97bf97f4ULL,0xef340a98172aace5ULL,
+    0xb23867fb2a35b28eULL,0x84c8d4dfd2c63f3bULL,0xc5dd44271ad3cdbaULL,0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL,0xa3ab66580d5fdaf6ULL,0xf3e2f893dec3f126ULL,0xb5b5ada8aaff80b8ULL,
+    0x87625f056c7c4a8bULL,0xc9bcff6034c13053ULL,0x964e858c91ba2655ULL,0xdff9772470297ebdULL,
+    0xa6dfbd9fb8e5b88fULL,0xf8a95fcf88747d94ULL,0xb94470938fa89bcfULL,0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL,0x993fe2c6d07b7facULL,0xe45c10c42a2b3b06ULL,0xaa242499697392d3ULL,
+    0xfd87b5f28300ca0eULL,0xbce5086492111aebULL,0x8cbccc096f5088ccULL,0xd1b71758e219652cULL,
+    0x9c40000000000000ULL,0xe8d4a51000000000ULL,0xad78ebc5ac620000ULL,0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL,0x8f7e32ce7bea5c70ULL,0xd5d238a4abe98068ULL,0x9f4f2726179a2245ULL,
+    0xed63a231d4c4fb27ULL,0xb0de65388cc8ada8ULL,0x83c7088e1aab65dbULL,0xc45d1df942711d9aULL,
+    0x924d692ca61be758ULL,0xda01ee641a708deaULL,0xa26da3999aef774aULL,0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL,0x865b86925b9bc5c2ULL,0xc83553c5c8965d3dULL,0x952ab45cfa97a0b3ULL,
+    0xde469fbd99a05fe3ULL,0xa59bc234db398c25ULL,0xf6c69a72a3989f5cULL,0xb7dcbf5354e9beceULL,
+    0x88fcf317f22241e2ULL,0xcc20ce9bd35c78a5ULL,0x98165af37b2153dfULL,0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL,0xfb9b7cd9a4a7443cULL,0xbb764c4ca7a44410ULL,0x8bab8eefb6409c1aULL,
+    0xd01fef10a657842cULL,0x9b10a4e5e9913129ULL,0xe7109bfba19c0c9dULL,0xac2820d9623bf429ULL,
+    0x80444b5e7aa7cf85ULL,0xbf21e44003acdd2dULL,0x8e679c2f5e44ff8fULL,0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL,0xeb96bf6ebadf77d9ULL,0xaf87023b9bf0ee6bULL
+};
+static const int16_t cachedPowerExponents[87]=
+{
+    -1220,-1193,-1166,-1140,-1113,-1087,-1060,-1034,-1007,-980,-954,-927,-901,-874,-847,-821,
+    -794,-768,-741,-715,-688,-661,-635,-608,-582,-555,-529,-502,-475,-449,-422,-396,
+    -369,-343,-316,-289,-263,-236,-210,-183,-157,-130,-103,-77,-50,-24,3,30,
+    56,83,109,136,162,189,216,242,269,295,322,348,375,402,428,455,
+    481,508,534,561,588,614,641,667,694,720,747,774,800,827,853,880,
+    907,933,960,986,1013,1039,1066
+};
+static const uint64_t powersOf10[20]=
+{
+    1ULL,10ULL,100ULL,1000ULL,10000ULL,100000ULL,1000000ULL,10000000ULL,100000000ULL,1000000000ULL,10000000000ULL,100000000000ULL,
+    1000000000000ULL,10000000000000ULL,100000000000000ULL,1000000000000000ULL,10000000000000000ULL,100000000000000000ULL,
+    1000000000000000000ULL,10000000000000000000ULL
+};
+
+// Rounded upper 64 bits of the 128 bit product of two significands; the exponents are added
+static uint64_t multiplySignificands(uint64_t a, uint64_t b)
+{
+    uint64_t aHigh=a>>32;
+    uint64_t aLow=a&0xFFFFFFFFULL;
+    uint64_t bHigh=b>>32;
+    uint64_t bLow=b&0xFFFFFFFFULL;
+    uint64_t middle=((aLow*bLow)>>32)+((aHigh*bLow)&0xFFFFFFFFULL)+((aLow*bHigh)&0xFFFFFFFFULL)+(1ULL<<31);
+    return aHigh*bHigh+((aHigh*bLow)>>32)+((aLow*bHigh)>>32)+(middle>>32);
+}
+
+static void grisuRound(char *digits, int digitCount, uint64_t delta, uint64_t rest, uint64_t tenKappa, uint64_t distance)
+{
+    while(rest<distance&&delta-rest>=tenKappa&&(rest+tenKappa<distance||distance-rest>rest+tenKappa-distance))
+    {
+        digits[digitCount-1]--;
+        rest+=tenKappa;
+    }
+}
+
+// Writes the digits of a finite positive value to "digits" (at most 17); the value is digits*10^decimalExponent.
+static void grisu2(double value, char *digits, int &digitCount, int &decimalExponent)
+{
+    uint64_t bits;
+    memcpy(&bits,&value,sizeof(double));
+    uint64_t significand=bits&0xFFFFFFFFFFFFFULL;
+    int32_t biasedExponent=(int32_t)((bits>>52)&0x7FF);
+    uint64_t f;
+    int32_t e;
+    if(biasedExponent!=0)
+    {
+        f=significand|(1ULL<<52);
+        e=biasedExponent-1075;
+    }
+    else
+    {
+        f=significand;
+        e=-1074;
+    }
+
+    // Boundaries halfway to the neighbouring doubles, with the same exponent as the normalized upper boundary
+    uint64_t plusF=(f<<1)+1;
+    int32_t plusE=e-1;
+    while((plusF&(1ULL<<53))==0)
+    {
+        plusF<<=1;
+        plusE--;
+    }
+    plusF<<=10;
+    plusE-=10;
+    uint64_t minusF;
+    int32_t minusE;
+    if(f==(1ULL<<52)) // The lower neighbour is closer.
+    {
+        minusF=(f<<2)-1;
+        minusE=e-2;
+    }
+    else
+    {
+        minusF=(f<<1)-1;
+        minusE=e-1;
+    }
+    minusF<<=minusE-plusE;
+    while((f&(1ULL<<63))==0)
+    {
+        f<<=1;
+        e--;
+    }
+
+    // Cached power c=10^-k which brings the exponent of the product into [-60, -32]
+    double dk=(-61-plusE)*0.30102999566398114+347;
+    int32_t k=(int32_t)dk;
+    if(dk-k>0.0)
+        k++;
+    uint32_t index=(uint32_t)((k>>3)+1);
+    decimalExponent=-(-348+(int32_t)(index<<3));
+    uint64_t cachedF=cachedPowerSignificands[index];
+    int32_t productE=plusE+cachedPowerExponents[index]+64;
+    uint64_t w=multiplySignificands(f,cachedF);
+    uint64_t upper=multiplySignificands(plusF,cachedF)-1;
+    uint64_t lower=multiplySignificands(minusF,cachedF)+1;
+    uint64_t delta=upper-lower;
+    uint64_t distance=upper-w;
+
+    // Digit generation: integral part (p1) and fractional part (p2) of the upper boundary
+    int32_t shift=-productE;
+    uint64_t one=1ULL<<shift;
+    uint32_t p1=(uint32_t)(upper>>shift);
+    uint64_t p2=upper&(one-1);
+    int kappa=1;
+    while(kappa<10&&p1>=powersOf10[kappa])
+        kappa++;
+    digitCount=0;
+    while(kappa>0)
+    {
+        uint32_t digit=(uint32_t)(p1/powersOf10[kappa-1]);
+        p1%=(uint32_t)powersOf10[kappa-1];
+        if(digit!=0||digitCount!=0)
+            digits[digitCount++]=(char)('0'+digit);
+        kappa--;
+        uint64_t rest=((uint64_t)p1<<shift)+p2;
+        if(rest<=delta)
+        {
+            decimalExponent+=kappa;
+            grisuRound(digits,digitCount,delta,rest,powersOf10[kappa]<<shift,distance);
+            return;
+        }
+    }
+    for(;;)
+    {
+        p2*=10;
+        delta*=10;
+        char digit=(char)(p2>>shift);
+        if(digit!=0||digitCount!=0)
+            digits[digitCount++]=(char)('0'+digit);
+        p2&=one-1;
+        kappa--;
+        if(p2<delta)
+        {
+            decimalExponent+=kappa;
+            grisuRound(digits,digitCount,delta,p2,one,-kappa<20?distance*powersOf10[-kappa]:0);
+            return;
+        }
+    }
+}
+
+static size_t formatSpecialDouble(double in, char *out)
+{
+    const char *str;
+    if(in!=in)
+        str="nan";
+    else if(in>0.0)
+        str="inf";
+    else if(in<0.0)
+        str="-inf";
+    else
+        str=signbit(in)?"-0.0":"0.0";
+    size_t length=strlen(str);
+    memcpy(out,str,length+1);
+    return length;
+}
+
+size_t text::formatDouble(double in, char *out)
+{
+    if(in==0.0||in!=in||in-in!=0.0) // Zero, NaN or infinity
+        return formatSpecialDouble(in,out);
+    char *pos=out;
+    if(in<0.0)
+    {
+        *(pos++)='-';
+        in=-in;
+    }
+    char digits[18];
+    int digitCount;
+    int decimalExponent;
+    grisu2(in,digits,digitCount,decimalExponent);
+    int pointPosition=digitCount+decimalExponent; // Digits before the decimal point
+
+    if(pointPosition>=digitCount&&pointPosition<=21) // Integer: 123.0 or 1200.0
+    {
+        memcpy(pos,digits,digitCount);
+        pos+=digitCount;
+        for(int i=digitCount;i<pointPosition;i++)
+            *(pos++)='0';
+        *(pos++)='.';
+        *(pos++)='0';
+    }
+    else if(pointPosition>0&&pointPosition<=21) // 12.34
+    {
+        memcpy(pos,digits,pointPosition);
+        pos+=pointPosition;
+        *(pos++)='.';
+        memcpy(pos,digits+pointPosition,digitCount-pointPosition);
+        pos+=digitCount-pointPosition;
+    }
+    else if(pointPosition>-6&&pointPosition<=0) // 0.001234
+    {
+        *(pos++)='0';
+        *(pos++)='.';
+        for(int i=pointPosition;i<0;i++)
+            *(pos++)='0';
+        memcpy(pos,digits,digitCount);
+        pos+=digitCount;
+    }
+    else // 1.234e-7 or 1e+300
+    {
+        *(pos++)=digits[0];
+        if(digitCount>1)
+        {
+            *(pos++)='.';
+            memcpy(pos,digits+1,digitCount-1);
+            pos+=digitCount-1;
+        }
+        *(pos++)='e';
+        int exponent=pointPosition-1;
+        *(pos++)=exponent<0?'-':'+';
+        if(exponent<0)
+            exponent=-exponent;
+        if(exponent>=100)
+            *(pos++)=(char)('0'+exponent/100);
+        if(exponent>=10)
+            *(pos++)=(char)('0'+exponent/10%10);
+        *(pos++)=(char)('0'+exponent%10);
+    }
+    *pos=0;
+    return pos-out;
+}
+
+size_t text::formatDoubleWithFixedPrecision(double in, uint8_t precision, char *out)
+{
+    if(in!=in||in-in!=0.0) // NaN or infinity
+        return formatSpecialDouble(in,out);
+    bool negative=in<0.0;
+    double magnitude=negative?-in:in;
+    if(precision>18||magnitude*(double)powersOf10[precision]>=9.2e18) // Does not fit into 64 bits: shortest form instead
+        return formatDouble(in,out);
+    uint64_t scaled=(uint64_t)llround(magnitude*(double)powersOf10[precision]);
+    char *pos=out;
+    if(negative&&scaled!=0)
+        *(pos++)='-';
+    char digits[21];
+    size_t digitCount=formatUnsignedLong(scaled,digits);
+    if(digitCount<=precision) // Leading zeros: 0.05
+    {
+        memmove(digits+precision+1-digitCount,digits,digitCount);
+        memset(digits,'0',precision+1-digitCount);
+        digitCount=precision+1;
+    }
+    size_t integerDigitCount=digitCount-precision;
+    memcpy(pos,digits,integerDigitCount);
+    pos+=integerDigitCount;
+    if(precision>0)
+    {
+        *(pos++)='.';
+        memcpy(pos,digits+integerDigitCount,precision);
+        pos+=precision;
+    }
+    *pos=0;
+    return pos-out;
+}
+
+size_t text::formatUnsignedLong(uint64_t in, char *out)
+{
+    char reversed[20];
+    size_t length=0;
+    do
+    {
+        reversed[length++]=(char)('0'+in%10);
+        in/=10;
+    }
+    while(in!=0);
+    for(size_t i=0;i<length;i++)
+        out[i]=reversed[length-1-i];
+    out[length]=0;
+    return length;
+}
+
+// Case-insensitive prefix check without allocating (unlike iStartsWith()); "with" is lower case.
+static bool startsWithLowerCase(const char *str, const char *with)
+{
+    for(;*with!=0;str++,with++)
+    {
+        if(tolower((unsigned char)*str)!=*with)
+            return false;
+    }
+    return true;
+}
+
+double text::parseDouble(const char *in, const char **end)
+{
+    const char *pos=in;
+    bool negative=*pos=='-';
+    if(*pos=='-'||*pos=='+')
+        pos++;
+    if(startsWithLowerCase(pos,"inf")||startsWithLowerCase(pos,"nan"))
+    {
+        bool nan=tolower(*pos)=='n';
+        pos+=3;
+        if(!nan&&startsWithLowerCase(pos,"inity"))
+            pos+=5;
+        if(end!=0)
+            *end=pos;
+        double special=nan?std::numeric_limits<double>::quiet_NaN():std::numeric_limits<double>::infinity();
+        return negative?-special:special;
+    }
+
+    // Up to 19 significant digits are collected exactly; further digits only shift the exponent.
+    uint64_t mantissa=0;
+    int32_t significantDigitCount=0;
+    int32_t exponent=0;
+    bool hasDigits=false;
+    bool truncated=false;
+    for(;*pos>='0'&&*pos<='9';pos++)
+    {
+        hasDigits=true;
+        if(mantissa==0&&*pos=='0')
+            continue;
+        if(significantDigitCount<19)
+        {
+            mantissa=mantissa*10+(uint64_t)(*pos-'0');
+            significantDigitCount++;
+        }
+        else
+        {
+            exponent++;
+            truncated=truncated||*pos!='0';
+        }
+    }
+    if(*pos=='.')
+    {
+        pos++;
+        for(;*pos>='0'&&*pos<='9';pos++)
+        {
+            hasDigits=true;
+            if(mantissa==0&&*pos=='0')
+            {
+                exponent--;
+                continue;
+            }
+            if(significantDigitCount<19)
+            {
+                mantissa=mantissa*10+(uint64_t)(*pos-'0');
+                significantDigitCount++;
+                exponent--;
+            }
+            else
+                truncated=truncated||*pos!='0';
+        }
+    }
+    if(!hasDigits)
+    {
+        if(end!=0)
+            *end=in;
+        return 0.0;
+    }
+    if(*pos=='e'||*pos=='E')
+    {
+        const char *exponentPos=pos+1;
+        bool negativeExponent=*exponentPos=='-';
+        if(*exponentPos=='-'||*exponentPos=='+')
+            exponentPos++;
+        if(*exponentPos>='0'&&*exponentPos<='9')
+        {
+            int32_t explicitExponent=0;
+            for(;*exponentPos>='0'&&*exponentPos<='9';exponentPos++)
+            {
+                if(explicitExponent<100000)
+                    explicitExponent=explicitExponent*10+(*exponentPos-'0');
+            }
+            exponent+=negativeExponent?-explicitExponent:explicitExponent;
+            pos=exponentPos;
+        }
+    }
+    if(end!=0)
+        *end=pos;
+
+    double out;
+    if(mantissa==0)
+        out=0.0;
+    else if(!truncated&&mantissa<=(1ULL<<53)&&exponent>=-22&&exponent<=22)
+    {
+        // Both the mantissa and the power of ten are exact doubles, so one correctly rounded operation gives the correctly rounded result.
+        static const double exactPowersOf10[23]={1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,1e8,1e9,1e10,1e11,1e12,1e13,1e14,1e15,1e16,1e17,1e18,1e19,1e20,1e21,1e22};
+        out=exponent<0?(double)mantissa/exactPowersOf10[-exponent]:(double)mantissa*exactPowersOf10[exponent];
+    }
+    else
+    {
+        // Rare: more than 2^53 or far from 1. strtod() rounds correctly (all digits matter, as a halfway point between two doubles can have
+        // hundreds of digits). Its decimal separator depends on the locale, which this code never changes from "C".
+        size_t length=(size_t)(pos-in);
+        char shortCopy[64];
+        char *copy=length<sizeof(shortCopy)?shortCopy:(char*)malloc(length+1);
+        memcpy(copy,in,length);
+        copy[length]=0;
+        out=fabs(strtod(copy,0));
+        if(copy!=shortCopy)
+            free(copy);
+    }
+    return negative?-out:out;
+}
+
 double text::doubleFromString(const char *in)
 {
-    // Only supports a.b
-    size_t dotPos=indexOf(in,".");
-    if(dotPos==pos_notFound)
-        return (double)longFromString(in);
-    bool negative=in[0]=='-'; // Needed for cases like -0.5
-    int64_t base=longFromString(substr(in,negative?1:0,dotPos-(negative?1:0)));
-    char *fracStr=substr(in,dotPos+1);
-    int64_t fraction=longFromString(fracStr);
-    int8_t n=base<0?-1:1;
-    double out=(double)base+((double)fraction/int64Pow(10,strlen(fracStr)))*n;
-    free(fracStr);
-    return out*(negative?-1.0:1.0);
+    return parseDouble(in);
 }
 
 size_t text::indexOf(const char *haystack, const char *needle)
@@ -12,6 +12,7 @@
 #include <limits>
 
 #define pos_notFound (std::numeric_limits<size_t>::max())
+#define TEXT_DOUBLE_BUFFER_SIZE 32 // Enough for formatDouble() and formatDoubleWithFixedPrecision()
 
 typedef size_t text_t;
 
@@ -64,7 +65,14 @@ public:
     static int32_t roundf(float in);
     static int64_t roundl(double in);
     static double roundToPrecision(double in,int32_t precision);
-    static double doubleFromString(const char *in); // Only supports a.b
+    // Allocation-free formatting into "out"; the length is returned and a zero terminator is written.
+    static size_t formatDouble(double in,char *out); // Shortest output that reads back as exactly "in" (e.g. 0.1, 1.0, 1.5e-7)
+    static size_t formatDoubleWithFixedPrecision(double in,uint8_t precision,char *out); // Falls back to formatDouble() above 9.2e18/10^precision
+    static size_t formatUnsignedLong(uint64_t in,char *out);
+    // Correctly rounded parsing of [+-]digits[.digits][(e|E)[+-]digits], inf, infinity and nan. If "end" is not 0, it is set to the first
+    // character after the number (or "in" if there is none).
+    static double parseDouble(const char *in,const char **end=0);
+    static double doubleFromString(const char *in); // Same as parseDouble()
     static size_t indexOf(const char *haystack,const char *needle);
     static size_t indexOfFrom(const char *haystack,const char *needle,size_t startFrom);
     static size_t lastIndexOf(const char *haystack,const char *needle);
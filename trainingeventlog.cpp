@@ -0,0 +1,116 @@
+#include "trainingeventlog.h"
+
+#include <chrono>
+
+TrainingEventLog *TrainingEventLog::create(const char *filePath, uint32_t _ringSize, uint32_t _flushInterval)
+{
+    FILE *f=fopen(filePath,"wb");
+    if(f==0)
+        return 0;
+    return new TrainingEventLog(f,_ringSize,_flushInterval);
+}
+
+TrainingEventLog::TrainingEventLog(FILE *_file, uint32_t _ringSize, uint32_t _flushInterval)
+{
+    file=_file;
+    ringSize=1;
+    while(ringSize<_ringSize)
+        ringSize*=2;
+    ring=(TrainingEvent*)malloc(ringSize*sizeof(TrainingEvent));
+    writtenEventCount=0;
+    flushedEventCount=0;
+    droppedEventCount=0;
+    stopping=false;
+    flushInterval=_flushInterval;
+    recordBuffer=(char*)malloc(ringSize*TRAINING_EVENT_RECORD_SIZE);
+
+    char header[TRAINING_EVENT_LOG_HEADER_SIZE];
+    fs_t pos=0;
+    io::writeRawData(header,"LTEL",4,pos);
+    io::writeUInt32(header,TRAINING_EVENT_LOG_VERSION,pos);
+    io::writeUInt32(header,TRAINING_EVENT_RECORD_SIZE,pos);
+    io::writeUInt32(header,0,pos);
+    failed=fwrite(header,1,TRAINING_EVENT_LOG_HEADER_SIZE,file)!=TRAINING_EVENT_LOG_HEADER_SIZE;
+
+    flushThread=std::thread([this]()
+    {
+        while(!stopping.load(std::memory_order_acquire))
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(flushInterval));
+            flush();
+        }
+    });
+}
+
+void TrainingEventLog::log(uint64_t step, double loss, double accuracy, uint64_t processTime, uint64_t learnTime)
+{
+    uint64_t position=writtenEventCount.load(std::memory_order_relaxed);
+    if(position-flushedEventCount.load(std::memory_order_acquire)>=ringSize)
+    {
+        droppedEventCount.fetch_add(1,std::memory_order_relaxed);
+        return;
+    }
+    TrainingEvent *event=&ring[position&(ringSize-1)];
+    event->step=step;
+    event->loss=loss;
+    event->accuracy=accuracy;
+    event->processTime=processTime;
+    event->learnTime=learnTime;
+    writtenEventCount.store(position+1,std::memory_order_release); // Publishes the event to flush()
+}
+
+bool TrainingEventLog::flush()
+{
+    std::lock_guard<std::mutex> lock(flushMutex);
+    uint64_t first=flushedEventCount.load(std::memory_order_relaxed);
+    uint64_t end=writtenEventCount.load(std::memory_order_acquire);
+    if(first==end)
+        return !failed;
+    // The events are encoded before flushedEventCount frees their slots, then written with one fwrite():
+    for(uint64_t position=first;position<end;position++)
+        encodeEvent(recordBuffer+(position-first)*TRAINING_EVENT_RECORD_SIZE,&ring[position&(ringSize-1)]);
+    flushedEventCount.store(end,std::memory_order_release);
+    fs_t size=(fs_t)(end-first)*TRAINING_EVENT_RECORD_SIZE;
+    if(fwrite(recordBuffer,1,size,file)!=size||fflush(file)!=0)
+        failed=true;
+    return !failed;
+}
+
+TrainingEventLog::~TrainingEventLog()
+{
+    stopping.store(true,std::memory_order_release);
+    flushThread.join();
+    flush();
+    fclose(file);
+    free(ring);
+    free(recordBuffer);
+}
+
+void TrainingEventLog::encodeEvent(char *data, TrainingEvent *event)
+{
+    bool systemIsLittleEndian=io::getSystemIsLittleEndian();
+    fs_t pos=0;
+    io::writeUInt64(data,event->step,pos);
+    io::writeDouble(data,event->loss,pos,systemIsLittleEndian);
+    io::writeDouble(data,event->accuracy,pos,systemIsLittleEndian);
+    io::writeUInt64(data,event->processTime,pos);
+    io::writeUInt64(data,event->learnTime,pos);
+}
+
+void TrainingEventLog::decodeEvent(char *data, TrainingEvent *event)
+{
+    bool systemIsLittleEndian=io::getSystemIsLittleEndian();
+    fs_t pos=0;
+    event->step=io::posBasedReadUInt64(data,pos);
+    event->loss=io::posBasedReadDouble(data,pos,systemIsLittleEndian);
+    event->accuracy=io::posBasedReadDouble(data,pos,systemIsLittleEndian);
+    event->processTime=io::posBasedReadUInt64(data,pos);
+    event->learnTime=io::posBasedReadUInt64(data,pos);
+}
+
+int64_t TrainingEventLog::getEventCount(char *data, fs_t size)
+{
+    if(size<TRAINING_EVENT_LOG_HEADER_SIZE||memcmp(data,"LTEL",4)!=0||io::peekUInt32(data,4)!=TRAINING_EVENT_LOG_VERSION||io::peekUInt32(data,8)!=TRAINING_EVENT_RECORD_SIZE)
+        return -1;
+    return (int64_t)((size-TRAINING_EVENT_LOG_HEADER_SIZE)/TRAINING_EVENT_RECORD_SIZE);
+}
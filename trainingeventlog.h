@@ -0,0 +1,63 @@
+#ifndef TRAININGEVENTLOG_H
+#define TRAININGEVENTLOG_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "io.h"
+
+#define TRAINING_EVENT_LOG_VERSION 1
+#define TRAINING_EVENT_LOG_HEADER_SIZE 16
+#define TRAINING_EVENT_RECORD_SIZE 40
+
+// Training event log file (all values little-endian):
+// Header: "LTEL", version, record size, reserved (all uint32)
+// Records: step (uint64), loss, accuracy (double), process time, learn time (uint64, nanoseconds; the learn time is 0 if learn() was not called)
+
+struct TrainingEvent
+{
+    uint64_t step;
+    double loss;
+    double accuracy;
+    uint64_t processTime;
+    uint64_t learnTime;
+};
+
+// Appends training events to a binary log without slowing down the training thread: log() only stores the event in a ring buffer, and a
+// background thread writes the buffered events to the file every flushInterval milliseconds. If the ring buffer is full, events are dropped
+// (and counted) instead of blocking. log() must always be called from the same thread. See traininglogdecoder.cpp for reading the log.
+
+class TrainingEventLog
+{
+public:
+    FILE *file;
+    TrainingEvent *ring;
+    uint32_t ringSize; // Power of 2
+    std::atomic<uint64_t> writtenEventCount; // Logged events (position in the ring buffer is modulo ringSize)
+    std::atomic<uint64_t> flushedEventCount;
+    std::atomic<uint64_t> droppedEventCount;
+    std::atomic<bool> stopping;
+    std::mutex flushMutex;
+    std::thread flushThread;
+    uint32_t flushInterval;
+    char *recordBuffer;
+    bool failed;
+
+    // Returns 0 if the file cannot be created. "_ringSize" is rounded up to a power of 2.
+    static TrainingEventLog *create(const char *filePath,uint32_t _ringSize=65536,uint32_t _flushInterval=100);
+    TrainingEventLog(FILE *_file,uint32_t _ringSize,uint32_t _flushInterval);
+    void log(uint64_t step,double loss,double accuracy,uint64_t processTime,uint64_t learnTime);
+    bool flush(); // Writes all events logged so far. Returns false if a write has failed.
+    ~TrainingEventLog(); // Writes the remaining events and closes the file
+
+    static void encodeEvent(char *data,TrainingEvent *event); // Writes TRAINING_EVENT_RECORD_SIZE bytes
+    static void decodeEvent(char *data,TrainingEvent *event);
+    // Returns the number of records of a mapped or read log file, or -1 if it is not a valid log (an incomplete last record is ignored).
+    static int64_t getEventCount(char *data,fs_t size);
+};
+
+#endif // TRAININGEVENTLOG_H
@@ -0,0 +1,58 @@
+// Renders a training event log written by TrainingEventLog (see trainingeventlog.h) as text or CSV.
+// Usage: TrainingLogDecoder <log file> [--csv]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "io.h"
+#include "text.h"
+#include "trainingeventlog.h"
+
+int main(int argc, char *argv[])
+{
+    if(argc<2)
+    {
+        fprintf(stderr,"Usage: %s <log file> [--csv]\n",argv[0]);
+        return 2;
+    }
+    bool csv=argc>2&&strcmp(argv[2],"--csv")==0;
+    fs_t size;
+    char *data=io::mapFile(argv[1],size);
+    if(data==0)
+    {
+        fprintf(stderr,"Cannot read %s\n",argv[1]);
+        return 1;
+    }
+    int64_t eventCount=TrainingEventLog::getEventCount(data,size);
+    if(eventCount<0)
+    {
+        fprintf(stderr,"%s is not a training event log\n",argv[1]);
+        io::unmapFile(data,size);
+        return 1;
+    }
+
+    if(csv)
+        fputs("step,loss,accuracy,process_ns,learn_ns\n",stdout);
+    TrainingEvent event;
+    for(int64_t i=0;i<eventCount;i++)
+    {
+        TrainingEventLog::decodeEvent(data+TRAINING_EVENT_LOG_HEADER_SIZE+i*TRAINING_EVENT_RECORD_SIZE,&event);
+        char step[TEXT_DOUBLE_BUFFER_SIZE];
+        char loss[TEXT_DOUBLE_BUFFER_SIZE];
+        char accuracy[TEXT_DOUBLE_BUFFER_SIZE];
+        char processTime[TEXT_DOUBLE_BUFFER_SIZE];
+        char learnTime[TEXT_DOUBLE_BUFFER_SIZE];
+        text::formatUnsignedLong(event.step,step);
+        text::formatDouble(event.loss,loss);
+        text::formatDouble(event.accuracy,accuracy);
+        text::formatUnsignedLong(event.processTime,processTime);
+        text::formatUnsignedLong(event.learnTime,learnTime);
+        if(csv)
+            printf("%s,%s,%s,%s,%s\n",step,loss,accuracy,processTime,learnTime);
+        else
+            printf("Step %s: loss %s, accuracy %s, process() %s ns, learn() %s ns\n",step,loss,accuracy,processTime,learnTime);
+    }
+    io::unmapFile(data,size);
+    return 0;
+}